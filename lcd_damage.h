@@ -0,0 +1,257 @@
+// ************ DAMAGE TRACKING **************
+// Screen regions that need to be sent again. A new rectangle is split around
+// the ones already listed, so the list never covers a pixel twice. Before
+// sending, lcd_damage_coalesce merges rectangles wherever one bigger window
+// is cheaper than several small ones, using a cost per window (the 11 word
+// lcd_setarea2 header) and a cost per pixel measured on the real bus.
+// -------------------------------------------
+
+#ifndef LCD_DAMAGE_H
+#define LCD_DAMAGE_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define LCD_DAMAGE_MAX 32   // at most 32, sets of entries are kept in a uint32_t mask
+
+/**
+ * @brief  Rectangle, corners inclusive like lcd_fill2
+ */
+typedef struct {
+	int16_t x0, y0;
+	int16_t x1, y1;
+} LCD_Rect_t;
+
+/**
+ * @brief  Bus time of a window: window + pixels * pixel, any unit (lcd_cost_calibrate in lcd_tune.h uses us)
+ */
+typedef struct {
+	float window;   /*!< lcd_setarea2: 3 commands and 8 data words */
+	float pixel;    /*!< one data word */
+} LCD_Cost_t;
+
+/**
+ * @brief  What the coalescer did, summed until the caller resets it
+ */
+typedef struct {
+	uint32_t added;     /*!< rectangles passed to lcd_damage_add */
+	uint32_t splits;    /*!< extra pieces made by splitting around listed rectangles */
+	uint32_t merges;    /*!< merges chosen by the cost model */
+	uint32_t forced;    /*!< merges because the list was full */
+	uint32_t plans;     /*!< lcd_damage_coalesce calls */
+	uint32_t windows;   /*!< windows in the final plans */
+	uint32_t dirty;     /*!< damaged pixels before coalescing */
+	uint32_t pixels;    /*!< pixels in the final plans, pixels - dirty is resent unchanged */
+	float cost_split;   /*!< cost of sending the damage exactly, one window per piece */
+	float cost_bbox;    /*!< cost of one window around all damage */
+	float cost_plan;    /*!< cost of the chosen plan */
+} LCD_DamageStats_t;
+
+typedef struct {
+	LCD_Rect_t r[LCD_DAMAGE_MAX];
+	int n;
+	LCD_Cost_t cost;
+	LCD_DamageStats_t stats;
+} LCD_Damage_t;
+
+static inline LCD_Rect_t lcd_rect(int x0, int y0, int x1, int y1) {
+	LCD_Rect_t r = { (int16_t)x0, (int16_t)y0, (int16_t)x1, (int16_t)y1 };
+	return r;
+}
+
+static inline int lcd_rect_area(const LCD_Rect_t *a) {
+	return (a->x1 - a->x0 + 1) * (a->y1 - a->y0 + 1);
+}
+
+static inline bool lcd_rect_overlap(const LCD_Rect_t *a, const LCD_Rect_t *b) {
+	return a->x0 <= b->x1 && b->x0 <= a->x1 && a->y0 <= b->y1 && b->y0 <= a->y1;
+}
+
+static inline bool lcd_rect_contains(const LCD_Rect_t *a, const LCD_Rect_t *b) {
+	return a->x0 <= b->x0 && a->y0 <= b->y0 && a->x1 >= b->x1 && a->y1 >= b->y1;
+}
+
+static inline LCD_Rect_t lcd_rect_union(const LCD_Rect_t *a, const LCD_Rect_t *b) {
+	LCD_Rect_t u;
+	u.x0 = a->x0 < b->x0 ? a->x0 : b->x0;
+	u.y0 = a->y0 < b->y0 ? a->y0 : b->y0;
+	u.x1 = a->x1 > b->x1 ? a->x1 : b->x1;
+	u.y1 = a->y1 > b->y1 ? a->y1 : b->y1;
+	return u;
+}
+
+/**
+ * @brief  Intersection of a and b in *out
+ * @retval false if they do not overlap
+ */
+static inline bool lcd_rect_clip(const LCD_Rect_t *a, const LCD_Rect_t *b, LCD_Rect_t *out) {
+	if (!lcd_rect_overlap(a, b)) return false;
+	out->x0 = a->x0 > b->x0 ? a->x0 : b->x0;
+	out->y0 = a->y0 > b->y0 ? a->y0 : b->y0;
+	out->x1 = a->x1 < b->x1 ? a->x1 : b->x1;
+	out->y1 = a->y1 < b->y1 ? a->y1 : b->y1;
+	return true;
+}
+
+static inline float lcd_rect_cost(const LCD_Cost_t *c, const LCD_Rect_t *r) {
+	return c->window + c->pixel * lcd_rect_area(r);
+}
+
+/**
+ * @brief  Uncalibrated model in bus words: 11 per window, 1 per pixel
+ */
+LCD_Cost_t lcd_cost_default(void) {
+	LCD_Cost_t c = { 11.0f, 1.0f };
+	return c;
+}
+
+/**
+ * @brief  Empty list using cost model c (NULL: lcd_cost_default), stats reset
+ */
+void lcd_damage_init(LCD_Damage_t *dm, const LCD_Cost_t *c) {
+	memset(dm, 0, sizeof(*dm));
+	dm->cost = c ? *c : lcd_cost_default();
+}
+
+void lcd_damage_clear(LCD_Damage_t *dm) {
+	dm->n = 0;
+}
+
+/*
+	Name: lcd_damage_grow
+	Description: Grow u until it swallows every listed rectangle it touches.
+	Returns:
+		mask of the swallowed entries, their summed cost in *absorbed
+*/
+uint32_t lcd_damage_grow(const LCD_Damage_t *dm, LCD_Rect_t *u, float *absorbed) {
+	uint32_t mask = 0;
+	bool grew = true;
+
+	*absorbed = 0;
+	while (grew) {
+		grew = false;
+		for (int i=0; i<dm->n; i++) {
+			if ((mask & (1u << i)) || !lcd_rect_overlap(&dm->r[i], u)) continue;
+			mask |= 1u << i;
+			*absorbed += lcd_rect_cost(&dm->cost, &dm->r[i]);
+			if (!lcd_rect_contains(u, &dm->r[i])) {
+				*u = lcd_rect_union(u, &dm->r[i]);
+				grew = true;
+			}
+		}
+	}
+	return mask;
+}
+
+/* drop the entries in mask and append u */
+void lcd_damage_replace(LCD_Damage_t *dm, uint32_t mask, LCD_Rect_t u) {
+	int n = 0;
+	for (int i=0; i<dm->n; i++) {
+		if (!(mask & (1u << i))) dm->r[n++] = dm->r[i];
+	}
+	dm->r[n++] = u;
+	dm->n = n;
+}
+
+/* r minus the listed rectangles, see lcd_damage_add */
+void lcd_damage_insert(LCD_Damage_t *dm, LCD_Rect_t r) {
+	for (int i=0; i<dm->n; i++) {
+		const LCD_Rect_t e = dm->r[i];
+		if (!lcd_rect_overlap(&e, &r)) continue;
+		if (lcd_rect_contains(&e, &r)) return;
+
+		/* r minus e: full width bands above and below, side pieces next to e */
+		LCD_Rect_t p[4];
+		int np = 0;
+		int16_t y0 = r.y0 > e.y0 ? r.y0 : e.y0;
+		int16_t y1 = r.y1 < e.y1 ? r.y1 : e.y1;
+		if (r.y0 < e.y0) p[np++] = lcd_rect(r.x0, r.y0, r.x1, e.y0 - 1);
+		if (r.y1 > e.y1) p[np++] = lcd_rect(r.x0, e.y1 + 1, r.x1, r.y1);
+		if (r.x0 < e.x0) p[np++] = lcd_rect(r.x0, y0, e.x0 - 1, y1);
+		if (r.x1 > e.x1) p[np++] = lcd_rect(e.x1 + 1, y0, r.x1, y1);
+		dm->stats.splits += np - 1;
+		for (int k=0; k<np; k++) lcd_damage_insert(dm, p[k]);
+		return;
+	}
+
+	if (dm->n == LCD_DAMAGE_MAX) {
+		/* full: merge r where the union adds the least cost */
+		LCD_Rect_t best_u = r;
+		uint32_t best_mask = 0;
+		float best = 3.4e38f;
+		for (int i=0; i<dm->n; i++) {
+			float absorbed;
+			LCD_Rect_t u = lcd_rect_union(&dm->r[i], &r);
+			uint32_t mask = lcd_damage_grow(dm, &u, &absorbed);
+			float delta = lcd_rect_cost(&dm->cost, &u) - absorbed - lcd_rect_cost(&dm->cost, &r);
+			if (delta < best) { best = delta; best_u = u; best_mask = mask; }
+		}
+		dm->stats.forced++;
+		lcd_damage_replace(dm, best_mask, best_u);
+		return;
+	}
+	dm->r[dm->n++] = r;
+}
+
+/*
+	Name: lcd_damage_add
+	Description: Add a dirty rectangle. The parts of r already listed are cut away, the rest is
+		added as up to four pieces, so the list covers exactly the damaged pixels. When the list
+		is full a piece is merged where that costs the least.
+*/
+void lcd_damage_add(LCD_Damage_t *dm, LCD_Rect_t r) {
+	if (r.x0 > r.x1 || r.y0 > r.y1) return;
+	dm->stats.added++;
+	lcd_damage_insert(dm, r);
+}
+
+/*
+	Name: lcd_damage_coalesce
+	Description: Turn the list into the plan to send. Repeatedly merges the pair of rectangles
+		(plus whatever their union touches) that saves the most cost, until no merge pays off.
+		Updates dm->stats with the cost of this plan and of the two simple alternatives.
+	Returns:
+		number of windows in the plan
+*/
+int lcd_damage_coalesce(LCD_Damage_t *dm) {
+	LCD_DamageStats_t *st = &dm->stats;
+	const LCD_Cost_t *c = &dm->cost;
+
+	if (dm->n == 0) return 0;
+
+	LCD_Rect_t bbox = dm->r[0];
+	for (int i=0; i<dm->n; i++) {
+		bbox = lcd_rect_union(&bbox, &dm->r[i]);
+		st->dirty += lcd_rect_area(&dm->r[i]);
+		st->cost_split += lcd_rect_cost(c, &dm->r[i]);
+	}
+	st->cost_bbox += lcd_rect_cost(c, &bbox);
+
+	for (;;) {
+		LCD_Rect_t best_u = bbox;
+		uint32_t best_mask = 0;
+		float best = 0;
+		for (int i=0; i<dm->n; i++) {
+			for (int j=i+1; j<dm->n; j++) {
+				float absorbed;
+				LCD_Rect_t u = lcd_rect_union(&dm->r[i], &dm->r[j]);
+				uint32_t mask = lcd_damage_grow(dm, &u, &absorbed);
+				float delta = lcd_rect_cost(c, &u) - absorbed;
+				if (delta < best) { best = delta; best_u = u; best_mask = mask; }
+			}
+		}
+		if (!best_mask) break;
+		lcd_damage_replace(dm, best_mask, best_u);
+		st->merges++;
+	}
+
+	st->plans++;
+	st->windows += dm->n;
+	for (int i=0; i<dm->n; i++) {
+		st->pixels += lcd_rect_area(&dm->r[i]);
+		st->cost_plan += lcd_rect_cost(c, &dm->r[i]);
+	}
+	return dm->n;
+}
+
+#endif
@@ -0,0 +1,1359 @@
+// ************ KEDEI 3.5 LCD **************
+// ILI9486L panel behind the KeDei SPI shift registers
+// ------------------------------------------
+
+#ifndef LCD_DISPLAY_H
+#define LCD_DISPLAY_H
+
+#include "lcd_spi.h"
+#include "lcd_encode.h"
+#include "lcd_damage.h"
+#include "lcd_latency.h"
+#include "lcd_record.h"
+#include "tm_stm32f4_fonts.h"
+
+/* LCD settings */
+#define ILI9341_WIDTH        480
+#define ILI9341_HEIGHT       320
+#define ILI9341_PIXEL        153600
+
+/* Colors */
+#define ILI9341_COLOR_WHITE			0xFFFF
+#define ILI9341_COLOR_BLACK			0x0000
+#define ILI9341_COLOR_RED      		0xF800
+#define ILI9341_COLOR_GREEN			0x07E0
+#define ILI9341_COLOR_GREEN2		0xB723
+#define ILI9341_COLOR_BLUE			0x001F
+#define ILI9341_COLOR_BLUE2			0x051D
+#define ILI9341_COLOR_YELLOW		0xFFE0
+#define ILI9341_COLOR_ORANGE		0xFBE4
+#define ILI9341_COLOR_CYAN			0x07FF
+#define ILI9341_COLOR_MAGENTA		0xA254
+#define ILI9341_COLOR_GRAY			0x7BEF
+#define ILI9341_COLOR_BROWN			0xBBCA
+
+/* Transparent background, only for strings and chars */
+#define ILI9341_TRANSPARENT			0x80000000
+
+/**
+ * @brief  Orientation
+ * @note   Used private
+ */
+typedef enum {
+	TM_ILI9341_Landscape,
+	TM_ILI9341_Portrait,
+	TM_ILI9341_Landscape_Flipped,  /* rotated 180 degrees */
+	TM_ILI9341_Portrait_Flipped
+} TM_ILI9341_Orientation;
+
+/* Memory Access Control (0x36) bits */
+#define ILI9341_MADCTL_MY    0x80  /* row address order */
+#define ILI9341_MADCTL_MX    0x40  /* column address order */
+#define ILI9341_MADCTL_MV    0x20  /* row / column exchange */
+#define ILI9341_MADCTL_BGR   0x08
+
+/**
+ * @brief  LCD options
+ * @note   Used private
+ */
+typedef struct {
+	uint16_t width;
+	uint16_t height;
+	TM_ILI9341_Orientation orientation; // see TM_ILI9341_Rotate
+} TM_ILI931_Options_t;
+
+#define LCD_SPI_DEVICE "/dev/spidev0.0"
+#define LCD_SPI_MODE SPI_MODE_0
+//#define LCD_SPI_SPEED 3500000
+#define LCD_SPI_SPEED 25000000
+#define LCD_SPI_BITS_PER_WORD 8
+#define LCD_SPI_CS_WORD 1 // with 32 bit words let the controller toggle chip select per frame (SPI_CS_WORD), 0 - never
+
+/**
+ * @brief  Optional copy of the screen kept by the display, see lcd_shadow_init
+ */
+typedef enum {
+	LCD_SHADOW_NONE,     /*!< drawing goes straight to the panel */
+	LCD_SHADOW_RGB565,   /*!< 2 bytes per pixel (300 KB), frames are encoded on every flush */
+	LCD_SHADOW_WIRE,     /*!< 8 bytes per pixel (1.2 MB) already in KeDei frames, a flush hands them to spidev as they are */
+	LCD_SHADOW_I8,       /*!< 1 byte per pixel (150 KB), an index into a palette of up to 256 colors */
+	LCD_SHADOW_I4,       /*!< 4 bits per pixel (75 KB), up to 16 colors, the left pixel in the high nibble */
+	LCD_SHADOW_RLE       /*!< every row a list of color runs, 4 bytes per run: small for flat UIs, any color */
+} LCD_ShadowMode_t;
+
+#define LCD_RUN_ROWS ILI9341_WIDTH   // run lists of LCD_SHADOW_RLE, enough rows for either orientation
+
+/**
+ * @brief  Palette of an indexed shadow, see lcd_palette_set
+ * @note   wire and pair are the flush LUTs, frames laid out for the display's word size
+ */
+typedef struct {
+	uint16_t color[256];        /*!< RGB565 of each index */
+	int n;                      /*!< indices in use */
+	int max;                    /*!< 256 for LCD_SHADOW_I8, 16 for LCD_SHADOW_I4 */
+	int last;                   /*!< index found by the previous lookup */
+	uint8_t wire[256][8];       /*!< frame pair of each index */
+	uint8_t pair[256][16];      /*!< I4: frame pairs of both pixels of a byte */
+} LCD_Palette_t;
+
+/**
+ * @brief  Pixels of one color in a row of the run shadow, from x up to the next run or the row end
+ */
+typedef struct {
+	uint16_t x;          /*!< first pixel */
+	uint16_t color;      /*!< RGB565 */
+} LCD_Run_t;
+
+/**
+ * @brief  Row of the run shadow: run[0].x is 0, x increases, neighbouring runs differ in color
+ */
+typedef struct {
+	LCD_Run_t *run;
+	uint16_t n;          /*!< runs in use */
+	uint16_t cap;        /*!< runs allocated */
+} LCD_RunRow_t;
+
+/**
+ * @brief  Transport other than spidev, see lcd_open_transport (lcd_gpio.h has GPIO bit-banging)
+ */
+typedef struct {
+	/* send rows of 4 byte frames in 8 bit order lying stride bytes apart, chip select
+	   released after every frame; returns bytes sent or negative */
+	int (*rows)(void *ctx, const uint8_t *data, int row_len, int rows, int stride);
+	int (*close)(void *ctx);
+} LCD_Transport_t;
+
+/**
+ * @brief  One panel: its spidev transport, text cursor and options.
+ * @note   Nothing is shared between instances, so displays on different
+ *         spidev nodes can be driven from separate threads at the same time.
+ *         The only exception is a bus the caller hands over in bus.
+ *         A single instance must only be used by one thread at a time.
+ */
+typedef struct {
+	int spi;              /*!< spidev handle, 0 when closed */
+	uint32_t speed;       /*!< SPI clock in Hz */
+	uint8_t bits;         /*!< bits per word in use, see spi_negotiate_bits */
+	uint16_t x;           /*!< text cursor X (was ILI9341_x) */
+	uint16_t y;           /*!< text cursor Y (was ILI9341_y) */
+	TM_ILI931_Options_t opts;
+	uint8_t buff[4];      /*!< frame being sent by lcd_cmd/lcd_data */
+	int chunk;            /*!< bytes per bulk pixel message, from the tune file or the largest allowed */
+	bool cs_word;         /*!< SPI_CS_WORD is on, see spi_set_cs_word */
+	uint8_t *wire;        /*!< frames being sent by lcd_pixels, spi_message_max(cs_word) bytes */
+	uint8_t shadow;       /*!< LCD_ShadowMode_t */
+	uint16_t *fb;         /*!< RGB565 shadow, opts.width pixels per row */
+	uint8_t *fbw;         /*!< wire shadow, opts.width * 8 bytes per row */
+	uint8_t *fbi;         /*!< indexed shadow, opts.width (I8) or opts.width / 2 (I4) bytes per row */
+	LCD_Palette_t *pal;   /*!< colors of fbi */
+	LCD_RunRow_t *fbr;    /*!< run shadow, LCD_RUN_ROWS rows */
+	LCD_Damage_t dirty;   /*!< shadow areas not flushed yet */
+	LCD_Latency_t *lat;   /*!< touch-to-photon tracing (lcd_latency.h), NULL - off */
+	const LCD_Transport_t *xport; /*!< replaces spidev when set, see lcd_open_transport */
+	void *xctx;           /*!< xport context */
+	LCD_Record_t *rec;    /*!< capture of everything sent (lcd_record.h), NULL - off */
+	SPI_Bus_t *bus;       /*!< arbiter shared with the touch controller (spi_bus_init), NULL - not shared */
+} LCD_Display_t;
+
+/**
+ * @brief  Off-screen RGB565 pixel block (shadow buffer), see lcd_blit_buffer
+ */
+typedef struct {
+	int w;                /*!< width in pixels */
+	int h;                /*!< height in pixels */
+	int stride;           /*!< pixels between rows */
+	uint16_t *px;         /*!< first pixel, row major */
+} LCD_Buffer_t;
+
+
+/* **********************************************************************************
+	LCD ROUTINES
+   ********************************************************************************** */
+
+/*
+	Name: lcd_open
+	Description: Reset display state and open its spidev node. Clock and bulk message size come
+		from the tune file when the autotuner has an entry for spidev (see spi_tune_load).
+	Parameters:
+		1. d : pointer LCD_Display_t - display to set up
+		2. spidev : string - spi device, e.g. LCD_SPI_DEVICE
+		3. speed : uint32_t - SPI clk speed in Hz when not tuned
+		4. wide : uint8_t - 16 or 32 to try wider SPI words, 0 for plain 8 bits
+	Returns:
+		0 - on success, negative - spi_open error, -11 - out of memory
+*/
+int lcd_open(LCD_Display_t *d, std::string spidev, uint32_t speed, uint8_t wide) {
+	SPI_Tune_t tune;
+	int r;
+
+	memset(d, 0, sizeof(*d));
+	d->speed = speed;
+	d->bits = LCD_SPI_BITS_PER_WORD;
+	d->opts.width = ILI9341_WIDTH;
+	d->opts.height = ILI9341_HEIGHT;
+	d->opts.orientation = TM_ILI9341_Landscape; // MADCTL 0x28, what lcd_init always used
+
+	r = spi_open(&d->spi, spidev, LCD_SPI_MODE, LCD_SPI_BITS_PER_WORD, speed);
+	if (r < 0) {
+		spi_close(&d->spi);
+		return r;
+	}
+	if (spi_get_speed(&d->spi)) d->speed = spi_get_speed(&d->spi);
+
+	if (wide) {
+		d->bits = spi_negotiate_bits(&d->spi, wide);
+	}
+	if (LCD_SPI_CS_WORD && d->bits == 32) {
+		d->cs_word = spi_set_cs_word(&d->spi, true) == 0;
+	}
+
+	/* bulk messages as large as spidev allows, unless the autotuner found smaller ones faster */
+	d->chunk = spi_message_max(d->cs_word) & ~7;
+	d->wire = (uint8_t *)malloc(d->chunk);
+	if (!d->wire) {
+		spi_close(&d->spi);
+		return -11;
+	}
+	if (spi_tune_load(spidev, &tune) == 0 && tune.chunk < d->chunk) d->chunk = tune.chunk & ~7;
+	return 0;
+}
+
+/*
+	Name: lcd_open_transport
+	Description: Reset display state and send through xport instead of spidev, e.g. a GPIO
+		bit-banger where spidev is missing or the controller is claimed. Frames go out in
+		8 bit order; there is no clock to tune, speed is whatever xport manages.
+	Parameters:
+		1. d : pointer LCD_Display_t - display to set up
+		2. xport : pointer LCD_Transport_t - transport functions, must outlive d
+		3. ctx : pointer - passed to them, closed by lcd_close
+	Returns:
+		0 - on success, -11 - out of memory
+*/
+int lcd_open_transport(LCD_Display_t *d, const LCD_Transport_t *xport, void *ctx) {
+	memset(d, 0, sizeof(*d));
+	d->bits = 8;
+	d->opts.width = ILI9341_WIDTH;
+	d->opts.height = ILI9341_HEIGHT;
+	d->opts.orientation = TM_ILI9341_Landscape;
+	d->chunk = SPI_BUFSIZ;
+	d->wire = (uint8_t *)malloc(d->chunk);
+	if (!d->wire) return -11;
+	d->xport = xport;
+	d->xctx = ctx;
+	return 0;
+}
+
+/* release the run shadow */
+void lcd_run_free(LCD_Display_t *d) {
+	if (d->fbr) {
+		for (int y=0; y<LCD_RUN_ROWS; y++) free(d->fbr[y].run);
+	}
+	free(d->fbr);
+	d->fbr = NULL;
+}
+
+/*
+	Name: lcd_close
+	Description: Close the display's spidev node or transport
+	Returns:
+		see spi_close
+*/
+int lcd_close(LCD_Display_t *d) {
+	free(d->wire);
+	d->wire = NULL;
+	free(d->fb);
+	free(d->fbw);
+	free(d->fbi);
+	free(d->pal);
+	lcd_run_free(d);
+	d->fb = NULL;
+	d->fbw = NULL;
+	d->fbi = NULL;
+	d->pal = NULL;
+	d->shadow = LCD_SHADOW_NONE;
+	if (d->xport) {
+		int r = d->xport->close ? d->xport->close(d->xctx) : 0;
+		d->xport = NULL;
+		return r;
+	}
+	return spi_close(&d->spi);
+}
+
+/* send the 4 byte frame in buff, through spidev or d->xport */
+int lcd_send(LCD_Display_t *d, uint8_t *buff) {
+	if (d->rec) lcd_record_frame(d->rec, buff, d->bits);
+	if (d->xport) return d->xport->rows(d->xctx, buff, 4, 1, 4);
+	return spi_transmit(&d->spi, d->bus, buff, 4, d->speed, d->bits);
+}
+
+/* send rows of frames, see spi_transmit_rows */
+int lcd_send_rows(LCD_Display_t *d, uint8_t *data, int row_len, int rows, int stride, int chunk) {
+	if (d->rec) {
+		int max = spi_message_max(d->cs_word); // the split spi_transmit_rows makes, before a shared bus cuts it
+		lcd_record_rows(d->rec, data, row_len, rows, stride, d->bits, chunk > 0 && chunk < max ? chunk & ~3 : max);
+	}
+	if (d->xport) return d->xport->rows(d->xctx, data, row_len, rows, stride);
+	return spi_transmit_rows(&d->spi, d->bus, data, row_len, rows, stride, d->speed, d->bits, chunk, d->cs_word);
+}
+
+void lcd_reset(LCD_Display_t *d) {
+	uint8_t *buff = d->buff;
+	int r;
+	
+	#ifdef _DEBUG_
+		printf("LCD_RESET\n");
+	#endif	
+	
+	// set Reset LOW
+	lcd_frame(buff, 0, 0x00, d->bits);
+	r = lcd_send(d, &buff[0]);
+	if (r < 0) {		
+		fprintf(stderr, "SPI.LCD_RESET_1 error (%d) : %s", errno, strerror(errno));
+	}
+	
+	delayms(50);
+	
+	// set Reset High
+	lcd_frame(buff, 0, 0x02, d->bits);
+	r = lcd_send(d, &buff[0]);
+	if (r < 0) {		
+		fprintf(stderr, "SPI.LCD_RESET_2 error (%d) : %s", errno, strerror(errno));
+	}
+	
+	#ifdef _DEBUG_
+		printf("LCD_RESET end.\n");
+	#endif	
+	
+	
+	delayms(200);
+}	
+
+void lcd_data(LCD_Display_t *d, uint16_t data) {
+	uint8_t *buff = d->buff;
+	int r;
+	
+	// #ifdef _DEBUG_
+		// printf("LCD_DATA(%04X)\n", data);
+	// #endif
+	
+	lcd_frame(buff, data, 0x15, d->bits); // 0x15 - DATA_BE const from ili9341.c (BE is short form "before")
+	r = lcd_send(d, &buff[0]);
+	
+	if (r < 0) {		
+		fprintf(stderr, "SPI.LCD_DATA_1(0x%4X) error (%d,%d) : %s", data, r, errno, strerror(errno));
+		return;
+	}
+	
+	lcd_frame(buff, data, 0x1F, d->bits); // 0x1F - DATA_AF const from ili9341.c (AF is short form "after")
+	r = lcd_send(d, &buff[0]);
+	if (r < 0) {		
+		fprintf(stderr, "SPI.LCD_DATA_2(0x%4X) error (%d,%d) : %s", data, r, errno, strerror(errno));
+	}
+
+}
+
+void lcd_cmd(LCD_Display_t *d, uint16_t cmd) {
+	uint8_t *buff = d->buff;
+	int r;
+	
+	// #ifdef _DEBUG_
+		// printf("LCD_CMD(%04X)\n", cmd);
+	// #endif
+	
+	
+	lcd_frame(buff, cmd, 0x11, d->bits); // 0x15 - DATA_BE const from ili9341.c (BE is short form "before")
+	r = lcd_send(d, &buff[0]);
+	if (r < 0) {		
+		fprintf(stderr, "SPI.LCD_CMD_1(%4X) error (%d,%d) : %s", cmd, r, errno, strerror(errno));
+	}
+	
+	lcd_frame(buff, cmd, 0x1B, d->bits); // 0x1F - DATA_AF const from ili9341.c (AF is short form "after")
+	r = lcd_send(d, &buff[0]);
+	if (r < 0) {		
+		fprintf(stderr, "SPI.LCD_CMD_2(%4X) error (%d,%d) : %s", cmd, r, errno, strerror(errno));
+	}
+
+}
+
+void lcd_setptr(LCD_Display_t *d) {
+	uint16_t ex = d->opts.width - 1;
+	uint16_t ey = d->opts.height - 1;
+	
+	lcd_cmd(d, 0x002b);	//Page Address Set 
+	lcd_data(d, 0x0000); 
+	lcd_data(d, 0x0000); // 0
+	lcd_data(d, ey>>8);
+	lcd_data(d, 0x00ff&ey); //319 in landscape
+	
+	lcd_cmd(d, 0x002a);	//Column Address Set
+	lcd_data(d, 0x0000);
+	lcd_data(d, 0x0000); // 0
+	lcd_data(d, ex>>8);
+	lcd_data(d, 0x00ff&ex); // 479 in landscape
+	
+	lcd_cmd(d, 0x002c);
+}
+
+
+	
+void lcd_setarea(LCD_Display_t *d, uint16_t x, uint16_t y) {
+	uint16_t ex = d->opts.width - 1;
+	uint16_t ey = d->opts.height - 1;
+	
+	lcd_cmd(d, 0x002b);//Set Gamma 
+	lcd_data(d, y>>8);
+	lcd_data(d, 0x00ff&y);
+	lcd_data(d, ey>>8);
+	lcd_data(d, 0x00ff&ey);
+
+	lcd_cmd(d, 0x002a);//Set Gamma 
+	lcd_data(d, x>>8) ;
+	lcd_data(d, 0x00ff&x) ;
+	lcd_data(d, ex>>8);
+	lcd_data(d, 0x00ff&ex);
+	lcd_cmd(d, 0x002c);
+}
+
+void lcd_setarea2(LCD_Display_t *d, uint16_t sx, uint16_t sy, uint16_t x, uint16_t y) {
+	LCD_TRACE_SCOPE(LCD_TR_SETAREA, (uint32_t)(abs(x - sx) + 1) * (abs(y - sy) + 1));
+	LCD_STATS_SCOPE(LCD_ST_SETAREA);
+	uint16_t ex = d->opts.width - 1;
+	uint16_t ey = d->opts.height - 1;
+	
+	if (sx>ex) sx=0;
+	if (sy>ey) sy=0;
+	if (x>ex) x=ex;
+	if (y>ey) y=ey;
+	
+	if (d->lat && d->lat->windowing.load(std::memory_order_relaxed)) lcd_latency_window(d->lat);
+	lcd_cmd(d, 0x002b);
+	lcd_data(d, sy>>8) ;
+	lcd_data(d, 0x00ff&sy);
+	lcd_data(d, y>>8);
+	lcd_data(d, 0x00ff&y);
+
+	lcd_cmd(d, 0x002a);
+	lcd_data(d, sx>>8) ;
+	lcd_data(d, 0x00ff&sx) ;
+	lcd_data(d, x>>8);
+	lcd_data(d, 0x00ff&x);
+	
+	lcd_cmd(d, 0x002c); //Memory Write
+}
+
+/* send the first len bytes of d->wire */
+void lcd_wire_send(LCD_Display_t *d, int len) {
+	int r = lcd_send_rows(d, d->wire, len, 1, len, len);
+	if (r < 0) {
+		fprintf(stderr, "SPI.LCD_PIXELS(%d) error (%d,%d) : %s", len, r, errno, strerror(errno));
+	}
+}
+
+/*
+	Name: lcd_pixels
+	Description: Stream a block of pixels after lcd_setarea2, the bulk form of one lcd_data per pixel.
+		Frames are collected in d->wire and sent d->chunk bytes per ioctl, across row ends.
+	Parameters:
+		1. d : pointer LCD_Display_t - display
+		2. px : pointer uint16_t - first pixel
+		3. w, h : int - block size in pixels
+		4. stride : int - pixels between rows of px
+*/
+void lcd_pixels(LCD_Display_t *d, const uint16_t *px, int w, int h, int stride) {
+	int per = d->chunk > 8 ? d->chunk / 8 : 1; // pixels per message
+	int len = 0;
+
+	for (int j=0; j<h; j++) {
+		const uint16_t *row = px + j*stride;
+		for (int i=0; i<w; ) {
+			int n = w - i < per - len/8 ? w - i : per - len/8;
+			lcd_encode_span(d->wire + len, row + i, n, d->bits);
+			len += n * 8;
+			i += n;
+			if (len/8 == per) {
+				lcd_wire_send(d, len);
+				len = 0;
+			}
+		}
+	}
+	if (len) lcd_wire_send(d, len);
+}
+
+/**
+ * @brief  Stream n pixels of one color, the pattern is encoded once and resent
+ */
+void lcd_pixels_fill(LCD_Display_t *d, uint16_t color565, int n) {
+	int per = d->chunk > 8 ? d->chunk / 8 : 1; // pixels per message
+
+	lcd_frame(d->wire, color565, 0x15, d->bits);
+	lcd_frame(d->wire + 4, color565, 0x1F, d->bits);
+	for (int i=1; i<per && i<n; i++) memcpy(d->wire + i*8, d->wire, 8);
+	for (; n > 0; n -= per) {
+		lcd_wire_send(d, (n < per ? n : per) * 8);
+	}
+}
+
+/* ------------------------------------------------------------------------------ */
+
+/* palette an indexed shadow starts with, black first */
+static const uint16_t lcd_palette_default[] = {
+	ILI9341_COLOR_BLACK, ILI9341_COLOR_WHITE, ILI9341_COLOR_RED, ILI9341_COLOR_GREEN, ILI9341_COLOR_GREEN2,
+	ILI9341_COLOR_BLUE, ILI9341_COLOR_BLUE2, ILI9341_COLOR_YELLOW, ILI9341_COLOR_ORANGE, ILI9341_COLOR_CYAN,
+	ILI9341_COLOR_MAGENTA, ILI9341_COLOR_GRAY, ILI9341_COLOR_BROWN
+};
+
+/* flush tables of index i: its frame pair, and for I4 every byte holding it */
+void lcd_palette_entry(LCD_Display_t *d, int i) {
+	LCD_Palette_t *p = d->pal;
+
+	lcd_frame(p->wire[i], p->color[i], 0x15, d->bits);
+	lcd_frame(p->wire[i] + 4, p->color[i], 0x1F, d->bits);
+	if (p->max == 16) {
+		for (int k=0; k<16; k++) {
+			memcpy(p->pair[i << 4 | k], p->wire[i], 8);
+			memcpy(p->pair[k << 4 | i] + 8, p->wire[i], 8);
+		}
+	}
+}
+
+/*
+	Name: lcd_palette_set
+	Description: Replace the colors of an indexed shadow with colors[0..n-1]. Indices already
+		drawn keep their number, so the whole screen is damaged. Entries beyond n are free
+		for colors drawn later.
+	Returns:
+		0 - on success, -1 - no indexed shadow, -2 - n larger than the mode allows
+*/
+int lcd_palette_set(LCD_Display_t *d, const uint16_t *colors, int n) {
+	LCD_Palette_t *p = d->pal;
+
+	if (!p) return -1;
+	if (n < 1 || n > p->max) return -2;
+	for (int i=0; i<p->max; i++) {
+		p->color[i] = i < n ? colors[i] : 0;
+		lcd_palette_entry(d, i);
+	}
+	p->n = n;
+	p->last = 0;
+	lcd_damage_add(&d->dirty, lcd_rect(0, 0, d->opts.width - 1, d->opts.height - 1));
+	return 0;
+}
+
+/*
+	Name: lcd_palette_index
+	Description: Index of color565, added to the palette when missing and there is room,
+		otherwise the nearest entry (RGB distance).
+*/
+int lcd_palette_index(LCD_Display_t *d, uint16_t color565) {
+	LCD_Palette_t *p = d->pal;
+	int best = 0, dist = 1 << 30;
+
+	if (p->color[p->last] == color565) return p->last; // drawing mostly repeats a color
+	for (int i=0; i<p->n; i++) {
+		if (p->color[i] == color565) return p->last = i;
+	}
+	if (p->n < p->max) {
+		p->color[p->n] = color565;
+		lcd_palette_entry(d, p->n);
+		return p->last = p->n++;
+	}
+	for (int i=0; i<p->n; i++) {
+		int dr = ((p->color[i] >> 11) - (color565 >> 11)) * 2;   // 5 bit red and blue against 6 bit green
+		int dg = ((p->color[i] >> 5) & 0x3F) - ((color565 >> 5) & 0x3F);
+		int db = ((p->color[i] & 0x1F) - (color565 & 0x1F)) * 2;
+		int e = dr*dr + dg*dg + db*db;
+		if (e < dist) { dist = e; best = i; }
+	}
+	return p->last = best;
+}
+
+/* set indices x0..x1 of one I4 row, partial bytes at both ends */
+static inline void lcd_shadow_span_i4(uint8_t *row, int x0, int x1, uint8_t idx) {
+	if (x0 & 1) {
+		row[x0 >> 1] = (row[x0 >> 1] & 0xF0) | idx;
+		x0++;
+	}
+	if (x0 > x1) return;
+	if (!(x1 & 1)) {
+		row[x1 >> 1] = (row[x1 >> 1] & 0x0F) | idx << 4;
+		x1--;
+	}
+	if (x0 < x1) memset(row + (x0 >> 1), idx * 0x11, (x1 - x0 + 1) >> 1);
+}
+
+/* index of the run holding pixel x */
+static inline int lcd_run_find(const LCD_RunRow_t *row, int x) {
+	int lo = 0, hi = row->n - 1;
+	while (lo < hi) {
+		int mid = (lo + hi + 1) >> 1;
+		if (row->run[mid].x <= x) lo = mid;
+		else hi = mid - 1;
+	}
+	return lo;
+}
+
+/* runs of w pixels starting at screen x0, returns how many */
+static inline int lcd_run_encode(LCD_Run_t *out, int x0, const uint16_t *px, int w) {
+	int k = 0;
+	for (int i=0; i<w; i++) {
+		if (i == 0 || px[i] != px[i-1]) {
+			out[k].x = (uint16_t)(x0 + i);
+			out[k++].color = px[i];
+		}
+	}
+	return k;
+}
+
+/*
+	Name: lcd_run_splice
+	Description: Replace pixels x0..x1 of a run row with k runs (src[0].x is x0, x increasing,
+		all inside x0..x1). The runs cut at x0 and x1 are split, equal colors meeting at
+		either end merged, so a row never holds two neighbouring runs of one color.
+	Parameters:
+		1. row : pointer LCD_RunRow_t - row to change
+		2. x0, x1 : int - pixels replaced, inside the row
+		3. src, k : runs covering them
+		4. w : int - row width
+	Returns:
+		0 - on success, -1 - out of memory (the row is unchanged)
+*/
+int lcd_run_splice(LCD_RunRow_t *row, int x0, int x1, const LCD_Run_t *src, int k, int w) {
+	LCD_Run_t tmp[ILI9341_WIDTH + 4];
+	int a = lcd_run_find(row, x0), b = lcd_run_find(row, x1);
+	int lo = a > 0 ? a - 1 : a;                 // one neighbour on each side, for merging
+	int hi = b + 2 < row->n ? b + 2 : row->n;
+	int m = 0, j = 0, n;
+
+	for (int i=lo; i<a; i++) tmp[m++] = row->run[i];
+	if (row->run[a].x < x0) tmp[m++] = row->run[a];
+	memcpy(tmp + m, src, k * sizeof(LCD_Run_t));
+	m += k;
+	if (x1 + 1 < (b + 1 < row->n ? row->run[b+1].x : w)) { // what is left of run b
+		tmp[m].x = (uint16_t)(x1 + 1);
+		tmp[m++].color = row->run[b].color;
+	}
+	for (int i=b+1; i<hi; i++) tmp[m++] = row->run[i];
+	for (int i=1; i<m; i++) {
+		if (tmp[i].color != tmp[j].color) tmp[++j] = tmp[i];
+	}
+	m = j + 1;
+
+	n = row->n - (hi - lo) + m;
+	if (n > row->cap) {
+		int cap = row->cap * 2 > n ? row->cap * 2 : n;
+		LCD_Run_t *p = (LCD_Run_t *)realloc(row->run, cap * sizeof(LCD_Run_t));
+		if (!p) return -1;
+		row->run = p;
+		row->cap = (uint16_t)cap;
+	}
+	memmove(row->run + lo + m, row->run + hi, (row->n - hi) * sizeof(LCD_Run_t));
+	memcpy(row->run + lo, tmp, m * sizeof(LCD_Run_t));
+	row->n = (uint16_t)n;
+	return 0;
+}
+
+/*
+	Name: lcd_shadow_init
+	Description: Choose where drawing goes. With a shadow buffer lcd_fill, lcd_fill2, lcd_blit and
+		lcd_DrawPixel (and everything built on them) only update the shadow and record the damage,
+		lcd_flush sends it. LCD_SHADOW_WIRE trades 1.2 MB for flushes without any per pixel work,
+		LCD_SHADOW_RGB565 keeps 300 KB and encodes on flush. LCD_SHADOW_I8 / I4 keep palette
+		indices (150 / 75 KB) and expand them through a table on flush; colors missing from the
+		palette are added while there is room, then drawn as the nearest one. LCD_SHADOW_RLE
+		keeps rows as color runs: a few KB for flat screens, more than RGB565 once most
+		neighbouring pixels differ; each run is encoded once on flush. The shadow starts
+		black and all dirty.
+	Parameters:
+		1. d : pointer LCD_Display_t - opened display
+		2. mode : LCD_ShadowMode_t - LCD_SHADOW_NONE frees the shadow
+	Returns:
+		0 - on success, -1 - out of memory (the display is left without shadow)
+*/
+int lcd_shadow_init(LCD_Display_t *d, LCD_ShadowMode_t mode) {
+	free(d->fb);
+	free(d->fbw);
+	free(d->fbi);
+	free(d->pal);
+	lcd_run_free(d);
+	d->fb = NULL;
+	d->fbw = NULL;
+	d->fbi = NULL;
+	d->pal = NULL;
+	d->shadow = LCD_SHADOW_NONE;
+	lcd_damage_init(&d->dirty, NULL);
+
+	if (mode == LCD_SHADOW_I8 || mode == LCD_SHADOW_I4) {
+		/* index 0 is black, which the zeroed buffer starts in */
+		d->fbi = (uint8_t *)calloc(mode == LCD_SHADOW_I8 ? ILI9341_PIXEL : ILI9341_PIXEL / 2, 1);
+		d->pal = (LCD_Palette_t *)calloc(1, sizeof(LCD_Palette_t));
+		if (!d->fbi || !d->pal) {
+			free(d->fbi);
+			free(d->pal);
+			d->fbi = NULL;
+			d->pal = NULL;
+			return -1;
+		}
+		d->pal->max = mode == LCD_SHADOW_I8 ? 256 : 16;
+		lcd_palette_set(d, lcd_palette_default, sizeof(lcd_palette_default) / sizeof(lcd_palette_default[0]));
+	} else if (mode == LCD_SHADOW_RLE) {
+		/* one black run per row, room for a few more */
+		d->fbr = (LCD_RunRow_t *)calloc(LCD_RUN_ROWS, sizeof(LCD_RunRow_t));
+		if (!d->fbr) return -1;
+		for (int y=0; y<LCD_RUN_ROWS; y++) {
+			LCD_RunRow_t *row = &d->fbr[y];
+			row->run = (LCD_Run_t *)calloc(4, sizeof(LCD_Run_t));
+			if (!row->run) {
+				lcd_run_free(d);
+				return -1;
+			}
+			row->n = 1;
+			row->cap = 4;
+		}
+	} else if (mode == LCD_SHADOW_RGB565) {
+		d->fb = (uint16_t *)calloc(ILI9341_PIXEL, sizeof(uint16_t));
+		if (!d->fb) return -1;
+	} else if (mode == LCD_SHADOW_WIRE) {
+		d->fbw = (uint8_t *)malloc((size_t)ILI9341_PIXEL * 8);
+		if (!d->fbw) return -1;
+		lcd_frame(d->fbw, 0x0000, 0x15, d->bits);
+		lcd_frame(d->fbw + 4, 0x0000, 0x1F, d->bits);
+		for (size_t n=8; n<(size_t)ILI9341_PIXEL*8; n*=2) {
+			memcpy(d->fbw + n, d->fbw, n*2 <= (size_t)ILI9341_PIXEL*8 ? n : ILI9341_PIXEL*8 - n);
+		}
+	}
+	d->shadow = mode;
+	if (mode != LCD_SHADOW_NONE) {
+		lcd_damage_add(&d->dirty, lcd_rect(0, 0, d->opts.width - 1, d->opts.height - 1));
+	}
+	return 0;
+}
+
+/* fill a clipped rectangle of the shadow */
+void lcd_shadow_fill(LCD_Display_t *d, int x0, int y0, int x1, int y1, uint16_t color565) {
+	const int W = d->opts.width;
+	const int w = x1 - x0 + 1;
+
+	if (d->shadow == LCD_SHADOW_WIRE) {
+		uint8_t *first = d->fbw + ((size_t)y0*W + x0) * 8;
+		lcd_frame(first, color565, 0x15, d->bits);
+		lcd_frame(first + 4, color565, 0x1F, d->bits);
+		for (int n=1; n<w; n*=2) memcpy(first + n*8, first, (n*2 <= w ? n : w - n) * 8);
+		for (int y=y0+1; y<=y1; y++) memcpy(d->fbw + ((size_t)y*W + x0) * 8, first, w * 8);
+	} else if (d->shadow == LCD_SHADOW_I8) {
+		uint8_t idx = lcd_palette_index(d, color565);
+		for (int y=y0; y<=y1; y++) memset(d->fbi + y*W + x0, idx, w);
+	} else if (d->shadow == LCD_SHADOW_I4) {
+		uint8_t idx = lcd_palette_index(d, color565);
+		for (int y=y0; y<=y1; y++) lcd_shadow_span_i4(d->fbi + y*(W/2), x0, x1, idx);
+	} else if (d->shadow == LCD_SHADOW_RLE) {
+		LCD_Run_t r = { (uint16_t)x0, color565 };
+		for (int y=y0; y<=y1; y++) {
+			if (lcd_run_splice(&d->fbr[y], x0, x1, &r, 1, W) < 0) fprintf(stderr, "LCD.RUNS out of memory\n");
+		}
+	} else {
+		for (int y=y0; y<=y1; y++) {
+			uint16_t *p = d->fb + y*W + x0;
+			for (int i=0; i<w; i++) p[i] = color565;
+		}
+	}
+	lcd_damage_add(&d->dirty, lcd_rect(x0, y0, x1, y1));
+}
+
+/* copy a clipped block of pixels into the shadow, encoding it right away in wire mode,
+   mapping every pixel to its palette index in the indexed modes and to runs in run mode */
+void lcd_shadow_blit(LCD_Display_t *d, int x0, int y0, int w, int h, const uint16_t *px, int stride) {
+	const int W = d->opts.width;
+	LCD_Run_t runs[ILI9341_WIDTH];
+
+	for (int j=0; j<h; j++) {
+		const uint16_t *row = px + j*stride;
+		if (d->shadow == LCD_SHADOW_RLE) {
+			int k = lcd_run_encode(runs, x0, row, w);
+			if (lcd_run_splice(&d->fbr[y0+j], x0, x0 + w - 1, runs, k, W) < 0) fprintf(stderr, "LCD.RUNS out of memory\n");
+		} else if (d->shadow == LCD_SHADOW_WIRE) {
+			lcd_encode_span(d->fbw + ((size_t)(y0+j)*W + x0) * 8, row, w, d->bits);
+		} else if (d->shadow == LCD_SHADOW_I8) {
+			uint8_t *p = d->fbi + (y0+j)*W + x0;
+			for (int i=0; i<w; i++) p[i] = lcd_palette_index(d, row[i]);
+		} else if (d->shadow == LCD_SHADOW_I4) {
+			uint8_t *p = d->fbi + (y0+j)*(W/2);
+			for (int i=0; i<w; i++) lcd_shadow_span_i4(p, x0+i, x0+i, lcd_palette_index(d, row[i]));
+		} else {
+			memcpy(d->fb + (y0+j)*W + x0, row, w * sizeof(uint16_t));
+		}
+	}
+	lcd_damage_add(&d->dirty, lcd_rect(x0, y0, x0 + w - 1, y0 + h - 1));
+}
+
+/*
+	Name: lcd_pixels_indexed
+	Description: lcd_pixels for a block of the indexed shadow: every index (I8) or index pair
+		(I4) becomes its frames with one table copy while d->wire fills.
+*/
+void lcd_pixels_indexed(LCD_Display_t *d, int x0, int y0, int w, int h) {
+	const LCD_Palette_t *p = d->pal;
+	const int W = d->opts.width;
+	int per = d->chunk > 8 ? d->chunk / 8 : 1; // pixels per message
+	int len = 0;
+
+	for (int j=0; j<h; j++) {
+		for (int i=0; i<w; ) {
+			int n = w - i < per - len/8 ? w - i : per - len/8;
+			uint8_t *out = d->wire + len;
+			int x = x0 + i;
+			if (d->shadow == LCD_SHADOW_I8) {
+				const uint8_t *src = d->fbi + (y0+j)*W + x;
+				for (int k=0; k<n; k++) memcpy(out + k*8, p->wire[src[k]], 8);
+			} else {
+				const uint8_t *src = d->fbi + (y0+j)*(W/2);
+				int k = 0;
+				if (x & 1) { // odd start: low nibble alone
+					memcpy(out, p->wire[src[x >> 1] & 0x0F], 8);
+					k = 1;
+				}
+				for (; k+1<n; k+=2) memcpy(out + k*8, p->pair[src[(x+k) >> 1]], 16);
+				if (k < n) memcpy(out + k*8, p->wire[src[(x+k) >> 1] >> 4], 8);
+			}
+			len += n * 8;
+			i += n;
+			if (len/8 == per) {
+				lcd_wire_send(d, len);
+				len = 0;
+			}
+		}
+	}
+	if (len) lcd_wire_send(d, len);
+}
+
+/*
+	Name: lcd_pixels_runs
+	Description: lcd_pixels for a block of the run shadow. A run's frame pair is encoded once
+		(and cached by color) and stored out over the run; a message that is all one run of
+		the color the previous full message carried is sent again without touching d->wire.
+*/
+void lcd_pixels_runs(LCD_Display_t *d, int x0, int y0, int w, int h) {
+	const int W = d->opts.width;
+	const int x1 = x0 + w - 1;
+	int per = d->chunk > 8 ? d->chunk / 8 : 1; // pixels per message
+	int len = 0, held = -1;                    // held: color of the full message in d->wire
+	int last = -1;
+	uint64_t pair = 0;                         // frames of color last
+	uint32_t key[64] = {};                     // color + 1 held by each slot of cache, 0 - empty
+	uint64_t cache[64];
+
+	for (int j=0; j<h; j++) {
+		const LCD_RunRow_t *row = &d->fbr[y0+j];
+		int r = lcd_run_find(row, x0);
+		for (int x=x0; x<=x1; r++) {
+			int end = r + 1 < row->n && row->run[r+1].x <= W ? row->run[r+1].x - 1 : W - 1;
+			uint16_t color = row->run[r].color;
+			int left = (end < x1 ? end : x1) - x + 1;
+			if (color != last) { // screens alternate few colors, their frames are cached
+				int slot = (color ^ color >> 7) & 63;
+				if (key[slot] != color + 1u) {
+					uint8_t f[8];
+					lcd_frame(f, color, 0x15, d->bits);
+					lcd_frame(f + 4, color, 0x1F, d->bits);
+					memcpy(&cache[slot], f, 8);
+					key[slot] = color + 1u;
+				}
+				pair = cache[slot];
+				last = color;
+			}
+			while (left > 0) {
+				int n = left < per - len/8 ? left : per - len/8;
+				if (!(len == 0 && n == per && held == color)) {
+					uint8_t *out = d->wire + len;
+					for (int k=0; k<n; k++) memcpy(out + k*8, &pair, 8);
+					held = len == 0 && n == per ? color : -1;
+				}
+				len += n * 8;
+				left -= n;
+				x += n;
+				if (len/8 == per) {
+					lcd_wire_send(d, len);
+					len = 0;
+				}
+			}
+		}
+	}
+	if (len) lcd_wire_send(d, len);
+}
+
+/**
+ * @brief  Bytes of pixel storage held by the shadow buffer (run lists as allocated)
+ */
+size_t lcd_shadow_bytes(const LCD_Display_t *d) {
+	size_t n = 0;
+	switch (d->shadow) {
+	case LCD_SHADOW_RGB565: return (size_t)ILI9341_PIXEL * 2;
+	case LCD_SHADOW_WIRE: return (size_t)ILI9341_PIXEL * 8;
+	case LCD_SHADOW_I8: return ILI9341_PIXEL;
+	case LCD_SHADOW_I4: return ILI9341_PIXEL / 2;
+	case LCD_SHADOW_RLE:
+		n = LCD_RUN_ROWS * sizeof(LCD_RunRow_t);
+		for (int y=0; y<LCD_RUN_ROWS; y++) n += d->fbr[y].cap * sizeof(LCD_Run_t);
+		return n;
+	default: return 0;
+	}
+}
+
+/*
+	Name: lcd_flush
+	Description: Send the damaged parts of the shadow buffer, coalesced by the cost model in
+		d->dirty.cost. In wire mode every window goes to spidev straight from the shadow.
+		Sends nothing without a shadow buffer. Either way, everything drawn before is on
+		the wire afterwards, which closes the ids traced in d->lat.
+	Returns:
+		number of windows sent
+*/
+int lcd_flush(LCD_Display_t *d) {
+	LCD_TRACE_SCOPE(LCD_TR_FLUSH, d->dirty.n);
+	LCD_STATS_SCOPE(LCD_ST_FLUSH);
+	const int W = d->opts.width;
+	int n;
+
+	if (d->shadow == LCD_SHADOW_NONE) {
+		if (d->lat) lcd_latency_done(d->lat); // drawn directly, already on the wire
+		return 0;
+	}
+	n = lcd_damage_coalesce(&d->dirty);
+	for (int i=0; i<n; i++) {
+		const LCD_Rect_t *r = &d->dirty.r[i];
+		int w = r->x1 - r->x0 + 1;
+		int h = r->y1 - r->y0 + 1;
+		lcd_setarea2(d, r->x0, r->y0, r->x1, r->y1);
+		if (d->shadow == LCD_SHADOW_WIRE) {
+			int e = lcd_send_rows(d, d->fbw + ((size_t)r->y0*W + r->x0) * 8, w * 8, h, W * 8, d->chunk);
+			if (e < 0) fprintf(stderr, "SPI.LCD_FLUSH error (%d,%d) : %s", e, errno, strerror(errno));
+		} else if (d->fbi) {
+			lcd_pixels_indexed(d, r->x0, r->y0, w, h);
+		} else if (d->fbr) {
+			lcd_pixels_runs(d, r->x0, r->y0, w, h);
+		} else {
+			lcd_pixels(d, d->fb + r->y0*W + r->x0, w, h, W);
+		}
+	}
+	lcd_damage_clear(&d->dirty);
+	if (d->lat) lcd_latency_done(d->lat);
+	return n;
+}
+
+void lcd_fill(LCD_Display_t *d, uint16_t color565) {
+	if (d->shadow) {
+		lcd_shadow_fill(d, 0, 0, d->opts.width - 1, d->opts.height - 1, color565);
+		return;
+	}
+	lcd_setptr(d);
+	lcd_pixels_fill(d, color565, 153601);
+}
+
+void lcd_fill2(LCD_Display_t *d, uint16_t sx, uint16_t sy, uint16_t x, uint16_t y, uint16_t color565) {
+	LCD_TRACE_SCOPE(LCD_TR_FILL2, (uint32_t)(abs(x - sx) + 1) * (abs(y - sy) + 1));
+	LCD_STATS_SCOPE(LCD_ST_FILL);
+	uint16_t tmp=0;
+	uint16_t ex = d->opts.width - 1;
+	uint16_t ey = d->opts.height - 1;
+	int cnt;
+	if (sx>ex) sx=0;
+	if (sy>ey) sy=0;
+	if (x>ex)  x=ex;
+	if (y>ey)  y=ey;
+	
+	if (sx>x) {
+		tmp=sx;
+		sx=x;
+		x=tmp;
+	}
+	
+	if (sy>y) {
+		tmp=sy;
+		sy=y;
+		y=tmp;
+	}
+	
+	if (d->shadow) {
+		lcd_shadow_fill(d, sx, sy, x, y, color565);
+		return;
+	}
+	
+	cnt = (y-sy+1) * (x-sx+1);
+	lcd_setarea2(d, sx,sy,x,y);
+	lcd_pixels_fill(d, color565, cnt);
+}
+
+/*
+	Name: lcd_blit
+	Description: Copy a block of RGB565 pixels to the panel, clipped to the screen
+	Parameters:
+		1. d : pointer LCD_Display_t - display
+		2. x, y : int - top left corner on screen (may be off screen)
+		3. w, h : int - block size in pixels
+		4. px : pointer uint16_t - first pixel of the block
+		5. stride : int - pixels between rows of px
+*/
+void lcd_blit(LCD_Display_t *d, int x, int y, int w, int h, const uint16_t *px, int stride) {
+	LCD_STATS_SCOPE(LCD_ST_BLIT);
+	int sx = x < 0 ? 0 : x;
+	int sy = y < 0 ? 0 : y;
+	int ex = x + w - 1;
+	int ey = y + h - 1;
+	if (ex > d->opts.width-1) ex = d->opts.width-1;
+	if (ey > d->opts.height-1) ey = d->opts.height-1;
+	if (sx > ex || sy > ey) return;
+
+	if (d->shadow) {
+		lcd_shadow_blit(d, sx, sy, ex-sx+1, ey-sy+1, px + (sy-y)*stride + (sx-x), stride);
+		return;
+	}
+	lcd_setarea2(d, sx, sy, ex, ey);
+	lcd_pixels(d, px + (sy-y)*stride + (sx-x), ex-sx+1, ey-sy+1, stride);
+}
+
+/**
+ * @brief  Copy a whole off-screen buffer to the panel with its top left corner at x, y
+ */
+void lcd_blit_buffer(LCD_Display_t *d, int x, int y, const LCD_Buffer_t *b) {
+	lcd_blit(d, x, y, b->w, b->h, b->px, b->stride);
+}
+
+
+/*
+	Name: lcd_madctl
+	Description: Memory Access Control value that makes the panel itself map the given orientation
+*/
+uint8_t lcd_madctl(TM_ILI9341_Orientation o) {
+	switch (o) {
+	case TM_ILI9341_Portrait:           return ILI9341_MADCTL_MX | ILI9341_MADCTL_BGR;
+	case TM_ILI9341_Landscape_Flipped:  return ILI9341_MADCTL_MY | ILI9341_MADCTL_MX | ILI9341_MADCTL_MV | ILI9341_MADCTL_BGR;
+	case TM_ILI9341_Portrait_Flipped:   return ILI9341_MADCTL_MY | ILI9341_MADCTL_BGR;
+	case TM_ILI9341_Landscape:
+	default:                            return ILI9341_MADCTL_MV | ILI9341_MADCTL_BGR;
+	}
+}
+
+/**
+ * @brief  Rotates the LCD at runtime
+ * @note   Only MADCTL is reprogrammed, the panel does the rotation so drawing
+ *         costs the same in every mode. Width, height and clipping follow the
+ *         new mode; what is already on screen is not redrawn. A shadow buffer
+ *         must be redrawn completely before the next lcd_flush.
+ * @param  *d: Display to rotate
+ * @param  orientation: one of TM_ILI9341_Orientation
+ * @retval None
+ */
+void TM_ILI9341_Rotate(LCD_Display_t *d, TM_ILI9341_Orientation orientation) {
+	d->opts.orientation = orientation;
+	if (orientation == TM_ILI9341_Portrait || orientation == TM_ILI9341_Portrait_Flipped) {
+		d->opts.width = ILI9341_HEIGHT;
+		d->opts.height = ILI9341_WIDTH;
+	} else {
+		d->opts.width = ILI9341_WIDTH;
+		d->opts.height = ILI9341_HEIGHT;
+	}
+	if (d->shadow) {
+		/* the shadow now has a different row length, its content is garbage until redrawn */
+		lcd_damage_clear(&d->dirty);
+		lcd_damage_add(&d->dirty, lcd_rect(0, 0, d->opts.width - 1, d->opts.height - 1));
+	}
+	
+	lcd_cmd(d, 0x0036);  //Memory Access Control
+	lcd_data(d, lcd_madctl(orientation));
+}
+
+//	ILI9486L
+void lcd_init(LCD_Display_t *d) {
+	LCD_STATS_SCOPE(LCD_ST_INIT);
+	lcd_reset(d);
+	delayms(100);
+	lcd_cmd(d, 0x0000);	//No Operation
+	delayms(1);
+
+	lcd_cmd(d, 0x00B0);	//Interface Mode Control 
+	lcd_data(d, 0x0000);
+	lcd_cmd(d, 0x0011);	//Sleep OUT
+	delayms(50); //mdelay(50);
+
+	lcd_cmd(d, 0x00B3);	//Frame Control
+	lcd_data(d, 0x0002);
+	lcd_data(d, 0x0000);
+	lcd_data(d, 0x0000);
+	lcd_data(d, 0x0000);
+
+	lcd_cmd(d, 0x00C0);	//Power Control 1
+	lcd_data(d, 0x0010);//13
+	lcd_data(d, 0x003B);//480
+	lcd_data(d, 0x0000);
+	lcd_data(d, 0x0002);
+	lcd_data(d, 0x0000);
+	lcd_data(d, 0x0001);
+	lcd_data(d, 0x0000);//NW
+	lcd_data(d, 0x0043);
+
+	lcd_cmd(d, 0x00C1);	//Power Control 2
+	lcd_data(d, 0x0008);//w_data(0x0008);
+	lcd_data(d, 0x0016);//w_data(0x0016);//CLOCK
+	lcd_data(d, 0x0008);
+	lcd_data(d, 0x0008);
+
+	lcd_cmd(d, 0x00C4);//Power Control 5
+	lcd_data(d, 0x0011);
+	lcd_data(d, 0x0007);
+	lcd_data(d, 0x0003);
+	lcd_data(d, 0x0003);
+
+	lcd_cmd(d, 0x00C6);//CABC Control 1 ????
+	lcd_data(d, 0x0000);
+
+	lcd_cmd(d, 0x00C8); //GAMMA
+	lcd_data(d, 0x0003);
+	lcd_data(d, 0x0003);
+	lcd_data(d, 0x0013);
+	lcd_data(d, 0x005C);
+	lcd_data(d, 0x0003);
+	lcd_data(d, 0x0007);
+	lcd_data(d, 0x0014);
+	lcd_data(d, 0x0008);
+	lcd_data(d, 0x0000);
+	lcd_data(d, 0x0021);
+	lcd_data(d, 0x0008);
+	lcd_data(d, 0x0014);
+	lcd_data(d, 0x0007);
+	lcd_data(d, 0x0053);
+	lcd_data(d, 0x000C);
+	lcd_data(d, 0x0013);
+	lcd_data(d, 0x0003);
+	lcd_data(d, 0x0003);
+	lcd_data(d, 0x0021);
+	lcd_data(d, 0x0000);
+
+	lcd_cmd(d, 0x0035);	//Tearing Effect Line ON
+	lcd_data(d, 0x0000);
+
+	lcd_cmd(d, 0x0036);  //Memory Access Control
+	lcd_data(d, lcd_madctl(d->opts.orientation)); // 0x28 in landscape
+
+	lcd_cmd(d, 0x003A);	//Pixel Format Set
+	lcd_data(d, 0x0055); //55 lgh
+
+	lcd_cmd(d, 0x0044);//Set Tear Scanline
+	lcd_data(d, 0x0000);
+	lcd_data(d, 0x0001);
+
+	lcd_cmd(d, 0x00B6);	//Display Function Control
+	lcd_data(d, 0x0000);
+	lcd_data(d, 0x0002); //220 GS SS SM ISC[3:0]
+	lcd_data(d, 0x003B);
+
+	lcd_cmd(d, 0x00D0);	//NV Memory Write
+	lcd_data(d, 0x0007);
+	lcd_data(d, 0x0007); //VCI1
+	lcd_data(d, 0x001D); //VRH
+
+	lcd_cmd(d, 0x00D1);	//NV Memory Protection Key
+	lcd_data(d, 0x0000);
+	lcd_data(d, 0x0003); //VCM
+	lcd_data(d, 0x0000); //VDV
+
+	lcd_cmd(d, 0x00D2);	//NV Memory Status Read
+	lcd_data(d, 0x0003);
+	lcd_data(d, 0x0014);
+	lcd_data(d, 0x0004);
+
+
+
+	lcd_cmd(d, 0xE0);  		//Positive Gamma Correction
+	lcd_data(d, 0x1f);  
+	lcd_data(d, 0x2C);  
+	lcd_data(d, 0x2C);  
+	lcd_data(d, 0x0B);  
+	lcd_data(d, 0x0C);  
+	lcd_data(d, 0x04);  
+	lcd_data(d, 0x4C);  
+	lcd_data(d, 0x64);  
+	lcd_data(d, 0x36);  
+	lcd_data(d, 0x03);  
+	lcd_data(d, 0x0E);  
+	lcd_data(d, 0x01);  
+	lcd_data(d, 0x10);  
+	lcd_data(d, 0x01);  
+	lcd_data(d, 0x00);  
+
+	lcd_cmd(d, 0XE1);  	//Negative Gamma Correction
+	lcd_data(d, 0x1f);  
+	lcd_data(d, 0x3f);  
+	lcd_data(d, 0x3f);  
+	lcd_data(d, 0x0f);  
+	lcd_data(d, 0x1f);  
+	lcd_data(d, 0x0f);  
+	lcd_data(d, 0x7f);  
+	lcd_data(d, 0x32);  
+	lcd_data(d, 0x36);  
+	lcd_data(d, 0x04);  
+	lcd_data(d, 0x0B);  
+	lcd_data(d, 0x00);  
+	lcd_data(d, 0x19);  
+	lcd_data(d, 0x14);  
+	lcd_data(d, 0x0F);  
+
+	lcd_cmd(d, 0xE2);	//Digital Gamma Control 1
+	lcd_data(d, 0x0f);
+	lcd_data(d, 0x0f);
+
+	lcd_data(d, 0x0f);
+
+	lcd_cmd(d, 0xE3);	//Digital Gamma Control 2
+	lcd_data(d, 0x0f);
+	lcd_data(d, 0x0f);
+
+	lcd_data(d, 0x0f);
+
+	lcd_cmd(d, 0x13);	//Normal Display Mode ON
+
+	lcd_cmd(d, 0x0029);	//Display ON
+	delayms(20); //mdelay(20);
+
+	lcd_cmd(d, 0x00B4);	//Display Inversion Control
+	lcd_data(d, 0x0000);
+	delayms(20); //mdelay(20);
+	lcd_cmd(d, 0x002C);	//Memory Write
+	lcd_cmd(d, 0x002A); 	//Column Address Set
+	lcd_data(d, 0x0000);
+	lcd_data(d, 0x0000);
+
+	lcd_data(d, (d->opts.width - 1) >> 8);
+	lcd_data(d, (d->opts.width - 1) & 0x00ff); // 0x01DF in landscape
+
+	lcd_cmd(d, 0x002B);  //Page Address Set
+	lcd_data(d, 0x0000);
+	lcd_data(d, 0x0000);
+	lcd_data(d, (d->opts.height - 1) >> 8);
+	lcd_data(d, (d->opts.height - 1) & 0x00ff); // 0x013F in landscape
+
+	lcd_cmd(d, 0x002c); //Memory Write
+}
+
+
+
+
+/**
+ * @brief  Draws single pixel to LCD
+ * @param  *d: Display to draw on
+ * @param  x: X position for pixel
+ * @param  y: Y position for pixel
+ * @param  color: Color of pixel
+ * @retval None
+ */
+
+void lcd_DrawPixel(LCD_Display_t *d, uint16_t x, uint16_t y, uint32_t color) {
+	// lcd_SetCursorPosition(x, y, x, y);
+	
+	// lcd_cmd(&spi, 0x002c);
+	// lcd_data(&spi,color >> 8);
+	// lcd_data(&spi,color & 0xFF);
+	if (d->shadow) {
+		if (x < d->opts.width && y < d->opts.height) lcd_shadow_fill(d, x, y, x, y, color);
+		return;
+	}
+	lcd_setarea2(d, x,y,x,y);
+	lcd_data(d, color);
+}
+
+/**
+ * @brief  Puts single character to LCD
+ * @param  *d: Display to draw on
+ * @param  x: X position of top left corner
+ * @param  y: Y position of top left corner
+ * @param  c: Character to be displayed
+ * @param  *font: Pointer to @ref TM_FontDef_t used font
+ * @param  foreground: Color for char
+ * @param  background: Color for char background
+ * @retval None
+ */
+
+void TM_ILI9341_Putc(LCD_Display_t *d, uint16_t x, uint16_t y, char c, TM_FontDef_t *font, uint32_t foreground, uint32_t background) {
+	LCD_TRACE_SCOPE(LCD_TR_PUTC, (uint8_t)c);
+	uint32_t i, b, j;
+	/* Cell width and empty columns skipped, FontWidth and 0 for monospaced fonts */
+	uint32_t w = TM_FONTS_Advance(font, c);
+	uint32_t left = font->metrics && c >= 32 && c <= 126 ? font->metrics->left[c - 32] : 0;
+	/* Set coordinates */
+	d->x = x;
+	d->y = y;
+	
+	if ((d->x + w) > d->opts.width) {
+		/* If at the end of a line of display, go to new line and set x to 0 position */
+		d->y += font->FontHeight;
+		d->x = 0;
+	}
+	
+	/* Draw rectangle for background */
+	if(background != ILI9341_TRANSPARENT)
+		lcd_fill2(d, d->x, d->y, d->x + w, d->y + font->FontHeight, background);
+	
+	/* Draw font data */
+	for (i = 0; i < font->FontHeight; i++) {
+		b = font->data[(c - 32) * font->FontHeight + i];
+		for (j = left; j < font->FontWidth; j++) {
+			if ((b << j) & 0x8000) {
+				lcd_DrawPixel(d, d->x + j - left, (d->y + i), foreground);
+			}
+		}
+	}
+	
+	/* Set new pointer */
+	d->x += w;
+}
+
+/**
+ * @brief  Puts string to LCD
+ * @param  *d: Display to draw on
+ * @param  x: X position of top left corner of first character in string
+ * @param  y: Y position of top left corner of first character in string
+ * @param  *str: Pointer to first character
+ * @param  *font: Pointer to @ref TM_FontDef_t used font
+ * @param  foreground: Color for string
+ * @param  background: Color for string background
+ * @retval None
+ */
+
+void TM_ILI9341_Puts(LCD_Display_t *d, uint16_t x, uint16_t y, char *str, TM_FontDef_t *font, uint32_t foreground, uint32_t background) {
+	LCD_TRACE_SCOPE(LCD_TR_PUTS, lcd_trace_on() ? strlen(str) : 0);
+	LCD_STATS_SCOPE(LCD_ST_TEXT);
+	uint16_t startX = x;
+	char prev = 0;
+	
+	/* Set X and Y coordinates */
+	d->x = x;
+	d->y = y;
+	
+	while (*str) {
+		/* New line */
+		if (*str == '\n') {
+			d->y += font->FontHeight + 1;
+			/* if after \n is also \r, than go to the left of the screen */
+			if (*(str + 1) == '\r') {
+				d->x = 0;
+				str++;
+			} else {
+				d->x = startX;
+			}
+			prev = 0;
+			str++;
+			continue;
+		} else if (*str == '\r') {
+			str++;
+			continue;
+		}
+		
+		/* Kerning against the previous character, proportional fonts only */
+		if (prev) d->x += TM_FONTS_Kern(font, prev, *str);
+		prev = *str;
+		
+		/* Put character to LCD */
+		TM_ILI9341_Putc(d, d->x, d->y, *str++, font, foreground, background);
+	}
+}
+
+#endif
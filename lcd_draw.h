@@ -0,0 +1,510 @@
+// ************ 2D PRIMITIVES **************
+// Lines, rectangles, circles and rounded boxes built from horizontal and
+// vertical spans. Every span is a single lcd_fill2 window, clipped to the
+// panel, so nothing here sets up a window per pixel.
+// -----------------------------------------
+
+#ifndef LCD_DRAW_H
+#define LCD_DRAW_H
+
+#include "lcd_display.h"
+
+/**
+ * @brief  Horizontal span x0..x1 (inclusive, any order) on row y, clipped to the panel
+ */
+void lcd_DrawHLine(LCD_Display_t *d, int x0, int x1, int y, uint16_t color) {
+	if (x0 > x1) { int t = x0; x0 = x1; x1 = t; }
+	if (y < 0 || y >= d->opts.height) return;
+	if (x0 < 0) x0 = 0;
+	if (x1 > d->opts.width-1) x1 = d->opts.width-1;
+	if (x0 > x1) return;
+	lcd_fill2(d, x0, y, x1, y, color);
+}
+
+/**
+ * @brief  Vertical span y0..y1 (inclusive, any order) on column x, clipped to the panel
+ */
+void lcd_DrawVLine(LCD_Display_t *d, int x, int y0, int y1, uint16_t color) {
+	if (y0 > y1) { int t = y0; y0 = y1; y1 = t; }
+	if (x < 0 || x >= d->opts.width) return;
+	if (y0 < 0) y0 = 0;
+	if (y1 > d->opts.height-1) y1 = d->opts.height-1;
+	if (y0 > y1) return;
+	lcd_fill2(d, x, y0, x, y1, color);
+}
+
+/**
+ * @brief  Filled rectangle between two corners (inclusive), clipped to the panel
+ */
+void lcd_FillRect(LCD_Display_t *d, int x0, int y0, int x1, int y1, uint16_t color) {
+	if (x0 > x1) { int t = x0; x0 = x1; x1 = t; }
+	if (y0 > y1) { int t = y0; y0 = y1; y1 = t; }
+	if (x0 < 0) x0 = 0;
+	if (y0 < 0) y0 = 0;
+	if (x1 > d->opts.width-1) x1 = d->opts.width-1;
+	if (y1 > d->opts.height-1) y1 = d->opts.height-1;
+	if (x0 > x1 || y0 > y1) return;
+	lcd_fill2(d, x0, y0, x1, y1, color);
+}
+
+/**
+ * @brief  Draws a line with Bresenham's algorithm
+ * @note   Pixels sharing a row (x-major lines) or a column (y-major lines)
+ *         are sent as one span, so a shallow line costs one window per step
+ *         in its minor axis instead of one per pixel.
+ * @param  *d: Display to draw on
+ * @param  x0, y0: start point
+ * @param  x1, y1: end point
+ * @param  color: line color
+ * @retval None
+ */
+void lcd_DrawLine(LCD_Display_t *d, int x0, int y0, int x1, int y1, uint16_t color) {
+	int dx, dy, err, step, s;
+
+	if (y0 == y1) {
+		lcd_DrawHLine(d, x0, x1, y0, color);
+		return;
+	}
+	if (x0 == x1) {
+		lcd_DrawVLine(d, x0, y0, y1, color);
+		return;
+	}
+
+	dx = abs(x1 - x0);
+	dy = abs(y1 - y0);
+	if (dx >= dy) {
+		if (x0 > x1) { int t = x0; x0 = x1; x1 = t; t = y0; y0 = y1; y1 = t; }
+		step = y0 < y1 ? 1 : -1;
+		err = dx / 2;
+		s = x0;
+		for (int x=x0; x<=x1; x++) {
+			err -= dy;
+			if (err < 0) {
+				lcd_DrawHLine(d, s, x, y0, color);
+				y0 += step;
+				err += dx;
+				s = x + 1;
+			}
+		}
+		if (s <= x1) lcd_DrawHLine(d, s, x1, y0, color);
+	} else {
+		if (y0 > y1) { int t = x0; x0 = x1; x1 = t; t = y0; y0 = y1; y1 = t; }
+		step = x0 < x1 ? 1 : -1;
+		err = dy / 2;
+		s = y0;
+		for (int y=y0; y<=y1; y++) {
+			err -= dx;
+			if (err < 0) {
+				lcd_DrawVLine(d, x0, s, y, color);
+				x0 += step;
+				err += dy;
+				s = y + 1;
+			}
+		}
+		if (s <= y1) lcd_DrawVLine(d, x0, s, y1, color);
+	}
+}
+
+/**
+ * @brief  Rectangle outline between two corners (inclusive)
+ */
+void lcd_DrawRect(LCD_Display_t *d, int x0, int y0, int x1, int y1, uint16_t color) {
+	if (x0 > x1) { int t = x0; x0 = x1; x1 = t; }
+	if (y0 > y1) { int t = y0; y0 = y1; y1 = t; }
+	lcd_DrawHLine(d, x0, x1, y0, color);
+	if (y1 == y0) return;
+	lcd_DrawHLine(d, x0, x1, y1, color);
+	if (y1 - y0 < 2) return;
+	lcd_DrawVLine(d, x0, y0+1, y1-1, color);
+	if (x1 != x0) lcd_DrawVLine(d, x1, y0+1, y1-1, color);
+}
+
+/*
+	Name: lcd_arcs
+	Description: Midpoint circle outline split into four quarters. The left quarters are centred on
+		column xl, the right ones on xr, the top ones on row yt and the bottom ones on yb, so
+		xl == xr and yt == yb is a full circle and anything else the corners of a rounded box.
+		Points of one octant that share a row become a horizontal span, the mirrored
+		octant gets the same run as a vertical span.
+*/
+void lcd_arcs(LCD_Display_t *d, int xl, int xr, int yt, int yb, int r, uint16_t color) {
+	int x = 0, y = r, f = 1 - r;
+	int s = 0;
+
+	while (x <= y) {
+		int cx = x, cy = y;
+
+		x++;
+		if (f < 0) {
+			f += 2*x + 1;
+		} else {
+			y--;
+			f += 2*(x - y) + 1;
+		}
+		if (y == cy && x <= y) continue; // run goes on
+
+		/* run s..cx at distance cy : rows above / below */
+		if (xl == xr && s == 0) {
+			lcd_DrawHLine(d, xl - cx, xr + cx, yt - cy, color);
+			lcd_DrawHLine(d, xl - cx, xr + cx, yb + cy, color);
+		} else {
+			lcd_DrawHLine(d, xl - cx, xl - s, yt - cy, color);
+			lcd_DrawHLine(d, xr + s, xr + cx, yt - cy, color);
+			lcd_DrawHLine(d, xl - cx, xl - s, yb + cy, color);
+			lcd_DrawHLine(d, xr + s, xr + cx, yb + cy, color);
+		}
+		/* same run mirrored : columns left / right */
+		if (yt == yb && s == 0) {
+			lcd_DrawVLine(d, xl - cy, yt - cx, yb + cx, color);
+			lcd_DrawVLine(d, xr + cy, yt - cx, yb + cx, color);
+		} else {
+			lcd_DrawVLine(d, xl - cy, yt - cx, yt - s, color);
+			lcd_DrawVLine(d, xl - cy, yb + s, yb + cx, color);
+			lcd_DrawVLine(d, xr + cy, yt - cx, yt - s, color);
+			lcd_DrawVLine(d, xr + cy, yb + s, yb + cx, color);
+		}
+		s = x;
+	}
+}
+
+/*
+	Name: lcd_fill_arcs
+	Description: Filled halves of a circle as horizontal spans. corners bit 0 fills the rows above yt,
+		bit 1 the rows below yb; each span reaches from xl - a to xr + a.
+*/
+void lcd_fill_arcs(LCD_Display_t *d, int xl, int xr, int yt, int yb, int r, uint8_t corners, uint16_t color) {
+	int f = 1 - r, ddx = 1, ddy = -2 * r;
+	int x = 0, y = r;
+	int px = x, py = y;
+
+	while (x < y) {
+		if (f >= 0) {
+			y--;
+			ddy += 2;
+			f += ddy;
+		}
+		x++;
+		ddx += 2;
+		f += ddx;
+		if (x < (y + 1)) {
+			if (corners & 1) lcd_DrawHLine(d, xl - y, xr + y, yt - x, color);
+			if (corners & 2) lcd_DrawHLine(d, xl - y, xr + y, yb + x, color);
+		}
+		if (y != py) {
+			if (corners & 1) lcd_DrawHLine(d, xl - px, xr + px, yt - py, color);
+			if (corners & 2) lcd_DrawHLine(d, xl - px, xr + px, yb + py, color);
+			py = y;
+		}
+		px = x;
+	}
+}
+
+/**
+ * @brief  Circle outline
+ * @param  *d: Display to draw on
+ * @param  xc, yc: center
+ * @param  r: radius in pixels
+ * @param  color: outline color
+ * @retval None
+ */
+void lcd_DrawCircle(LCD_Display_t *d, int xc, int yc, int r, uint16_t color) {
+	if (r < 0) return;
+	if (r == 0) {
+		lcd_DrawHLine(d, xc, xc, yc, color);
+		return;
+	}
+	lcd_arcs(d, xc, xc, yc, yc, r, color);
+}
+
+/**
+ * @brief  Filled circle, one horizontal span per row
+ * @param  *d: Display to draw on
+ * @param  xc, yc: center
+ * @param  r: radius in pixels
+ * @param  color: fill color
+ * @retval None
+ */
+void lcd_FillCircle(LCD_Display_t *d, int xc, int yc, int r, uint16_t color) {
+	if (r < 0) return;
+	lcd_DrawHLine(d, xc - r, xc + r, yc, color);
+	lcd_fill_arcs(d, xc, xc, yc, yc, r, 3, color);
+}
+
+/**
+ * @brief  Rounded rectangle outline between two corners (inclusive)
+ * @param  r: corner radius, limited to half the shorter side
+ */
+void lcd_DrawRoundRect(LCD_Display_t *d, int x0, int y0, int x1, int y1, int r, uint16_t color) {
+	if (x0 > x1) { int t = x0; x0 = x1; x1 = t; }
+	if (y0 > y1) { int t = y0; y0 = y1; y1 = t; }
+	if (r > (x1 - x0) / 2) r = (x1 - x0) / 2;
+	if (r > (y1 - y0) / 2) r = (y1 - y0) / 2;
+	if (r <= 0) {
+		lcd_DrawRect(d, x0, y0, x1, y1, color);
+		return;
+	}
+
+	if (x1 - x0 > 2*r) {
+		lcd_DrawHLine(d, x0 + r + 1, x1 - r - 1, y0, color);
+		lcd_DrawHLine(d, x0 + r + 1, x1 - r - 1, y1, color);
+	}
+	if (y1 - y0 > 2*r) {
+		lcd_DrawVLine(d, x0, y0 + r + 1, y1 - r - 1, color);
+		lcd_DrawVLine(d, x1, y0 + r + 1, y1 - r - 1, color);
+	}
+	lcd_arcs(d, x0 + r, x1 - r, y0 + r, y1 - r, r, color);
+}
+
+/**
+ * @brief  Filled rounded rectangle between two corners (inclusive)
+ * @note   The straight middle band is one window, each cap row one span.
+ * @param  r: corner radius, limited to half the shorter side
+ */
+void lcd_FillRoundRect(LCD_Display_t *d, int x0, int y0, int x1, int y1, int r, uint16_t color) {
+	if (x0 > x1) { int t = x0; x0 = x1; x1 = t; }
+	if (y0 > y1) { int t = y0; y0 = y1; y1 = t; }
+	if (r > (x1 - x0) / 2) r = (x1 - x0) / 2;
+	if (r > (y1 - y0) / 2) r = (y1 - y0) / 2;
+	if (r <= 0) {
+		lcd_FillRect(d, x0, y0, x1, y1, color);
+		return;
+	}
+
+	lcd_FillRect(d, x0, y0 + r, x1, y1 - r, color);
+	lcd_fill_arcs(d, x0 + r, x1 - r, y0 + r, y1 - r, r, 3, color);
+}
+
+/* **********************************************************************************
+	POLYGONS
+   ********************************************************************************** */
+
+#define LCD_POLY_MAX 64   // most vertices accepted by lcd_poly_spans
+
+typedef struct {
+	int16_t x;
+	int16_t y;
+} LCD_Point_t;
+
+/**
+ * @brief  Span sink for the rasterizer: fill pixels x0..x1 (inclusive) of row y
+ */
+typedef void (*lcd_span_fn)(void *ctx, int x0, int x1, int y);
+
+typedef struct {
+	int ymin, ymax;   /* scanlines y with ymin <= y < ymax */
+	int64_t x;        /* 16.16 x at the center of the current scanline */
+	int64_t dx;       /* 16.16 x step per scanline, int16_t endpoints 65535 apart still fit */
+} lcd_edge_t;
+
+/*
+	Name: lcd_poly_spans
+	Description: Edge table scanline rasterizer (even-odd rule), works for convex, concave and
+		self-intersecting outlines. Pixels are sampled at their centers and edges stepped in
+		16.16 fixed point, so neighbouring polygons sharing an edge never overlap or gap.
+		Each run between an entering and a leaving edge is one call of fn, rows outside
+		0..h-1 are skipped and spans are clipped to 0..w-1.
+	Parameters:
+		1. pts : pointer LCD_Point_t - outline, closed implicitly
+		2. n : int - number of points, 3..LCD_POLY_MAX
+		3. w, h : int - clip size
+		4. fn, ctx : span sink
+	Returns:
+		number of spans emitted, -1 if n is out of range
+*/
+int lcd_poly_spans(const LCD_Point_t *pts, int n, int w, int h, lcd_span_fn fn, void *ctx) {
+	lcd_edge_t et[LCD_POLY_MAX];      /* edge table, sorted by ymin */
+	lcd_edge_t *aet[LCD_POLY_MAX];    /* active edges, sorted by x */
+	int ne = 0, na = 0, next = 0, spans = 0;
+	int ytop = h, ybot = 0;
+
+	if (n < 3 || n > LCD_POLY_MAX) return -1;
+
+	for (int i=0; i<n; i++) {
+		const LCD_Point_t *a = &pts[i];
+		const LCD_Point_t *b = &pts[(i+1) % n];
+		if (a->y == b->y) continue; /* horizontal edges are covered by their neighbours */
+		if (a->y > b->y) { const LCD_Point_t *t = a; a = b; b = t; }
+
+		lcd_edge_t *e = &et[ne];
+		e->ymin = a->y;
+		e->ymax = b->y;
+		e->dx = ((int64_t)(b->x - a->x) << 16) / (b->y - a->y);
+		e->x = ((int64_t)a->x << 16) + e->dx / 2; /* at a->y + 0.5 */
+
+		/* insertion into the edge table, outlines are short */
+		int j = ne++;
+		while (j > 0 && et[j-1].ymin > et[j].ymin) {
+			lcd_edge_t t = et[j-1]; et[j-1] = et[j]; et[j] = t;
+			j--;
+		}
+	}
+	if (ne == 0) return 0;
+
+	for (int i=0; i<ne; i++) {
+		if (et[i].ymin < ytop) ytop = et[i].ymin;
+		if (et[i].ymax > ybot) ybot = et[i].ymax;
+	}
+	if (ytop < 0) ytop = 0;
+	if (ybot > h) ybot = h;
+
+	for (int y=ytop; y<ybot; y++) {
+		/* retire finished edges */
+		for (int i=0; i<na; ) {
+			if (aet[i]->ymax <= y) aet[i] = aet[--na];
+			else i++;
+		}
+		/* activate new ones, catching up edges that start above the clip */
+		while (next < ne && et[next].ymin <= y) {
+			lcd_edge_t *e = &et[next++];
+			if (e->ymax <= y) continue;
+			e->x += e->dx * (y - e->ymin);
+			aet[na++] = e;
+		}
+		/* keep sorted by x, nearly sorted already */
+		for (int i=1; i<na; i++) {
+			lcd_edge_t *e = aet[i];
+			int j = i;
+			while (j > 0 && aet[j-1]->x > e->x) { aet[j] = aet[j-1]; j--; }
+			aet[j] = e;
+		}
+
+		for (int i=0; i+1<na; i+=2) {
+			/* first and last pixel whose centers lie inside [x_in, x_out) */
+			int64_t x0 = (aet[i]->x - 0x8000 + 0xFFFF) >> 16;
+			int64_t x1 = ((aet[i+1]->x - 0x8000 + 0xFFFF) >> 16) - 1;
+			if (x0 < 0) x0 = 0;
+			if (x1 > w-1) x1 = w-1;
+			if (x0 <= x1) {
+				fn(ctx, (int)x0, (int)x1, y);
+				spans++;
+			}
+		}
+
+		for (int i=0; i<na; i++) aet[i]->x += aet[i]->dx;
+	}
+	return spans;
+}
+
+typedef struct {
+	LCD_Display_t *d;
+	uint16_t color;
+} lcd_span_ctx_t;
+
+void lcd_span_display(void *ctx, int x0, int x1, int y) {
+	lcd_span_ctx_t *c = (lcd_span_ctx_t *)ctx;
+	lcd_fill2(c->d, x0, y, x1, y, c->color);
+}
+
+typedef struct {
+	LCD_Buffer_t *b;
+	uint16_t color;
+} lcd_span_buf_t;
+
+void lcd_span_buffer(void *ctx, int x0, int x1, int y) {
+	lcd_span_buf_t *c = (lcd_span_buf_t *)ctx;
+	uint16_t *p = c->b->px + y * c->b->stride;
+	for (int x=x0; x<=x1; x++) p[x] = c->color;
+}
+
+/**
+ * @brief  Filled polygon, one window per span
+ * @param  *d: Display to draw on
+ * @param  *pts: outline points, the last one connects back to the first
+ * @param  n: number of points (3..LCD_POLY_MAX)
+ * @param  color: fill color
+ * @retval number of spans sent
+ */
+int lcd_FillPolygon(LCD_Display_t *d, const LCD_Point_t *pts, int n, uint16_t color) {
+	lcd_span_ctx_t c = { d, color };
+	return lcd_poly_spans(pts, n, d->opts.width, d->opts.height, lcd_span_display, &c);
+}
+
+/**
+ * @brief  Filled polygon into an off-screen buffer, coordinates relative to the buffer
+ */
+int lcd_buffer_FillPolygon(LCD_Buffer_t *b, const LCD_Point_t *pts, int n, uint16_t color) {
+	lcd_span_buf_t c = { b, color };
+	return lcd_poly_spans(pts, n, b->w, b->h, lcd_span_buffer, &c);
+}
+
+/**
+ * @brief  Filled triangle
+ */
+int lcd_FillTriangle(LCD_Display_t *d, int x0, int y0, int x1, int y1, int x2, int y2, uint16_t color) {
+	LCD_Point_t p[3] = { { (int16_t)x0, (int16_t)y0 }, { (int16_t)x1, (int16_t)y1 }, { (int16_t)x2, (int16_t)y2 } };
+	return lcd_FillPolygon(d, p, 3, color);
+}
+
+/**
+ * @brief  Polygon outline, built from lcd_DrawLine spans
+ */
+void lcd_DrawPolygon(LCD_Display_t *d, const LCD_Point_t *pts, int n, uint16_t color) {
+	for (int i=0; i<n; i++) {
+		const LCD_Point_t *a = &pts[i];
+		const LCD_Point_t *b = &pts[(i+1) % n];
+		lcd_DrawLine(d, a->x, a->y, b->x, b->y, color);
+	}
+}
+
+
+/* ************************************************************
+	BUFFER RENDERING : server surfaces (lcd_server.h), strips (lcd_strip.h)
+   ************************************************************ */
+
+/* rectangle (corners in any order) clipped to b, false when nothing is left */
+static inline bool lcd_surface_clip(const LCD_Buffer_t *b, int x0, int y0, int x1, int y1, LCD_Rect_t *out) {
+	LCD_Rect_t s = lcd_rect(0, 0, b->w - 1, b->h - 1);
+	LCD_Rect_t r = lcd_rect(x0 < x1 ? x0 : x1, y0 < y1 ? y0 : y1, x0 < x1 ? x1 : x0, y0 < y1 ? y1 : y0);
+	return lcd_rect_clip(&s, &r, out);
+}
+
+void lcd_surface_fill(LCD_Buffer_t *b, const LCD_Rect_t *r, uint16_t color) {
+	for (int y=r->y0; y<=r->y1; y++) {
+		uint16_t *p = b->px + y*b->stride;
+		for (int x=r->x0; x<=r->x1; x++) p[x] = color;
+	}
+}
+
+/*
+	Name: lcd_surface_text
+	Description: TM_ILI9341_Puts into a buffer: '\n' starts a line below x, characters that do
+		not fit are dropped. The background covers each character cell, proportional fonts
+		are spaced by their advances and kerning.
+	Returns:
+		the touched rectangle in *out, false when nothing was drawn
+*/
+bool lcd_surface_text(LCD_Buffer_t *b, int x, int y, const char *str, const TM_FontDef_t *f, uint32_t fg, uint32_t bg, LCD_Rect_t *out) {
+	int cx = x, cy = y, x1 = x - 1, y1 = y - 1;
+	char prev = 0;
+
+	for (; *str; str++) {
+		if (*str == '\n') {
+			cy += f->FontHeight + 1;
+			cx = x;
+			prev = 0;
+			continue;
+		}
+		if (*str == '\r' || *str < 32 || *str > 126) continue;
+		if (prev) cx += TM_FONTS_Kern(f, prev, *str);
+		prev = *str;
+		int w = TM_FONTS_Advance(f, *str);
+		int left = f->metrics ? f->metrics->left[*str - 32] : 0;
+		LCD_Rect_t c;
+		if (lcd_surface_clip(b, cx, cy, cx + w - 1, cy + f->FontHeight - 1, &c)) {
+			for (int yy=c.y0; yy<=c.y1; yy++) {
+				uint16_t *p = b->px + yy*b->stride;
+				uint32_t bits = f->data[(*str - 32) * f->FontHeight + (yy - cy)];
+				for (int xx=c.x0; xx<=c.x1; xx++) {
+					if ((bits << (xx - cx + left)) & 0x8000) p[xx] = (uint16_t)fg;
+					else if (bg != ILI9341_TRANSPARENT) p[xx] = (uint16_t)bg;
+				}
+			}
+			if (cx + w - 1 > x1) x1 = cx + w - 1;
+			if (cy + f->FontHeight - 1 > y1) y1 = cy + f->FontHeight - 1;
+		}
+		cx += w;
+	}
+	return x1 >= x && y1 >= y && lcd_surface_clip(b, x, y, x1, y1, out);
+}
+
+#endif
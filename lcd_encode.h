@@ -0,0 +1,209 @@
+// ************ KEDEI FRAME ENCODING **************
+// Every 16 bit value goes out as 4 byte frames (0x00, hi, lo, ctl), a pixel
+// as the data pair 0x15 / 0x1F, 8 bytes per RGB565 pixel. lcd_frame encodes
+// one frame, lcd_encode_span whole pixel runs: a byte shuffle done 8 pixels
+// at a time with SSSE3 (chosen at run time) or NEON, scalar elsewhere.
+// Build with -DLCD_ENCODE_SCALAR to force the plain C version.
+// ------------------------------------------------
+
+#ifndef LCD_ENCODE_H
+#define LCD_ENCODE_H
+
+#include <stdint.h>
+#include <string.h>
+
+#if !defined(LCD_ENCODE_SCALAR) && (defined(__x86_64__) || defined(__i386__))
+	#define LCD_ENCODE_SSSE3
+	#include <tmmintrin.h>
+#elif !defined(LCD_ENCODE_SCALAR) && (defined(__ARM_NEON) || defined(__ARM_NEON__)) && \
+	defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+	#define LCD_ENCODE_NEON
+	#include <arm_neon.h>
+#endif
+
+/*
+	Name: lcd_frame
+	Description: Encode one 4 byte KeDei frame (0x00, hi, lo, ctl on the wire) for the given word size.
+		The controller shifts every word MSB first but reads it from memory in host order,
+		so with 16/32 bits per word the bytes are swapped here instead of in the SPI driver.
+	Parameters:
+		1. buff : pointer uint8_t - 4 byte output
+		2. data : uint16_t - command or data value
+		3. ctl : uint8_t - frame control byte (0x11/0x1B command, 0x15/0x1F data, 0x00/0x02 reset)
+		4. bits : uint8_t - bits per word used for the transfer (8, 16 or 32)
+*/
+void lcd_frame(uint8_t *buff, uint16_t data, uint8_t ctl, uint8_t bits) {
+	uint8_t hi = data>>8;
+	uint8_t lo = data&0x00ff;
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+	bits = 8; // memory order is already wire order
+#endif
+	switch (bits) {
+	case 32:
+		buff[0] = ctl;
+		buff[1] = lo;
+		buff[2] = hi;
+		buff[3] = 0;
+		break;
+	case 16:
+		buff[0] = hi;
+		buff[1] = 0;
+		buff[2] = ctl;
+		buff[3] = lo;
+		break;
+	default:
+		buff[0] = 0;
+		buff[1] = hi;
+		buff[2] = lo;
+		buff[3] = ctl;
+		break;
+	}
+}
+
+
+/**
+ * @brief  Where lcd_frame puts things for one word size
+ */
+typedef struct {
+	uint8_t hi, lo;       /*!< byte offsets of the value inside a frame */
+	uint8_t tmpl[8];      /*!< 0x15 / 0x1F frame pair of value 0 */
+} LCD_EncodeLayout_t;
+
+/* probe lcd_frame, so every encoder below agrees with it by construction */
+void lcd_encode_layout(LCD_EncodeLayout_t *l, uint8_t bits) {
+	uint8_t f[4];
+
+	lcd_frame(f, 0x0102, 0x00, bits);
+	for (int i=0; i<4; i++) {
+		if (f[i] == 0x01) l->hi = i;
+		if (f[i] == 0x02) l->lo = i;
+	}
+	lcd_frame(l->tmpl, 0, 0x15, bits);
+	lcd_frame(l->tmpl + 4, 0, 0x1F, bits);
+}
+
+/**
+ * @brief  Reference encoder, one pixel at a time
+ */
+void lcd_encode_span_scalar(uint8_t *out, const uint16_t *px, int n, uint8_t bits) {
+	LCD_EncodeLayout_t l;
+
+	lcd_encode_layout(&l, bits);
+	for (int i=0; i<n; i++, out+=8) {
+		uint8_t hi = px[i] >> 8, lo = px[i] & 0xff;
+		memcpy(out, l.tmpl, 8);
+		out[l.hi] = out[4 + l.hi] = hi;
+		out[l.lo] = out[4 + l.lo] = lo;
+	}
+}
+
+#if defined(LCD_ENCODE_SSSE3)
+/*
+	Name: lcd_encode_span_ssse3
+	Description: 8 pixels (16 bytes) per step, four pshufb each spread two pixels over
+		their four frames, an OR adds the control bytes. Only call if the CPU has SSSE3.
+*/
+__attribute__((target("ssse3")))
+void lcd_encode_span_ssse3(uint8_t *out, const uint16_t *px, int n, uint8_t bits) {
+	LCD_EncodeLayout_t l;
+	uint8_t m[4][16], t[16];
+	__m128i mk[4], tv;
+	int i = 0;
+
+	lcd_encode_layout(&l, bits);
+	for (int k=0; k<4; k++) {
+		for (int b=0; b<16; b++) {
+			int p = 2*k + b/8; // pixel, its low byte is input byte 2p
+			int f = b % 4;     // byte inside the frame
+			m[k][b] = f == l.hi ? 2*p + 1 : f == l.lo ? 2*p : 0x80;
+		}
+		mk[k] = _mm_loadu_si128((const __m128i *)m[k]);
+	}
+	for (int b=0; b<16; b++) t[b] = l.tmpl[b % 8];
+	tv = _mm_loadu_si128((const __m128i *)t);
+
+	for (; i+8 <= n; i+=8) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(px + i));
+		__m128i *o = (__m128i *)(out + i*8);
+		_mm_storeu_si128(o,     _mm_or_si128(_mm_shuffle_epi8(v, mk[0]), tv));
+		_mm_storeu_si128(o + 1, _mm_or_si128(_mm_shuffle_epi8(v, mk[1]), tv));
+		_mm_storeu_si128(o + 2, _mm_or_si128(_mm_shuffle_epi8(v, mk[2]), tv));
+		_mm_storeu_si128(o + 3, _mm_or_si128(_mm_shuffle_epi8(v, mk[3]), tv));
+	}
+	lcd_encode_span_scalar(out + i*8, px + i, n - i, bits);
+}
+#endif
+
+#if defined(LCD_ENCODE_NEON)
+/*
+	Name: lcd_encode_span_neon
+	Description: 8 pixels (16 bytes) per step, one vtbl per pixel builds its frame pair,
+		out of range indices give the zero bytes, an OR adds the control bytes.
+*/
+void lcd_encode_span_neon(uint8_t *out, const uint16_t *px, int n, uint8_t bits) {
+	LCD_EncodeLayout_t l;
+	uint8_t m[8][8];
+	uint8x8_t mk[8], tv;
+	int i = 0;
+
+	lcd_encode_layout(&l, bits);
+	for (int p=0; p<8; p++) {
+		for (int b=0; b<8; b++) {
+			int f = b % 4;
+			m[p][b] = f == l.hi ? 2*p + 1 : f == l.lo ? 2*p : 0xff;
+		}
+		mk[p] = vld1_u8(m[p]);
+	}
+	tv = vld1_u8(l.tmpl);
+
+	for (; i+8 <= n; i+=8) {
+		uint8x16_t v = vld1q_u8((const uint8_t *)(px + i));
+		uint8x8x2_t tab;
+		tab.val[0] = vget_low_u8(v);
+		tab.val[1] = vget_high_u8(v);
+		for (int p=0; p<8; p++) {
+			vst1_u8(out + i*8 + p*8, vorr_u8(vtbl2_u8(tab, mk[p]), tv));
+		}
+	}
+	lcd_encode_span_scalar(out + i*8, px + i, n - i, bits);
+}
+#endif
+
+/**
+ * @brief  Name of the encoder lcd_encode_span uses on this machine
+ */
+const char *lcd_encode_impl(void) {
+#if defined(LCD_ENCODE_SSSE3)
+	static const bool ssse3 = __builtin_cpu_supports("ssse3");
+	if (ssse3) return "ssse3";
+#elif defined(LCD_ENCODE_NEON)
+	return "neon";
+#endif
+	return "scalar";
+}
+
+/*
+	Name: lcd_encode_span
+	Description: Encode n RGB565 pixels as data frame pairs, the bulk form of lcd_data.
+	Parameters:
+		1. out : pointer uint8_t - n * 8 bytes of output
+		2. px : pointer uint16_t - pixels, no alignment needed
+		3. n : int - pixel count
+		4. bits : uint8_t - bits per word of the transfer, as lcd_frame
+*/
+void lcd_encode_span(uint8_t *out, const uint16_t *px, int n, uint8_t bits) {
+#if defined(LCD_ENCODE_SSSE3)
+	static const bool ssse3 = __builtin_cpu_supports("ssse3");
+	if (ssse3) {
+		lcd_encode_span_ssse3(out, px, n, bits);
+		return;
+	}
+#elif defined(LCD_ENCODE_NEON)
+	lcd_encode_span_neon(out, px, n, bits);
+	return;
+#endif
+	lcd_encode_span_scalar(out, px, n, bits);
+}
+
+#endif
@@ -0,0 +1,134 @@
+// ************ PROPORTIONAL FONTS **************
+// The TM bitmap fonts center narrow glyphs in a fixed cell, so "il1" takes as
+// much of a 480 pixel line as "MWM". lcd_font_proportional derives per
+// character metrics from the glyph ink (empty columns at the left are
+// skipped, the advance is the ink width plus one pixel) and attaches optional
+// kerning pairs; everything that draws or measures text with the resulting
+// font spaces it that way. String sizes can be kept in an LCD_FontCache_t
+// keyed by font and string hash, so layouts measuring the same labels every
+// frame do not walk the glyph tables again.
+// ----------------------------------------------
+
+#ifndef LCD_FONT_H
+#define LCD_FONT_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include "tm_stm32f4_fonts.h"
+
+#define LCD_FONT_CACHE 64   // string sizes kept per cache, a power of two
+
+/* classic pairs that look loose in the TM fonts, sorted; one pixel closer */
+static const TM_FontKern_t lcd_font_kern_default[] = {
+	{ 'A', 'T', -1 }, { 'A', 'V', -1 }, { 'A', 'W', -1 }, { 'A', 'Y', -1 }, { 'F', 'a', -1 },
+	{ 'F', 'o', -1 }, { 'L', 'T', -1 }, { 'L', 'V', -1 }, { 'L', 'Y', -1 }, { 'P', 'a', -1 },
+	{ 'T', 'a', -1 }, { 'T', 'e', -1 }, { 'T', 'o', -1 }, { 'V', 'A', -1 }, { 'V', 'a', -1 },
+	{ 'V', 'e', -1 }, { 'V', 'o', -1 }, { 'W', 'A', -1 }, { 'Y', 'A', -1 }, { 'Y', 'a', -1 },
+	{ 'Y', 'o', -1 }, { 'r', ',', -1 }, { 'r', '.', -1 }
+};
+#define LCD_FONT_KERN_DEFAULT (sizeof(lcd_font_kern_default) / sizeof(lcd_font_kern_default[0]))
+
+/*
+	Name: lcd_font_proportional
+	Description: Proportional variant of a monospaced TM font. Each glyph keeps its bitmap; its
+		empty columns at the left are skipped and its advance is the ink width plus one
+		pixel of spacing. The space gets about a third of the cell.
+	Parameters:
+		1. mono : pointer TM_FontDef_t - font to measure
+		2. m : pointer TM_FontMetrics_t - filled, must live as long as out
+		3. kern, kerns : pairs sorted by left then right character, NULL / 0 - none; referenced
+		4. out : pointer TM_FontDef_t - the proportional font, same bitmaps as mono
+	Returns:
+		0 - on success, -1 - kerning pairs not sorted
+*/
+int lcd_font_proportional(const TM_FontDef_t *mono, TM_FontMetrics_t *m, const TM_FontKern_t *kern, int kerns, TM_FontDef_t *out) {
+	for (int i=1; i<kerns; i++) {
+		const TM_FontKern_t *a = &kern[i-1], *b = &kern[i];
+		if ((uint8_t)a->left > (uint8_t)b->left || (a->left == b->left && (uint8_t)a->right >= (uint8_t)b->right)) return -1;
+	}
+
+	memset(m, 0, sizeof(*m));
+	for (int c=0; c<95; c++) {
+		uint16_t ink = 0;
+		for (int i=0; i<mono->FontHeight; i++) ink |= mono->data[c * mono->FontHeight + i];
+		ink &= (uint16_t)(0xFFFF << (16 - mono->FontWidth));
+		if (!ink) { // space and blanks
+			m->advance[c] = (uint8_t)((mono->FontWidth + 2) / 3);
+			continue;
+		}
+		int first = __builtin_clz((uint32_t)ink << 16);
+		int last = 15 - __builtin_ctz(ink);
+		m->left[c] = (uint8_t)first;
+		m->advance[c] = (uint8_t)(last - first + 2);
+	}
+	m->kern = kern;
+	m->kerns = (uint16_t)kerns;
+
+	*out = *mono;
+	out->metrics = m;
+	return 0;
+}
+
+/**
+ * @brief  Size of one string
+ */
+typedef struct {
+	const TM_FontDef_t *font;
+	uint64_t hash;            /*!< lcd_font_hash of the string, 0 - slot empty */
+	TM_FONTS_SIZE_t size;
+} LCD_FontCacheEntry_t;
+
+/**
+ * @brief  String sizes, direct mapped by hash; zero it (or lcd_font_cache_clear) before use
+ */
+typedef struct {
+	LCD_FontCacheEntry_t e[LCD_FONT_CACHE];
+	uint32_t hits;
+	uint32_t misses;
+} LCD_FontCache_t;
+
+/**
+ * @brief  FNV-1a of a string, never 0; callers that keep it next to a label skip the rehash
+ */
+static inline uint64_t lcd_font_hash(const char *str) {
+	uint64_t h = 0xcbf29ce484222325ull;
+	for (; *str; str++) h = (h ^ (uint8_t)*str) * 0x100000001b3ull;
+	return h ? h : 1;
+}
+
+/**
+ * @brief  Forget every size, after changing the metrics of a font in use
+ */
+void lcd_font_cache_clear(LCD_FontCache_t *c) {
+	memset(c, 0, sizeof(*c));
+}
+
+/*
+	Name: lcd_font_size_hashed
+	Description: TM_FONTS_GetStringSize through the cache, for a string whose lcd_font_hash is
+		already known. Sizes are taken on trust by (font, hash): two strings colliding in 64
+		bits would share one.
+*/
+TM_FONTS_SIZE_t lcd_font_size_hashed(LCD_FontCache_t *c, const char *str, uint64_t hash, const TM_FontDef_t *f) {
+	LCD_FontCacheEntry_t *e = &c->e[(hash ^ hash >> 32) & (LCD_FONT_CACHE - 1)];
+
+	if (e->hash == hash && e->font == f) {
+		c->hits++;
+		return e->size;
+	}
+	c->misses++;
+	TM_FONTS_GetStringSize((char *)str, &e->size, (TM_FontDef_t *)f);
+	e->hash = hash;
+	e->font = f;
+	return e->size;
+}
+
+/**
+ * @brief  TM_FONTS_GetStringSize through the cache
+ */
+TM_FONTS_SIZE_t lcd_font_size(LCD_FontCache_t *c, const char *str, const TM_FontDef_t *f) {
+	return lcd_font_size_hashed(c, str, lcd_font_hash(str), f);
+}
+
+#endif
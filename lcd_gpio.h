@@ -0,0 +1,471 @@
+// ************ GPIO BIT-BANG TRANSPORT **************
+// Drives SCK / MOSI / CS from userspace for boards where spidev is missing
+// or the controller is claimed by something else. The word loops are the
+// bitbang_txrx_be_cpha0/cpha1 loops of TFT3_5drv/spi-bitbang-txrx.h turned
+// into templates: backend, SPI mode, flags and bits per word are template
+// parameters, so each loop unrolls into straight register writes.
+// Backends: BCM283x registers (/dev/gpiomem, Raspberry Pi), Allwinner PIO
+// (/dev/mem, Orange Pi), the gpiochip character device (any board, one
+// ioctl per edge) and a mock that decodes what it is sent, for testing.
+// ---------------------------------------------------
+
+#ifndef LCD_GPIO_H
+#define LCD_GPIO_H
+
+#include <sys/mman.h>
+#include <linux/gpio.h>
+
+#include "lcd_display.h"
+
+/* same meaning as SPI_MASTER_NO_TX / SPI_MASTER_NO_RX of the kernel header */
+#define LCD_GPIO_NO_TX 0x01
+#define LCD_GPIO_NO_RX 0x02
+
+#define GPIO_BCM_DEVICE   "/dev/gpiomem"
+#define GPIO_SUNXI_DEVICE "/dev/mem"
+#define GPIO_SUNXI_PIO    0x01C20800  // H3 / H5 PIO block
+#define GPIO_SUNXI_PORT_C 2
+
+/**
+ * @brief  Pin numbers of one bit-banged bus, miso < 0 when not wired (the KeDei is write only)
+ */
+typedef struct {
+	int sck;
+	int mosi;
+	int cs;
+	int miso;
+} GPIO_Pins_t;
+
+static const GPIO_Pins_t gpio_pins_bcm = { 11, 10, 8, 9 };   // SPI0 header pins: SCLK, MOSI, CE0, MISO
+static const GPIO_Pins_t gpio_pins_sunxi = { 2, 0, 3, 1 };   // PC2, PC0, PC3, PC1 on the SPI0 header pins
+
+/* busy wait, the clock half period; 0 - run as fast as the CPU writes the pins */
+static inline void spidelay(unsigned nsecs) {
+	struct timespec a, b;
+
+	if (!nsecs) return;
+	clock_gettime(CLOCK_MONOTONIC, &a);
+	do {
+		clock_gettime(CLOCK_MONOTONIC, &b);
+	} while ((b.tv_sec - a.tv_sec) * 1000000000L + (b.tv_nsec - a.tv_nsec) < (long)nsecs);
+}
+
+
+/* ************************************************************
+	WORD LOOPS (spi-bitbang-txrx.h)
+   ************************************************************ */
+
+template <class G, unsigned CPOL, unsigned FLAGS, unsigned BITS>
+static inline uint32_t bitbang_txrx_be_cpha0(G *g, unsigned nsecs, uint32_t word) {
+	static_assert(BITS >= 1 && BITS <= 32, "1..32 bits per word");
+	/* if (CPOL == 0) this is SPI_MODE_0; else this is SPI_MODE_2 */
+
+	/* clock starts at inactive polarity */
+	word <<= (32 - BITS);
+	#pragma GCC unroll 32
+	for (unsigned bits = BITS; bits; bits--) {
+
+		/* setup MSB (to slave) on trailing edge */
+		if ((FLAGS & LCD_GPIO_NO_TX) == 0)
+			setmosi(g, word & (1u << 31));
+		spidelay(nsecs);	/* T(setup) */
+
+		setsck(g, !CPOL);
+		spidelay(nsecs);
+
+		/* sample MSB (from slave) on leading edge */
+		word <<= 1;
+		if ((FLAGS & LCD_GPIO_NO_RX) == 0)
+			word |= getmiso(g);
+		setsck(g, CPOL);
+	}
+	return word;
+}
+
+template <class G, unsigned CPOL, unsigned FLAGS, unsigned BITS>
+static inline uint32_t bitbang_txrx_be_cpha1(G *g, unsigned nsecs, uint32_t word) {
+	static_assert(BITS >= 1 && BITS <= 32, "1..32 bits per word");
+	/* if (CPOL == 0) this is SPI_MODE_1; else this is SPI_MODE_3 */
+
+	/* clock starts at inactive polarity */
+	word <<= (32 - BITS);
+	#pragma GCC unroll 32
+	for (unsigned bits = BITS; bits; bits--) {
+
+		/* setup MSB (to slave) on leading edge */
+		setsck(g, !CPOL);
+		if ((FLAGS & LCD_GPIO_NO_TX) == 0)
+			setmosi(g, word & (1u << 31));
+		spidelay(nsecs); /* T(setup) */
+
+		setsck(g, CPOL);
+		spidelay(nsecs);
+
+		/* sample MSB (from slave) on trailing edge */
+		word <<= 1;
+		if ((FLAGS & LCD_GPIO_NO_RX) == 0)
+			word |= getmiso(g);
+	}
+	return word;
+}
+
+template <class G, unsigned MODE, unsigned FLAGS, unsigned BITS>
+static inline uint32_t bitbang_txrx_word(G *g, unsigned nsecs, uint32_t word) {
+	if (MODE & SPI_CPHA) return bitbang_txrx_be_cpha1<G, (MODE & SPI_CPOL) ? 1 : 0, FLAGS, BITS>(g, nsecs, word);
+	return bitbang_txrx_be_cpha0<G, (MODE & SPI_CPOL) ? 1 : 0, FLAGS, BITS>(g, nsecs, word);
+}
+
+/*
+	Name: bitbang_rows
+	Description: Send rows of 4 byte KeDei frames (8 bit order, see lcd_frame), chip select
+		asserted around every frame like the cs_change transfers of spi_transmit_rows.
+		A frame is 32 / BITS words, MSB first; the bits on the wire are the same for any BITS,
+		32 just runs one unrolled loop per frame.
+	Returns:
+		bytes sent, -3 - row_len not a multiple of 4
+*/
+template <class G, unsigned MODE, unsigned BITS>
+int bitbang_rows(G *g, const uint8_t *data, int row_len, int rows, int stride) {
+	static_assert(BITS == 8 || BITS == 16 || BITS == 32, "words must divide a frame");
+	const int step = BITS / 8;
+
+	if (row_len % 4) return -3;
+	for (int j=0; j<rows; j++) {
+		const uint8_t *f = data + (size_t)j*stride;
+		for (int off=0; off<row_len; off+=4, f+=4) {
+			setcs(g, 1);
+			for (int k=0; k<4; k+=step) {
+				uint32_t w = f[k];
+				if (BITS >= 16) w = w << 8 | f[k+1];
+				if (BITS == 32) w = w << 16 | f[k+2] << 8 | f[k+3];
+				bitbang_txrx_word<G, MODE, LCD_GPIO_NO_RX, BITS>(g, g->nsecs, w);
+			}
+			setcs(g, 0);
+		}
+	}
+	return row_len * rows;
+}
+
+
+/* ************************************************************
+	BCM283x (Raspberry Pi) : GPSET0 / GPCLR0 through /dev/gpiomem
+   ************************************************************ */
+
+typedef struct {
+	volatile uint32_t *reg;   /*!< GPIO block, mapped */
+	uint32_t sck, mosi, cs;   /*!< pin masks */
+	int miso;                 /*!< pin, < 0 - not wired */
+	unsigned nsecs;           /*!< half clock period, 0 - full speed */
+} GPIO_Bcm_t;
+
+#define GPIO_BCM_GPSET0 7
+#define GPIO_BCM_GPCLR0 10
+#define GPIO_BCM_GPLEV0 13
+
+static inline void setsck(GPIO_Bcm_t *g, int on) { g->reg[on ? GPIO_BCM_GPSET0 : GPIO_BCM_GPCLR0] = g->sck; }
+static inline void setmosi(GPIO_Bcm_t *g, int on) { g->reg[on ? GPIO_BCM_GPSET0 : GPIO_BCM_GPCLR0] = g->mosi; }
+static inline void setcs(GPIO_Bcm_t *g, int on) { g->reg[on ? GPIO_BCM_GPCLR0 : GPIO_BCM_GPSET0] = g->cs; } // active low
+static inline int getmiso(GPIO_Bcm_t *g) { return g->miso < 0 ? 0 : (g->reg[GPIO_BCM_GPLEV0] >> g->miso) & 1; }
+
+/* function select: 0 - input, 1 - output */
+void gpio_bcm_fsel(GPIO_Bcm_t *g, int pin, uint32_t f) {
+	volatile uint32_t *r = &g->reg[pin / 10];
+	*r = (*r & ~(7u << (pin % 10 * 3))) | f << (pin % 10 * 3);
+}
+
+/*
+	Name: gpio_bcm_open
+	Description: Map the GPIO block and make SCK, MOSI and CS outputs (MISO an input).
+		The pins must not be in their SPI function, i.e. spidev disabled for them.
+	Returns:
+		0 - on success, -1 - cannot open /dev/gpiomem, -2 - mmap failed, -3 - pin above 31
+*/
+int gpio_bcm_open(GPIO_Bcm_t *g, const GPIO_Pins_t *p, unsigned nsecs) {
+	int fd;
+	void *m;
+
+	if (p->sck > 31 || p->mosi > 31 || p->cs > 31 || p->miso > 31) return -3;
+	fd = open(GPIO_BCM_DEVICE, O_RDWR | O_SYNC);
+	if (fd < 0) return -1;
+	m = mmap(NULL, 4096, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (m == MAP_FAILED) return -2;
+
+	g->reg = (volatile uint32_t *)m;
+	g->sck = 1u << p->sck;
+	g->mosi = 1u << p->mosi;
+	g->cs = 1u << p->cs;
+	g->miso = p->miso;
+	g->nsecs = nsecs;
+	setcs(g, 0);
+	setsck(g, 0);
+	gpio_bcm_fsel(g, p->sck, 1);
+	gpio_bcm_fsel(g, p->mosi, 1);
+	gpio_bcm_fsel(g, p->cs, 1);
+	if (p->miso >= 0) gpio_bcm_fsel(g, p->miso, 0);
+	return 0;
+}
+
+int gpio_close(GPIO_Bcm_t *g) {
+	if (!g->reg) return 0;
+	munmap((void *)g->reg, 4096);
+	g->reg = NULL;
+	return 0;
+}
+
+
+/* ************************************************************
+	ALLWINNER PIO (Orange Pi) : port data register through /dev/mem
+   ************************************************************ */
+
+/**
+ * @note  The port has no set / clear registers. The data register is written from a copy,
+ *        so other pins of the port must not be changed by anyone else while it is open.
+ */
+typedef struct {
+	void *map;                /*!< mapped pages */
+	volatile uint32_t *port;  /*!< CFG0..3, DAT of the port */
+	uint32_t dat;             /*!< copy of DAT */
+	uint32_t sck, mosi, cs;   /*!< pin masks */
+	int miso;                 /*!< pin, < 0 - not wired */
+	unsigned nsecs;           /*!< half clock period, 0 - full speed */
+} GPIO_Sunxi_t;
+
+#define GPIO_SUNXI_DAT 4
+
+static inline void setsck(GPIO_Sunxi_t *g, int on) { g->port[GPIO_SUNXI_DAT] = g->dat = on ? g->dat | g->sck : g->dat & ~g->sck; }
+static inline void setmosi(GPIO_Sunxi_t *g, int on) { g->port[GPIO_SUNXI_DAT] = g->dat = on ? g->dat | g->mosi : g->dat & ~g->mosi; }
+static inline void setcs(GPIO_Sunxi_t *g, int on) { g->port[GPIO_SUNXI_DAT] = g->dat = on ? g->dat & ~g->cs : g->dat | g->cs; } // active low
+static inline int getmiso(GPIO_Sunxi_t *g) { return g->miso < 0 ? 0 : (g->port[GPIO_SUNXI_DAT] >> g->miso) & 1; }
+
+/* pin function: 0 - input, 1 - output */
+void gpio_sunxi_cfg(GPIO_Sunxi_t *g, int pin, uint32_t f) {
+	volatile uint32_t *r = &g->port[pin / 8];
+	*r = (*r & ~(7u << (pin % 8 * 4))) | f << (pin % 8 * 4);
+}
+
+/*
+	Name: gpio_sunxi_open
+	Description: Map the PIO block (needs root) and make SCK, MOSI and CS of port outputs.
+	Parameters:
+		1. g : pointer GPIO_Sunxi_t - backend to set up
+		2. port : int - 0 for PA, 2 for PC (GPIO_SUNXI_PORT_C, the SPI0 pins) ...
+		3. p : pointer GPIO_Pins_t - pin numbers within the port, e.g. gpio_pins_sunxi
+		4. nsecs : unsigned - half clock period, 0 - full speed
+	Returns:
+		0 - on success, -1 - cannot open /dev/mem, -2 - mmap failed
+*/
+int gpio_sunxi_open(GPIO_Sunxi_t *g, int port, const GPIO_Pins_t *p, unsigned nsecs) {
+	const long page = sysconf(_SC_PAGESIZE);
+	const off_t base = GPIO_SUNXI_PIO & ~(page - 1);
+	int fd;
+	void *m;
+
+	fd = open(GPIO_SUNXI_DEVICE, O_RDWR | O_SYNC);
+	if (fd < 0) return -1;
+	m = mmap(NULL, page, PROT_READ | PROT_WRITE, MAP_SHARED, fd, base);
+	close(fd);
+	if (m == MAP_FAILED) return -2;
+
+	g->map = m;
+	g->port = (volatile uint32_t *)((uint8_t *)m + (GPIO_SUNXI_PIO - base) + port * 0x24);
+	g->dat = g->port[GPIO_SUNXI_DAT];
+	g->sck = 1u << p->sck;
+	g->mosi = 1u << p->mosi;
+	g->cs = 1u << p->cs;
+	g->miso = p->miso;
+	g->nsecs = nsecs;
+	setcs(g, 0);
+	setsck(g, 0);
+	gpio_sunxi_cfg(g, p->sck, 1);
+	gpio_sunxi_cfg(g, p->mosi, 1);
+	gpio_sunxi_cfg(g, p->cs, 1);
+	if (p->miso >= 0) gpio_sunxi_cfg(g, p->miso, 0);
+	return 0;
+}
+
+int gpio_close(GPIO_Sunxi_t *g) {
+	if (!g->map) return 0;
+	munmap(g->map, sysconf(_SC_PAGESIZE));
+	g->map = NULL;
+	return 0;
+}
+
+
+/* ************************************************************
+	GPIO CHARACTER DEVICE : /dev/gpiochipN, any board
+   ************************************************************ */
+
+typedef struct {
+	int fd;                   /*!< line request, 0 when closed */
+	uint64_t bits;            /*!< current output values, line i is bit i */
+	unsigned nsecs;           /*!< half clock period, 0 - full speed */
+} GPIO_Chip_t;
+
+/* lines in the request */
+#define GPIO_CHIP_SCK  0
+#define GPIO_CHIP_MOSI 1
+#define GPIO_CHIP_CS   2
+#define GPIO_CHIP_MISO 3
+
+static inline void gpio_chip_set(GPIO_Chip_t *g, int line, int on) {
+	struct gpio_v2_line_values v;
+	g->bits = on ? g->bits | 1u << line : g->bits & ~(1u << line);
+	v.bits = g->bits;
+	v.mask = 1u << line;
+	ioctl(g->fd, GPIO_V2_LINE_SET_VALUES_IOCTL, &v);
+}
+
+static inline void setsck(GPIO_Chip_t *g, int on) { gpio_chip_set(g, GPIO_CHIP_SCK, on); }
+static inline void setmosi(GPIO_Chip_t *g, int on) { gpio_chip_set(g, GPIO_CHIP_MOSI, on); }
+static inline void setcs(GPIO_Chip_t *g, int on) { gpio_chip_set(g, GPIO_CHIP_CS, !on); } // active low
+static inline int getmiso(GPIO_Chip_t *g) {
+	struct gpio_v2_line_values v;
+	v.bits = 0;
+	v.mask = 1u << GPIO_CHIP_MISO;
+	if (ioctl(g->fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &v) < 0) return 0;
+	return (v.bits >> GPIO_CHIP_MISO) & 1;
+}
+
+/*
+	Name: gpio_chip_open
+	Description: Request SCK, MOSI, CS (and MISO when wired) from a gpiochip as one line request.
+		Portable, but every edge is an ioctl: expect well under 1 MHz.
+	Parameters:
+		1. g : pointer GPIO_Chip_t - backend to set up
+		2. chip : string - e.g. "/dev/gpiochip0"
+		3. p : pointer GPIO_Pins_t - line offsets on that chip
+		4. nsecs : unsigned - half clock period, 0 - full speed
+	Returns:
+		0 - on success, -1 - cannot open chip, -2 - lines busy or invalid
+*/
+int gpio_chip_open(GPIO_Chip_t *g, std::string chip, const GPIO_Pins_t *p, unsigned nsecs) {
+	struct gpio_v2_line_request req;
+	int fd, r;
+
+	fd = open(chip.c_str(), O_RDWR);
+	if (fd < 0) return -1;
+	memset(&req, 0, sizeof(req));
+	req.offsets[GPIO_CHIP_SCK] = p->sck;
+	req.offsets[GPIO_CHIP_MOSI] = p->mosi;
+	req.offsets[GPIO_CHIP_CS] = p->cs;
+	req.num_lines = 3;
+	strncpy(req.consumer, "kedei-lcd", sizeof(req.consumer) - 1);
+	req.config.flags = GPIO_V2_LINE_FLAG_OUTPUT;
+	req.config.attrs[0].attr.id = GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES;
+	req.config.attrs[0].attr.values = 1u << GPIO_CHIP_CS; // chip select inactive, clock low
+	req.config.attrs[0].mask = 7;
+	req.config.num_attrs = 1;
+	if (p->miso >= 0) {
+		req.offsets[GPIO_CHIP_MISO] = p->miso;
+		req.num_lines = 4;
+		req.config.attrs[1].attr.id = GPIO_V2_LINE_ATTR_ID_FLAGS;
+		req.config.attrs[1].attr.flags = GPIO_V2_LINE_FLAG_INPUT;
+		req.config.attrs[1].mask = 1u << GPIO_CHIP_MISO;
+		req.config.num_attrs = 2;
+	}
+	r = ioctl(fd, GPIO_V2_GET_LINE_IOCTL, &req);
+	close(fd);
+	if (r < 0) return -2;
+
+	g->fd = req.fd;
+	g->bits = 1u << GPIO_CHIP_CS;
+	g->nsecs = nsecs;
+	return 0;
+}
+
+int gpio_close(GPIO_Chip_t *g) {
+	if (g->fd <= 0) return 0;
+	close(g->fd);
+	g->fd = 0;
+	return 0;
+}
+
+
+/* ************************************************************
+	MOCK : decodes the pin activity like an SPI slave would
+   ************************************************************ */
+
+typedef struct {
+	uint8_t mode;             /*!< SPI mode to sample with */
+	int sck, mosi, cs;        /*!< pin levels, cs 1 - asserted */
+	int miso;                 /*!< level returned by getmiso */
+	uint32_t shift;           /*!< bits of the byte being received */
+	int nbits;                /*!< bits received in this chip select cycle */
+	uint8_t *out;             /*!< received bytes are stored here up to cap, may be NULL */
+	size_t cap, len;          /*!< out size, bytes received in total */
+	uint64_t hash;            /*!< FNV-1a of every byte received */
+	uint32_t frames;          /*!< chip select cycles */
+	uint32_t bad;             /*!< cycles that ended in the middle of a byte */
+	uint64_t writes;          /*!< pin writes, what a register backend would do */
+	unsigned nsecs;
+} GPIO_Mock_t;
+
+void gpio_mock_init(GPIO_Mock_t *g, uint8_t mode, uint8_t *out, size_t cap) {
+	memset(g, 0, sizeof(*g));
+	g->mode = mode;
+	g->sck = (mode & SPI_CPOL) ? 1 : 0;
+	g->out = out;
+	g->cap = cap;
+	g->hash = 1469598103934665603ULL;
+}
+
+static inline void setsck(GPIO_Mock_t *g, int on) {
+	on = on ? 1 : 0;
+	g->writes++;
+	if (on == g->sck) return;
+	g->sck = on;
+	bool leading = on != ((g->mode & SPI_CPOL) ? 1 : 0);
+	if (!g->cs || leading == ((g->mode & SPI_CPHA) != 0)) return; // not the sampling edge
+	g->shift = g->shift << 1 | g->mosi;
+	if (++g->nbits % 8 == 0) {
+		uint8_t b = (uint8_t)g->shift;
+		if (g->len < g->cap) g->out[g->len] = b;
+		g->len++;
+		g->hash = (g->hash ^ b) * 1099511628211ULL;
+	}
+}
+
+static inline void setmosi(GPIO_Mock_t *g, int on) { g->writes++; g->mosi = on ? 1 : 0; }
+static inline int getmiso(GPIO_Mock_t *g) { return g->miso; }
+
+static inline void setcs(GPIO_Mock_t *g, int on) {
+	g->writes++;
+	if (g->cs && !on) {
+		g->frames++;
+		if (g->nbits % 8) g->bad++;
+	}
+	g->cs = on ? 1 : 0;
+	g->nbits = 0;
+}
+
+int gpio_close(GPIO_Mock_t *g) {
+	(void)g;
+	return 0;
+}
+
+
+/* ************************************************************
+	LCD TRANSPORT
+   ************************************************************ */
+
+template <class G, unsigned MODE, unsigned BITS>
+int lcd_gpio_rows(void *ctx, const uint8_t *data, int row_len, int rows, int stride) {
+	return bitbang_rows<G, MODE, BITS>((G *)ctx, data, row_len, rows, stride);
+}
+
+template <class G>
+int lcd_gpio_close(void *ctx) {
+	return gpio_close((G *)ctx);
+}
+
+/**
+ * @brief  Transport for lcd_open_transport sending through backend G, ctx is the opened G
+ */
+template <class G, unsigned MODE = LCD_SPI_MODE, unsigned BITS = 32>
+const LCD_Transport_t *lcd_gpio_transport(void) {
+	static const LCD_Transport_t t = { lcd_gpio_rows<G, MODE, BITS>, lcd_gpio_close<G> };
+	return &t;
+}
+
+#endif
@@ -0,0 +1,92 @@
+// ************ LATENCY HISTOGRAM **************
+// Fixed size log-linear histogram of microsecond values: exact below 16 us,
+// then 8 buckets per power of two (within 12.5%) up to 2^32 us. 1 KB and no
+// allocation; recording is a few shifts and one counter increment. The
+// buckets do not care about the unit, lcd_stats.h records nanoseconds.
+// ---------------------------------------------
+
+#ifndef LCD_HIST_H
+#define LCD_HIST_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define LCD_HIST_LINEAR  16                              // exact buckets 0..15 us
+#define LCD_HIST_SUB     8                               // buckets per power of two above
+#define LCD_HIST_BUCKETS (LCD_HIST_LINEAR + 28 * LCD_HIST_SUB) // 2^4 .. 2^32 us
+
+/**
+ * @brief  Histogram of durations in us
+ * @note   One thread records into it; readers on other threads see
+ *         approximate values while it is being written.
+ */
+typedef struct {
+	uint32_t n[LCD_HIST_BUCKETS];
+	uint32_t count;
+	uint32_t max;
+	uint64_t sum;
+} LCD_Hist_t;
+
+static inline int lcd_hist_bucket(uint32_t us) {
+	if (us < LCD_HIST_LINEAR) return us;
+	int e = 31 - __builtin_clz(us); // 4..31
+	return LCD_HIST_LINEAR + (e - 4) * LCD_HIST_SUB + ((us >> (e - 3)) & (LCD_HIST_SUB - 1));
+}
+
+/* smallest value that lands in bucket b */
+static inline uint32_t lcd_hist_lower(int b) {
+	if (b < LCD_HIST_LINEAR) return b;
+	int e = (b - LCD_HIST_LINEAR) / LCD_HIST_SUB + 4;
+	return (uint32_t)(LCD_HIST_SUB + (b - LCD_HIST_LINEAR) % LCD_HIST_SUB) << (e - 3);
+}
+
+void lcd_hist_reset(LCD_Hist_t *h) {
+	memset(h, 0, sizeof(*h));
+}
+
+static inline void lcd_hist_add(LCD_Hist_t *h, uint32_t us) {
+	h->n[lcd_hist_bucket(us)]++;
+	h->count++;
+	h->sum += us;
+	if (us > h->max) h->max = us;
+}
+
+/**
+ * @brief  Add the counts of src to dst
+ */
+void lcd_hist_merge(LCD_Hist_t *dst, const LCD_Hist_t *src) {
+	for (int b=0; b<LCD_HIST_BUCKETS; b++) dst->n[b] += src->n[b];
+	dst->count += src->count;
+	dst->sum += src->sum;
+	if (src->max > dst->max) dst->max = src->max;
+}
+
+/*
+	Name: lcd_hist_quantile
+	Description: Value below which a fraction q of the recorded durations lie, e.g. 0.5 or 0.99.
+		Reported as the lower edge of its bucket, so within 12.5% below the true value.
+	Returns:
+		us, 0 for an empty histogram
+*/
+uint32_t lcd_hist_quantile(const LCD_Hist_t *h, double q) {
+	uint64_t rank = (uint64_t)(q * h->count + 0.5);
+	uint64_t seen = 0;
+
+	if (h->count == 0) return 0;
+	if (rank < 1) rank = 1;
+	if (rank >= h->count) return h->max;
+	for (int b=0; b<LCD_HIST_BUCKETS; b++) {
+		seen += h->n[b];
+		if (seen >= rank) return lcd_hist_lower(b);
+	}
+	return h->max;
+}
+
+/**
+ * @brief  Mean in us, 0 for an empty histogram
+ */
+double lcd_hist_mean(const LCD_Hist_t *h) {
+	return h->count ? (double)h->sum / h->count : 0;
+}
+
+#endif
@@ -0,0 +1,331 @@
+// ************ MULTI-LANE BIT-BANG **************
+// Several panels on one GPIO bank: SCK and CS wired to all of them, a MOSI
+// pin per panel. Every clock edge is one port write that carries a bit for
+// each panel, so N panels take about the bus time of one. The frame
+// streams are bit-sliced: one frame per lane is transposed (8x8 bit blocks)
+// into 32 lane bytes, and a 256 entry table turns each lane byte into the
+// port word to write.
+// Lanes that run out of frames repeat their last one, which holds the
+// KeDei control lines steady and latches nothing.
+// -----------------------------------------------
+
+#ifndef LCD_LANES_H
+#define LCD_LANES_H
+
+#include "lcd_gpio.h"
+
+#define LCD_LANES_MAX 8       // lanes per port, one bit of a lane byte each
+#define LCD_LANES_BUF 65536   // frame bytes recorded per lane before all lanes are sent
+
+/* transpose an 8x8 bit matrix, byte r bit c <-> byte c bit r (Hacker's Delight) */
+static inline uint64_t lcd_transpose8(uint64_t x) {
+	uint64_t t;
+	t = (x ^ (x >> 7)) & 0x00AA00AA00AA00AAULL;  x = x ^ t ^ (t << 7);
+	t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCULL; x = x ^ t ^ (t << 14);
+	t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ULL; x = x ^ t ^ (t << 28);
+	return x;
+}
+
+/*
+	Name: lcd_lanes_slice
+	Description: Bit-slice one 4 byte frame per lane: slice[b] bit i is bit b (MSB first) of
+		lane i's frame, so slice[0..31] are the lane bytes of the 32 clocks of the frame.
+*/
+static inline void lcd_lanes_slice(uint8_t slice[32], const uint8_t *const frame[], int n) {
+	for (int k=0; k<4; k++) {
+		uint64_t x = 0;
+		for (int i=0; i<n; i++) x |= (uint64_t)frame[i][k] << (8 * i);
+		x = lcd_transpose8(x);
+		for (int b=0; b<8; b++) slice[k*8 + b] = (uint8_t)(x >> (8 * (7 - b)));
+	}
+}
+
+/* one frame on every lane, chip select around it like bitbang_rows */
+template <class G, unsigned CPOL>
+static inline void bitbang_lanes_be_cpha0(G *g, unsigned nsecs, const uint32_t *lut, const uint8_t *slice) {
+	/* clock starts at inactive polarity */
+	#pragma GCC unroll 32
+	for (unsigned b=0; b<32; b++) {
+
+		/* setup every lane's bit (to the slaves) on trailing edge */
+		setlanes(g, lut[slice[b]]);
+		spidelay(nsecs);	/* T(setup) */
+
+		setsck(g, !CPOL);
+		spidelay(nsecs);
+		setsck(g, CPOL);
+	}
+}
+
+/*
+	Name: bitbang_lanes
+	Description: Send n frame streams at once. Lane i sends frames[i] frames from data[i]
+		(8 bit order, see lcd_frame), then repeats its last frame until the longest lane is
+		done. idle[i] keeps the last frame for lanes with nothing to send next time.
+	Parameters:
+		1. g : pointer G - backend with setlanes, setsck, setcs
+		2. nsecs : unsigned - half clock period, 0 - full speed
+		3. lut : uint32_t[256] - port word for each lane byte, see lcd_lanes_lut
+		4. data, frames : lane streams and their length in frames
+		5. idle : uint8_t[n][4] - frame a lane repeats when it has nothing to send
+		6. n : int - lanes, 1..LCD_LANES_MAX
+	Returns:
+		frame slots sent, every lane sent that many frames
+*/
+template <class G, unsigned MODE>
+int bitbang_lanes(G *g, unsigned nsecs, const uint32_t *lut, const uint8_t *const data[], const int frames[], uint8_t idle[][4], int n) {
+	static_assert((MODE & SPI_CPHA) == 0, "the lanes share one clock, modes 0 and 2 only");
+	const uint8_t *f[LCD_LANES_MAX];
+	uint8_t slice[32];
+	int slots = 0;
+
+	for (int i=0; i<n; i++) {
+		slots = frames[i] > slots ? frames[i] : slots;
+		if (frames[i]) memcpy(idle[i], data[i] + (size_t)(frames[i] - 1) * 4, 4);
+	}
+	for (int s=0; s<slots; s++) {
+		for (int i=0; i<n; i++) f[i] = s < frames[i] ? data[i] + (size_t)s*4 : idle[i];
+		lcd_lanes_slice(slice, f, n);
+		setcs(g, 1);
+		bitbang_lanes_be_cpha0<G, (MODE & SPI_CPOL) ? 1 : 0>(g, nsecs, lut, slice);
+		setcs(g, 0);
+	}
+	return slots;
+}
+
+/**
+ * @brief  Table of port words: bit i of the index sets mosi[i], the other lane pins stay low
+ */
+void lcd_lanes_lut(uint32_t lut[256], const uint32_t *mosi, int n) {
+	for (int v=0; v<256; v++) {
+		lut[v] = 0;
+		for (int i=0; i<n; i++) {
+			if (v & (1 << i)) lut[v] |= mosi[i];
+		}
+	}
+}
+
+
+/* ************************************************************
+	PORT BACKENDS : all lanes in one write
+   ************************************************************ */
+
+/* BCM283x: set and clear registers, the lanes' pins are given in GPIO_Bcm_t mosi */
+static inline void setlanes(GPIO_Bcm_t *g, uint32_t v) {
+	g->reg[GPIO_BCM_GPSET0] = v;
+	g->reg[GPIO_BCM_GPCLR0] = g->mosi & ~v;
+}
+
+/* Allwinner: one data register write */
+static inline void setlanes(GPIO_Sunxi_t *g, uint32_t v) {
+	g->port[GPIO_SUNXI_DAT] = g->dat = (g->dat & ~g->mosi) | v;
+}
+
+/**
+ * @brief  Turn an opened single lane backend into a port of lanes: mosi[i] are the lane pins,
+ *         made outputs here; sck and cs stay shared.
+ */
+void gpio_lanes(GPIO_Bcm_t *g, const int *mosi, int n) {
+	g->mosi = 0;
+	for (int i=0; i<n; i++) {
+		g->mosi |= 1u << mosi[i];
+		gpio_bcm_fsel(g, mosi[i], 1);
+	}
+}
+
+void gpio_lanes(GPIO_Sunxi_t *g, const int *mosi, int n) {
+	g->mosi = 0;
+	for (int i=0; i<n; i++) {
+		g->mosi |= 1u << mosi[i];
+		gpio_sunxi_cfg(g, mosi[i], 1);
+	}
+}
+
+/**
+ * @brief  Mock port: decodes every lane like its own SPI slave, mode 0 / 2
+ */
+typedef struct {
+	uint8_t mode;
+	int sck, cs;
+	uint32_t port;                       /*!< lane pin levels */
+	uint32_t mosi;                       /*!< all lane pins */
+	uint32_t pin[LCD_LANES_MAX];         /*!< lane pins */
+	int n;
+	uint32_t shift[LCD_LANES_MAX];
+	int nbits;
+	uint8_t *out[LCD_LANES_MAX];         /*!< received bytes per lane, up to cap */
+	size_t cap, len;                     /*!< same for every lane, they share the clock */
+	uint32_t frames, bad;
+	uint64_t writes;
+	unsigned nsecs;
+} GPIO_MockPort_t;
+
+void gpio_mock_port_init(GPIO_MockPort_t *g, uint8_t mode, const uint32_t *pin, int n, uint8_t **out, size_t cap) {
+	memset(g, 0, sizeof(*g));
+	g->mode = mode;
+	g->sck = (mode & SPI_CPOL) ? 1 : 0;
+	g->n = n;
+	for (int i=0; i<n; i++) {
+		g->pin[i] = pin[i];
+		g->mosi |= pin[i];
+		g->out[i] = out ? out[i] : NULL;
+	}
+	g->cap = out ? cap : 0;
+}
+
+static inline void setlanes(GPIO_MockPort_t *g, uint32_t v) { g->writes++; g->port = v & g->mosi; }
+
+static inline void setsck(GPIO_MockPort_t *g, int on) {
+	on = on ? 1 : 0;
+	g->writes++;
+	if (on == g->sck) return;
+	g->sck = on;
+	if (!g->cs || on == ((g->mode & SPI_CPOL) ? 1 : 0)) return; // sample on the leading edge
+	for (int i=0; i<g->n; i++) g->shift[i] = g->shift[i] << 1 | ((g->port & g->pin[i]) != 0);
+	if (++g->nbits % 8 == 0) {
+		if (g->len < g->cap) {
+			for (int i=0; i<g->n; i++) g->out[i][g->len] = (uint8_t)g->shift[i];
+		}
+		g->len++;
+	}
+}
+
+static inline void setcs(GPIO_MockPort_t *g, int on) {
+	g->writes++;
+	if (g->cs && !on) {
+		g->frames++;
+		if (g->nbits % 8) g->bad++;
+	}
+	g->cs = on ? 1 : 0;
+	g->nbits = 0;
+}
+
+int gpio_close(GPIO_MockPort_t *g) {
+	(void)g;
+	return 0;
+}
+
+
+/* ************************************************************
+	LCD TRANSPORT : one display per lane
+   ************************************************************ */
+
+typedef struct LCD_Lanes_s LCD_Lanes_t;
+
+typedef struct {
+	LCD_Lanes_t *lanes;
+	int lane;
+} LCD_LaneCtx_t;
+
+/**
+ * @brief  Lanes of one port, each display records its frames into its lane
+ * @note   Single threaded: all displays of a port are drawn from one thread.
+ */
+struct LCD_Lanes_s {
+	void *gpio;                          /*!< opened backend with setlanes */
+	int (*bang)(LCD_Lanes_t *l);         /*!< bitbang_lanes for its type, see lcd_lanes_init */
+	int n;                               /*!< lanes */
+	uint32_t lut[256];
+	bool batch;                          /*!< record until lcd_lanes_send, false - send every call at once */
+	uint8_t *buf[LCD_LANES_MAX];         /*!< frames recorded per lane */
+	int len[LCD_LANES_MAX];              /*!< bytes recorded */
+	uint8_t idle[LCD_LANES_MAX][4];      /*!< frame repeated by a lane with nothing to send */
+	LCD_LaneCtx_t ctx[LCD_LANES_MAX];
+	uint64_t frames;                     /*!< frames sent, all lanes */
+	uint64_t slots;                      /*!< frame times used, slots * n - frames were padding */
+};
+
+template <class G, unsigned MODE>
+int lcd_lanes_bang(LCD_Lanes_t *l) {
+	G *g = (G *)l->gpio;
+	const uint8_t *data[LCD_LANES_MAX];
+	int frames[LCD_LANES_MAX];
+
+	for (int i=0; i<l->n; i++) {
+		data[i] = l->buf[i];
+		frames[i] = l->len[i] / 4;
+		l->frames += frames[i];
+	}
+	l->slots += bitbang_lanes<G, MODE>(g, g->nsecs, l->lut, data, frames, l->idle, l->n);
+	for (int i=0; i<l->n; i++) l->len[i] = 0;
+	return 0;
+}
+
+/**
+ * @brief  Send what every lane recorded, shorter lanes padded with their idle frame
+ */
+int lcd_lanes_send(LCD_Lanes_t *l) {
+	bool any = false;
+	for (int i=0; i<l->n; i++) any |= l->len[i] > 0;
+	return any ? l->bang(l) : 0;
+}
+
+int lcd_lanes_rows(void *ctx, const uint8_t *data, int row_len, int rows, int stride) {
+	LCD_LaneCtx_t *c = (LCD_LaneCtx_t *)ctx;
+	LCD_Lanes_t *l = c->lanes;
+
+	if (row_len % 4) return -3;
+	for (int j=0; j<rows; j++) {
+		const uint8_t *row = data + (size_t)j*stride;
+		for (int off=0; off<row_len; ) {
+			int take = row_len - off;
+			if (take > LCD_LANES_BUF - l->len[c->lane]) take = LCD_LANES_BUF - l->len[c->lane];
+			memcpy(l->buf[c->lane] + l->len[c->lane], row + off, take);
+			l->len[c->lane] += take;
+			off += take;
+			if (l->len[c->lane] == LCD_LANES_BUF) lcd_lanes_send(l);
+		}
+	}
+	if (!l->batch) lcd_lanes_send(l);
+	return row_len * rows;
+}
+
+int lcd_lanes_close(void *ctx) {
+	lcd_lanes_send(((LCD_LaneCtx_t *)ctx)->lanes);
+	return 0;
+}
+
+static const LCD_Transport_t lcd_lanes_transport = { lcd_lanes_rows, lcd_lanes_close };
+
+/*
+	Name: lcd_lanes_init
+	Description: Set up n lanes on an opened backend g whose lane pins are mosi[i] (masks).
+		Lanes start unbatched, so lcd_init's delays fall between the frames they belong to;
+		set batch afterwards to draw every panel and send them together with lcd_lanes_send.
+	Returns:
+		0 - on success, -1 - bad lane count, -11 - out of memory
+*/
+template <class G, unsigned MODE>
+int lcd_lanes_init(LCD_Lanes_t *l, G *g, const uint32_t *mosi, int n) {
+	if (n < 1 || n > LCD_LANES_MAX) return -1;
+	memset(l, 0, sizeof(*l));
+	l->gpio = g;
+	l->bang = lcd_lanes_bang<G, MODE>;
+	l->n = n;
+	lcd_lanes_lut(l->lut, mosi, n);
+	for (int i=0; i<n; i++) {
+		l->buf[i] = (uint8_t *)malloc(LCD_LANES_BUF);
+		if (!l->buf[i]) return -11;
+		lcd_frame(l->idle[i], 0, 0x1F, 8); // data strobe high, what every write ends with
+		l->ctx[i].lanes = l;
+		l->ctx[i].lane = i;
+	}
+	return 0;
+}
+
+void lcd_lanes_free(LCD_Lanes_t *l) {
+	for (int i=0; i<l->n; i++) {
+		free(l->buf[i]);
+		l->buf[i] = NULL;
+	}
+}
+
+/**
+ * @brief  Open display d on lane i, see lcd_open_transport
+ */
+int lcd_lanes_open(LCD_Display_t *d, LCD_Lanes_t *l, int i) {
+	if (i < 0 || i >= l->n) return -1;
+	return lcd_open_transport(d, &lcd_lanes_transport, &l->ctx[i]);
+}
+
+#endif
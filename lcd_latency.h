@@ -0,0 +1,201 @@
+// ************ TOUCH-TO-PHOTON LATENCY **************
+// Follows input events through the display path by an id: the input itself
+// (a touch sample or any app event), submission of the draw commands it
+// caused, the consumer starting on them, the first lcd_setarea2 window that
+// carries them and the end of the transfer (lcd_flush). The time between
+// each pair of points goes into a histogram per stage, which tells whether
+// slowness comes from the app, the queue, the driver or the bus.
+// ---------------------------------------------------
+
+#ifndef LCD_LATENCY_H
+#define LCD_LATENCY_H
+
+#include <atomic>
+#include <pthread.h>
+#include <time.h>
+
+#include "lcd_hist.h"
+
+#define LCD_LATENCY_OPEN 32   // ids in flight at the same time
+
+/**
+ * @brief  Points an id passes on its way to the panel
+ */
+typedef enum {
+	LCD_LAT_INPUT,    /*!< lcd_latency_input: touch sampled or app event */
+	LCD_LAT_SUBMIT,   /*!< lcd_latency_submit: draw commands handed over (lcd_queue_mark) */
+	LCD_LAT_APPLY,    /*!< lcd_latency_apply: display thread starts drawing them */
+	LCD_LAT_WINDOW,   /*!< first lcd_setarea2 after that, pixels start going out */
+	LCD_LAT_DONE,     /*!< lcd_flush returned, the pixels are on the wire */
+	LCD_LAT_POINTS
+} LCD_LatPoint_t;
+
+/**
+ * @brief  Histograms kept per stage
+ */
+typedef enum {
+	LCD_LAT_APP,      /*!< input -> submit */
+	LCD_LAT_QUEUE,    /*!< submit -> apply */
+	LCD_LAT_DRIVER,   /*!< apply -> window: drawing, shadow, encoding */
+	LCD_LAT_WIRE,     /*!< window -> done: transfers */
+	LCD_LAT_TOTAL,    /*!< input -> done */
+	LCD_LAT_STAGES
+} LCD_LatStage_t;
+
+static const char *lcd_latency_stage_name[LCD_LAT_STAGES] = { "app", "queue", "driver", "wire", "total" };
+
+typedef struct {
+	uint32_t id;
+	uint64_t t[LCD_LAT_POINTS];   /*!< CLOCK_MONOTONIC ns, 0 - not reached yet */
+} LCD_LatRec_t;
+
+/**
+ * @brief  Tracer shared by the input, app and display threads, see LCD_Display_t lat
+ */
+typedef struct {
+	pthread_mutex_t lock;
+	LCD_LatRec_t rec[LCD_LATENCY_OPEN];
+	int n;
+	std::atomic<int> windowing;        /*!< applied ids waiting for their window */
+	std::atomic<int> applied;          /*!< applied ids waiting for lcd_flush */
+	LCD_Hist_t stage[LCD_LAT_STAGES];
+	uint32_t completed;                /*!< ids that reached the panel */
+	uint32_t dropped;                  /*!< ids not traced, LCD_LATENCY_OPEN already in flight */
+} LCD_Latency_t;
+
+static inline uint64_t lcd_latency_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+void lcd_latency_init(LCD_Latency_t *l) {
+	pthread_mutex_init(&l->lock, NULL);
+	l->n = 0;
+	l->windowing.store(0);
+	l->applied.store(0);
+	for (int s=0; s<LCD_LAT_STAGES; s++) lcd_hist_reset(&l->stage[s]);
+	l->completed = 0;
+	l->dropped = 0;
+}
+
+void lcd_latency_destroy(LCD_Latency_t *l) {
+	pthread_mutex_destroy(&l->lock);
+}
+
+/**
+ * @brief  Histograms and counters back to zero, ids in flight are kept
+ */
+void lcd_latency_reset(LCD_Latency_t *l) {
+	pthread_mutex_lock(&l->lock);
+	for (int s=0; s<LCD_LAT_STAGES; s++) lcd_hist_reset(&l->stage[s]);
+	l->completed = 0;
+	l->dropped = 0;
+	pthread_mutex_unlock(&l->lock);
+}
+
+/* record of id, created when missing; NULL when the table is full. Called locked. */
+LCD_LatRec_t *lcd_latency_rec(LCD_Latency_t *l, uint32_t id, uint64_t now) {
+	for (int i=0; i<l->n; i++) {
+		if (l->rec[i].id == id) return &l->rec[i];
+	}
+	if (l->n == LCD_LATENCY_OPEN) {
+		l->dropped++;
+		return NULL;
+	}
+	LCD_LatRec_t *r = &l->rec[l->n++];
+	memset(r, 0, sizeof(*r));
+	r->id = id;
+	r->t[LCD_LAT_INPUT] = now;
+	return r;
+}
+
+/* stamp point p of id, earlier points not seen yet get the same time */
+void lcd_latency_mark(LCD_Latency_t *l, uint32_t id, int p, uint64_t t_ns) {
+	uint64_t now = t_ns ? t_ns : lcd_latency_now();
+
+	pthread_mutex_lock(&l->lock);
+	LCD_LatRec_t *r = lcd_latency_rec(l, id, now);
+	if (r && !r->t[p]) {
+		for (int k=LCD_LAT_INPUT; k<p; k++) {
+			if (!r->t[k]) r->t[k] = now;
+		}
+		r->t[p] = now;
+		if (p == LCD_LAT_APPLY) {
+			l->windowing.fetch_add(1, std::memory_order_relaxed);
+			l->applied.fetch_add(1, std::memory_order_release);
+		}
+	}
+	pthread_mutex_unlock(&l->lock);
+}
+
+/**
+ * @brief  Input event id happened at t_ns (CLOCK_MONOTONIC, e.g. LCD_TouchEvent_t t_ns), 0 - now
+ */
+void lcd_latency_input(LCD_Latency_t *l, uint32_t id, uint64_t t_ns) {
+	lcd_latency_mark(l, id, LCD_LAT_INPUT, t_ns);
+}
+
+/**
+ * @brief  The draw commands for id were handed to the display thread
+ */
+void lcd_latency_submit(LCD_Latency_t *l, uint32_t id) {
+	lcd_latency_mark(l, id, LCD_LAT_SUBMIT, 0);
+}
+
+/**
+ * @brief  Display thread: what is drawn from now on belongs to id (as well)
+ */
+void lcd_latency_apply(LCD_Latency_t *l, uint32_t id) {
+	lcd_latency_mark(l, id, LCD_LAT_APPLY, 0);
+}
+
+/* lcd_setarea2: pixels of the applied ids start going out */
+void lcd_latency_window(LCD_Latency_t *l) {
+	uint64_t now = lcd_latency_now();
+
+	pthread_mutex_lock(&l->lock);
+	for (int i=0; i<l->n; i++) {
+		LCD_LatRec_t *r = &l->rec[i];
+		if (r->t[LCD_LAT_APPLY] && !r->t[LCD_LAT_WINDOW]) r->t[LCD_LAT_WINDOW] = now;
+	}
+	l->windowing.store(0, std::memory_order_relaxed);
+	pthread_mutex_unlock(&l->lock);
+}
+
+static inline uint32_t lcd_latency_us(uint64_t a, uint64_t b) {
+	return b > a ? (uint32_t)((b - a) / 1000) : 0;
+}
+
+/*
+	Name: lcd_latency_done
+	Description: Called at the end of lcd_flush: every applied id is on the wire. Its stage
+		times go into the histograms and the id is closed. An id that never opened a window
+		(everything clipped away, nothing changed) counts its whole time as driver time.
+*/
+void lcd_latency_done(LCD_Latency_t *l) {
+	uint64_t now;
+	int k = 0;
+
+	if (l->applied.load(std::memory_order_acquire) == 0) return;
+	now = lcd_latency_now();
+	pthread_mutex_lock(&l->lock);
+	for (int i=0; i<l->n; i++) {
+		LCD_LatRec_t *r = &l->rec[i];
+		if (!r->t[LCD_LAT_APPLY]) {
+			l->rec[k++] = *r; // not drawn yet, stays open
+			continue;
+		}
+		if (!r->t[LCD_LAT_WINDOW]) r->t[LCD_LAT_WINDOW] = now;
+		r->t[LCD_LAT_DONE] = now;
+		for (int s=LCD_LAT_APP; s<LCD_LAT_TOTAL; s++) lcd_hist_add(&l->stage[s], lcd_latency_us(r->t[s], r->t[s+1]));
+		lcd_hist_add(&l->stage[LCD_LAT_TOTAL], lcd_latency_us(r->t[LCD_LAT_INPUT], now));
+		l->completed++;
+	}
+	l->n = k;
+	l->windowing.store(0, std::memory_order_relaxed);
+	l->applied.store(0, std::memory_order_relaxed);
+	pthread_mutex_unlock(&l->lock);
+}
+
+#endif
@@ -0,0 +1,141 @@
+// ************ FRAME PACING **************
+// Consumer of an LCD_Queue_t that refreshes the panel at a target rate
+// instead of after every burst. Commands are applied to the shadow buffer
+// as they come, which costs memory bandwidth only; the panel is flushed on
+// the first frame boundary (lcd_queue_frame) after each tick. Frames that
+// complete between two ticks are merged: their damage is sent once and
+// content drawn over before the tick never reaches the bus.
+// ----------------------------------------
+
+#ifndef LCD_PACE_H
+#define LCD_PACE_H
+
+#include "lcd_queue.h"
+
+#define LCD_PACE_IDLE_US 1000  // longest sleep while nothing is queued
+
+typedef struct {
+	LCD_Queue_t *q;
+	LCD_Display_t *d;
+	uint64_t period_ns;       /*!< 1e9 / target fps */
+	uint64_t next_ns;         /*!< next tick, CLOCK_MONOTONIC */
+	uint32_t ready;           /*!< frames completed since the last flush */
+	bool drawn;               /*!< commands applied since the last flush */
+	/* stats since lcd_pace_init / lcd_pace_reset */
+	uint64_t start_ns;
+	uint64_t frames;          /*!< completed frames submitted */
+	uint64_t presented;       /*!< flushes, each shows the newest complete frame */
+	uint64_t dropped;         /*!< frames superseded before a tick */
+	uint64_t late;            /*!< ticks missed, the previous flush ran past them */
+	uint64_t busy_ns;         /*!< time in lcd_flush, the bus was busy */
+} LCD_Pacer_t;
+
+/**
+ * @brief  Stats back to zero, the schedule keeps running
+ */
+void lcd_pace_reset(LCD_Pacer_t *p) {
+	p->start_ns = lcd_latency_now();
+	p->frames = p->presented = p->dropped = p->late = p->busy_ns = 0;
+}
+
+/*
+	Name: lcd_pace_init
+	Description: Pace display d, fed by queue q, at fps refreshes per second. d must keep a
+		shadow buffer (lcd_shadow_init), that is where frames wait for their tick.
+	Returns:
+		0 - on success, -1 - no shadow buffer, -2 - bad rate
+*/
+int lcd_pace_init(LCD_Pacer_t *p, LCD_Queue_t *q, LCD_Display_t *d, double fps) {
+	memset(p, 0, sizeof(*p));
+	if (d->shadow == LCD_SHADOW_NONE) return -1;
+	if (!(fps > 0 && fps <= 1000)) return -2;
+	p->q = q;
+	p->d = d;
+	p->period_ns = (uint64_t)(1e9 / fps);
+	lcd_pace_reset(p);
+	p->next_ns = p->start_ns + p->period_ns;
+	return 0;
+}
+
+/* send the shadow, count what it merged */
+void lcd_pace_flush(LCD_Pacer_t *p, uint64_t now) {
+	lcd_flush(p->d);
+	uint64_t end = lcd_latency_now();
+	p->busy_ns += end - now;
+	p->presented++;
+	if (p->ready > 1) p->dropped += p->ready - 1;
+	p->ready = 0;
+	p->drawn = false;
+
+	/* next tick on the grid; ticks the flush overran are skipped, not caught up */
+	p->next_ns += p->period_ns;
+	if (p->next_ns <= end) {
+		uint64_t missed = (end - p->next_ns) / p->period_ns + 1;
+		p->late += missed;
+		p->next_ns += missed * p->period_ns;
+	}
+}
+
+/*
+	Name: lcd_pace_step
+	Description: Apply queued commands until the queue runs dry or a tick is due at a frame
+		boundary, flushing then. A tick with nothing complete waits for the next boundary,
+		unless the queue is empty: then what was drawn is shown as it is.
+	Returns:
+		true - flushed
+*/
+bool lcd_pace_step(LCD_Pacer_t *p) {
+	for (;;) {
+		int type = lcd_queue_step(p->q, p->d);
+		uint64_t now = lcd_latency_now();
+		if (type == LCD_CMD_FRAME) {
+			p->frames++;
+			p->ready++;
+		} else if (type >= 0) {
+			p->drawn = true;
+		}
+		if (now >= p->next_ns) {
+			if ((type == LCD_CMD_FRAME) || (type < 0 && (p->ready || p->drawn))) {
+				lcd_pace_flush(p, now);
+				return true;
+			}
+			if (type < 0) p->next_ns = now + p->period_ns; // idle, nothing to show: restart the grid
+		}
+		if (type < 0) return false;
+	}
+}
+
+/*
+	Name: lcd_pace_run
+	Description: Pacing loop until *stop is set and the queue is empty; what was drawn last is
+		flushed before returning.
+*/
+void lcd_pace_run(LCD_Pacer_t *p, std::atomic<int> *stop) {
+	for (;;) {
+		if (lcd_pace_step(p)) continue;
+		if (stop->load(std::memory_order_acquire) && lcd_queue_depth(p->q) == 0) break;
+		uint64_t now = lcd_latency_now();
+		uint64_t wait = p->next_ns > now ? (p->next_ns - now) / 1000 : 0;
+		delayus(wait < LCD_PACE_IDLE_US ? (int)wait + 1 : LCD_PACE_IDLE_US);
+	}
+	while (lcd_queue_step(p->q, p->d) >= 0) p->drawn = true;
+	if (p->ready || p->drawn) lcd_pace_flush(p, lcd_latency_now());
+}
+
+/**
+ * @brief  Achieved refresh rate since the stats were reset
+ */
+double lcd_pace_fps(const LCD_Pacer_t *p) {
+	uint64_t t = lcd_latency_now() - p->start_ns;
+	return t ? p->presented * 1e9 / t : 0;
+}
+
+/**
+ * @brief  Share of the time spent flushing, 0..1
+ */
+double lcd_pace_busy(const LCD_Pacer_t *p) {
+	uint64_t t = lcd_latency_now() - p->start_ns;
+	return t ? (double)p->busy_ns / t : 0;
+}
+
+#endif
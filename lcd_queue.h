@@ -0,0 +1,253 @@
+// ************ DRAW COMMAND QUEUE **************
+// Lock-free multi producer / single consumer ring of draw commands.
+// Any thread may enqueue without blocking; one consumer thread owns the
+// LCD_Display_t and is the only one talking to spidev.
+// ----------------------------------------------
+
+#ifndef LCD_QUEUE_H
+#define LCD_QUEUE_H
+
+#include <atomic>
+
+#include "lcd_display.h"
+
+#define LCD_QUEUE_SIZE      256  // slots, must be a power of two
+#define LCD_QUEUE_TEXT_LEN  48   // longest string carried by a text command, incl. '\0'
+
+typedef enum {
+	LCD_CMD_FILL,   // lcd_fill2(x, y, x2, y2, color)
+	LCD_CMD_BLIT,   // lcd_blit(x, y, w, h, pixels, stride), pixels are referenced, not copied
+	LCD_CMD_TEXT,   // TM_ILI9341_Puts(x, y, text, font, color, bg)
+	LCD_CMD_PIXEL,  // lcd_DrawPixel(x, y, color)
+	LCD_CMD_MARK,   // lcd_latency_apply(d->lat, id), the producer's following commands belong to id
+	LCD_CMD_FRAME   // nothing drawn, the producer's frame is complete (frame pacing, lcd_pace.h)
+} LCD_CmdType_t;
+
+/**
+ * @brief  One queued draw command
+ * @note   Blit pixels stay owned by the producer. They must not change until
+ *         *done becomes non-zero (if done is set) or the queue is drained.
+ */
+typedef struct {
+	uint8_t type;              /*!< LCD_CmdType_t */
+	int16_t x, y;              /*!< top left corner */
+	int16_t x2, y2;            /*!< fill: bottom right corner; blit: width, height */
+	uint32_t color;            /*!< fill, pixel and text foreground color */
+	uint32_t bg;               /*!< text background or ILI9341_TRANSPARENT */
+	const uint16_t *pixels;    /*!< blit source */
+	int stride;                /*!< blit source pixels per row */
+	std::atomic<int> *done;    /*!< optional, set to 1 once the command reached the bus */
+	uint32_t id;               /*!< mark: latency trace id */
+	TM_FontDef_t *font;        /*!< text font */
+	char text[LCD_QUEUE_TEXT_LEN];
+} LCD_Cmd_t;
+
+typedef struct {
+	std::atomic<uint32_t> seq;
+	LCD_Cmd_t cmd;
+} LCD_QueueSlot_t;
+
+/**
+ * @brief  Bounded MPSC queue (Vyukov style ring with a sequence number per slot)
+ */
+typedef struct {
+	LCD_QueueSlot_t slot[LCD_QUEUE_SIZE];
+	alignas(64) std::atomic<uint32_t> head;     /*!< next slot to claim, producers */
+	alignas(64) std::atomic<uint32_t> tail;     /*!< next slot to apply, written by the consumer only */
+	std::atomic<uint32_t> overflow;             /*!< commands rejected because the ring was full */
+	std::atomic<uint32_t> peak;                 /*!< highest depth seen by a producer */
+	std::atomic<uint32_t> applied;              /*!< commands applied by the consumer */
+} LCD_Queue_t;
+
+void lcd_queue_init(LCD_Queue_t *q) {
+	for (uint32_t i=0; i<LCD_QUEUE_SIZE; i++) {
+		q->slot[i].seq.store(i, std::memory_order_relaxed);
+	}
+	q->head.store(0, std::memory_order_relaxed);
+	q->tail.store(0, std::memory_order_relaxed);
+	q->overflow.store(0, std::memory_order_relaxed);
+	q->peak.store(0, std::memory_order_relaxed);
+	q->applied.store(0, std::memory_order_release);
+}
+
+/*
+	Name: lcd_queue_push
+	Description: Claim a slot and copy the command into it. Never blocks, never waits for the bus.
+	Returns:
+		0 - queued, -1 - ring full (counted in overflow), command dropped
+*/
+int lcd_queue_push(LCD_Queue_t *q, const LCD_Cmd_t *cmd) {
+	uint32_t pos = q->head.load(std::memory_order_relaxed);
+	LCD_QueueSlot_t *s;
+
+	for (;;) {
+		s = &q->slot[pos & (LCD_QUEUE_SIZE-1)];
+		int32_t dif = (int32_t)(s->seq.load(std::memory_order_acquire) - pos);
+		if (dif == 0) {
+			if (q->head.compare_exchange_weak(pos, pos+1, std::memory_order_relaxed)) break;
+		} else if (dif < 0) {
+			q->overflow.fetch_add(1, std::memory_order_relaxed);
+			return -1; // consumer has not freed this slot yet
+		} else {
+			pos = q->head.load(std::memory_order_relaxed);
+		}
+	}
+
+	s->cmd = *cmd;
+	s->seq.store(pos+1, std::memory_order_release);
+
+	uint32_t depth = pos + 1 - q->tail.load(std::memory_order_relaxed);
+	uint32_t peak = q->peak.load(std::memory_order_relaxed);
+	while (depth > peak && !q->peak.compare_exchange_weak(peak, depth, std::memory_order_relaxed));
+	return 0;
+}
+
+/**
+ * @brief  Producer helpers, all return lcd_queue_push result
+ */
+int lcd_queue_fill(LCD_Queue_t *q, int16_t sx, int16_t sy, int16_t x, int16_t y, uint16_t color) {
+	LCD_Cmd_t c = {};
+	c.type = LCD_CMD_FILL;
+	c.x = sx; c.y = sy; c.x2 = x; c.y2 = y;
+	c.color = color;
+	return lcd_queue_push(q, &c);
+}
+
+int lcd_queue_pixel(LCD_Queue_t *q, int16_t x, int16_t y, uint16_t color) {
+	LCD_Cmd_t c = {};
+	c.type = LCD_CMD_PIXEL;
+	c.x = x; c.y = y;
+	c.color = color;
+	return lcd_queue_push(q, &c);
+}
+
+int lcd_queue_blit(LCD_Queue_t *q, int16_t x, int16_t y, int16_t w, int16_t h, const uint16_t *px, int stride, std::atomic<int> *done) {
+	LCD_Cmd_t c = {};
+	c.type = LCD_CMD_BLIT;
+	c.x = x; c.y = y; c.x2 = w; c.y2 = h;
+	c.pixels = px;
+	c.stride = stride;
+	c.done = done;
+	if (done) done->store(0, std::memory_order_relaxed);
+	return lcd_queue_push(q, &c);
+}
+
+int lcd_queue_text(LCD_Queue_t *q, int16_t x, int16_t y, const char *str, TM_FontDef_t *font, uint32_t foreground, uint32_t background) {
+	LCD_Cmd_t c = {};
+	size_t len = strlen(str);
+	if (len >= LCD_QUEUE_TEXT_LEN) return -2; // split longer strings
+	c.type = LCD_CMD_TEXT;
+	c.x = x; c.y = y;
+	c.color = foreground;
+	c.bg = background;
+	c.font = font;
+	memcpy(c.text, str, len+1);
+	return lcd_queue_push(q, &c);
+}
+
+/**
+ * @brief  Tag the commands this producer queues next with trace id, see lcd_latency.h.
+ *         lat may be NULL, otherwise the id's submit time is taken now.
+ */
+int lcd_queue_mark(LCD_Queue_t *q, LCD_Latency_t *lat, uint32_t id) {
+	LCD_Cmd_t c = {};
+	c.type = LCD_CMD_MARK;
+	c.id = id;
+	if (lat) lcd_latency_submit(lat, id);
+	return lcd_queue_push(q, &c);
+}
+
+/**
+ * @brief  End of a frame: what this producer queued so far may be shown, see lcd_pace.h
+ */
+int lcd_queue_frame(LCD_Queue_t *q) {
+	LCD_Cmd_t c = {};
+	c.type = LCD_CMD_FRAME;
+	return lcd_queue_push(q, &c);
+}
+
+/**
+ * @brief  Current number of queued commands (approximate while producers run)
+ */
+uint32_t lcd_queue_depth(LCD_Queue_t *q) {
+	return q->head.load(std::memory_order_relaxed) - q->tail.load(std::memory_order_relaxed);
+}
+
+void lcd_queue_apply(LCD_Display_t *d, LCD_Cmd_t *c) {
+	switch (c->type) {
+	case LCD_CMD_FILL:
+		lcd_fill2(d, c->x, c->y, c->x2, c->y2, c->color);
+		break;
+	case LCD_CMD_BLIT:
+		lcd_blit(d, c->x, c->y, c->x2, c->y2, c->pixels, c->stride);
+		break;
+	case LCD_CMD_TEXT:
+		TM_ILI9341_Puts(d, c->x, c->y, c->text, c->font, c->color, c->bg);
+		break;
+	case LCD_CMD_PIXEL:
+		lcd_DrawPixel(d, c->x, c->y, c->color);
+		break;
+	case LCD_CMD_MARK:
+		if (d->lat) lcd_latency_apply(d->lat, c->id);
+		break;
+	case LCD_CMD_FRAME:
+		break;
+	}
+	if (c->done) c->done->store(1, std::memory_order_release);
+}
+
+/*
+	Name: lcd_queue_step
+	Description: Consumer side. Apply the oldest queued command to the display, no flush.
+		Must only ever be called from one thread per queue.
+	Returns:
+		LCD_CmdType_t of the command applied, -1 - nothing queued
+*/
+int lcd_queue_step(LCD_Queue_t *q, LCD_Display_t *d) {
+	uint32_t pos = q->tail.load(std::memory_order_relaxed);
+	LCD_QueueSlot_t *s = &q->slot[pos & (LCD_QUEUE_SIZE-1)];
+	int type;
+
+	if ((int32_t)(s->seq.load(std::memory_order_acquire) - (pos+1)) < 0) return -1; // empty, or producer still copying
+
+	type = s->cmd.type;
+	lcd_queue_apply(d, &s->cmd);
+	s->seq.store(pos + LCD_QUEUE_SIZE, std::memory_order_release);
+	q->tail.store(pos + 1, std::memory_order_relaxed);
+	q->applied.fetch_add(1, std::memory_order_relaxed);
+	return type;
+}
+
+/*
+	Name: lcd_queue_drain
+	Description: Consumer side. Apply up to max queued commands (max <= 0 : all) to the display.
+		Must only ever be called from one thread per queue.
+	Returns:
+		number of commands applied
+*/
+int lcd_queue_drain(LCD_Queue_t *q, LCD_Display_t *d, int max) {
+	int n = 0;
+
+	while ((max <= 0 || n < max) && lcd_queue_step(q, d) >= 0) n++;
+	if (n) lcd_flush(d); // no-op unless the display keeps a shadow buffer
+	return n;
+}
+
+/*
+	Name: lcd_queue_run
+	Description: Consumer loop, drains the queue until *stop is set and the queue is empty.
+		Sleeps idle_us between polls while there is nothing to do.
+*/
+void lcd_queue_run(LCD_Queue_t *q, LCD_Display_t *d, std::atomic<int> *stop, int idle_us) {
+	for (;;) {
+		if (lcd_queue_drain(q, d, 0) == 0) {
+			if (stop->load(std::memory_order_acquire)) {
+				if (lcd_queue_drain(q, d, 0) == 0) return;
+				continue;
+			}
+			delayus(idle_us);
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,210 @@
+// ************ WIRE RECORDER **************
+// Logs every transfer a display sends (lcd_send / lcd_send_rows) with its
+// start time into a compact binary file, so the exact byte stream of a
+// device can be replayed later (lcd_replay.h). Frames are stored in wire
+// order whatever the word size, and runs of equal pixels (fills) shrink
+// to a few bytes. Pixel records keep the message size they were split
+// into, so a replay makes the same ioctls as the recorded device.
+//
+// File: header "KDWR", u16 version, u16 word bits of the recording, u32 SPI
+// clock, u64 CLOCK_REALTIME ns at the start, u8 flags (1 - SPI_CS_WORD),
+// 3 bytes zero (little endian). Then records:
+//   u8 kind, varint us since the previous record, varint payload bytes,
+//   payload: kind FRAME - 4 bytes; kind ROWS - varint bytes per message
+//   (version 2 on), then tokens over 8 byte units, varint (n << 1 | 1) +
+//   one unit repeated n times or varint (n << 1) + n units, then the
+//   len % 8 bytes left over as they are.
+// -----------------------------------------
+
+#ifndef LCD_RECORD_H
+#define LCD_RECORD_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define LCD_RECORD_MAGIC    "KDWR"
+#define LCD_RECORD_VERSION  2    // 1 - no message sizes, still replayed
+#define LCD_RECORD_HEADER   24   // bytes
+#define LCD_RECORD_CS_WORD  0x01 // header flags
+
+typedef enum {
+	LCD_REC_FRAME = 1,   /*!< one frame by lcd_send: commands, register data, reset */
+	LCD_REC_ROWS  = 2    /*!< one lcd_send_rows call: pixels, gathered row after row */
+} LCD_RecKind_t;
+
+typedef struct {
+	FILE *f;
+	uint64_t last_ns;     /*!< CLOCK_MONOTONIC of the previous record */
+	uint8_t *tmp;         /*!< wire order copy of the transfer being written */
+	size_t tmp_len;
+	uint64_t records;
+	uint64_t bytes;       /*!< payload bytes recorded */
+	uint64_t written;     /*!< file bytes */
+	bool failed;          /*!< a write failed, the file is cut short */
+} LCD_Record_t;
+
+static inline uint64_t lcd_record_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/*
+	Name: lcd_wire_order
+	Description: Bytes of frames laid out by lcd_frame for a word size into wire order and back
+		(the layouts are their own inverse). n is a multiple of 4; dst may be src.
+*/
+void lcd_wire_order(uint8_t *dst, const uint8_t *src, size_t n, uint8_t bits) {
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+	bits = 8; // lcd_frame keeps wire order there
+#endif
+	for (size_t i=0; i<n; i+=4) {
+		uint8_t a = src[i], b = src[i+1], c = src[i+2], e = src[i+3];
+		switch (bits) {
+		case 32: dst[i] = e; dst[i+1] = c; dst[i+2] = b; dst[i+3] = a; break;
+		case 16: dst[i] = b; dst[i+1] = a; dst[i+2] = e; dst[i+3] = c; break;
+		default: if (dst != src) { dst[i] = a; dst[i+1] = b; dst[i+2] = c; dst[i+3] = e; } break;
+		}
+	}
+}
+
+static inline void lcd_record_put(LCD_Record_t *r, const void *p, size_t n) {
+	if (r->failed) return;
+	if (fwrite(p, 1, n, r->f) != n) r->failed = true;
+	r->written += n;
+}
+
+static inline void lcd_record_varint(LCD_Record_t *r, uint64_t v) {
+	uint8_t b[10];
+	int n = 0;
+	do {
+		b[n++] = (uint8_t)(v & 0x7F) | (v > 0x7F ? 0x80 : 0);
+		v >>= 7;
+	} while (v);
+	lcd_record_put(r, b, n);
+}
+
+/*
+	Name: lcd_record_open
+	Description: Start recording into path, replacing it. Point LCD_Display_t rec at r afterwards.
+	Parameters:
+		1. r : pointer LCD_Record_t - recorder to set up
+		2. path : string - output file
+		3. bits : uint8_t - word size of the display (d->bits), kept for reference
+		4. speed : uint32_t - SPI clock of the display in Hz, kept for reference
+		5. cs_word : bool - SPI_CS_WORD of the display (d->cs_word), it decides the transfers
+	Returns:
+		0 - on success, -1 - fopen failed (errno)
+*/
+int lcd_record_open(LCD_Record_t *r, const char *path, uint8_t bits, uint32_t speed, bool cs_word) {
+	uint8_t h[LCD_RECORD_HEADER];
+	struct timespec ts;
+	uint64_t t;
+
+	memset(r, 0, sizeof(*r));
+	r->f = fopen(path, "wb");
+	if (!r->f) return -1;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	t = (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+	memcpy(h, LCD_RECORD_MAGIC, 4);
+	h[4] = LCD_RECORD_VERSION; h[5] = 0;
+	h[6] = bits; h[7] = 0;
+	for (int i=0; i<4; i++) h[8+i] = (uint8_t)(speed >> (8*i));
+	for (int i=0; i<8; i++) h[12+i] = (uint8_t)(t >> (8*i));
+	memset(h + 20, 0, 4);
+	h[20] = cs_word ? LCD_RECORD_CS_WORD : 0;
+	lcd_record_put(r, h, sizeof(h));
+	r->last_ns = lcd_record_now();
+	return 0;
+}
+
+/**
+ * @brief  Finish the file
+ * @retval 0 - complete, -1 - a write failed, the file ends early
+ */
+int lcd_record_close(LCD_Record_t *r) {
+	int e = 0;
+	if (r->f) {
+		if (fclose(r->f) != 0) r->failed = true;
+		e = r->failed ? -1 : 0;
+	}
+	free(r->tmp);
+	r->f = NULL;
+	r->tmp = NULL;
+	return e;
+}
+
+/* record head: kind, time since the previous one, payload bytes */
+void lcd_record_begin(LCD_Record_t *r, uint8_t kind, size_t len) {
+	uint64_t now = lcd_record_now();
+	lcd_record_put(r, &kind, 1);
+	lcd_record_varint(r, (now - r->last_ns) / 1000);
+	lcd_record_varint(r, len);
+	r->last_ns += (now - r->last_ns) / 1000 * 1000; // keep the rounding from adding up
+	r->records++;
+	r->bytes += len;
+}
+
+/**
+ * @brief  lcd_send: one frame laid out for bits
+ */
+void lcd_record_frame(LCD_Record_t *r, const uint8_t *frame, uint8_t bits) {
+	uint8_t w[4];
+	lcd_wire_order(w, frame, 4, bits);
+	lcd_record_begin(r, LCD_REC_FRAME, 4);
+	lcd_record_put(r, w, 4);
+}
+
+/*
+	Name: lcd_record_rows
+	Description: lcd_send_rows: rows of frames laid out for bits, stride bytes apart, sent in
+		messages of up to message bytes. Gathered into wire order, then written as runs of
+		equal and of differing 8 byte units.
+*/
+void lcd_record_rows(LCD_Record_t *r, const uint8_t *data, int row_len, int rows, int stride, uint8_t bits, int message) {
+	size_t len = (size_t)row_len * rows;
+	size_t units = len / 8, lit = 0, i = 0;
+	uint64_t u, v;
+
+	if (len > r->tmp_len) {
+		uint8_t *p = (uint8_t *)realloc(r->tmp, len);
+		if (!p) {
+			r->failed = true;
+			return;
+		}
+		r->tmp = p;
+		r->tmp_len = len;
+	}
+	for (int j=0; j<rows; j++) lcd_wire_order(r->tmp + (size_t)j*row_len, data + (size_t)j*stride, row_len, bits);
+
+	lcd_record_begin(r, LCD_REC_ROWS, len);
+	lcd_record_varint(r, message > 0 ? message : 0);
+	while (i < units) {
+		size_t n = 1;
+		memcpy(&u, r->tmp + i*8, 8);
+		while (i + n < units && (memcpy(&v, r->tmp + (i+n)*8, 8), v == u)) n++;
+		if (n < 3) { // a repeat token does not pay off yet
+			lit += n;
+			i += n;
+			continue;
+		}
+		if (lit) {
+			lcd_record_varint(r, (uint64_t)lit << 1);
+			lcd_record_put(r, r->tmp + (i - lit)*8, lit*8);
+			lit = 0;
+		}
+		lcd_record_varint(r, (uint64_t)n << 1 | 1);
+		lcd_record_put(r, &u, 8);
+		i += n;
+	}
+	if (lit) {
+		lcd_record_varint(r, (uint64_t)lit << 1);
+		lcd_record_put(r, r->tmp + (i - lit)*8, lit*8);
+	}
+	lcd_record_put(r, r->tmp + units*8, len % 8);
+}
+
+#endif
@@ -0,0 +1,191 @@
+// ************ WIRE REPLAY **************
+// Plays a file written by lcd_record.h into a display: the real panel,
+// a GPIO mock or any other transport. Either at the recorded pace, or as
+// fast as the transport goes for benchmarks on production traffic.
+// ---------------------------------------
+
+#ifndef LCD_REPLAY_H
+#define LCD_REPLAY_H
+
+#include "lcd_display.h"
+#include "lcd_record.h"
+
+#define LCD_REPLAY_HOLD_US   1000  // fast replay keeps pauses this long after reset and command frames
+#define LCD_REPLAY_EARLY_US  100   // records due sooner go out right away, a sleep would oversleep
+
+/**
+ * @brief  Reader of a recording
+ */
+typedef struct {
+	FILE *f;
+	uint8_t bits;          /*!< word size of the recording */
+	uint32_t speed;        /*!< SPI clock of the recording */
+	uint64_t start_ns;     /*!< CLOCK_REALTIME at the start */
+	uint8_t version;
+	bool cs_word;          /*!< SPI_CS_WORD of the recording */
+	uint8_t kind;          /*!< LCD_RecKind_t of the current record */
+	int message;           /*!< rows: bytes per message they were sent in, 0 - not recorded */
+	uint64_t t_us;         /*!< start of the current record since the start of the file */
+	uint8_t *data;         /*!< its payload, wire order */
+	size_t len, cap;
+} LCD_Replay_t;
+
+/**
+ * @brief  Replay results, see lcd_replay
+ */
+typedef struct {
+	uint64_t records;
+	uint64_t bytes;
+	uint64_t recorded_us;  /*!< start of the last record */
+	uint64_t wall_us;      /*!< replay took */
+	int error;             /*!< 0, or the first negative transport result */
+	uint64_t resplit;      /*!< rows records d cannot send in the recorded messages (cs_word or bufsiz differ) */
+} LCD_ReplayStats_t;
+
+static inline bool lcd_replay_varint(FILE *f, uint64_t *v) {
+	int c, shift = 0;
+	*v = 0;
+	do {
+		if ((c = fgetc(f)) == EOF || shift > 63) return false;
+		*v |= (uint64_t)(c & 0x7F) << shift;
+		shift += 7;
+	} while (c & 0x80);
+	return true;
+}
+
+/*
+	Name: lcd_replay_open
+	Returns:
+		0 - on success, -1 - fopen failed (errno), -2 - not a recording or a newer version
+*/
+int lcd_replay_open(LCD_Replay_t *r, const char *path) {
+	uint8_t h[LCD_RECORD_HEADER];
+
+	memset(r, 0, sizeof(*r));
+	r->f = fopen(path, "rb");
+	if (!r->f) return -1;
+	if (fread(h, 1, sizeof(h), r->f) != sizeof(h) || memcmp(h, LCD_RECORD_MAGIC, 4) || h[4] < 1 || h[4] > LCD_RECORD_VERSION) {
+		fclose(r->f);
+		r->f = NULL;
+		return -2;
+	}
+	r->version = h[4];
+	r->bits = h[6];
+	r->cs_word = (h[20] & LCD_RECORD_CS_WORD) != 0;
+	for (int i=0; i<4; i++) r->speed |= (uint32_t)h[8+i] << (8*i);
+	for (int i=0; i<8; i++) r->start_ns |= (uint64_t)h[12+i] << (8*i);
+	return 0;
+}
+
+void lcd_replay_close(LCD_Replay_t *r) {
+	if (r->f) fclose(r->f);
+	free(r->data);
+	r->f = NULL;
+	r->data = NULL;
+}
+
+/*
+	Name: lcd_replay_next
+	Description: Read and expand the next record into r->kind, r->t_us, r->data, r->len.
+	Returns:
+		1 - got one, 0 - end of file, -2 - file damaged or cut short, -11 - out of memory
+*/
+int lcd_replay_next(LCD_Replay_t *r) {
+	uint64_t dt, len, tok, message = 0;
+	size_t units, u = 0;
+	int kind = fgetc(r->f);
+
+	if (kind == EOF) return 0;
+	if (!lcd_replay_varint(r->f, &dt) || !lcd_replay_varint(r->f, &len)) return -2;
+	if (len > (1u << 30) || (kind == LCD_REC_FRAME && len != 4) || (kind != LCD_REC_FRAME && kind != LCD_REC_ROWS)) return -2;
+	if (len > r->cap) {
+		uint8_t *p = (uint8_t *)realloc(r->data, len);
+		if (!p) return -11;
+		r->data = p;
+		r->cap = len;
+	}
+	if (kind == LCD_REC_ROWS && r->version >= 2 && (!lcd_replay_varint(r->f, &message) || message > (1u << 30))) return -2;
+	r->kind = kind;
+	r->t_us += dt;
+	r->len = len;
+	r->message = (int)message;
+
+	units = kind == LCD_REC_ROWS ? len / 8 : 0;
+	while (u < units) {
+		if (!lcd_replay_varint(r->f, &tok)) return -2;
+		size_t n = tok >> 1;
+		if (n == 0 || n > units - u) return -2;
+		if (tok & 1) {
+			if (fread(r->data + u*8, 1, 8, r->f) != 8) return -2;
+			for (size_t k=1; k<n; k*=2) memcpy(r->data + (u+k)*8, r->data + u*8, (k*2 <= n ? k : n - k) * 8);
+		} else if (fread(r->data + u*8, 1, n*8, r->f) != n*8) {
+			return -2;
+		}
+		u += n;
+	}
+	if (fread(r->data + units*8, 1, len - units*8, r->f) != len - units*8) return -2;
+	return 1;
+}
+
+/* controller timing lives in the pauses after reset and command frames (reset, sleep out) */
+static inline bool lcd_replay_holds(const LCD_Replay_t *r) {
+	if (r->kind != LCD_REC_FRAME) return false; // rows may be shorter than a frame, even empty
+	uint8_t ctl = r->data[3];
+	return ctl == 0x00 || ctl == 0x02 || ctl == 0x11 || ctl == 0x1B;
+}
+
+/*
+	Name: lcd_replay
+	Description: Send the recording at path to display d, converted to d's word size. Each record
+		goes out the way it was sent (lcd_send or lcd_send_rows), pixels in the message size
+		they were recorded with. Over spidev, records d cannot split that way (other cs_word,
+		smaller bufsiz) go out in d's largest messages and are counted in resplit; a shared
+		bus may still cut messages shorter.
+	Parameters:
+		1. d : pointer LCD_Display_t - opened display or transport
+		2. path : string - recording
+		3. fast : bool - false: every record at its recorded time (up to LCD_REPLAY_EARLY_US
+			early); true: back to back, only pauses of LCD_REPLAY_HOLD_US and more after reset
+			and command frames are kept so a panel still comes up
+		4. st : pointer LCD_ReplayStats_t - results, may be NULL
+	Returns:
+		0 - on success, negative - lcd_replay_open / lcd_replay_next error
+*/
+int lcd_replay(LCD_Display_t *d, const char *path, bool fast, LCD_ReplayStats_t *st) {
+	LCD_Replay_t r;
+	LCD_ReplayStats_t s = {};
+	struct timespec next;
+	uint64_t t0, hold_us = 0, prev_us = 0;
+	bool hold = false;
+	int e;
+
+	if ((e = lcd_replay_open(&r, path)) < 0) return e;
+	t0 = lcd_record_now();
+	while ((e = lcd_replay_next(&r)) > 0) {
+		/* shift the schedule by what fast mode skips */
+		if (fast && !(hold && r.t_us - prev_us >= LCD_REPLAY_HOLD_US)) hold_us += r.t_us - prev_us;
+		prev_us = r.t_us;
+		uint64_t due = t0 + (r.t_us - hold_us) * 1000;
+		if (due > lcd_record_now() + LCD_REPLAY_EARLY_US * 1000) {
+			next.tv_sec = due / 1000000000u;
+			next.tv_nsec = due % 1000000000u;
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+		}
+
+		hold = lcd_replay_holds(&r);
+		lcd_wire_order(r.data, r.data, r.len & ~(size_t)3, d->bits);
+		int chunk = r.message ? r.message : d->chunk;
+		if (r.kind == LCD_REC_ROWS && r.message && !d->xport && (r.cs_word != d->cs_word || r.message > spi_message_max(d->cs_word))) s.resplit++;
+		int n = r.kind == LCD_REC_FRAME ? lcd_send(d, r.data) : lcd_send_rows(d, r.data, r.len, 1, r.len, chunk);
+		if (n < 0 && !s.error) s.error = n;
+		s.records++;
+		s.bytes += r.len;
+	}
+	s.recorded_us = r.t_us;
+	s.wall_us = (lcd_record_now() - t0) / 1000;
+	lcd_replay_close(&r);
+	if (st) *st = s;
+	return e;
+}
+
+#endif
@@ -0,0 +1,104 @@
+// ************ SOFTWARE ROTATION **************
+// Rotating shadow buffer content by quarter turns. The panel rotates for free
+// with TM_ILI9341_Rotate; this is only for pixels that already sit in an
+// LCD_Buffer_t in the wrong orientation (e.g. a portrait sprite on a
+// landscape screen).
+// ---------------------------------------------
+
+#ifndef LCD_ROTATE_H
+#define LCD_ROTATE_H
+
+#include "lcd_display.h"
+
+/* Tile edge in pixels. A 32x32 tile of RGB565 is 32 source lines plus
+   32 destination lines of 64 bytes, 4 KB that stay in L1 while the tile
+   is transposed, so neither side walks the whole frame per pixel. */
+#define LCD_ROTATE_BLOCK 32
+
+/*
+	Name: lcd_buffer_rotate
+	Description: Rotate src clockwise by quarter * 90 degrees into dst.
+		Quarter turns 1 and 3 are transposes and run tile by tile, every tile is read
+		row-wise from src and written as short contiguous rows of dst.
+	Parameters:
+		1. src : pointer LCD_Buffer_t - source pixels
+		2. dst : pointer LCD_Buffer_t - destination, must be h x w for odd quarters, w x h otherwise;
+			dst->px must not overlap src->px
+		3. quarter : int - 0..3 clockwise quarter turns
+	Returns:
+		0 - on success, -1 - dst has the wrong size
+*/
+int lcd_buffer_rotate(const LCD_Buffer_t *src, LCD_Buffer_t *dst, int quarter) {
+	const int w = src->w, h = src->h;
+	const int ss = src->stride, ds = dst->stride;
+	const uint16_t *s = src->px;
+	uint16_t *o = dst->px;
+
+	quarter &= 3;
+	if (quarter & 1) {
+		if (dst->w != h || dst->h != w) return -1;
+	} else {
+		if (dst->w != w || dst->h != h) return -1;
+	}
+
+	switch (quarter) {
+	case 0:
+		for (int y=0; y<h; y++) memcpy(o + y*ds, s + y*ss, w * sizeof(uint16_t));
+		break;
+	case 2:
+		for (int y=0; y<h; y++) {
+			const uint16_t *sr = s + y*ss;
+			uint16_t *dr = o + (h-1-y)*ds + (w-1);
+			for (int x=0; x<w; x++) *dr-- = sr[x];
+		}
+		break;
+	case 1: /* src (x, y) -> dst (h-1-y, x) */
+		for (int by=0; by<h; by+=LCD_ROTATE_BLOCK) {
+			int ey = by + LCD_ROTATE_BLOCK < h ? by + LCD_ROTATE_BLOCK : h;
+			for (int bx=0; bx<w; bx+=LCD_ROTATE_BLOCK) {
+				int ex = bx + LCD_ROTATE_BLOCK < w ? bx + LCD_ROTATE_BLOCK : w;
+				for (int x=bx; x<ex; x++) {
+					uint16_t *dr = o + x*ds + (h-1-by);
+					const uint16_t *sc = s + by*ss + x;
+					for (int y=by; y<ey; y++, sc+=ss) *dr-- = *sc;
+				}
+			}
+		}
+		break;
+	case 3: /* src (x, y) -> dst (y, w-1-x) */
+		for (int by=0; by<h; by+=LCD_ROTATE_BLOCK) {
+			int ey = by + LCD_ROTATE_BLOCK < h ? by + LCD_ROTATE_BLOCK : h;
+			for (int bx=0; bx<w; bx+=LCD_ROTATE_BLOCK) {
+				int ex = bx + LCD_ROTATE_BLOCK < w ? bx + LCD_ROTATE_BLOCK : w;
+				for (int x=bx; x<ex; x++) {
+					uint16_t *dr = o + (w-1-x)*ds + by;
+					const uint16_t *sc = s + by*ss + x;
+					for (int y=by; y<ey; y++, sc+=ss) *dr++ = *sc;
+				}
+			}
+		}
+		break;
+	}
+	return 0;
+}
+
+/**
+ * @brief  Blit a buffer rotated by quarter turns, tmp must hold src->w * src->h pixels
+ */
+void lcd_blit_rotated(LCD_Display_t *d, int x, int y, const LCD_Buffer_t *src, int quarter, uint16_t *tmp) {
+	LCD_Buffer_t r;
+
+	if (quarter & 1) {
+		r.w = src->h;
+		r.h = src->w;
+	} else {
+		r.w = src->w;
+		r.h = src->h;
+	}
+	r.stride = r.w;
+	r.px = tmp;
+	lcd_buffer_rotate(src, &r, quarter);
+	lcd_blit_buffer(d, x, y, &r);
+}
+
+#endif
@@ -0,0 +1,542 @@
+// ************ DISPLAY SERVER **************
+// One process owns the panel, any number of others draw on it. Every client
+// gets a slot in a shared memory segment: a surface of RGB565 pixels it can
+// write directly (no copies, no syscalls) and a ring of draw commands (fill,
+// pixel, text) the server renders into that surface. Clients place their
+// surface on screen with a position and a z order; the server composites
+// the damaged parts of all visible surfaces off-screen and sends each
+// damaged rectangle once.
+// ------------------------------------------
+
+#ifndef LCD_SERVER_H
+#define LCD_SERVER_H
+
+#include <atomic>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "lcd_display.h"
+#include "lcd_damage.h"
+#include "lcd_draw.h"
+#include "lcd_queue.h"
+
+#define LCD_SERVER_NAME     "/kedei-lcd"  // shm_open name
+#define LCD_SERVER_CLIENTS  8             // slots, clients at the same time
+#define LCD_SERVER_RING     256           // commands per slot, must be a power of two
+#define LCD_SERVER_MAGIC    0x4B454431    // 'KED1', written last by the server
+
+typedef enum {
+	LCD_SRV_FILL,    // fill surface rectangle x, y .. x2, y2 with color
+	LCD_SRV_PIXEL,   // surface pixel x, y = color
+	LCD_SRV_TEXT,    // text at x, y in font, color on bg (or ILI9341_TRANSPARENT)
+	LCD_SRV_DAMAGE,  // the client wrote surface pixels x, y .. x2, y2 itself
+	LCD_SRV_MOVE,    // surface to screen x, y, layer x2, shown when y2 != 0
+	LCD_SRV_CLOSE    // last command of a client, frees the slot
+} LCD_SrvCmdType_t;
+
+/**
+ * @brief  One command in a slot ring, surface coordinates
+ * @note   No pointers, the segment is mapped at different addresses
+ */
+typedef struct {
+	uint8_t type;              /*!< LCD_SrvCmdType_t */
+	uint8_t font;              /*!< text: index in lcd_server_fonts */
+	int16_t x, y;
+	int16_t x2, y2;
+	uint32_t color;
+	uint32_t bg;
+	char text[LCD_QUEUE_TEXT_LEN];
+} LCD_SrvCmd_t;
+
+typedef enum {
+	LCD_SLOT_FREE,      /*!< with a pid: claimed, state not set yet */
+	LCD_SLOT_CLAIMED,   /*!< a client is setting it up */
+	LCD_SLOT_ACTIVE     /*!< the server reads its ring */
+} LCD_SlotState_t;
+
+/**
+ * @brief  Client slot: single producer (the client) / single consumer (the server) ring and surface
+ */
+typedef struct {
+	std::atomic<uint32_t> state;       /*!< LCD_SlotState_t */
+	std::atomic<int32_t> pid;          /*!< client process, claims the slot (0 - free); freed when it dies */
+	int16_t w, h;                      /*!< surface size asked for, the server checks and copies it */
+	alignas(64) std::atomic<uint32_t> head;  /*!< next command to write, client */
+	alignas(64) std::atomic<uint32_t> tail;  /*!< next command to apply, server */
+	std::atomic<uint32_t> overflow;    /*!< commands the client could not queue, ring full */
+	LCD_SrvCmd_t ring[LCD_SERVER_RING];
+	uint16_t px[ILI9341_PIXEL];        /*!< surface, w pixels per row */
+} LCD_SrvSlot_t;
+
+/**
+ * @brief  The shared memory segment
+ */
+typedef struct {
+	std::atomic<uint32_t> magic;       /*!< LCD_SERVER_MAGIC once the server set everything up */
+	uint32_t size;                     /*!< sizeof(LCD_SrvShm_t), client and server must agree */
+	uint16_t width, height;            /*!< screen */
+	int32_t pid;                       /*!< server */
+	LCD_SrvSlot_t slot[LCD_SERVER_CLIENTS];
+} LCD_SrvShm_t;
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "shared memory rings need lock-free atomics");
+
+/* fonts by index, pointers differ between processes; only these can be sent with lcd_client_text */
+static TM_FontDef_t *const lcd_server_fonts[] = { &TM_Font_7x10, &TM_Font_11x18, &TM_Font_16x26 };
+#define LCD_SERVER_FONTS ((int)(sizeof(lcd_server_fonts) / sizeof(lcd_server_fonts[0])))
+
+/**
+ * @brief  Server side placement of a slot, only the server touches it
+ */
+typedef struct {
+	LCD_Rect_t region;     /*!< surface on screen */
+	int z;                 /*!< higher layers cover lower ones, equal layers by slot */
+	bool visible;
+	int16_t w, h;          /*!< surface size, checked when the slot turned active; 0 - not yet */
+} LCD_SrvPlace_t;
+
+typedef struct {
+	LCD_Display_t *d;
+	LCD_SrvShm_t *shm;
+	char name[64];
+	uint16_t bg;                               /*!< where no surface is */
+	LCD_SrvPlace_t place[LCD_SERVER_CLIENTS];
+	LCD_Damage_t damage;                       /*!< screen areas to composite */
+	uint16_t *tmp;                             /*!< composite buffer, a screen */
+	uint32_t commands;                         /*!< applied */
+	uint32_t windows;                          /*!< sent */
+	uint64_t pixels;                           /*!< sent */
+	uint32_t reaped;                           /*!< slots freed because the client died */
+	uint32_t rejected;                         /*!< slots freed because of a bad surface size */
+} LCD_Server_t;
+
+/**
+ * @brief  Client handle, one per process (or per thread holding its own slot)
+ */
+typedef struct {
+	LCD_SrvShm_t *shm;
+	LCD_SrvSlot_t *slot;
+	LCD_Buffer_t surface;  /*!< the slot pixels, write them and call lcd_client_damage */
+} LCD_Client_t;
+
+
+/* ************************************************************
+	SERVER
+   ************************************************************ */
+
+/*
+	Name: lcd_server_open
+	Description: Create the shared memory segment name (LCD_SERVER_NAME) for display d, which the
+		server owns from now on.
+	Parameters:
+		1. s : pointer LCD_Server_t - server to set up
+		2. d : pointer LCD_Display_t - opened and initialized display
+		3. name : string - shm_open name, starts with '/'
+		4. bg : uint16_t - screen color where no surface is
+	Returns:
+		0 - on success, -1 - shm_open / ftruncate / mmap failed (errno), -2 - another server
+		runs on name, -11 - out of memory
+*/
+int lcd_server_open(LCD_Server_t *s, LCD_Display_t *d, const char *name, uint16_t bg) {
+	int fd;
+	void *m;
+
+	memset(s, 0, sizeof(*s));
+	s->d = d;
+	s->bg = bg;
+	snprintf(s->name, sizeof(s->name), "%s", name);
+	lcd_damage_init(&s->damage, &d->dirty.cost);
+	s->tmp = (uint16_t *)malloc(ILI9341_PIXEL * sizeof(uint16_t));
+	if (!s->tmp) return -11;
+
+	/* a segment left by a server that died is replaced, a live server's is not */
+	fd = shm_open(name, O_RDONLY, 0);
+	if (fd >= 0) {
+		m = mmap(NULL, sizeof(LCD_SrvShm_t), PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+		if (m != MAP_FAILED) {
+			const LCD_SrvShm_t *old = (const LCD_SrvShm_t *)m;
+			bool live = old->magic.load(std::memory_order_acquire) == LCD_SERVER_MAGIC && kill(old->pid, 0) == 0;
+			munmap(m, sizeof(LCD_SrvShm_t));
+			if (live) return -2;
+		}
+		shm_unlink(name);
+	}
+	fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0666);
+	if (fd < 0) return -1;
+	fchmod(fd, 0666); // umask must not lock other users' clients out
+	if (ftruncate(fd, sizeof(LCD_SrvShm_t)) < 0) {
+		close(fd);
+		shm_unlink(name);
+		return -1;
+	}
+	m = mmap(NULL, sizeof(LCD_SrvShm_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (m == MAP_FAILED) {
+		shm_unlink(name);
+		return -1;
+	}
+
+	/* fresh pages are zero: every slot free, rings empty, surfaces black */
+	s->shm = (LCD_SrvShm_t *)m;
+	s->shm->size = sizeof(LCD_SrvShm_t);
+	s->shm->width = d->opts.width;
+	s->shm->height = d->opts.height;
+	s->shm->pid = getpid();
+	s->shm->magic.store(LCD_SERVER_MAGIC, std::memory_order_release);
+
+	lcd_damage_add(&s->damage, lcd_rect(0, 0, d->opts.width - 1, d->opts.height - 1));
+	return 0;
+}
+
+/**
+ * @brief  Unmap and remove the segment; clients still mapping it keep drawing into nothing
+ */
+void lcd_server_close(LCD_Server_t *s) {
+	if (s->shm) {
+		s->shm->magic.store(0, std::memory_order_release);
+		munmap(s->shm, sizeof(LCD_SrvShm_t));
+		shm_unlink(s->name);
+	}
+	free(s->tmp);
+	s->shm = NULL;
+	s->tmp = NULL;
+}
+
+/* surface rectangle r of slot i changed, damage what of it shows */
+void lcd_server_damage(LCD_Server_t *s, int i, const LCD_Rect_t *r) {
+	const LCD_SrvPlace_t *p = &s->place[i];
+	LCD_Rect_t scr = lcd_rect(0, 0, s->d->opts.width - 1, s->d->opts.height - 1), c;
+
+	if (!p->visible) return;
+	LCD_Rect_t m = lcd_rect(r->x0 + p->region.x0, r->y0 + p->region.y0, r->x1 + p->region.x0, r->y1 + p->region.y0);
+	if (lcd_rect_clip(&scr, &m, &c)) lcd_damage_add(&s->damage, c);
+}
+
+/* take slot i out of the picture and hand it back; the pid goes last, it frees the slot */
+void lcd_server_drop(LCD_Server_t *s, int i) {
+	LCD_SrvSlot_t *sl = &s->shm->slot[i];
+	LCD_SrvPlace_t *p = &s->place[i];
+	LCD_Rect_t all = lcd_rect(0, 0, p->w - 1, p->h - 1);
+	size_t px = p->w ? (size_t)p->w * p->h : ILI9341_PIXEL; // never checked: clear it all
+
+	if (p->w) lcd_server_damage(s, i, &all);
+	memset(p, 0, sizeof(*p));
+	memset(sl->px, 0, px * sizeof(uint16_t));
+	sl->head.store(0, std::memory_order_relaxed);
+	sl->tail.store(0, std::memory_order_relaxed);
+	sl->overflow.store(0, std::memory_order_relaxed);
+	sl->state.store(LCD_SLOT_FREE, std::memory_order_relaxed);
+	sl->pid.store(0, std::memory_order_release);
+}
+
+/* copy the surface size of a slot that just turned active, the client may write anything */
+bool lcd_server_bind(LCD_Server_t *s, int i) {
+	const LCD_SrvSlot_t *sl = &s->shm->slot[i];
+	int w = sl->w, h = sl->h;
+
+	if (w < 1 || h < 1 || w * h > ILI9341_PIXEL) return false;
+	s->place[i].w = (int16_t)w;
+	s->place[i].h = (int16_t)h;
+	return true;
+}
+
+void lcd_server_apply(LCD_Server_t *s, int i, const LCD_SrvCmd_t *c) {
+	LCD_SrvSlot_t *sl = &s->shm->slot[i];
+	LCD_SrvPlace_t *p = &s->place[i];
+	LCD_Buffer_t b = { p->w, p->h, p->w, sl->px };
+	LCD_Rect_t r;
+
+	switch (c->type) {
+	case LCD_SRV_FILL:
+		if (!lcd_surface_clip(&b, c->x, c->y, c->x2, c->y2, &r)) break;
+		lcd_surface_fill(&b, &r, (uint16_t)c->color);
+		lcd_server_damage(s, i, &r);
+		break;
+	case LCD_SRV_PIXEL:
+		if (!lcd_surface_clip(&b, c->x, c->y, c->x, c->y, &r)) break;
+		b.px[r.y0*b.stride + r.x0] = (uint16_t)c->color;
+		lcd_server_damage(s, i, &r);
+		break;
+	case LCD_SRV_TEXT: {
+		char text[LCD_QUEUE_TEXT_LEN];
+		memcpy(text, c->text, sizeof(text));
+		text[sizeof(text) - 1] = 0; // the client may write anything
+		if (c->font >= LCD_SERVER_FONTS) break;
+		if (lcd_surface_text(&b, c->x, c->y, text, lcd_server_fonts[c->font], c->color, c->bg, &r)) lcd_server_damage(s, i, &r);
+		break;
+	}
+	case LCD_SRV_DAMAGE:
+		if (lcd_surface_clip(&b, c->x, c->y, c->x2, c->y2, &r)) lcd_server_damage(s, i, &r);
+		break;
+	case LCD_SRV_MOVE:
+		r = lcd_rect(0, 0, p->w - 1, p->h - 1);
+		lcd_server_damage(s, i, &r); // what it covered before
+		p->region = lcd_rect(c->x, c->y, c->x + p->w - 1, c->y + p->h - 1);
+		p->z = c->x2;
+		p->visible = c->y2 != 0;
+		lcd_server_damage(s, i, &r);
+		break;
+	case LCD_SRV_CLOSE:
+		lcd_server_drop(s, i);
+		break;
+	}
+}
+
+/*
+	Name: lcd_server_composite
+	Description: Coalesce the damage and redraw every rectangle of the plan from the surfaces,
+		lowest layer first, into one window each. Flushes the display at the end.
+	Returns:
+		number of windows sent
+*/
+int lcd_server_composite(LCD_Server_t *s) {
+	int order[LCD_SERVER_CLIENTS], n = 0;
+	LCD_Buffer_t buf;
+
+	if (lcd_damage_coalesce(&s->damage) == 0) return 0;
+
+	/* visible slots by layer, insertion sort keeps slot order within a layer */
+	for (int i=0; i<LCD_SERVER_CLIENTS; i++) {
+		if (!s->place[i].visible) continue;
+		int k = n++;
+		while (k > 0 && s->place[order[k-1]].z > s->place[i].z) {
+			order[k] = order[k-1];
+			k--;
+		}
+		order[k] = i;
+	}
+
+	for (int j=0; j<s->damage.n; j++) {
+		const LCD_Rect_t *r = &s->damage.r[j];
+		buf.w = buf.stride = r->x1 - r->x0 + 1;
+		buf.h = r->y1 - r->y0 + 1;
+		buf.px = s->tmp;
+		LCD_Rect_t all = lcd_rect(0, 0, buf.w - 1, buf.h - 1);
+		lcd_surface_fill(&buf, &all, s->bg);
+		for (int k=0; k<n; k++) {
+			const LCD_SrvSlot_t *sl = &s->shm->slot[order[k]];
+			const LCD_SrvPlace_t *p = &s->place[order[k]];
+			const LCD_Rect_t *g = &p->region;
+			LCD_Rect_t c;
+			if (!lcd_rect_clip(g, r, &c)) continue;
+			for (int y=c.y0; y<=c.y1; y++) {
+				memcpy(buf.px + (y - r->y0)*buf.stride + (c.x0 - r->x0),
+					sl->px + (y - g->y0)*p->w + (c.x0 - g->x0), (c.x1 - c.x0 + 1) * sizeof(uint16_t));
+			}
+		}
+		lcd_blit_buffer(s->d, r->x0, r->y0, &buf);
+		s->windows++;
+		s->pixels += buf.w * buf.h;
+	}
+	n = s->damage.n;
+	lcd_damage_clear(&s->damage);
+	lcd_flush(s->d); // with a shadow buffer the windows above only reached the shadow
+	return n;
+}
+
+/*
+	Name: lcd_server_poll
+	Description: Free the slots of dead clients, apply every queued command of the live ones
+		and composite what changed.
+	Returns:
+		commands applied
+*/
+int lcd_server_poll(LCD_Server_t *s) {
+	int applied = 0;
+
+	for (int i=0; i<LCD_SERVER_CLIENTS; i++) {
+		LCD_SrvSlot_t *sl = &s->shm->slot[i];
+		int32_t pid = sl->pid.load(std::memory_order_acquire);
+		uint32_t state = sl->state.load(std::memory_order_acquire);
+
+		if (pid == 0) continue; // free
+		if (state == LCD_SLOT_ACTIVE && !s->place[i].w && !lcd_server_bind(s, i)) {
+			lcd_server_drop(s, i);
+			s->rejected++;
+			continue;
+		}
+		if (state == LCD_SLOT_ACTIVE) {
+			uint32_t pos = sl->tail.load(std::memory_order_relaxed);
+			uint32_t head = sl->head.load(std::memory_order_acquire);
+			if (head - pos > LCD_SERVER_RING) pos = head - LCD_SERVER_RING; // a broken client, keep the newest
+			while (pos != head && sl->state.load(std::memory_order_relaxed) == LCD_SLOT_ACTIVE) {
+				LCD_SrvCmd_t c = sl->ring[pos & (LCD_SERVER_RING-1)];
+				sl->tail.store(++pos, std::memory_order_release);
+				lcd_server_apply(s, i, &c);
+				applied++;
+			}
+		}
+		/* after the ring: a client that closed and exited left its last commands there.
+		   One that died while claiming left its pid on a slot that never turned active. */
+		if (sl->pid.load(std::memory_order_relaxed) == pid && (pid < 0 || (kill(pid, 0) < 0 && errno == ESRCH))) {
+			lcd_server_drop(s, i);
+			s->reaped++;
+		}
+	}
+	s->commands += applied;
+	lcd_server_composite(s);
+	return applied;
+}
+
+/*
+	Name: lcd_server_run
+	Description: Server loop, polls until *stop is set. Sleeps idle_us between polls while no
+		client has anything queued.
+*/
+void lcd_server_run(LCD_Server_t *s, std::atomic<int> *stop, int idle_us) {
+	while (!stop->load(std::memory_order_acquire)) {
+		if (lcd_server_poll(s) == 0) delayus(idle_us);
+	}
+	lcd_server_poll(s);
+}
+
+
+/* ************************************************************
+	CLIENT
+   ************************************************************ */
+
+/*
+	Name: lcd_client_push
+	Description: Queue a command for the server. Never blocks.
+	Returns:
+		0 - queued, -1 - ring full (counted in overflow), command dropped
+*/
+int lcd_client_push(LCD_Client_t *c, const LCD_SrvCmd_t *cmd) {
+	LCD_SrvSlot_t *sl = c->slot;
+	uint32_t head = sl->head.load(std::memory_order_relaxed);
+
+	if (head - sl->tail.load(std::memory_order_acquire) >= LCD_SERVER_RING) {
+		sl->overflow.fetch_add(1, std::memory_order_relaxed);
+		return -1;
+	}
+	sl->ring[head & (LCD_SERVER_RING-1)] = *cmd;
+	sl->head.store(head + 1, std::memory_order_release);
+	return 0;
+}
+
+/**
+ * @brief  Put the surface at x, y on screen in layer z (higher covers lower), shown or hidden
+ */
+int lcd_client_move(LCD_Client_t *c, int16_t x, int16_t y, int16_t z, bool visible) {
+	LCD_SrvCmd_t cmd = {};
+	cmd.type = LCD_SRV_MOVE;
+	cmd.x = x; cmd.y = y; cmd.x2 = z; cmd.y2 = visible;
+	return lcd_client_push(c, &cmd);
+}
+
+/*
+	Name: lcd_client_open
+	Description: Connect to the server of segment name and claim a w x h surface at x, y in
+		layer z. The surface starts black and shown.
+	Returns:
+		0 - on success, -1 - no server (errno), -2 - server built differently, -3 - no free slot,
+		-4 - bad size
+*/
+int lcd_client_open(LCD_Client_t *c, const char *name, int16_t x, int16_t y, int16_t w, int16_t h, int16_t z) {
+	int fd;
+	void *m;
+
+	memset(c, 0, sizeof(*c));
+	if (w < 1 || h < 1 || (int)w * h > ILI9341_PIXEL) return -4;
+	fd = shm_open(name, O_RDWR, 0);
+	if (fd < 0) return -1;
+	m = mmap(NULL, sizeof(LCD_SrvShm_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (m == MAP_FAILED) return -1;
+	c->shm = (LCD_SrvShm_t *)m;
+	if (c->shm->magic.load(std::memory_order_acquire) != LCD_SERVER_MAGIC || c->shm->size != sizeof(LCD_SrvShm_t)) {
+		munmap(m, sizeof(LCD_SrvShm_t));
+		c->shm = NULL;
+		return -2;
+	}
+
+	/* the pid is the claim, so a slot never belongs to nobody while it is not free */
+	for (int i=0; i<LCD_SERVER_CLIENTS && !c->slot; i++) {
+		int32_t none = 0;
+		if (c->shm->slot[i].pid.compare_exchange_strong(none, getpid(), std::memory_order_acquire)) {
+			c->slot = &c->shm->slot[i];
+			c->slot->state.store(LCD_SLOT_CLAIMED, std::memory_order_relaxed);
+		}
+	}
+	if (!c->slot) {
+		munmap(m, sizeof(LCD_SrvShm_t));
+		c->shm = NULL;
+		return -3;
+	}
+	c->slot->w = w;
+	c->slot->h = h;
+	c->surface.w = c->surface.stride = w;
+	c->surface.h = h;
+	c->surface.px = c->slot->px;
+	lcd_client_move(c, x, y, z, true);
+	c->slot->state.store(LCD_SLOT_ACTIVE, std::memory_order_release);
+	return 0;
+}
+
+/**
+ * @brief  Give the slot back once the server applied everything queued before, then unmap
+ */
+void lcd_client_close(LCD_Client_t *c) {
+	LCD_SrvCmd_t cmd = {};
+	if (!c->shm) return;
+	cmd.type = LCD_SRV_CLOSE;
+	while (lcd_client_push(c, &cmd) < 0) delayus(1000);
+	munmap(c->shm, sizeof(LCD_SrvShm_t));
+	c->shm = NULL;
+	c->slot = NULL;
+}
+
+/**
+ * @brief  Draw commands in surface coordinates, all return lcd_client_push result
+ */
+int lcd_client_fill(LCD_Client_t *c, int16_t x0, int16_t y0, int16_t x1, int16_t y1, uint16_t color) {
+	LCD_SrvCmd_t cmd = {};
+	cmd.type = LCD_SRV_FILL;
+	cmd.x = x0; cmd.y = y0; cmd.x2 = x1; cmd.y2 = y1;
+	cmd.color = color;
+	return lcd_client_push(c, &cmd);
+}
+
+int lcd_client_pixel(LCD_Client_t *c, int16_t x, int16_t y, uint16_t color) {
+	LCD_SrvCmd_t cmd = {};
+	cmd.type = LCD_SRV_PIXEL;
+	cmd.x = x; cmd.y = y;
+	cmd.color = color;
+	return lcd_client_push(c, &cmd);
+}
+
+/*
+	Name: lcd_client_text
+	Description: Text in one of the lcd_server_fonts. Only those cross the process boundary, as an
+		index; other fonts (e.g. lcd_font_proportional ones) can be rendered into c->surface with
+		lcd_surface_text and shown with lcd_client_damage.
+	Returns:
+		see lcd_client_push, -2 - str longer than LCD_QUEUE_TEXT_LEN - 1, -3 - font not in lcd_server_fonts
+*/
+int lcd_client_text(LCD_Client_t *c, int16_t x, int16_t y, const char *str, TM_FontDef_t *font, uint32_t foreground, uint32_t background) {
+	LCD_SrvCmd_t cmd = {};
+	size_t len = strlen(str);
+	if (len >= LCD_QUEUE_TEXT_LEN) return -2; // split longer strings
+	cmd.type = LCD_SRV_TEXT;
+	while (cmd.font < LCD_SERVER_FONTS && lcd_server_fonts[cmd.font] != font) cmd.font++;
+	if (cmd.font == LCD_SERVER_FONTS) return -3;
+	cmd.x = x; cmd.y = y;
+	cmd.color = foreground;
+	cmd.bg = background;
+	memcpy(cmd.text, str, len+1);
+	return lcd_client_push(c, &cmd);
+}
+
+/**
+ * @brief  Pixels x0, y0 .. x1, y1 of c->surface were written directly, show them
+ */
+int lcd_client_damage(LCD_Client_t *c, int16_t x0, int16_t y0, int16_t x1, int16_t y1) {
+	LCD_SrvCmd_t cmd = {};
+	cmd.type = LCD_SRV_DAMAGE;
+	cmd.x = x0; cmd.y = y0; cmd.x2 = x1; cmd.y2 = y1;
+	return lcd_client_push(c, &cmd);
+}
+
+#endif
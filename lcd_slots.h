@@ -0,0 +1,68 @@
+// ************ PER-THREAD SLOTS **************
+// Fixed table of per-thread blocks for recorders that must not lock on the
+// draw path (lcd_trace.h rings, lcd_stats.h histograms). A thread claims
+// its block on its first call and from then on writes only to it; readers
+// walk the table while the writers go on. Threads beyond the table get no
+// block and their calls are counted in lost.
+// -------------------------------------------
+
+#ifndef LCD_SLOTS_H
+#define LCD_SLOTS_H
+
+#include <atomic>
+#include <stdint.h>
+#include <stdlib.h>
+
+/**
+ * @brief  Up to N blocks of T, zero initialised as a static
+ */
+template <class T, int N>
+struct LCD_Slots {
+	std::atomic<int> n;           /*!< blocks handed out, may run past N */
+	std::atomic<T *> slot[N];
+	std::atomic<uint32_t> lost;   /*!< calls of threads without a block */
+};
+
+/*
+	Name: lcd_slot
+	Description: Block of the calling thread in s, calloc'ed and passed to init on its first
+		call and published after that. A thread that found the table full (or calloc failing)
+		keeps getting NULL without trying again; every such call is counted in lost.
+		One table per block type: the thread's pointer lives with the T, N instance.
+	Returns:
+		the block, NULL - no block for this thread
+*/
+template <class T, int N>
+T *lcd_slot(LCD_Slots<T, N> *s, void (*init)(T *)) {
+	static thread_local T *self;
+	static thread_local bool full;
+
+	if (self) return self;
+	if (!full) {
+		int i = s->n.fetch_add(1);
+		T *b = i < N ? (T *)calloc(1, sizeof(T)) : NULL;
+		if (b) {
+			if (init) init(b);
+			s->slot[i].store(b, std::memory_order_release);
+			return self = b;
+		}
+		full = true;
+	}
+	s->lost.fetch_add(1, std::memory_order_relaxed);
+	return NULL;
+}
+
+/* blocks handed out, the bound for lcd_slot_at */
+template <class T, int N>
+int lcd_slots_used(LCD_Slots<T, N> *s) {
+	int n = s->n.load();
+	return n < N ? n : N;
+}
+
+/* block i as published, NULL while its thread is still setting it up */
+template <class T, int N>
+T *lcd_slot_at(LCD_Slots<T, N> *s, int i) {
+	return s->slot[i].load(std::memory_order_acquire);
+}
+
+#endif
@@ -0,0 +1,696 @@
+// ************ KEDEI SPI TRANSPORT **************
+// spidev access used by the LCD routines (lcd_display.h)
+// ----------------------------------------------
+
+#ifndef LCD_SPI_H
+#define LCD_SPI_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <cstring>
+#include <iostream>
+#include <atomic>
+#include <errno.h> // error handling
+#include <time.h> // for delay function
+#include <stdint.h> // aliases for int types (unsigned char = uint8_t, etc...)
+#include <unistd.h>
+#include <pthread.h>
+// for spi
+#include <fcntl.h> // file control options
+#include <sys/ioctl.h> // I/O control routines ( ioctl() function)
+#include <linux/spi/spidev.h> // SPI options
+
+#include "lcd_trace.h"
+#include "lcd_stats.h"
+
+//#define _DEBUG_
+
+#define SPI_TUNE_FILE "/etc/kedei_spi.conf" // settings written by the autotuner (lcd_tune.h), $KEDEI_SPI_CONF overrides
+#define SPI_BUFSIZ_FILE "/sys/module/spidev/parameters/bufsiz" // bytes per message spidev accepts, $KEDEI_SPI_BUFSIZ overrides
+#define SPI_BUFSIZ 4096    // spidev's default, used when the module parameter cannot be read
+#define SPI_XFER_MAX 511   // transfers per message: SPI_IOC_MESSAGE has a 14 bit size field, 16383 / 32 byte transfers
+#define SPI_TRANSMIT_XFERS 64 // transfers per spi_transmit message, 16 frames at 8 bits per word
+
+int delayus(int us) {
+	struct timespec tim, timr;
+	tim.tv_sec = 0;
+	tim.tv_nsec = (long)(us * 1000);
+	
+	return nanosleep(&tim, &timr);
+}
+
+int delayms(int ms) {
+	struct timespec tim, timr;
+	tim.tv_sec = 0;
+	tim.tv_nsec = (long)(ms * 1000000);
+	
+	return nanosleep(&tim, &timr);
+}
+
+int delays(int s) {
+	struct timespec tim, timr;
+	tim.tv_sec = s;
+	tim.tv_nsec = 0;
+	
+	return nanosleep(&tim, &timr);
+}
+
+
+/* ************************************************************
+	TUNED SETTINGS
+   ************************************************************ */
+
+/**
+ * @brief  Best transport settings found for one spidev node
+ */
+typedef struct {
+	uint32_t speed;   /*!< SPI clock in Hz */
+	int chunk;        /*!< bytes per bulk message, multiple of 8 (one pixel) */
+} SPI_Tune_t;
+
+const char *spi_tune_path(void) {
+	const char *p = getenv("KEDEI_SPI_CONF");
+	return p && *p ? p : SPI_TUNE_FILE;
+}
+
+/*
+	Name: spi_tune_load
+	Description: Look up the settings of spidev in the tune file. One line per device:
+		"<spidev> <speed_hz> <chunk_bytes>", lines starting with '#' are comments.
+	Parameters:
+		1. spidev : string - spi device
+		2. t : pointer SPI_Tune_t - filled in when found
+	Returns:
+		0 - found, -1 - no tune file, -2 - no valid line for spidev
+*/
+int spi_tune_load(std::string spidev, SPI_Tune_t *t) {
+	char line[256], dev[128];
+	unsigned long speed;
+	int chunk, r = -2;
+
+	FILE *f = fopen(spi_tune_path(), "r");
+	if (!f) return -1;
+	while (fgets(line, sizeof(line), f)) {
+		if (line[0] == '#') continue;
+		if (sscanf(line, "%127s %lu %d", dev, &speed, &chunk) != 3) continue;
+		if (spidev != dev || speed == 0 || chunk < 8) continue;
+		t->speed = speed;
+		t->chunk = chunk;
+		r = 0;
+	}
+	fclose(f);
+	return r;
+}
+
+/*
+	Name: spi_tune_save
+	Description: Store the settings of spidev in the tune file, keeping the lines of other devices.
+		The file is written next to the old one and renamed over it.
+	Returns:
+		0 - on success, negative - file could not be written
+*/
+int spi_tune_save(std::string spidev, const SPI_Tune_t *t) {
+	std::string path = spi_tune_path();
+	std::string tmp = path + ".tmp";
+	std::string keep;
+	char line[256], dev[128];
+
+	FILE *f = fopen(path.c_str(), "r");
+	if (f) {
+		while (fgets(line, sizeof(line), f)) {
+			if (sscanf(line, "%127s", dev) == 1 && spidev == dev) continue;
+			keep += line;
+		}
+		fclose(f);
+	} else {
+		keep = "# KeDei SPI transport, written by the autotuner: <spidev> <speed_hz> <chunk_bytes>\n";
+	}
+
+	f = fopen(tmp.c_str(), "w");
+	if (!f) return -1;
+	fputs(keep.c_str(), f);
+	fprintf(f, "%s %u %d\n", spidev.c_str(), t->speed, t->chunk);
+	if (fclose(f) != 0) return -2;
+	if (rename(tmp.c_str(), path.c_str()) < 0) return -3;
+	return 0;
+}
+
+
+/* ************************************************************
+	TRANSFER LIMITS
+   ************************************************************ */
+
+/*
+	Name: spi_bufsiz
+	Description: Largest message spidev takes, its bufsiz module parameter (read once).
+		$KEDEI_SPI_BUFSIZ overrides it, e.g. when the driver is built in and sysfs does not show it.
+		Safe from several threads: panels opening at the same time may each read the
+		parameter, they store the same value.
+	Returns:
+		bytes, a multiple of 4
+*/
+int spi_bufsiz(void) {
+	static std::atomic<int> bufsiz(0);
+	const char *env;
+	FILE *f;
+	int v = bufsiz.load(std::memory_order_relaxed);
+
+	if (v) return v;
+	env = getenv("KEDEI_SPI_BUFSIZ");
+	if (env && *env) {
+		v = atoi(env);
+	} else if ((f = fopen(SPI_BUFSIZ_FILE, "r")) != NULL) {
+		if (fscanf(f, "%d", &v) != 1) v = 0;
+		fclose(f);
+	}
+	if (v < 4) v = SPI_BUFSIZ;
+	v &= ~3;
+	bufsiz.store(v, std::memory_order_relaxed);
+	return v;
+}
+
+/**
+ * @brief  Bytes of frames one message can carry: one transfer per frame, or with SPI_CS_WORD
+ *         (chip select toggled by the controller after every 32 bit word) only bufsiz counts
+ */
+int spi_message_max(bool cs_word) {
+	int m = spi_bufsiz();
+	if (!cs_word && m > SPI_XFER_MAX * 4) m = SPI_XFER_MAX * 4;
+	return m;
+}
+
+
+/* ************************************************************
+	SHARED BUS
+   ************************************************************ */
+
+/**
+ * @brief  Arbiter for spidev nodes on one controller, e.g. the panel and its touch controller.
+ * @note   Messages of the nodes sharing it are sent one at a time in the order they were
+ *         requested (ticket lock), so a waiting node gets the bus after at most one message.
+ *         Bulk senders keep their messages within slice_us of wire time (see spi_bus_bytes),
+ *         which bounds that wait.
+ */
+typedef struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	uint32_t next;          /*!< next ticket to hand out */
+	uint32_t serving;       /*!< ticket allowed on the bus */
+	uint32_t slice_us;      /*!< longest message of a bulk sender in us of wire time, 0 - unbounded */
+	uint32_t messages;      /*!< messages sent */
+	uint32_t contended;     /*!< messages that had to wait for another one */
+	uint32_t wait_max_us;   /*!< longest wait for the bus */
+} SPI_Bus_t;
+
+void spi_bus_init(SPI_Bus_t *bus, uint32_t slice_us) {
+	memset(bus, 0, sizeof(*bus));
+	pthread_mutex_init(&bus->lock, NULL);
+	pthread_cond_init(&bus->cond, NULL);
+	bus->slice_us = slice_us;
+}
+
+void spi_bus_destroy(SPI_Bus_t *bus) {
+	pthread_cond_destroy(&bus->cond);
+	pthread_mutex_destroy(&bus->lock);
+}
+
+/* wait for our turn on bus, nothing to wait for when it is NULL (not shared) */
+SPI_Bus_t *spi_bus_acquire(SPI_Bus_t *bus) {
+	struct timespec t0, t1;
+	uint32_t ticket;
+
+	if (!bus) return NULL;
+	pthread_mutex_lock(&bus->lock);
+	ticket = bus->next++;
+	if (bus->serving != ticket) {
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		while (bus->serving != ticket) pthread_cond_wait(&bus->cond, &bus->lock);
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		uint32_t us = (uint32_t)((t1.tv_sec - t0.tv_sec) * 1000000 + (t1.tv_nsec - t0.tv_nsec) / 1000);
+		if (us > bus->wait_max_us) bus->wait_max_us = us;
+		bus->contended++;
+	}
+	bus->messages++;
+	pthread_mutex_unlock(&bus->lock);
+	return bus;
+}
+
+void spi_bus_release(SPI_Bus_t *bus) {
+	if (!bus) return;
+	pthread_mutex_lock(&bus->lock);
+	bus->serving++;
+	pthread_cond_broadcast(&bus->cond);
+	pthread_mutex_unlock(&bus->lock);
+}
+
+/**
+ * @brief  Bytes a bulk message on bus may carry at speed Hz, a multiple of 8 (one pixel);
+ *         0 - no limit (bus NULL or slice_us 0)
+ */
+int spi_bus_bytes(SPI_Bus_t *bus, uint32_t speed) {
+	if (!bus || !bus->slice_us) return 0;
+	uint64_t b = (uint64_t)bus->slice_us * speed / 8000000u;
+	if (b > 0x40000000) b = 0x40000000;
+	return b < 8 ? 8 : (int)b & ~7;
+}
+
+/* bytes carried by a message, for the tracer */
+static inline uint32_t spi_message_bytes(int cnt, const struct spi_ioc_transfer *buf) {
+	uint32_t n = 0;
+	for (int i=0; i<cnt; i++) n += buf[i].len;
+	return n;
+}
+
+/* one SPI_IOC_MESSAGE, in turn with the other nodes on bus when it is not NULL */
+int spi_message(int *h, SPI_Bus_t *bus, int cnt, struct spi_ioc_transfer *buf) {
+	int r;
+
+	spi_bus_acquire(bus);
+	{
+		LCD_TRACE_SCOPE(LCD_TR_IOCTL, lcd_trace_on() ? spi_message_bytes(cnt, buf) : 0);
+		r = ioctl(*h, SPI_IOC_MESSAGE(cnt), buf);
+	}
+	spi_bus_release(bus);
+	return r;
+}
+
+
+/* ************************************************************
+	BASIC SPI OPERATIONS 
+   ************************************************************ */
+
+/*
+	Name: spi_open
+	Description: Open SPI device and configure mode
+	Parameters:
+		1. h : pointer int32 - return device handle
+		2. spidev : string - spi device
+		3. mode : uint8_t - spi mode
+		4. bits : uint8_t - bits per word (normally 8)
+		5. speed : uint32_t - SPI clk speed in Hz, replaced by the tuned speed when the tune file
+			has an entry for spidev. The driver may round it, read the result with spi_get_speed.
+	Returns:
+		0 - on success, non-zero - fail, see function content for error return values. Alos check errno for more information.
+*/
+int spi_open(int *h, std::string spidev, uint8_t mode, uint8_t bits, uint32_t speed) {
+	int r;
+	uint8_t t8;
+	uint32_t t32;
+	SPI_Tune_t tune;
+	//*h = 0; // reset device handle
+	
+	if (spi_tune_load(spidev, &tune) == 0) {
+		speed = tune.speed;
+	}
+	
+	#ifdef _DEBUG_
+		std::cout << "SPI.SETUP: Messages up to " << spi_bufsiz() << " bytes, " << SPI_XFER_MAX << " transfers." << std::endl;
+	#else
+		spi_bufsiz(); // read the limit once now, not in the middle of a frame
+	#endif
+	
+	// open spi device
+	*h = open(spidev.c_str(), O_RDWR); // open spi device for R/W
+	if (*h < 0) { 
+		// can't open
+		*h = 0;
+		return -1; // -1 for unable to open device
+	}
+	
+	#ifdef _DEBUG_
+		std::cout << "SPI.SETUP: OPEN=" << spidev << " , MODE=" << mode << " , BITS_PER_WORD=" << bits << " , SPI_CLK_SPEED_HZ=" << speed << std::endl;
+	#endif
+	
+	// setup SPI mode
+	r = ioctl(*h, SPI_IOC_WR_MODE, &mode); // set mode
+	if (r < 0) {
+		return -2; // -2 for unable to set SPI mode
+	}
+	
+	r = ioctl(*h, SPI_IOC_RD_MODE, &t8); // read mode
+	if (r < 0) {
+		return -3;
+	}
+	
+	if (t8 != mode) {
+		fprintf(stderr, "SPI_SETUP(-4): Mode check fail. Set 0x%X but got 0x%X\n", mode, t8);
+		return -4; // mode mismatch
+	}
+	
+	#ifdef _DEBUG_
+		std::cout << "SPI.SETUP: Mode set." << std::endl;
+	#endif
+	
+	
+	// set bits per word
+	r = ioctl(*h, SPI_IOC_WR_BITS_PER_WORD, &bits); // set bits
+	if (r < 0) {
+		return -5;
+	}
+	
+	r = ioctl(*h, SPI_IOC_RD_BITS_PER_WORD, &t8); // read bits
+	if (r < 0) {
+		return -6;
+	}
+	
+	if (t8 != bits) {
+		fprintf(stderr, "SPI_SETUP(-7): Bits per word check fail. Set 0x%X but got 0x%X\n", bits, t8);
+		return -7; // mode mismatch
+	}
+	
+	#ifdef _DEBUG_
+		std::cout << "SPI.SETUP: Bits per word set." << std::endl;
+	#endif
+	
+	
+	// set SPI clock speed
+	r = ioctl(*h, SPI_IOC_WR_MAX_SPEED_HZ, &speed); // set bits
+	if (r < 0) {
+		return -8;
+	}
+	
+	r = ioctl(*h, SPI_IOC_RD_MAX_SPEED_HZ, &t32); // read bits
+	if (r < 0) {
+		return -9;
+	}
+	
+	if (t32 == 0) {
+		fprintf(stderr, "SPI_SETUP(-10): SPI Clock check fail. Set %u but got 0\n", speed);
+		return -10; // no usable clock
+	}
+	
+	if (t32 != speed) {
+		// controllers round to what their divider can make, that is still a working clock
+		fprintf(stderr, "SPI_SETUP: SPI Clock set %u but got %u, using %u\n", speed, t32, t32);
+	}
+	
+	#ifdef _DEBUG_
+		std::cout << "SPI.SETUP: Clock speed set." << std::endl;
+	#endif
+	
+	
+	return 0; // OK!
+
+}
+
+/*
+	Name: spi_set_bits
+	Description: Change bits per word on an opened device and verify the kernel accepted it
+	Parameters:
+		1. h : pointer int32 - opened device handle
+		2. bits : uint8_t - bits per word
+	Returns:
+		0 - on success, non-zero - controller (or spidev) refused the word size
+*/
+int spi_set_bits(int *h, uint8_t bits) {
+	uint8_t t8;
+
+	if (*h == 0) return -1; // device not opened
+	if (ioctl(*h, SPI_IOC_WR_BITS_PER_WORD, &bits) < 0) return -2;
+	if (ioctl(*h, SPI_IOC_RD_BITS_PER_WORD, &t8) < 0) return -3;
+	if (t8 != bits) return -4;
+
+	return 0;
+}
+
+/*
+	Name: spi_negotiate_bits
+	Description: Switch to the widest word size not above 'bits' that the controller supports.
+		Only 32, 16 and 8 are tried, every KeDei frame is 4 bytes so they always divide it.
+		Falls back to 8 bits per word when nothing wider is accepted.
+	Parameters:
+		1. h : pointer int32 - opened device handle
+		2. bits : uint8_t - preferred bits per word (8, 16 or 32)
+	Returns:
+		bits per word in use
+*/
+uint8_t spi_negotiate_bits(int *h, uint8_t bits) {
+	static const uint8_t sizes[] = { 32, 16 };
+
+	for (unsigned i=0; i<sizeof(sizes); i++) {
+		if (sizes[i] > bits) continue;
+		if (spi_set_bits(h, sizes[i]) == 0) {
+			#ifdef _DEBUG_
+				std::cout << "SPI.SETUP: Using " << (int)sizes[i] << " bits per word." << std::endl;
+			#endif
+			return sizes[i];
+		}
+	}
+
+	spi_set_bits(h, 8);
+	return 8;
+}
+
+/*
+	Name: spi_set_speed
+	Description: Change the maximum clock of an opened device
+	Returns:
+		clock the driver reports afterwards in Hz, 0 - refused
+*/
+uint32_t spi_set_speed(int *h, uint32_t speed) {
+	uint32_t t32 = 0;
+
+	if (*h == 0) return 0; // device not opened
+	if (ioctl(*h, SPI_IOC_WR_MAX_SPEED_HZ, &speed) < 0) return 0;
+	if (ioctl(*h, SPI_IOC_RD_MAX_SPEED_HZ, &t32) < 0) return 0;
+	return t32;
+}
+
+/**
+ * @brief  Maximum clock of an opened device in Hz, 0 on error
+ */
+uint32_t spi_get_speed(int *h) {
+	uint32_t t32 = 0;
+
+	if (*h == 0) return 0;
+	if (ioctl(*h, SPI_IOC_RD_MAX_SPEED_HZ, &t32) < 0) return 0;
+	return t32;
+}
+
+/*
+	Name: spi_set_cs_word
+	Description: Ask the controller to release chip select after every word (SPI_CS_WORD). With
+		32 bit words that is after every KeDei frame, so many frames fit in one transfer.
+		The SPI core emulates it for controllers that cannot do it themselves.
+	Returns:
+		0 - on success, non-zero - not supported here
+*/
+int spi_set_cs_word(int *h, bool on) {
+#ifdef SPI_CS_WORD
+	uint32_t mode;
+
+	if (*h == 0) return -1; // device not opened
+	if (ioctl(*h, SPI_IOC_RD_MODE32, &mode) < 0) return -2;
+	mode = on ? (mode | SPI_CS_WORD) : (mode & ~SPI_CS_WORD);
+	if (ioctl(*h, SPI_IOC_WR_MODE32, &mode) < 0) return -3;
+	if (ioctl(*h, SPI_IOC_RD_MODE32, &mode) < 0) return -4;
+	return ((mode & SPI_CS_WORD) != 0) == on ? 0 : -5;
+#else
+	return -1;
+#endif
+}
+
+/*
+	Name: spi_close
+	Description: Close SPI device
+	Parameters:
+		1. h : pointer int32 - opened device handle. After closing handle is reset to 0.
+	Returns:
+		0 - on success, non-zero - fail, see function content for error return values. Alos check errno for more information.
+*/
+int spi_close(int *h) {
+	if (*h == 0) return 0; // closed, or alredy closed
+	
+	int r = close(*h);
+	if (r < 0) {
+		return -1; // can't close
+	}
+	
+	#ifdef _DEBUG_
+		std::cout << "SPI.CLOSE: OK." << std::endl;
+	#endif
+	
+	*h=0; // rest device handle
+	return r;
+}
+
+/*
+	Name: spi_transmit
+	Description: Send data over SPI, and receive at the same time. Received data is put into transmitted data buffer.
+	Parameters:
+		1. h : pointer int32 - opened device handle. After closing handle is reset to 0.
+		2. bus : pointer SPI_Bus_t - bus shared with other nodes, NULL if not shared
+		3. data : pointer(array) uint8_t - data to be sent, and buffer for data to be received
+		4. len : int - bytes count to be sent from buffeer
+		5. spi_speed : uint32_t - spi speed override for transfer
+		6 . spi_bits : uin8_t - spi bits per word override for transfer. With 16 or 32 bits the
+			data must already be in word order (see lcd_frame) and len a multiple of the word size.
+	Note: data is taken as 4 byte KeDei frames. Messages carry whole frames and chip select is
+		released after each one, which is what the board latches on. Bulk data should go
+		through spi_transmit_rows, which sends a frame per transfer instead of a word.
+	Returns:
+		0 - on success, negative - fail, see function content for error return values. Alos check errno for more information.
+		positive - number of bytes received
+		
+*/
+int spi_transmit(int *h, SPI_Bus_t *bus, uint8_t *data, int len, uint32_t spi_speed, uint8_t spi_bits) {
+	int r, total = 0;
+	int wlen = (spi_bits + 7) / 8; // one transfer per word
+	int cnt = len / wlen;
+	int fw = wlen < 4 ? 4 / wlen : 1; // words per frame
+	int per = spi_bufsiz() / wlen; // words per message
+	struct spi_ioc_transfer buf[SPI_TRANSMIT_XFERS];
+	LCD_STATS_SCOPE(LCD_ST_SPI);
+	if (*h == 0) return -1; // device not opened
+	if (cnt * wlen != len) return -3; // partial word
+	if (per > SPI_TRANSMIT_XFERS) per = SPI_TRANSMIT_XFERS;
+	int cap = spi_bus_bytes(bus, spi_speed) / wlen; // shared bus: keep messages short
+	if (cap > 0 && cap < per) per = cap;
+	per -= per % fw; // whole frames only
+	if (per < fw) per = fw;
+	
+	// longer data goes out as several messages, chip select is released between them
+	for (int first=0; first<cnt; first+=per) {
+		int n = cnt - first < per ? cnt - first : per;
+		uint8_t *p = data + first*wlen;
+		// prepare data
+		for (int i=0;i<n;i++) {
+			buf[i].tx_buf = (uint64_t)(uintptr_t)(p + i*wlen);
+			buf[i].rx_buf = (uint64_t)(uintptr_t)(p + i*wlen);
+			buf[i].len = wlen; // 1 byte -_-" in 8 bit mode
+			buf[i].delay_usecs = 0; // no delay
+			buf[i].speed_hz = spi_speed;
+			buf[i].bits_per_word = spi_bits;
+			buf[i].cs_change = (i + 1) % fw == 0 && i != n - 1; // end of a frame, the message end releases it anyway
+			buf[i].pad = 0;
+			buf[i].tx_nbits = 1;
+			buf[i].rx_nbits = 1;
+		}
+
+		// #if defined(_DEBUG_)
+			// std::cout << "SPI TRANSMIT(" << len << ") data=";
+			// for (int i=0;i<len;i++) printf("%02x ",*(data+i));
+			// std::cout << " - SPI_SPEED=" << spi_speed << " BITS_PER_WORD=" << ((int)spi_bits) << " ... ";
+		// #endif
+		
+		// send it
+		r = spi_message(h, bus, n, buf);
+		
+		if (r < 0) {
+			#if defined(_DEBUG_)
+				std::cout << "ERROR" << std::endl;
+				fprintf(stderr, "   Return=%d errno=%d str=%s", r, errno, strerror(errno));
+				std::cout << std::endl;
+			#else 
+				fprintf(stderr, "SPI.TRANSMIT ERRROR (%d,%d) : %s", r, errno, strerror(errno));
+			#endif
+			return -2;
+		}
+		total += r;
+	}
+	
+	// #if defined(_DEBUG_)
+		// std::cout << "OK";
+		// std::cout << std::endl;
+	// #endif
+	
+	return total;	
+}
+
+/* send cnt prepared transfers as one message; without cs_word each one is a frame
+   and chip select is released after it */
+int spi_send_frames(int *h, SPI_Bus_t *bus, struct spi_ioc_transfer *buf, int cnt, bool cs_word) {
+	int r;
+
+	for (int i=0; i<cnt; i++) buf[i].cs_change = cs_word ? 0 : 1;
+	buf[cnt-1].cs_change = 0; // the end of the message releases it anyway
+
+	r = spi_message(h, bus, cnt, buf);
+	if (r < 0) {
+		fprintf(stderr, "SPI.TRANSMIT_FRAMES ERROR (%d,%d) : %s", r, errno, strerror(errno));
+		return -2;
+	}
+	return r;
+}
+
+/*
+	Name: spi_transmit_rows
+	Description: Send rows of 4 byte KeDei frames lying stride bytes apart, e.g. a rectangle of a
+		wire format shadow buffer. The transfers point straight into the rows, nothing is copied.
+		Every frame is its own transfer with chip select released after it, which is what the
+		board latches on; with cs_word the controller does that and a transfer covers as many
+		adjacent frames as fit. Messages carry up to chunk bytes, never more than spi_message_max,
+		and run on across row ends. On a shared bus they are also cut to spi_bus_bytes.
+	Parameters:
+		1. h : pointer int32 - opened device handle
+		2. bus : pointer SPI_Bus_t - bus shared with other nodes, NULL if not shared
+		3. data : pointer uint8_t - first frame of the first row, encoded for spi_bits (see lcd_frame)
+		4. row_len : int - bytes per row, a multiple of 4
+		5. rows : int - number of rows
+		6. stride : int - bytes from one row start to the next
+		7. spi_speed : uint32_t - spi speed override for transfer
+		8. spi_bits : uint8_t - bits per word of the encoding, 32 with cs_word
+		9. chunk : int - bytes per message wanted, <= 0 for the largest allowed
+		10. cs_word : bool - SPI_CS_WORD is on, see spi_set_cs_word
+	Returns:
+		bytes sent - on success, negative - fail
+*/
+int spi_transmit_rows(int *h, SPI_Bus_t *bus, uint8_t *data, int row_len, int rows, int stride, uint32_t spi_speed, uint8_t spi_bits, int chunk, bool cs_word) {
+	struct spi_ioc_transfer buf[SPI_XFER_MAX];
+	int max = spi_message_max(cs_word);
+	int tmax = cs_word ? max : 4; // bytes per transfer
+	int cnt = 0, bytes = 0, total = 0;
+
+	if (*h == 0) return -1; // device not opened
+	if (row_len % 4) return -3;
+	if (chunk > 0 && chunk < max) max = chunk & ~3;
+	int cap = spi_bus_bytes(bus, spi_speed);
+	if (cap > 0 && cap < max) max = cap;
+	if (max < 4) max = 4;
+	if (stride == row_len) { // one contiguous run
+		row_len *= rows;
+		rows = 1;
+	}
+
+	memset(buf, 0, sizeof(buf));
+	for (int j=0; j<rows; j++) {
+		uint8_t *row = data + (size_t)j*stride;
+		for (int off=0; off<row_len; ) {
+			int take = row_len - off;
+			if (take > max - bytes) take = max - bytes;
+			if (take > tmax) take = tmax;
+			if (cnt && cs_word && buf[cnt-1].tx_buf + buf[cnt-1].len == (uint64_t)(uintptr_t)(row + off) && (int)buf[cnt-1].len + take <= tmax) {
+				buf[cnt-1].len += take; // continues the previous transfer
+			} else {
+				struct spi_ioc_transfer *t = &buf[cnt++];
+				t->tx_buf = (uint64_t)(uintptr_t)(row + off);
+				t->len = take;
+				t->speed_hz = spi_speed;
+				t->bits_per_word = spi_bits;
+			}
+			off += take;
+			bytes += take;
+			if (bytes == max || cnt == SPI_XFER_MAX) {
+				if (spi_send_frames(h, bus, buf, cnt, cs_word) < 0) return -2;
+				memset(buf, 0, cnt * sizeof(buf[0]));
+				total += bytes;
+				cnt = bytes = 0;
+			}
+		}
+	}
+	if (cnt) {
+		if (spi_send_frames(h, bus, buf, cnt, cs_word) < 0) return -2;
+		total += bytes;
+	}
+	return total;
+}
+
+/**
+ * @brief  Send len bytes of frames, split into messages as spi_transmit_rows does
+ */
+int spi_transmit_frames(int *h, SPI_Bus_t *bus, uint8_t *data, int len, uint32_t spi_speed, uint8_t spi_bits, int chunk, bool cs_word) {
+	return spi_transmit_rows(h, bus, data, len, 1, len, spi_speed, spi_bits, chunk, cs_word);
+}
+
+#endif
@@ -0,0 +1,172 @@
+// ************ CALL STATISTICS **************
+// Latency histogram per public operation (lcd_fill2, lcd_setarea2,
+// TM_ILI9341_Puts, lcd_blit, lcd_flush, lcd_init) and per raw spi_transmit,
+// always on: the stall an operator sees once a minute shows up in p99 and
+// max where an average would hide it. Each thread records into its own
+// block of LCD_Hist_t (nanoseconds) without locks; lcd_stats_get merges the
+// blocks at query time. Recording costs two clock reads and one bucket
+// increment; lcd_stats_enable(false) leaves one relaxed load, LCD_STATS 0
+// compiles the hooks out.
+// -------------------------------------------
+
+#ifndef LCD_STATS_H
+#define LCD_STATS_H
+
+#include <atomic>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "lcd_hist.h"
+#include "lcd_latency.h"
+#include "lcd_slots.h"
+
+#ifndef LCD_STATS
+#define LCD_STATS 1                 // 0 - no hooks compiled in
+#endif
+#define LCD_STATS_THREADS 16        // threads recorded, later ones are counted in lost
+
+typedef enum {
+	LCD_ST_FILL,      /*!< lcd_fill2 */
+	LCD_ST_SETAREA,   /*!< lcd_setarea2 */
+	LCD_ST_TEXT,      /*!< TM_ILI9341_Puts */
+	LCD_ST_BLIT,      /*!< lcd_blit */
+	LCD_ST_FLUSH,     /*!< lcd_flush */
+	LCD_ST_INIT,      /*!< lcd_init */
+	LCD_ST_SPI,       /*!< spi_transmit */
+	LCD_ST_OPS
+} LCD_StatOp_t;
+
+static const char *lcd_stats_name[LCD_ST_OPS] = {
+	"lcd_fill2", "lcd_setarea2", "TM_ILI9341_Puts", "lcd_blit", "lcd_flush", "lcd_init", "spi_transmit"
+};
+
+/**
+ * @brief  Histograms of one thread, only that thread writes
+ */
+typedef struct {
+	LCD_Hist_t h[LCD_ST_OPS];     /*!< ns, clamped to 2^32 - 1 (4.3 s) */
+	std::atomic<uint32_t> epoch;  /*!< lcd_stats_reset generation the counts belong to */
+} LCD_StatsBlock_t;
+
+typedef struct {
+	std::atomic<int> off;                        /*!< lcd_stats_enable(false) */
+	std::atomic<uint32_t> epoch;                 /*!< bumped by lcd_stats_reset */
+	LCD_Slots<LCD_StatsBlock_t, LCD_STATS_THREADS> blocks;   /*!< lost: calls of threads without a block */
+} LCD_Stats_t;
+
+/**
+ * @brief  Summary of one operation, ns
+ */
+typedef struct {
+	uint32_t count;
+	uint32_t p50, p99, max;
+	double mean;
+} LCD_StatsSummary_t;
+
+static LCD_Stats_t lcd_stats;
+
+static void lcd_stats_block_init(LCD_StatsBlock_t *b) {
+	b->epoch.store(lcd_stats.epoch.load());
+}
+
+/* record one call of op that took ns; a reset since the last call is applied here first */
+void lcd_stats_add(uint8_t op, uint64_t ns) {
+	LCD_StatsBlock_t *b = lcd_slot(&lcd_stats.blocks, lcd_stats_block_init);   // claimed on the first call
+	if (!b) return;
+	uint32_t e = lcd_stats.epoch.load(std::memory_order_relaxed);
+	if (b->epoch.load(std::memory_order_relaxed) != e) {
+		for (int i=0; i<LCD_ST_OPS; i++) lcd_hist_reset(&b->h[i]);
+		b->epoch.store(e, std::memory_order_release);
+	}
+	lcd_hist_add(&b->h[op], ns < 0xFFFFFFFFu ? (uint32_t)ns : 0xFFFFFFFFu);
+}
+
+static inline bool lcd_stats_on(void) {
+	return lcd_stats.off.load(std::memory_order_relaxed) == 0;
+}
+
+/**
+ * @brief  Time from here to the end of the scope goes into the histogram of op
+ */
+struct LCD_StatScope {
+	uint8_t op;
+	uint64_t t;
+	LCD_StatScope(uint8_t o) : op(o), t(lcd_stats_on() ? lcd_latency_now() : 0) {}
+	~LCD_StatScope() {
+		if (t) lcd_stats_add(op, lcd_latency_now() - t);
+	}
+};
+
+#if LCD_STATS
+#define LCD_STATS_SCOPE(op) LCD_StatScope lcd_stats_scope_((op))
+#else
+#define LCD_STATS_SCOPE(op) do {} while (0)
+#endif
+
+/**
+ * @brief  Turn recording on (the default) or off, what was recorded stays
+ */
+void lcd_stats_enable(bool on) {
+	lcd_stats.off.store(on ? 0 : 1);
+}
+
+/**
+ * @brief  Start all histograms over; each thread drops its counts on its next call
+ */
+void lcd_stats_reset(void) {
+	lcd_stats.epoch.fetch_add(1);
+}
+
+/*
+	Name: lcd_stats_get
+	Description: Histogram of op merged over all threads, counted since the last lcd_stats_reset.
+		Safe while threads keep recording; counts being written may be off by a few.
+	Returns:
+		threads that recorded op
+*/
+int lcd_stats_get(int op, LCD_Hist_t *out) {
+	uint32_t e = lcd_stats.epoch.load();
+	int blocks = lcd_slots_used(&lcd_stats.blocks), n = 0;
+
+	lcd_hist_reset(out);
+	if (op < 0 || op >= LCD_ST_OPS) return 0;
+	for (int i=0; i<blocks; i++) {
+		LCD_StatsBlock_t *b = lcd_slot_at(&lcd_stats.blocks, i);
+		if (!b || b->epoch.load(std::memory_order_acquire) != e || !b->h[op].count) continue; // nothing since the reset
+		lcd_hist_merge(out, &b->h[op]);
+		n++;
+	}
+	return n;
+}
+
+/**
+ * @brief  Count, p50, p99, max and mean of op in ns, see lcd_stats_get
+ */
+LCD_StatsSummary_t lcd_stats_summary(int op) {
+	LCD_Hist_t h;
+	LCD_StatsSummary_t s;
+
+	lcd_stats_get(op, &h);
+	s.count = h.count;
+	s.p50 = lcd_hist_quantile(&h, 0.5);
+	s.p99 = lcd_hist_quantile(&h, 0.99);
+	s.max = h.max;
+	s.mean = lcd_hist_mean(&h);
+	return s;
+}
+
+/**
+ * @brief  One line per operation called since the last reset, times in us
+ */
+void lcd_stats_print(FILE *f) {
+	fprintf(f, "%16s %9s %9s %9s %9s %9s\n", "us", "calls", "mean", "p50", "p99", "max");
+	for (int op=0; op<LCD_ST_OPS; op++) {
+		LCD_StatsSummary_t s = lcd_stats_summary(op);
+		if (!s.count) continue;
+		fprintf(f, "%16s %9u %9.1f %9.1f %9.1f %9.1f\n", lcd_stats_name[op], s.count,
+			s.mean / 1e3, s.p50 / 1e3, s.p99 / 1e3, s.max / 1e3);
+	}
+	if (lcd_stats.blocks.lost.load()) fprintf(f, "%16s %9u\n", "lost", lcd_stats.blocks.lost.load());
+}
+
+#endif
@@ -0,0 +1,257 @@
+// ************ STRIP RENDERER **************
+// Page mode for boards without RAM for a frame buffer. Draw calls are
+// recorded once into a command list; lcd_strip_render then walks the screen
+// in horizontal strips (480x16 by default), replays every command whose
+// bounding box meets the strip into one small strip buffer and sends each
+// strip through its own lcd_setarea2 window. Memory is the strip buffer plus
+// the command list, whatever the scene draws. Text, pixel blocks and polygon
+// outlines are referenced, not copied: they must stay valid until the render.
+// ------------------------------------------
+
+#ifndef LCD_STRIP_H
+#define LCD_STRIP_H
+
+#include "lcd_display.h"
+#include "lcd_damage.h"
+#include "lcd_draw.h"
+#include "lcd_latency.h"
+
+#define LCD_STRIP_ROWS 16   // strip height lcd_strip_buffer is sized for
+
+typedef enum {
+	LCD_STRIP_FILL = 0,   /*!< rectangle, box is the rectangle */
+	LCD_STRIP_TEXT,       /*!< TM_ILI9341_Puts at x, y */
+	LCD_STRIP_BLIT,       /*!< RGB565 block at x, y, box.x1 - x + 1 wide */
+	LCD_STRIP_POLY        /*!< lcd_FillPolygon outline of n points */
+} LCD_StripType_t;
+
+typedef struct {
+	uint8_t type;             /*!< LCD_StripType_t */
+	uint8_t n;                /*!< points of a polygon */
+	int16_t x, y;             /*!< origin of text and blocks */
+	LCD_Rect_t box;           /*!< screen pixels the command may touch */
+	uint16_t color;
+	uint32_t bg;              /*!< text background, ILI9341_TRANSPARENT - none */
+	int stride;               /*!< pixels between rows of a block */
+	const void *ref;          /*!< text, pixels or points, owned by the caller */
+	const TM_FontDef_t *font;
+} LCD_StripCmd_t;
+
+typedef struct {
+	LCD_StripCmd_t *cmd;      /*!< command list, cap entries */
+	int n, cap;
+	uint16_t *buf;            /*!< strip buffer */
+	int px;                   /*!< its size in pixels, rows = px / area width */
+	uint16_t bg;              /*!< where no command draws */
+	/* summed over renders until the caller resets them */
+	uint32_t strips;          /*!< windows sent */
+	uint32_t visits;          /*!< command bounding boxes tested against a strip */
+	uint32_t draws;           /*!< commands replayed into a strip */
+	uint64_t raster_ns;       /*!< clearing and replaying into the strip buffer */
+	uint64_t send_ns;         /*!< lcd_blit of the strips */
+} LCD_Strip_t;
+
+/* strip buffer for LCD_STRIP_ROWS full width rows, in pixels */
+#define lcd_strip_buffer(width) ((width) * LCD_STRIP_ROWS)
+
+/*
+	Name: lcd_strip_init
+	Description: Set up a renderer on caller memory, nothing is allocated.
+	Parameters:
+		1. s : pointer LCD_Strip_t - renderer
+		2. cmd, cap : command list and its length
+		3. buf, px : strip buffer and its size in pixels, at least one row of the widest area rendered
+		4. bg : uint16_t - background color
+*/
+void lcd_strip_init(LCD_Strip_t *s, LCD_StripCmd_t *cmd, int cap, uint16_t *buf, int px, uint16_t bg) {
+	memset(s, 0, sizeof(*s));
+	s->cmd = cmd;
+	s->cap = cap;
+	s->buf = buf;
+	s->px = px;
+	s->bg = bg;
+}
+
+/**
+ * @brief  Forget the recorded commands, for the next scene
+ */
+void lcd_strip_clear(LCD_Strip_t *s) {
+	s->n = 0;
+}
+
+/**
+ * @brief  Bytes a renderer holds: strip buffer and command list
+ */
+size_t lcd_strip_memory(const LCD_Strip_t *s) {
+	return (size_t)s->px * sizeof(uint16_t) + (size_t)s->cap * sizeof(LCD_StripCmd_t);
+}
+
+/* next free command, NULL when the list is full */
+static inline LCD_StripCmd_t *lcd_strip_add(LCD_Strip_t *s, uint8_t type, int x0, int y0, int x1, int y1) {
+	if (s->n >= s->cap) return NULL;
+	LCD_StripCmd_t *c = &s->cmd[s->n++];
+	memset(c, 0, sizeof(*c));
+	c->type = type;
+	c->box = lcd_rect(x0 < x1 ? x0 : x1, y0 < y1 ? y0 : y1, x0 < x1 ? x1 : x0, y0 < y1 ? y1 : y0);
+	return c;
+}
+
+/**
+ * @brief  lcd_fill2, corners in any order
+ * @retval 0 - recorded, -1 - command list full
+ */
+int lcd_strip_fill(LCD_Strip_t *s, int x0, int y0, int x1, int y1, uint16_t color) {
+	LCD_StripCmd_t *c = lcd_strip_add(s, LCD_STRIP_FILL, x0, y0, x1, y1);
+	if (!c) return -1;
+	c->color = color;
+	return 0;
+}
+
+/**
+ * @brief  lcd_DrawPixel
+ * @retval 0 - recorded, -1 - command list full
+ */
+int lcd_strip_pixel(LCD_Strip_t *s, int x, int y, uint16_t color) {
+	return lcd_strip_fill(s, x, y, x, y, color);
+}
+
+/*
+	Name: lcd_strip_text
+	Description: TM_ILI9341_Puts, '\n' starts a line below x. str is kept by reference.
+	Returns:
+		0 - recorded, -1 - command list full
+*/
+int lcd_strip_text(LCD_Strip_t *s, int x, int y, const char *str, const TM_FontDef_t *f, uint32_t fg, uint32_t bg) {
+	TM_FONTS_SIZE_t size;
+
+	TM_FONTS_GetStringSize((char *)str, &size, (TM_FontDef_t *)f);
+	LCD_StripCmd_t *c = lcd_strip_add(s, LCD_STRIP_TEXT, x, y, x + (size.Length ? size.Length : 1) - 1, y + size.Height - 1);
+	if (!c) return -1;
+	c->x = (int16_t)x;
+	c->y = (int16_t)y;
+	c->color = (uint16_t)fg;
+	c->bg = bg;
+	c->ref = str;
+	c->font = f;
+	return 0;
+}
+
+/**
+ * @brief  lcd_blit, px is kept by reference
+ * @retval 0 - recorded, -1 - command list full
+ */
+int lcd_strip_blit(LCD_Strip_t *s, int x, int y, int w, int h, const uint16_t *px, int stride) {
+	if (w <= 0 || h <= 0) return 0;
+	LCD_StripCmd_t *c = lcd_strip_add(s, LCD_STRIP_BLIT, x, y, x + w - 1, y + h - 1);
+	if (!c) return -1;
+	c->x = (int16_t)x;
+	c->y = (int16_t)y;
+	c->ref = px;
+	c->stride = stride;
+	return 0;
+}
+
+/**
+ * @brief  lcd_FillPolygon, pts is kept by reference
+ * @retval 0 - recorded, -1 - command list full or n out of 3..LCD_POLY_MAX
+ */
+int lcd_strip_poly(LCD_Strip_t *s, const LCD_Point_t *pts, int n, uint16_t color) {
+	int x0, y0, x1, y1;
+
+	if (n < 3 || n > LCD_POLY_MAX) return -1;
+	x0 = x1 = pts[0].x;
+	y0 = y1 = pts[0].y;
+	for (int i=1; i<n; i++) {
+		if (pts[i].x < x0) x0 = pts[i].x;
+		if (pts[i].x > x1) x1 = pts[i].x;
+		if (pts[i].y < y0) y0 = pts[i].y;
+		if (pts[i].y > y1) y1 = pts[i].y;
+	}
+	LCD_StripCmd_t *c = lcd_strip_add(s, LCD_STRIP_POLY, x0, y0, x1, y1);
+	if (!c) return -1;
+	c->n = (uint8_t)n;
+	c->color = color;
+	c->ref = pts;
+	return 0;
+}
+
+/* one command into strip b, whose top left pixel is (ax, sy) on screen */
+void lcd_strip_replay(const LCD_StripCmd_t *c, LCD_Buffer_t *b, int ax, int sy) {
+	LCD_Rect_t r;
+
+	switch (c->type) {
+	case LCD_STRIP_FILL:
+		if (lcd_surface_clip(b, c->box.x0 - ax, c->box.y0 - sy, c->box.x1 - ax, c->box.y1 - sy, &r)) lcd_surface_fill(b, &r, c->color);
+		break;
+	case LCD_STRIP_TEXT:
+		lcd_surface_text(b, c->x - ax, c->y - sy, (const char *)c->ref, c->font, c->color, c->bg, &r);
+		break;
+	case LCD_STRIP_BLIT:
+		if (lcd_surface_clip(b, c->box.x0 - ax, c->box.y0 - sy, c->box.x1 - ax, c->box.y1 - sy, &r)) {
+			const uint16_t *src = (const uint16_t *)c->ref;
+			for (int y=r.y0; y<=r.y1; y++)
+				memcpy(b->px + y*b->stride + r.x0, src + (y + sy - c->y)*c->stride + (r.x0 + ax - c->x), (r.x1 - r.x0 + 1) * sizeof(uint16_t));
+		}
+		break;
+	case LCD_STRIP_POLY: {
+		/* the rasterizer skips rows above the strip by stepping its edges, output matches a full pass */
+		LCD_Point_t p[LCD_POLY_MAX];
+		const LCD_Point_t *src = (const LCD_Point_t *)c->ref;
+		for (int i=0; i<c->n; i++) {
+			p[i].x = (int16_t)(src[i].x - ax);
+			p[i].y = (int16_t)(src[i].y - sy);
+		}
+		lcd_buffer_FillPolygon(b, p, c->n, c->color);
+		break;
+	}
+	}
+}
+
+/*
+	Name: lcd_strip_render
+	Description: Draw the recorded scene over area in strips as tall as the strip buffer allows,
+		commands in the order they were recorded. Every pixel of area is sent once; pixels
+		no command covers get s->bg. The command list is kept for the next render.
+	Parameters:
+		1. s : pointer LCD_Strip_t - renderer
+		2. d : pointer LCD_Display_t - display
+		3. area : pointer LCD_Rect_t - screen part to draw, NULL - the whole screen
+	Returns:
+		strips sent, -1 - strip buffer smaller than one row of area
+*/
+int lcd_strip_render(LCD_Strip_t *s, LCD_Display_t *d, const LCD_Rect_t *area) {
+	LCD_Rect_t scr = lcd_rect(0, 0, d->opts.width - 1, d->opts.height - 1), a;
+	int strips = 0;
+
+	if (!lcd_rect_clip(&scr, area ? area : &scr, &a)) return 0;
+	int w = a.x1 - a.x0 + 1;
+	int rows = s->px / w;
+	if (rows < 1) return -1;
+
+	for (int sy=a.y0; sy<=a.y1; sy+=rows) {
+		int h = a.y1 - sy + 1 < rows ? a.y1 - sy + 1 : rows;
+		int sy1 = sy + h - 1;
+		LCD_Buffer_t b = { w, h, w, s->buf };
+		LCD_Rect_t all = lcd_rect(0, 0, w - 1, h - 1);
+		uint64_t t = lcd_latency_now();
+
+		lcd_surface_fill(&b, &all, s->bg);
+		for (int i=0; i<s->n; i++) {
+			const LCD_StripCmd_t *c = &s->cmd[i];
+			s->visits++;
+			if (c->box.y1 < sy || c->box.y0 > sy1 || c->box.x1 < a.x0 || c->box.x0 > a.x1) continue;
+			lcd_strip_replay(c, &b, a.x0, sy);
+			s->draws++;
+		}
+		uint64_t t2 = lcd_latency_now();
+		s->raster_ns += t2 - t;
+
+		lcd_blit(d, a.x0, sy, w, h, s->buf, w);
+		s->send_ns += lcd_latency_now() - t2;
+		s->strips++;
+		strips++;
+	}
+	return strips;
+}
+
+#endif
@@ -3,788 +3,1384 @@
 // ----------------------------------------
 
 
-#include <stdio.h>
-#include <stdlib.h>
-#include <string>
-#include <cstring>
-#include <iostream>
-#include <errno.h> // error handling
-#include <time.h> // for delay function
-#include <stdint.h> // aliases for int types (unsigned char = uint8_t, etc...)
-#include <unistd.h>
-// for spi
-#include <fcntl.h> // file control options
-#include <sys/ioctl.h> // I/O control routines ( ioctl() function)
-#include <linux/spi/spidev.h> // SPI options
-
-#include "tm_stm32f4_fonts.h"
-
-/* LCD settings */
-#define ILI9341_WIDTH        480
-#define ILI9341_HEIGHT       320
-#define ILI9341_PIXEL        153600
-
-/* Colors */
-#define ILI9341_COLOR_WHITE			0xFFFF
-#define ILI9341_COLOR_BLACK			0x0000
-#define ILI9341_COLOR_RED      		0xF800
-#define ILI9341_COLOR_GREEN			0x07E0
-#define ILI9341_COLOR_GREEN2		0xB723
-#define ILI9341_COLOR_BLUE			0x001F
-#define ILI9341_COLOR_BLUE2			0x051D
-#define ILI9341_COLOR_YELLOW		0xFFE0
-#define ILI9341_COLOR_ORANGE		0xFBE4
-#define ILI9341_COLOR_CYAN			0x07FF
-#define ILI9341_COLOR_MAGENTA		0xA254
-#define ILI9341_COLOR_GRAY			0x7BEF
-#define ILI9341_COLOR_BROWN			0xBBCA
-
-/* Transparent background, only for strings and chars */
-#define ILI9341_TRANSPARENT			0x80000000
-
-/**
- * @brief  Orientation
- * @note   Used private
- */
-typedef enum {
-	TM_ILI9341_Landscape,
-	TM_ILI9341_Portrait
-} TM_ILI9341_Orientation;
-
-/**
- * @brief  LCD options
- * @note   Used private
- */
-typedef struct {
-	uint16_t width;
-	uint16_t height;
-	TM_ILI9341_Orientation orientation; // 1 = portrait; 0 = landscape
-} TM_ILI931_Options_t;
+#include <pthread.h>
+#include <math.h>
+
+#include "lcd_display.h"
+#include "lcd_draw.h"
+#include "lcd_rotate.h"
+#include "lcd_widget.h"
+#include "lcd_queue.h"
+#include "lcd_tune.h"
+#include "lcd_touch.h"
+#include "lcd_gpio.h"
+#include "lcd_lanes.h"
+#include "lcd_server.h"
+#include "lcd_replay.h"
+#include "lcd_pace.h"
+#include "lcd_strip.h"
+#include "lcd_font.h"
+
+#include <sys/wait.h>
+
+#define LCD_MAX_PANELS 4
+
+/* extra runs after the test screen, command line flags */
+#define RUN_QUEUE   0x01  // -q : draw command queue demo
+#define RUN_BENCH   0x02  // -b : polygon fill benchmark
+#define RUN_WIDGETS 0x04  // -W : retained widget screen
+#define RUN_SERVER  0x08  // -m : display server with client processes
 
+typedef struct {
+	LCD_Display_t lcd;
+	const char *dev;
+	uint8_t wide;
+	unsigned run;     // RUN_* flags
+	TM_ILI9341_Orientation orientation;
+	uint32_t tune;    // -T MHz : autotune the transport up to this clock first, 0 - off
+	LCD_ShadowMode_t shadow;
+	const char *touch; // -t /dev/spidevX.Y : touch controller on the same bus, first panel only
+	const char *gpio;  // -g bcm|sunxi|mock|/dev/gpiochipN : bit-bang instead of spidev, first panel only
+	const char *record; // -c file : capture everything sent, first panel only
+	const char *replay; // -r / -rf file : send a capture instead of the test screen, first panel only
+	bool fast;          // -rf : replay back to back
+	double pace;        // -p fps : frame pacing demo at this rate, 0 - off
+	int result;
+} panel_t;
 
-//#define _DEBUG_
-int spi;
-uint16_t ILI9341_x;
-uint16_t ILI9341_y;
-TM_ILI931_Options_t ILI9341_Opts;
+typedef struct {
+	LCD_Queue_t *q;
+	int id;
+	std::atomic<int> *left;  // producers still running
+	std::atomic<int> *stop;  // set by the last producer, ends the consumer
+	LCD_Latency_t *lat;      // every bar step is traced as an app event
+} producer_t;
 
-int delayus(int us) {
-	struct timespec tim, timr;
-	tim.tv_sec = 0;
-	tim.tv_nsec = (long)(us * 1000);
-	
-	return nanosleep(&tim, &timr);
+/*
+	Name: producer_run
+	Description: Queue demo, each producer animates a bar in its own half of the screen without touching the bus.
+*/
+void *producer_run(void *arg) {
+	producer_t *p = (producer_t *)arg;
+	int16_t y = 200 + p->id * 50;
+	char label[16];
+	
+	snprintf(label, sizeof(label), "producer %d", p->id);
+	while (lcd_queue_text(p->q, 10, y, label, &TM_Font_7x10, ILI9341_COLOR_WHITE, ILI9341_COLOR_BLACK) < 0) delayus(100);
+	for (int16_t x=0; x<=300; x+=20) {
+		uint32_t id = (p->id << 16) | x;
+		lcd_latency_input(p->lat, id, 0);
+		while (lcd_queue_mark(p->q, p->lat, id) < 0) delayus(100);
+		while (lcd_queue_fill(p->q, 100, y, 100 + x, y + 20, p->id ? ILI9341_COLOR_CYAN : ILI9341_COLOR_ORANGE) < 0) delayus(100);
+	}
+	if (p->left->fetch_sub(1) == 1) p->stop->store(1, std::memory_order_release);
+	return NULL;
 }
 
-int delayms(int ms) {
-	struct timespec tim, timr;
-	tim.tv_sec = 0;
-	tim.tv_nsec = (long)(ms * 1000000);
-	
-	return nanosleep(&tim, &timr);
+/*
+	Name: telemetry_run
+	Description: Pacing demo producer: bursts of 1 to 8 frames as fast as the queue takes them,
+		each one a complete telemetry view (bar and value), 10 ms apart.
+*/
+void *telemetry_run(void *arg) {
+	producer_t *p = (producer_t *)arg;
+	int16_t y = 40 + p->id * 120;
+	int32_t v = 500;
+	char text[24];
+
+	for (int burst=0; burst<100; burst++) {
+		for (int f=0; f<1+(burst*7 + p->id*3)%8; f++) {
+			v += (int32_t)((f * 7919 + burst * 104729 + p->id * 31) % 101) - 50;
+			v = v < 0 ? 0 : v > 1000 ? 1000 : v;
+			snprintf(text, sizeof(text), "sensor %d: %4d.%d", p->id, v / 10, v % 10);
+			while (lcd_queue_fill(p->q, 10, y + 30, 10 + v * 46 / 100, y + 70, ILI9341_COLOR_GREEN) < 0) delayus(100);
+			while (lcd_queue_fill(p->q, 11 + v * 46 / 100, y + 30, 470, y + 70, ILI9341_COLOR_BLACK) < 0) delayus(100);
+			while (lcd_queue_text(p->q, 10, y, text, &TM_Font_11x18, ILI9341_COLOR_WHITE, ILI9341_COLOR_BLACK) < 0) delayus(100);
+			while (lcd_queue_frame(p->q) < 0) delayus(100);
+		}
+		delayms(10);
+	}
+	if (p->left->fetch_sub(1) == 1) p->stop->store(1, std::memory_order_release);
+	return NULL;
 }
 
-int delays(int s) {
-	struct timespec tim, timr;
-	tim.tv_sec = s;
-	tim.tv_nsec = 0;
-	
-	return nanosleep(&tim, &timr);
-}
+/*
+	Name: pace_demo
+	Description: Two bursty telemetry producers, this thread refreshes the panel at fps through
+		an LCD_Pacer_t. Uses an RGB565 shadow for the run when the display has none.
+*/
+void pace_demo(LCD_Display_t *d, double fps) {
+	LCD_Queue_t *q = new LCD_Queue_t;
+	LCD_Pacer_t pace;
+	producer_t prod[2];
+	pthread_t th[2];
+	std::atomic<int> left(2);
+	std::atomic<int> stop(0);
+	bool shadow = d->shadow != LCD_SHADOW_NONE;
+
+	if (!shadow && lcd_shadow_init(d, LCD_SHADOW_RGB565) < 0) {
+		fprintf(stderr, "Pacing: no memory for the shadow buffer.\n");
+		delete q;
+		return;
+	}
+	lcd_queue_init(q);
+	lcd_pace_init(&pace, q, d, fps);
+	for (int i=0; i<2; i++) {
+		prod[i].q = q;
+		prod[i].id = i;
+		prod[i].left = &left;
+		prod[i].stop = &stop;
+		prod[i].lat = NULL;
+		if (pthread_create(&th[i], NULL, telemetry_run, &prod[i]) != 0) {
+			telemetry_run(&prod[i]); // no thread, produce inline
+			th[i] = pthread_self();
+		}
+	}
 
+	lcd_pace_run(&pace, &stop);
+	for (int i=0; i<2; i++) {
+		if (!pthread_equal(th[i], pthread_self())) pthread_join(th[i], NULL);
+	}
 
-/* ************************************************************
-	BASIC SPI OPERATIONS 
-   ************************************************************ */
+	printf("Pacing at %.0f fps: %llu frames submitted, %llu shown (%.1f fps), %llu dropped, %llu ticks late, bus busy %.0f%%, queue peak %u\n",
+		fps, (unsigned long long)pace.frames, (unsigned long long)pace.presented, lcd_pace_fps(&pace),
+		(unsigned long long)pace.dropped, (unsigned long long)pace.late, lcd_pace_busy(&pace) * 100, q->peak.load());
+	if (!shadow) lcd_shadow_init(d, LCD_SHADOW_NONE);
+	delete q;
+}
 
 /*
-	Name: spi_open
-	Description: Open SPI device and configure mode
-	Parameters:
-		1. h : pointer int32 - return device handle
-		2. spidev : string - spi device
-		3. mode : uint8_t - spi mode
-		4. bits : uint8_t - bits per word (normally 8)
-		5. speed : uint32_t - SPI clk speed in MHz
-	Returns:
-		0 - on success, non-zero - fail, see function content for error return values. Alos check errno for more information.
+	Name: latency_print
+	Description: Percentiles of every touch-to-photon stage, see lcd_latency.h
 */
-int spi_open(int *h, std::string spidev, uint8_t mode, uint8_t bits, uint32_t speed) {
-	int r;
-	uint8_t t8;
-	uint32_t t32;
-	//*h = 0; // reset device handle
-	
-	// open spi device
-	*h = open(spidev.c_str(), O_RDWR); // open spi device for R/W
-	if (*h < 0) { 
-		// can't open
-		*h = 0;
-		return -1; // -1 for unable to open device
+void latency_print(const char *what, LCD_Latency_t *l) {
+	pthread_mutex_lock(&l->lock);
+	printf("%s latency (us), %u traced, %u dropped:\n    stage     p50     p99     max\n", what, l->completed, l->dropped);
+	for (int s=0; s<LCD_LAT_STAGES; s++) {
+		const LCD_Hist_t *h = &l->stage[s];
+		printf("%9s %7u %7u %7u\n", lcd_latency_stage_name[s], lcd_hist_quantile(h, 0.5), lcd_hist_quantile(h, 0.99), h->max);
 	}
-	
-	#ifdef _DEBUG_
-		std::cout << "SPI.SETUP: OPEN=" << spidev << " , MODE=" << mode << " , BITS_PER_WORD=" << bits << " , SPI_CLK_SPEED_HZ=" << speed << std::endl;
-	#endif
-	
-	// setup SPI mode
-	r = ioctl(*h, SPI_IOC_WR_MODE, &mode); // set mode
-	if (r < 0) {
-		return -2; // -2 for unable to set SPI mode
+	pthread_mutex_unlock(&l->lock);
+}
+
+/*
+	Name: queue_demo
+	Description: Two producer threads draw through an LCD_Queue_t, this thread is the only consumer.
+*/
+void queue_demo(LCD_Display_t *d) {
+	LCD_Queue_t *q = new LCD_Queue_t;
+	producer_t prod[2];
+	pthread_t th[2];
+	std::atomic<int> left(2);
+	std::atomic<int> stop(0);
+	LCD_Latency_t *lat = new LCD_Latency_t;
+	
+	lcd_latency_init(lat);
+	d->lat = lat;
+	lcd_queue_init(q);
+	for (int i=0; i<2; i++) {
+		prod[i].q = q;
+		prod[i].id = i;
+		prod[i].left = &left;
+		prod[i].stop = &stop;
+		prod[i].lat = lat;
+		if (pthread_create(&th[i], NULL, producer_run, &prod[i]) != 0) {
+			producer_run(&prod[i]); // no thread, produce inline
+			th[i] = pthread_self();
+		}
 	}
 	
-	r = ioctl(*h, SPI_IOC_RD_MODE, &t8); // read mode
-	if (r < 0) {
-		return -3;
+	lcd_queue_run(q, d, &stop, 200);
+	for (int i=0; i<2; i++) {
+		if (!pthread_equal(th[i], pthread_self())) pthread_join(th[i], NULL);
 	}
 	
-	if (t8 != mode) {
-		fprintf(stderr, "SPI_SETUP(-4): Mode check fail. Set 0x%X but got 0x%X\n", mode, t8);
-		return -4; // mode mismatch
+	std::cout << "Queue: applied=" << q->applied.load() << " peak=" << q->peak.load() << " overflow=" << q->overflow.load() << std::endl;
+	latency_print("Queue", lat);
+	d->lat = NULL;
+	lcd_latency_destroy(lat);
+	delete lat;
+	delete q;
+}
+
+/*
+	Name: now_ms
+	Description: Monotonic clock in milliseconds, for the benchmarks
+*/
+double now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/* needle outline around (cx, cy) at angle a (radians) */
+void needle(LCD_Point_t *p, int cx, int cy, double a, int len) {
+	double c = cos(a), s = sin(a);
+	p[0].x = cx + (int)lround(c * len);        p[0].y = cy - (int)lround(s * len);
+	p[1].x = cx + (int)lround(-s * 6);         p[1].y = cy - (int)lround(c * 6);
+	p[2].x = cx - (int)lround(c * len / 5);    p[2].y = cy + (int)lround(s * len / 5);
+	p[3].x = cx + (int)lround(s * 6);          p[3].y = cy + (int)lround(c * 6);
+}
+
+typedef struct {
+	LCD_Display_t *d;
+	uint16_t color;
+} pixel_ctx_t;
+
+/* span sink that draws every pixel on its own, what the library did before */
+void span_per_pixel(void *ctx, int x0, int x1, int y) {
+	pixel_ctx_t *c = (pixel_ctx_t *)ctx;
+	for (int x=x0; x<=x1; x++) lcd_DrawPixel(c->d, x, y, c->color);
+}
+
+/*
+	Name: bench_polygon
+	Description: Rotating needle, erase + redraw per step. Same rasterizer output sent as
+		spans (one window each) and as single pixels, plus rasterizing into a shadow buffer only.
+*/
+void bench_polygon(LCD_Display_t *d) {
+	const int steps = 36;
+	LCD_Point_t p[4];
+	pixel_ctx_t pc = { d, 0 };
+	int spans = 0;
+	double t;
+	
+	lcd_fill2(d, 160, 40, 320, 200, ILI9341_COLOR_BLACK);
+	
+	t = now_ms();
+	for (int i=0; i<steps; i++) {
+		needle(p, 240, 120, i * 2 * M_PI / steps, 75);
+		spans += lcd_FillPolygon(d, p, 4, ILI9341_COLOR_RED);
+		lcd_flush(d);
+		lcd_FillPolygon(d, p, 4, ILI9341_COLOR_BLACK);
+		lcd_flush(d);
 	}
-	
-	#ifdef _DEBUG_
-		std::cout << "SPI.SETUP: Mode set." << std::endl;
-	#endif
-	
-	
-	// set bits per word
-	r = ioctl(*h, SPI_IOC_WR_BITS_PER_WORD, &bits); // set bits
-	if (r < 0) {
-		return -5;
+	t = now_ms() - t;
+	printf("Needle spans    : %8.3f ms/step, %d spans/needle\n", t / steps, spans / steps);
+	
+	t = now_ms();
+	for (int i=0; i<steps; i++) {
+		needle(p, 240, 120, i * 2 * M_PI / steps, 75);
+		pc.color = ILI9341_COLOR_RED;
+		lcd_poly_spans(p, 4, d->opts.width, d->opts.height, span_per_pixel, &pc);
+		lcd_flush(d);
+		pc.color = ILI9341_COLOR_BLACK;
+		lcd_poly_spans(p, 4, d->opts.width, d->opts.height, span_per_pixel, &pc);
+		lcd_flush(d);
 	}
-	
-	r = ioctl(*h, SPI_IOC_RD_BITS_PER_WORD, &t8); // read bits
-	if (r < 0) {
-		return -6;
+	t = now_ms() - t;
+	printf("Needle per pixel: %8.3f ms/step\n", t / steps);
+	
+	LCD_Buffer_t b;
+	b.w = b.stride = 160;
+	b.h = 160;
+	b.px = (uint16_t *)calloc(b.w * b.h, sizeof(uint16_t));
+	t = now_ms();
+	for (int i=0; i<steps*100; i++) {
+		needle(p, 80, 80, i * 2 * M_PI / steps, 75);
+		lcd_buffer_FillPolygon(&b, p, 4, ILI9341_COLOR_RED);
+		lcd_buffer_FillPolygon(&b, p, 4, ILI9341_COLOR_BLACK);
 	}
-	
-	if (t8 != bits) {
-		fprintf(stderr, "SPI_SETUP(-7): Bits per word check fail. Set 0x%X but got 0x%X\n", bits, t8);
-		return -7; // mode mismatch
+	t = now_ms() - t;
+	printf("Needle in buffer: %8.3f us/step (rasterizer only)\n", t * 1000 / (steps*100));
+	free(b.px);
+	
+	/* full frame quarter turn, cache blocked against a plain pixel walk */
+	LCD_Buffer_t src, dst;
+	src.px = (uint16_t *)malloc(ILI9341_PIXEL * sizeof(uint16_t));
+	dst.px = (uint16_t *)malloc(ILI9341_PIXEL * sizeof(uint16_t));
+	uint16_t *ref = (uint16_t *)malloc(ILI9341_PIXEL * sizeof(uint16_t));
+	for (int i=0; i<ILI9341_PIXEL; i++) src.px[i] = (uint16_t)(i * 40503u);
+	bool same = true;
+	for (int k=0; k<2; k++) { // whole tiles, then a size with partial tiles at both edges
+		src.w = src.stride = k ? 101 : ILI9341_WIDTH;
+		src.h = k ? 70 : ILI9341_HEIGHT;
+		for (int q=1; q<4; q++) {
+			dst.w = dst.stride = q & 1 ? src.h : src.w;
+			dst.h = q & 1 ? src.w : src.h;
+			lcd_buffer_rotate(&src, &dst, q);
+			for (int y=0; y<src.h; y++) {
+				for (int x=0; x<src.w; x++) {
+					int dx = q == 1 ? src.h-1-y : q == 2 ? src.w-1-x : y;
+					int dy = q == 1 ? x : q == 2 ? src.h-1-y : src.w-1-x;
+					ref[dy*dst.stride + dx] = src.px[y*src.stride + x];
+				}
+			}
+			if (memcmp(ref, dst.px, (size_t)dst.w * dst.h * sizeof(uint16_t))) {
+				printf("Rotate %dx%d by %d: MISMATCH\n", src.w, src.h, q * 90);
+				same = false;
+			}
+		}
 	}
-	
-	#ifdef _DEBUG_
-		std::cout << "SPI.SETUP: Bits per word set." << std::endl;
-	#endif
-	
-	
-	// set SPI clock speed
-	r = ioctl(*h, SPI_IOC_WR_MAX_SPEED_HZ, &speed); // set bits
-	if (r < 0) {
-		return -8;
+	printf("Rotate 90/180/270 against a pixel walk: %s\n", same ? "ok" : "MISMATCH");
+	free(ref);
+
+	src.w = src.stride = dst.h = ILI9341_WIDTH;
+	src.h = dst.w = dst.stride = ILI9341_HEIGHT;
+	t = now_ms();
+	for (int i=0; i<100; i++) lcd_buffer_rotate(&src, &dst, 1);
+	t = now_ms() - t;
+	printf("Rotate 90 block : %8.3f ms/frame\n", t / 100);
+	t = now_ms();
+	for (int i=0; i<100; i++) {
+		for (int y=0; y<src.h; y++)
+			for (int x=0; x<src.w; x++) dst.px[x*dst.stride + src.h-1-y] = src.px[y*src.stride + x];
+		__asm__ __volatile__("" : : "r"(dst.px) : "memory");
 	}
-	
-	r = ioctl(*h, SPI_IOC_RD_MAX_SPEED_HZ, &t32); // read bits
-	if (r < 0) {
-		return -9;
+	t = now_ms() - t;
+	printf("Rotate 90 naive : %8.3f ms/frame\n", t / 100);
+	free(src.px);
+	free(dst.px);
+}
+
+/*
+	Name: bench_frame
+	Description: Full screen image, split into drawing it (into the shadow buffer, if any)
+		and getting it onto the panel. Compare runs with -s 565 and -s wire.
+*/
+void bench_frame(LCD_Display_t *d) {
+	static const char *modes[] = { "none", "565", "wire", "i8", "i4", "rle" };
+	const int frames = 4;
+	LCD_Buffer_t b;
+	double draw = 0, send = 0, t;
+
+	b.w = b.stride = d->opts.width;
+	b.h = d->opts.height;
+	b.px = (uint16_t *)malloc(ILI9341_PIXEL * sizeof(uint16_t));
+	for (int y=0; y<b.h; y++)
+		for (int x=0; x<b.w; x++) b.px[y*b.stride + x] = (uint16_t)(((x >> 4) << 11) | ((y >> 3) << 5) | ((x + y) >> 5));
+
+	for (int i=0; i<frames; i++) {
+		t = now_ms();
+		lcd_blit_buffer(d, 0, 0, &b);
+		draw += now_ms() - t;
+		t = now_ms();
+		lcd_flush(d);
+		send += now_ms() - t;
 	}
-	
-	if (t32 != speed) {
-		fprintf(stderr, "SPI_SETUP(-10): SPI Clock check fail. Set %d but got %d\n", speed, t32);
-		return -10; // mode mismatch
+	printf("Frame, shadow %-4s: %8.3f ms draw + %8.3f ms flush\n", modes[d->shadow], draw / frames, send / frames);
+	free(b.px);
+}
+
+/* transport that drops everything, for timing the driver alone */
+int null_rows(void *ctx, const uint8_t *data, int row_len, int rows, int stride) {
+	(void)ctx; (void)data; (void)stride;
+	return row_len * rows;
+}
+
+static const LCD_Transport_t null_transport = { null_rows, NULL };
+
+typedef struct {
+	bool on;
+	uint64_t h;
+} sum_t;
+
+/* transport that only hashes the bytes while on, ctx is a sum_t */
+int sum_rows(void *ctx, const uint8_t *data, int row_len, int rows, int stride) {
+	sum_t *s = (sum_t *)ctx;
+	for (int j=0; s->on && j<rows; j++)
+		for (int i=0; i<row_len; i++) s->h = (s->h ^ data[j*stride + i]) * 0x100000001b3ull;
+	return row_len * rows;
+}
+
+static const LCD_Transport_t sum_transport = { sum_rows, NULL };
+
+/* frame f of a dashboard in palette colors: twelve tiles with a bar each, labelled or not */
+void dashboard(LCD_Display_t *d, int f, bool labels) {
+	lcd_fill(d, ILI9341_COLOR_BLACK);
+	for (int i=0; i<12; i++) {
+		int x = (i % 4) * 120, y = 24 + (i / 4) * 96;
+		lcd_fill2(d, x + 2, y + 2, x + 117, y + 93, lcd_palette_default[1 + (i + f) % 12]);
+		lcd_fill2(d, x + 10, y + 40, x + 10 + (i * 37 + f * 11) % 100, y + 60, ILI9341_COLOR_BLACK);
+		if (labels) TM_ILI9341_Puts(d, x + 8, y + 8, (char *)"sensor", &TM_Font_11x18, ILI9341_COLOR_WHITE, ILI9341_TRANSPARENT);
 	}
-	
-	#ifdef _DEBUG_
-		std::cout << "SPI.SETUP: Clock speed set." << std::endl;
-	#endif
-	
-	
-	return 0; // OK!
-	
 }
 
 /*
-	Name: spi_close
-	Description: Close SPI device
-	Parameters:
-		1. h : pointer int32 - opened device handle. After closing handle is reset to 0.
-	Returns:
-		0 - on success, non-zero - fail, see function content for error return values. Alos check errno for more information.
+	Name: bench_shadow
+	Description: Every shadow mode drawing a dashboard of palette colors (fills and text) and
+		flushing it whole into a transport that drops the bytes: memory, draw and flush time.
 */
-int spi_close(int *h) {
-	if (*h == 0) return 0; // closed, or alredy closed
-	
-	int r = close(*h);
-	if (r < 0) {
-		return -1; // can't close
+void bench_shadow(void) {
+	static const char *modes[] = { "none", "565", "wire", "i8", "i4", "rle" };
+	const int frames = 8;
+	LCD_Display_t *d = new LCD_Display_t;
+
+	for (int m=LCD_SHADOW_RGB565; m<=LCD_SHADOW_RLE; m++) {
+		double draw = 0, send = 0, t;
+		lcd_open_transport(d, &null_transport, NULL);
+		lcd_shadow_init(d, (LCD_ShadowMode_t)m);
+		lcd_flush(d);
+		for (int f=0; f<frames; f++) {
+			t = now_ms();
+			dashboard(d, f, true);
+			draw += now_ms() - t;
+			t = now_ms();
+			lcd_flush(d);
+			send += now_ms() - t;
+		}
+		printf("Shadow %-4s: %7zu bytes, %7.3f ms draw + %7.3f ms flush per screen\n", modes[m], lcd_shadow_bytes(d), draw / frames, send / frames);
+		lcd_close(d);
+	}
+	delete d;
+}
+
+/* per pixel references for bench_shapes, drawn unclipped on a canvas REF_M pixels larger
+   than the panel on every side and cropped afterwards */
+#define REF_M 200
+#define REF_W (ILI9341_WIDTH + 2*REF_M)
+#define REF_H (ILI9341_HEIGHT + 2*REF_M)
+
+void ref_plot(uint16_t *px, int x, int y, uint16_t c) {
+	x += REF_M;
+	y += REF_M;
+	if (x >= 0 && x < REF_W && y >= 0 && y < REF_H) px[y * REF_W + x] = c;
+}
+
+void ref_line(uint16_t *px, int x0, int y0, int x1, int y1, uint16_t c) {
+	int dx = abs(x1 - x0), dy = abs(y1 - y0);
+	bool steep = dy > dx;
+	if (steep ? y0 > y1 : x0 > x1) { int t = x0; x0 = x1; x1 = t; t = y0; y0 = y1; y1 = t; }
+	int n = steep ? dy : dx, e = steep ? dx : dy, err = n / 2;
+	int step = steep ? (x0 < x1 ? 1 : -1) : (y0 < y1 ? 1 : -1);
+	for (int i=0; i<=n; i++) {
+		if (steep) ref_plot(px, x0, y0 + i, c);
+		else ref_plot(px, x0 + i, y0, c);
+		err -= e;
+		if (err < 0) {
+			if (steep) x0 += step;
+			else y0 += step;
+			err += n;
+		}
+	}
+}
+
+/* midpoint quarters around columns xl, xr and rows yt, yb, eight points per step */
+void ref_arcs(uint16_t *px, int xl, int xr, int yt, int yb, int r, uint16_t c) {
+	int x = 0, y = r, f = 1 - r;
+	while (x <= y) {
+		ref_plot(px, xl - x, yt - y, c); ref_plot(px, xr + x, yt - y, c);
+		ref_plot(px, xl - x, yb + y, c); ref_plot(px, xr + x, yb + y, c);
+		ref_plot(px, xl - y, yt - x, c); ref_plot(px, xr + y, yt - x, c);
+		ref_plot(px, xl - y, yb + x, c); ref_plot(px, xr + y, yb + x, c);
+		x++;
+		if (f < 0) {
+			f += 2*x + 1;
+		} else {
+			y--;
+			f += 2*(x - y) + 1;
+		}
+	}
+}
+
+/* rounded box outline between any two corners with the radius limit of lcd_DrawRoundRect, r 0 is a rectangle */
+void ref_round(uint16_t *px, int x0, int y0, int x1, int y1, int r, uint16_t c) {
+	if (x0 > x1) { int t = x0; x0 = x1; x1 = t; }
+	if (y0 > y1) { int t = y0; y0 = y1; y1 = t; }
+	if (r > (x1 - x0) / 2) r = (x1 - x0) / 2;
+	if (r > (y1 - y0) / 2) r = (y1 - y0) / 2;
+	if (r < 0) r = 0;
+	for (int x=x0+r; x<=x1-r; x++) { ref_plot(px, x, y0, c); ref_plot(px, x, y1, c); }
+	for (int y=y0+r; y<=y1-r; y++) { ref_plot(px, x0, y, c); ref_plot(px, x1, y, c); }
+	if (r > 0) ref_arcs(px, x0 + r, x1 - r, y0 + r, y1 - r, r, c);
+}
+
+/* filled shape from its outline in tmp: each row from the leftmost to the rightmost pixel */
+void ref_fill(uint16_t *px, const uint16_t *tmp, uint16_t c) {
+	for (int y=0; y<REF_H; y++) {
+		const uint16_t *row = tmp + y * REF_W;
+		int a = 0, b = REF_W - 1;
+		while (a < REF_W && !row[a]) a++;
+		while (b > a && !row[b]) b--;
+		for (int x=a; x<=b && a<REF_W; x++) px[y * REF_W + x] = c;
+	}
+}
+
+typedef enum { SH_LINE, SH_RECT, SH_FILLRECT, SH_CIRCLE, SH_FILLCIRCLE, SH_ROUND, SH_FILLROUND } shape_kind_t;
+
+typedef struct {
+	shape_kind_t kind;
+	int x0, y0, x1, y1, r;   /* circles: centre x0, y0 */
+} shape_t;
+
+/* one shape on the panel through lcd_draw.h */
+void shape_draw(LCD_Display_t *d, const shape_t *s, uint16_t c) {
+	switch (s->kind) {
+	case SH_LINE:       lcd_DrawLine(d, s->x0, s->y0, s->x1, s->y1, c); break;
+	case SH_RECT:       lcd_DrawRect(d, s->x0, s->y0, s->x1, s->y1, c); break;
+	case SH_FILLRECT:   lcd_FillRect(d, s->x0, s->y0, s->x1, s->y1, c); break;
+	case SH_CIRCLE:     lcd_DrawCircle(d, s->x0, s->y0, s->r, c); break;
+	case SH_FILLCIRCLE: lcd_FillCircle(d, s->x0, s->y0, s->r, c); break;
+	case SH_ROUND:      lcd_DrawRoundRect(d, s->x0, s->y0, s->x1, s->y1, s->r, c); break;
+	case SH_FILLROUND:  lcd_FillRoundRect(d, s->x0, s->y0, s->x1, s->y1, s->r, c); break;
+	}
+}
+
+/* the same shape pixel by pixel onto the reference canvas, tmp is scratch for the fills */
+void shape_ref(uint16_t *px, uint16_t *tmp, const shape_t *s, uint16_t c) {
+	switch (s->kind) {
+	case SH_LINE:
+		ref_line(px, s->x0, s->y0, s->x1, s->y1, c);
+		break;
+	case SH_RECT:
+	case SH_ROUND:
+		ref_round(px, s->x0, s->y0, s->x1, s->y1, s->kind == SH_RECT ? 0 : s->r, c);
+		break;
+	case SH_CIRCLE:
+		ref_arcs(px, s->x0, s->x0, s->y0, s->y0, s->r, c);
+		break;
+	default:
+		memset(tmp, 0, REF_W * REF_H * sizeof(uint16_t));
+		if (s->kind == SH_FILLCIRCLE) ref_arcs(tmp, s->x0, s->x0, s->y0, s->y0, s->r, 1);
+		else ref_round(tmp, s->x0, s->y0, s->x1, s->y1, s->kind == SH_FILLRECT ? 0 : s->r, 1);
+		ref_fill(px, tmp, c);
+		break;
 	}
-	
-	#ifdef _DEBUG_
-		std::cout << "SPI.CLOSE: OK." << std::endl;
-	#endif
-	
-	*h=0; // rest device handle
-	return r;
+}
+
+/* boxes and circles: fb is the same under a left-right and a top-bottom mirror of the box, and for circles
+   under a swap of the axes around the centre */
+bool shape_symmetric(const uint16_t *fb, const shape_t *s) {
+	int x0 = s->x0, y0 = s->y0, x1 = s->x1, y1 = s->y1;
+	bool circle = s->kind == SH_CIRCLE || s->kind == SH_FILLCIRCLE;
+	if (s->kind == SH_LINE) return true;
+	if (circle) { x0 = s->x0 - s->r; x1 = s->x0 + s->r; y0 = s->y0 - s->r; y1 = s->y0 + s->r; }
+	if (x0 < 0 || y0 < 0 || x1 >= ILI9341_WIDTH || y1 >= ILI9341_HEIGHT) return true; // clipped
+	for (int y=y0; y<=y1; y++)
+		for (int x=x0; x<=x1; x++) {
+			uint16_t v = fb[y * ILI9341_WIDTH + x];
+			if (v != fb[y * ILI9341_WIDTH + (x0 + x1 - x)] || v != fb[(y0 + y1 - y) * ILI9341_WIDTH + x]) return false;
+			if (circle && v != fb[(y0 + (x - x0)) * ILI9341_WIDTH + (x0 + (y - y0))]) return false;
+		}
+	return true;
 }
 
 /*
-	Name: spi_transmit
-	Description: Send data over SPI, and receive at the same time. Received data is put into transmitted data buffer.
-	Parameters:
-		1. h : pointer int32 - opened device handle. After closing handle is reset to 0.
-		2. data : pointer(array) uint8_t - data to be sent, and buffer for data to be received
-		3. len : int - bytes count to be sent from buffeer
-		4. spi_speed : uint32_t - spi speed override for transfer
-		5 . spi_bits : uin8_t - spi bits per word override for transfer
-	Returns:
-		0 - on success, negative - fail, see function content for error return values. Alos check errno for more information.
-		positive - number of bytes received
-		
+	Name: bench_shapes
+	Description: Lines, rectangles, circles and rounded boxes, whole and partly or fully off the
+		panel, drawn as spans into an RGB565 shadow and checked pixel for pixel against a
+		per-pixel reference that is cropped only afterwards: covers span decomposition and
+		clipping. Shapes inside the panel are also checked for mirror symmetry.
 */
-int spi_transmit(int *h, uint8_t *data, int len, uint32_t spi_speed, uint8_t spi_bits) {
-	int r;
-	struct spi_ioc_transfer buf[len];
-	if (*h == 0) return -1; // device not opened
-	// prepare data
-	for (int i=0;i<len;i++) {
-		buf[i].tx_buf = (uint64_t)(data + i);
-		buf[i].rx_buf = (uint64_t)(data + i);
-		buf[i].len = sizeof(*(data+i)); // 1 byte -_-"
-		buf[i].delay_usecs = 0; // no delay
-		buf[i].speed_hz = spi_speed;
-		buf[i].bits_per_word = spi_bits;
-		buf[i].cs_change = 0;
-		buf[i].pad = 0;
-		buf[i].tx_nbits = 1;
-		buf[i].rx_nbits = 1;
-	}
-
-	// #if defined(_DEBUG_)
-		// std::cout << "SPI TRANSMIT(" << len << ") data=";
-		// for (int i=0;i<len;i++) printf("%02x ",*(data+i));
-		// std::cout << " - SPI_SPEED=" << spi_speed << " BITS_PER_WORD=" << ((int)spi_bits) << " ... ";
-	// #endif
-	
-	//buf[len-1].cs_change=1;
-	// send it
-	r = ioctl(*h, SPI_IOC_MESSAGE(len), &buf);	
-	
-	if (r < 0) {
-		#if defined(_DEBUG_)
-			std::cout << "ERROR" << std::endl;
-			fprintf(stderr, "   Return=%d errno=%d str=%s", r, errno, strerror(errno));
-			std::cout << std::endl;
-		#else 
-			fprintf(stderr, "SPI.TRANSMIT ERRROR (%d,%d) : %s", r, errno, strerror(errno));
-		#endif
-		return -2;
+void bench_shapes(void) {
+	static const shape_t shapes[] = {
+		{ SH_LINE, 0, 0, 479, 319, 0 },      { SH_LINE, 479, 0, 0, 319, 0 },
+		{ SH_LINE, 20, 300, 460, 290, 0 },   { SH_LINE, 200, 10, 213, 310, 0 },
+		{ SH_LINE, 300, 200, 100, 120, 0 },  { SH_LINE, 150, 300, 160, 20, 0 },
+		{ SH_LINE, -60, 10, 530, 300, 0 },   { SH_LINE, 10, -40, 60, 400, 0 },
+		{ SH_LINE, -10, 50, 600, 50, 0 },    { SH_LINE, 30, -10, 30, 500, 0 },
+		{ SH_LINE, 470, 310, 560, 350, 0 },  { SH_LINE, -50, -20, -5, 300, 0 },
+		{ SH_LINE, 100, 100, 100, 100, 0 },  { SH_LINE, 0, 0, 7, 3, 0 },
+		{ SH_RECT, 10, 10, 200, 120, 0 },    { SH_RECT, 300, 200, 290, 250, 0 },
+		{ SH_RECT, -20, 100, 40, 400, 0 },   { SH_RECT, 5, 5, 5, 9, 0 },
+		{ SH_FILLRECT, 50, 60, 52, 61, 0 },  { SH_FILLRECT, 400, -30, 520, 40, 0 },
+		{ SH_CIRCLE, 240, 160, 0, 0, 0 },    { SH_CIRCLE, 240, 160, 0, 0, 1 },
+		{ SH_CIRCLE, 240, 160, 0, 0, 2 },    { SH_CIRCLE, 240, 160, 0, 0, 7 },
+		{ SH_CIRCLE, 240, 160, 0, 0, 50 },   { SH_CIRCLE, 240, 160, 0, 0, 159 },
+		{ SH_CIRCLE, 10, 10, 0, 0, 30 },     { SH_CIRCLE, 470, 315, 0, 0, 25 },
+		{ SH_CIRCLE, -20, 160, 0, 0, 40 },   { SH_CIRCLE, 240, 400, 0, 0, 60 },
+		{ SH_FILLCIRCLE, 240, 160, 0, 0, 0 }, { SH_FILLCIRCLE, 240, 160, 0, 0, 1 },
+		{ SH_FILLCIRCLE, 100, 100, 0, 0, 3 }, { SH_FILLCIRCLE, 240, 160, 0, 0, 33 },
+		{ SH_FILLCIRCLE, 240, 160, 0, 0, 150 }, { SH_FILLCIRCLE, 0, 319, 0, 0, 45 },
+		{ SH_FILLCIRCLE, 500, 100, 0, 0, 30 }, { SH_FILLCIRCLE, 240, -50, 0, 0, 70 },
+		{ SH_ROUND, 330, 170, 470, 300, 12 }, { SH_ROUND, 20, 20, 60, 200, 40 },
+		{ SH_ROUND, 100, 100, 103, 110, 5 }, { SH_ROUND, -20, -20, 100, 60, 15 },
+		{ SH_ROUND, 400, 280, 520, 360, 30 }, { SH_ROUND, 220, 230, 200, 200, 10 },
+		{ SH_FILLROUND, 330, 170, 470, 300, 12 }, { SH_FILLROUND, 20, 20, 60, 200, 40 },
+		{ SH_FILLROUND, 100, 100, 101, 101, 3 }, { SH_FILLROUND, -20, -20, 100, 60, 15 },
+		{ SH_FILLROUND, 400, 280, 520, 360, 30 }, { SH_FILLROUND, 200, 200, 221, 230, 9 },
+	};
+	const int n = sizeof(shapes) / sizeof(shapes[0]);
+	LCD_Display_t *d = new LCD_Display_t;
+	uint16_t *ref = (uint16_t *)malloc(REF_W * REF_H * sizeof(uint16_t));
+	uint16_t *tmp = (uint16_t *)malloc(REF_W * REF_H * sizeof(uint16_t));
+	int bad = 0, skew = 0;
+
+	lcd_open_transport(d, &null_transport, NULL);
+	lcd_shadow_init(d, LCD_SHADOW_RGB565);
+	for (int i=0; i<n; i++) {
+		lcd_fill(d, ILI9341_COLOR_BLACK);
+		memset(ref, 0, REF_W * REF_H * sizeof(uint16_t));
+		shape_draw(d, &shapes[i], ILI9341_COLOR_WHITE);
+		shape_ref(ref, tmp, &shapes[i], ILI9341_COLOR_WHITE);
+		bool same = true;
+		for (int y=0; y<ILI9341_HEIGHT && same; y++)
+			same = memcmp(d->fb + y * ILI9341_WIDTH, ref + (y + REF_M) * REF_W + REF_M, ILI9341_WIDTH * sizeof(uint16_t)) == 0;
+		if (!same) {
+			bad++;
+			printf("Shape %d (kind %d) differs from the pixel reference\n", i, shapes[i].kind);
+		}
+		if (!shape_symmetric(d->fb, &shapes[i])) {
+			skew++;
+			printf("Shape %d (kind %d) is not symmetric\n", i, shapes[i].kind);
+		}
 	}
-	
-	// #if defined(_DEBUG_)
-		// std::cout << "OK";
-		// std::cout << std::endl;
-	// #endif
-	
-	return r;	
+	lcd_close(d);
+	printf("Shapes against a pixel reference: %d shapes, %s\n", n, bad || skew ? "MISMATCH" : "ok");
+	free(ref);
+	free(tmp);
+	delete d;
 }
 
+/* dashboard for bench_strip: tiles, labels, needles, an icon block */
+void strip_scene(LCD_Strip_t *s, LCD_Point_t (*needles)[4], const uint16_t *icon) {
+	static const char *labels[12] = { "rpm", "oil", "fuel", "temp", "volt", "amp", "boost", "egt", "afr", "map", "iat", "gear" };
+	lcd_strip_clear(s);
+	lcd_strip_fill(s, 0, 0, 479, 19, ILI9341_COLOR_BLUE);
+	lcd_strip_text(s, 4, 1, "strip renderer\npage mode", &TM_Font_7x10, ILI9341_COLOR_WHITE, ILI9341_TRANSPARENT);
+	for (int i=0; i<12; i++) {
+		int x = (i % 4) * 120, y = 24 + (i / 4) * 96;
+		lcd_strip_fill(s, x + 2, y + 2, x + 117, y + 93, lcd_palette_default[1 + i % 12]);
+		lcd_strip_text(s, x + 8, y + 8, labels[i], &TM_Font_11x18, ILI9341_COLOR_WHITE, ILI9341_COLOR_BLACK);
+		needle(needles[i], x + 60, y + 60, i * M_PI / 6, 30);
+		lcd_strip_poly(s, needles[i], 4, ILI9341_COLOR_RED);
+		lcd_strip_blit(s, x + 90, y + 66, 24, 24, icon, 24);
+	}
+}
 
-/* **********************************************************************************
-	LCD ROUTINES
-   ********************************************************************************** */
+/*
+	Name: bench_strip
+	Description: Dashboard scene rendered in strips of several heights into a transport that
+		drops the bytes: replay cost per strip height against one full height pass (the frame
+		buffer case) and memory held. Every height is checked pixel for pixel against the full
+		pass through an RGB565 shadow.
+*/
+void bench_strip(void) {
+	static const int heights[] = { 8, 16, 32, 64 };
+	const int frames = 20, cap = 64;
+	LCD_Display_t *d = new LCD_Display_t;
+	LCD_StripCmd_t *cmd = (LCD_StripCmd_t *)malloc(cap * sizeof(LCD_StripCmd_t));
+	uint16_t *buf = (uint16_t *)malloc(ILI9341_PIXEL * sizeof(uint16_t));
+	uint16_t *ref = (uint16_t *)malloc(ILI9341_PIXEL * sizeof(uint16_t));
+	uint16_t icon[24*24];
+	LCD_Point_t needles[12][4];
+	LCD_Strip_t s;
+	double full = 0;
+
+	for (int i=0; i<24*24; i++) icon[i] = (uint16_t)(((i % 24) << 11) | ((i / 24) << 6));
+	for (int k=-1; k<(int)(sizeof(heights)/sizeof(heights[0])); k++) {
+		int rows = k < 0 ? ILI9341_HEIGHT : heights[k];
+		lcd_strip_init(&s, cmd, cap, buf, ILI9341_WIDTH * rows, ILI9341_COLOR_BLACK);
+		strip_scene(&s, needles, icon);
+
+		lcd_open_transport(d, &null_transport, NULL);
+		lcd_shadow_init(d, LCD_SHADOW_RGB565);
+		lcd_strip_render(&s, d, NULL);
+		if (k < 0) memcpy(ref, d->fb, ILI9341_PIXEL * sizeof(uint16_t));
+		bool same = memcmp(ref, d->fb, ILI9341_PIXEL * sizeof(uint16_t)) == 0;
+		lcd_close(d);
+
+		lcd_open_transport(d, &null_transport, NULL);
+		s.strips = s.visits = s.draws = 0;
+		s.raster_ns = s.send_ns = 0;
+		for (int f=0; f<frames; f++) lcd_strip_render(&s, d, NULL);
+		lcd_close(d);
+
+		double raster = s.raster_ns / 1e6 / frames;
+		if (k < 0) full = raster;
+		printf("Strip %3d rows: %7zu bytes, %3u strips, %5.1f of %d commands each, %7.3f ms raster (%+5.1f%%) + %7.3f ms send, %s\n",
+			rows, lcd_strip_memory(&s), s.strips / frames, (double)s.draws / s.strips, s.n, raster,
+			full > 0 ? (raster / full - 1) * 100 : 0, s.send_ns / 1e6 / frames, same ? "ok" : "MISMATCH");
+	}
+	free(cmd);
+	free(buf);
+	free(ref);
+	delete d;
+}
 
-#define LCD_SPI_DEVICE "/dev/spidev0.0"
-#define LCD_SPI_MODE SPI_MODE_0
-//#define LCD_SPI_SPEED 3500000
-#define LCD_SPI_SPEED 25000000
-#define LCD_SPI_BITS_PER_WORD 8
-   
-void lcd_reset(int *spih) {
-	uint8_t buff[4] = { 0,0,0,0 };
-	int r;
-	
-	#ifdef _DEBUG_
-		printf("LCD_RESET\n");
-	#endif	
-	
-	// set Reset LOW
-	r = spi_transmit(spih, &buff[0], 4, LCD_SPI_SPEED, LCD_SPI_BITS_PER_WORD);
-	if (r < 0) {		
-		fprintf(stderr, "SPI.LCD_RESET_1 error (%d) : %s", errno, strerror(errno));
+/*
+	Name: bench_runs
+	Description: Run shadow against RGB565 as the dashboard gets busier: tiles only, tiles with
+		labels, then a growing share of the screen under a block where every pixel differs
+		from its neighbour. Reports memory and draw and flush time per screen to find the
+		crossover; both modes must hash to the same bytes.
+*/
+void bench_runs(void) {
+	static const int busy[] = { -1, 0, 5, 10, 25, 50, 100 }; // -1: no labels
+	const int frames = 8;
+	LCD_Display_t *d = new LCD_Display_t;
+	uint16_t *img = (uint16_t *)malloc((ILI9341_PIXEL + frames) * sizeof(uint16_t));
+
+	for (int i=0; i<ILI9341_PIXEL + frames; i++) img[i] = (uint16_t)(i * 2654435761u >> 16);
+	for (size_t k=0; k<sizeof(busy)/sizeof(busy[0]); k++) {
+		size_t bytes[2];
+		double draw[2], send[2];
+		sum_t sum[2] = {};
+		char name[24];
+		int rows = ILI9341_HEIGHT * busy[k] / 100;
+		for (int m=0; m<2; m++) {
+			lcd_open_transport(d, &sum_transport, &sum[m]);
+			lcd_shadow_init(d, m ? LCD_SHADOW_RLE : LCD_SHADOW_RGB565);
+			lcd_flush(d);
+			draw[m] = send[m] = 0;
+			for (int f=0; f<frames; f++) {
+				double t = now_ms();
+				dashboard(d, f, busy[k] >= 0);
+				if (rows > 0) lcd_blit(d, 0, 0, ILI9341_WIDTH, rows, img + f, ILI9341_WIDTH);
+				draw[m] += now_ms() - t;
+				t = now_ms();
+				lcd_flush(d);
+				send[m] += now_ms() - t;
+			}
+			bytes[m] = lcd_shadow_bytes(d);
+			sum[m].on = true; // last frame once more, hashed
+			lcd_damage_add(&d->dirty, lcd_rect(0, 0, d->opts.width - 1, d->opts.height - 1));
+			lcd_flush(d);
+			lcd_close(d);
+		}
+		if (busy[k] < 0) snprintf(name, sizeof(name), "flat");
+		else if (busy[k] == 0) snprintf(name, sizeof(name), "labels");
+		else snprintf(name, sizeof(name), "%d%% busy", busy[k]);
+		printf("Runs, %-9s: 565 %7zu bytes %6.3f + %6.3f ms, rle %7zu bytes %6.3f + %6.3f ms (draw + flush), %s\n", name, bytes[0], draw[0] / frames, send[0] / frames, bytes[1], draw[1] / frames, send[1] / frames,
+			sum[0].h == sum[1].h ? "same bytes" : "MISMATCH");
 	}
-	
-	delayms(50);
-	
-	// set Reset High
-	buff[0]=buff[1]=buff[2] = 0;
-	buff[3]=0x02;
-	r = spi_transmit(spih, &buff[0], 4, LCD_SPI_SPEED, LCD_SPI_BITS_PER_WORD);
-	if (r < 0) {		
-		fprintf(stderr, "SPI.LCD_RESET_2 error (%d) : %s", errno, strerror(errno));
+	free(img);
+	delete d;
+}
+
+/*
+	Name: bench_fonts
+	Description: Proportional variants of the TM fonts: line width against the monospaced cells,
+		drawing checked between TM_ILI9341_Puts and lcd_surface_text, and the cost of
+		measuring a dashboard's labels every frame, plain and through LCD_FontCache_t.
+*/
+void bench_fonts(LCD_Display_t *d) {
+	static TM_FontDef_t *mono[3] = { &TM_Font_7x10, &TM_Font_11x18, &TM_Font_16x26 };
+	static const char *labels[12] = { "Temperature", "Oil pressure", "Fuel level", "Battery 13.8 V", "Boost 1.2 bar",
+		"AFR 14.7", "Intake 31 C", "Coolant 88 C", "Gear 4", "RPM 3250", "Speed 72 km/h", "Trip 1034.5 km" };
+	const char *line = "Today: Vin 12.4 V, Iout 1.25 A, Tamb 21.5 C, RH 48 %";
+	const int reps = 20000;
+	TM_FontMetrics_t m[3];
+	TM_FontDef_t prop[3];
+	LCD_FontCache_t cache;
+	uint64_t hash[12];
+	volatile int sink = 0;
+	double t;
+
+	for (int i=0; i<3; i++) {
+		TM_FONTS_SIZE_t a, b;
+		lcd_font_proportional(mono[i], &m[i], lcd_font_kern_default, LCD_FONT_KERN_DEFAULT, &prop[i]);
+		TM_FONTS_GetStringSize((char *)line, &a, mono[i]);
+		TM_FONTS_GetStringSize((char *)line, &b, &prop[i]);
+		printf("Font %2dx%-2d: line %4d px monospaced, %4d px proportional (%.0f%%)\n", mono[i]->FontWidth, mono[i]->FontHeight,
+			a.Length, b.Length, 100.0 * b.Length / a.Length);
 	}
-	
-	#ifdef _DEBUG_
-		printf("LCD_RESET end.\n");
-	#endif	
-	
-	
-	delayms(200);
-}	
 
-void lcd_data(int *spih, uint16_t data) {
-	uint8_t buff[4] = { 0,0,0,0};
-	int r;
-	
-	// #ifdef _DEBUG_
-		// printf("LCD_DATA(%04X)\n", data);
-	// #endif
-	
-	buff[1] =  data>>8;
-	buff[2] = data&0x00ff;
-	buff[3] = 0x15; // 0x15 - DATA_BE const from ili9341.c (BE is short form "before")
-	r = spi_transmit(spih, &buff[0], 4, LCD_SPI_SPEED, LCD_SPI_BITS_PER_WORD);
-	
-	if (r < 0) {		
-		fprintf(stderr, "SPI.LCD_DATA_1(0x%4X) error (%d,%d) : %s", data, r, errno, strerror(errno));
-		return;
+	/* the same text both ways, transparent so cell backgrounds do not differ */
+	LCD_Display_t *s = new LCD_Display_t;
+	LCD_Buffer_t buf = { ILI9341_WIDTH, ILI9341_HEIGHT, ILI9341_WIDTH, (uint16_t *)calloc(ILI9341_PIXEL, sizeof(uint16_t)) };
+	LCD_Rect_t r;
+	lcd_open_transport(s, &null_transport, NULL);
+	lcd_shadow_init(s, LCD_SHADOW_RGB565);
+	for (int i=0; i<3; i++) {
+		TM_ILI9341_Puts(s, 4, 4 + i * 40, (char *)"AVAWAY To Ta\nfill 1.25 A", &prop[i], ILI9341_COLOR_WHITE, ILI9341_TRANSPARENT);
+		lcd_surface_text(&buf, 4, 4 + i * 40, "AVAWAY To Ta\nfill 1.25 A", &prop[i], ILI9341_COLOR_WHITE, ILI9341_TRANSPARENT, &r);
 	}
-	
-	buff[1] =  data>>8;
-	buff[2] = data&0x00ff;
-	buff[3] = 0x1F; // 0x1F - DATA_AF const from ili9341.c (AF is short form "after")
-	r = spi_transmit(spih, &buff[0], 4, LCD_SPI_SPEED, LCD_SPI_BITS_PER_WORD);
-	if (r < 0) {		
-		fprintf(stderr, "SPI.LCD_DATA_2(0x%4X) error (%d,%d) : %s", data, r, errno, strerror(errno));
+	printf("Proportional Puts against lcd_surface_text: %s\n", memcmp(s->fb, buf.px, ILI9341_PIXEL * sizeof(uint16_t)) ? "MISMATCH" : "ok");
+	lcd_close(s);
+	delete s;
+	free(buf.px);
+
+	t = now_ms();
+	for (int k=0; k<reps; k++) {
+		for (int i=0; i<12; i++) {
+			TM_FONTS_SIZE_t z;
+			TM_FONTS_GetStringSize((char *)labels[i], &z, &prop[1]);
+			sink += z.Length;
+		}
 	}
+	t = now_ms() - t;
+	printf("Label sizes, measured     : %7.1f ns/label\n", t * 1e6 / (reps * 12));
+
+	lcd_font_cache_clear(&cache);
+	t = now_ms();
+	for (int k=0; k<reps; k++)
+		for (int i=0; i<12; i++) sink += lcd_font_size(&cache, labels[i], &prop[1]).Length;
+	t = now_ms() - t;
+	printf("Label sizes, cached       : %7.1f ns/label, %u hits %u misses\n", t * 1e6 / (reps * 12), cache.hits, cache.misses);
+
+	for (int i=0; i<12; i++) hash[i] = lcd_font_hash(labels[i]);
+	lcd_font_cache_clear(&cache);
+	t = now_ms();
+	for (int k=0; k<reps; k++)
+		for (int i=0; i<12; i++) sink += lcd_font_size_hashed(&cache, labels[i], hash[i], &prop[1]).Length;
+	t = now_ms() - t;
+	printf("Label sizes, kept hash    : %7.1f ns/label, %u hits %u misses\n", t * 1e6 / (reps * 12), cache.hits, cache.misses);
+
+	lcd_fill2(d, 0, 262, 479, 319, ILI9341_COLOR_WHITE);
+	TM_ILI9341_Puts(d, 2, 264, (char *)line, &TM_Font_7x10, ILI9341_COLOR_BLACK, ILI9341_TRANSPARENT);
+	TM_ILI9341_Puts(d, 2, 278, (char *)line, &prop[0], ILI9341_COLOR_BLACK, ILI9341_TRANSPARENT);
+	TM_ILI9341_Puts(d, 2, 292, (char *)line, &prop[1], ILI9341_COLOR_BLUE, ILI9341_TRANSPARENT);
+	lcd_flush(d);
+}
 
+/* bench_hook toggles: the recorder under test off or on */
+void trace_toggle(bool on) {
+	if (on) lcd_trace_start();
+	else lcd_trace_stop();
 }
 
-void lcd_cmd(int *spih, uint16_t cmd) {
-	uint8_t buff[4] = { 0,0,0,0};
-	int r;
-	
-	// #ifdef _DEBUG_
-		// printf("LCD_CMD(%04X)\n", cmd);
-	// #endif
-	
-	
-	buff[1] =  cmd>>8;
-	buff[2] = cmd&0x00ff;
-	buff[3] = 0x11; // 0x15 - DATA_BE const from ili9341.c (BE is short form "before")
-	r = spi_transmit(spih, &buff[0], 4, LCD_SPI_SPEED, LCD_SPI_BITS_PER_WORD);
-	if (r < 0) {		
-		fprintf(stderr, "SPI.LCD_CMD_1(%4X) error (%d,%d) : %s", cmd, r, errno, strerror(errno));
+void stats_toggle(bool on) {
+	lcd_stats_enable(on);
+	lcd_stats_reset();
+}
+
+/*
+	Name: bench_hook
+	Description: Time of the smallest draw call (a one pixel lcd_fill2 into a transport that drops
+		the bytes) with the recorder under test switched off by toggle, then on.
+	Parameters:
+		1. toggle : function - switches the recorder
+		2. calls : int - fills per run
+		3. ns : double[2] - out, ns per call off and on
+*/
+void bench_hook(void (*toggle)(bool), int calls, double ns[2]) {
+	LCD_Display_t *d = new LCD_Display_t;
+
+	lcd_open_transport(d, &null_transport, NULL);
+	for (int on=0; on<2; on++) {
+		toggle(on);
+		ns[on] = now_ms();
+		for (int i=0; i<calls; i++) lcd_fill2(d, i % 480, i % 320, i % 480, i % 320, (uint16_t)i);
+		ns[on] = (now_ms() - ns[on]) * 1e6 / calls;
 	}
-	
-	buff[1] =  cmd>>8;
-	buff[2] = cmd&0x00ff;
-	buff[3] = 0x1B; // 0x1F - DATA_AF const from ili9341.c (AF is short form "after")
-	r = spi_transmit(spih, &buff[0], 4, LCD_SPI_SPEED, LCD_SPI_BITS_PER_WORD);
-	if (r < 0) {		
-		fprintf(stderr, "SPI.LCD_CMD_2(%4X) error (%d,%d) : %s", cmd, r, errno, strerror(errno));
+	lcd_close(d);
+	delete d;
+}
+
+/*
+	Name: bench_trace
+	Description: Cost of the call tracer on the smallest draw call, tracing off and on.
+		Call statistics are off meanwhile.
+*/
+void bench_trace(void) {
+	bool was = lcd_trace_on(), stats = lcd_stats_on();
+	double t[2];
+
+	lcd_stats_enable(false);
+	bench_hook(trace_toggle, 200000, t);
+	if (!was) lcd_trace_stop();
+	lcd_stats_enable(stats);
+	printf("Trace: %7.1f ns per 1 px fill off, %7.1f ns on (4 events each)\n", t[0], t[1]);
+}
+
+/*
+	Name: bench_stats
+	Description: Cost of the call statistics on the smallest draw call, recording off and on, and
+		the histogram it fills. Restores the state it found; the counts start over.
+*/
+void bench_stats(void) {
+#if !LCD_STATS
+	printf("Stats: compiled out (LCD_STATS 0)\n");
+#else
+	const int calls = 200000;
+	bool was = lcd_stats_on();
+	double t[2];
+
+	bench_hook(stats_toggle, calls, t);
+	LCD_StatsSummary_t s = lcd_stats_summary(LCD_ST_FILL);
+	lcd_stats_enable(was);
+	lcd_stats_reset();
+	printf("Stats: %7.1f ns per 1 px fill off, %7.1f ns on; %u calls p50 %u ns p99 %u ns max %u ns%s\n", t[0], t[1],
+		s.count, s.p50, s.p99, s.max, s.count == (uint32_t)calls ? "" : " COUNT MISMATCH");
+#endif
+}
+
+/*
+	Name: bench_encode
+	Description: RGB565 to KeDei frames for a full screen, scalar against the vector encoder,
+		checked byte for byte in every word size and compared with what the bus can take.
+*/
+void bench_encode(LCD_Display_t *d) {
+	static const uint8_t sizes[3] = { 8, 16, 32 };
+	const int n = ILI9341_PIXEL, reps = 20;
+	uint16_t *px = (uint16_t *)malloc(n * sizeof(uint16_t));
+	uint8_t *a = (uint8_t *)malloc((size_t)n * 8);
+	uint8_t *b = (uint8_t *)malloc((size_t)n * 8);
+	double t;
+
+	for (int i=0; i<n; i++) px[i] = (uint16_t)(i * 40503u);
+	for (int k=0; k<3; k++) {
+		lcd_encode_span_scalar(a, px, n - k, sizes[k]); // odd lengths exercise the tails
+		lcd_encode_span(b, px, n - k, sizes[k]);
+		if (memcmp(a, b, (size_t)(n - k) * 8)) printf("Encode %s: MISMATCH at %d bits\n", lcd_encode_impl(), sizes[k]);
 	}
 
+	t = now_ms();
+	for (int r=0; r<reps; r++) {
+		lcd_encode_span_scalar(a, px, n, d->bits);
+		__asm__ __volatile__("" : : "r"(a) : "memory");
+	}
+	t = (now_ms() - t) / reps;
+	printf("Encode scalar   : %8.3f ms/frame, %7.1f MB/s out\n", t, n * 8 / t / 1000);
+	t = now_ms();
+	for (int r=0; r<reps; r++) {
+		lcd_encode_span(b, px, n, d->bits);
+		__asm__ __volatile__("" : : "r"(b) : "memory");
+	}
+	t = (now_ms() - t) / reps;
+	printf("Encode %-9s: %8.3f ms/frame, %7.1f MB/s out (bus %.1f MB/s)\n", lcd_encode_impl(), t, n * 8 / t / 1000, d->speed / 8e6);
+	free(px);
+	free(a);
+	free(b);
 }
 
-void lcd_setptr(int *spih) {
-	lcd_cmd(spih, 0x002b);	//Page Address Set 
-	lcd_data(spih, 0x0000); 
-	lcd_data(spih, 0x0000); // 0
-	lcd_data(spih, 0x0001);
-	lcd_data(spih, 0x003f); //319
-	
-	lcd_cmd(spih, 0x002a);	//Column Address Set
-	lcd_data(spih, 0x0000);
-	lcd_data(spih, 0x0000); // 0
-	lcd_data(spih, 0x0001);
-	lcd_data(spih, 0x00df); // 479
-	
-	lcd_cmd(spih, 0x002c);
+/* one mock run of bitbang_rows, checked against what was sent */
+template <unsigned MODE, unsigned BITS>
+void bench_bitbang_run(const uint8_t *in, uint8_t *out, int len) {
+	GPIO_Mock_t g;
+	double t;
+
+	gpio_mock_init(&g, MODE, out, len);
+	t = now_ms();
+	bitbang_rows<GPIO_Mock_t, MODE, BITS>(&g, in, len, 1, len);
+	t = now_ms() - t;
+	bool ok = g.len == (size_t)len && g.frames == (uint32_t)len / 4 && !g.bad && !memcmp(in, out, len);
+	printf("Bitbang mock mode %u, %2u bit words: %s, %.2f pin writes per bit, %.1f ns per bit\n",
+		MODE, BITS, ok ? "ok" : "MISMATCH", (double)g.writes / (len * 8), t * 1e6 / (len * 8));
 }
 
+/*
+	Name: bench_bitbang
+	Description: The bit-bang word loops against the mock GPIO: every mode and word size must
+		deliver the frames unchanged, one chip select cycle each.
+*/
+void bench_bitbang(void) {
+	const int n = 16384; // frames
+	uint8_t *in = (uint8_t *)malloc(n * 4);
+	uint8_t *out = (uint8_t *)malloc(n * 4);
+
+	for (int i=0; i<n; i++) lcd_frame(in + i*4, (uint16_t)(i * 40503u), i & 1 ? 0x1F : 0x15, 8);
+	bench_bitbang_run<SPI_MODE_0, 32>(in, out, n * 4);
+	bench_bitbang_run<SPI_MODE_0, 8>(in, out, n * 4);
+	bench_bitbang_run<SPI_MODE_1, 16>(in, out, n * 4);
+	bench_bitbang_run<SPI_MODE_3, 32>(in, out, n * 4);
+	free(in);
+	free(out);
+}
 
-	
-void lcd_setarea(int *spih, uint16_t x, uint16_t y) {
-	lcd_cmd(spih, 0x002b);//Set Gamma 
-	lcd_data(spih, y>>8);
-	lcd_data(spih, 0x00ff&y);
-	lcd_data(spih, 0x0001);
-	lcd_data(spih, 0x003f);
+/* what lane i draws in bench_lanes */
+void lanes_draw(LCD_Display_t *d, int i) {
+	static const uint16_t colors[4] = { ILI9341_COLOR_RED, ILI9341_COLOR_GREEN, ILI9341_COLOR_BLUE, ILI9341_COLOR_YELLOW };
+	lcd_fill2(d, 10 * i, 20, 10 * i + 60 + 20 * i, 80, colors[i & 3]);
+	TM_ILI9341_Puts(d, 5, 100 + 20 * i, (char *)"lane", &TM_Font_7x10, ILI9341_COLOR_WHITE, ILI9341_COLOR_BLACK);
+}
+
+/*
+	Name: bench_lanes
+	Description: Multi-lane bit-bang against a mock port. Raw streams of different lengths must
+		arrive unchanged on every lane with idle padding behind them; then four displays drawn
+		on lanes must send what each sends alone on a single lane mock.
+*/
+void bench_lanes(void) {
+	const int n = 4, max = 4096, cap = 1 << 18;
+	const int frames[n] = { max, 3000, max, 100 };
+	const uint32_t pin[n] = { 1u << 4, 1u << 7, 1u << 12, 1u << 13 };
+	uint8_t *in[n], *out[n], *ref = (uint8_t *)malloc(cap), idle[n][4];
+	uint32_t lut[256];
+	GPIO_MockPort_t g;
+	uint64_t serial = 0;
+	bool ok = true;
+	double t;
+
+	for (int i=0; i<n; i++) {
+		in[i] = (uint8_t *)malloc(max * 4);
+		out[i] = (uint8_t *)malloc(cap);
+		for (int f=0; f<max; f++) lcd_frame(in[i] + f*4, (uint16_t)(f * 40503u + i * 7919u), f & 1 ? 0x1F : 0x15, 8);
+		lcd_frame(idle[i], 0, 0x1F, 8);
+		GPIO_Mock_t one;
+		gpio_mock_init(&one, SPI_MODE_0, NULL, 0);
+		bitbang_rows<GPIO_Mock_t, SPI_MODE_0, 32>(&one, in[i], frames[i] * 4, 1, frames[i] * 4);
+		serial += one.writes;
+	}
+	lcd_lanes_lut(lut, pin, n);
+	gpio_mock_port_init(&g, SPI_MODE_0, pin, n, out, cap);
+	t = now_ms();
+	int slots = bitbang_lanes<GPIO_MockPort_t, SPI_MODE_0>(&g, 0, lut, in, frames, idle, n);
+	t = now_ms() - t;
+	ok = slots == max && g.frames == (uint32_t)max && !g.bad && g.len == (size_t)max * 4;
+	for (int i=0; i<n && ok; i++) {
+		ok = !memcmp(out[i], in[i], frames[i] * 4);
+		for (int f=frames[i]; f<max && ok; f++) ok = !memcmp(out[i] + f*4, in[i] + (frames[i] - 1) * 4, 4);
+	}
+	printf("Lanes mock, %d lanes: %s, %llu pin writes against %llu one lane after the other, %.1f ns per clock\n",
+		n, ok ? "ok" : "MISMATCH", (unsigned long long)g.writes, (unsigned long long)serial, t * 1e6 / (max * 32));
+
+	/* displays on lanes against each display alone */
+	LCD_Lanes_t *l = new LCD_Lanes_t;
+	LCD_Display_t *d = new LCD_Display_t[n];
+	gpio_mock_port_init(&g, SPI_MODE_0, pin, n, out, cap);
+	lcd_lanes_init<GPIO_MockPort_t, SPI_MODE_0>(l, &g, pin, n);
+	l->batch = true;
+	for (int i=0; i<n; i++) lcd_lanes_open(&d[i], l, i);
+	for (int i=0; i<n; i++) lanes_draw(&d[i], i);
+	lcd_lanes_send(l);
+	ok = !g.bad;
+	for (int i=0; i<n; i++) {
+		GPIO_Mock_t one;
+		LCD_Display_t *s = new LCD_Display_t;
+		gpio_mock_init(&one, SPI_MODE_0, ref, cap);
+		lcd_open_transport(s, lcd_gpio_transport<GPIO_Mock_t>(), &one);
+		lanes_draw(s, i);
+		lcd_close(s);
+		delete s;
+		ok &= one.len <= (size_t)cap && one.len <= g.len && !memcmp(out[i], ref, one.len);
+	}
+	printf("Lanes displays, %d lanes: %s, %llu frames in %llu frame times\n",
+		n, ok ? "ok" : "MISMATCH", (unsigned long long)l->frames, (unsigned long long)l->slots);
+	for (int i=0; i<n; i++) lcd_close(&d[i]);
+	lcd_lanes_free(l);
+	delete[] d;
+	delete l;
+	for (int i=0; i<n; i++) {
+		free(in[i]);
+		free(out[i]);
+	}
+	free(ref);
+}
 
-	lcd_cmd(spih, 0x002a);//Set Gamma 
-	lcd_data(spih, x>>8) ;
-	lcd_data(spih, 0x00ff&x) ;
-	lcd_data(spih, 0x0001);
-	lcd_data(spih, 0x00df);
-	lcd_cmd(spih, 0x002c);
+/* what the GPIO mock decoded, when d bit-bangs into one */
+void gpio_mock_print(LCD_Display_t *d) {
+	if (d->xport == lcd_gpio_transport<GPIO_Mock_t>()) {
+		GPIO_Mock_t *g = (GPIO_Mock_t *)d->xctx;
+		printf("GPIO mock: %u frames, %u cut, %llu pin writes, hash %016llx\n", g->frames, g->bad, (unsigned long long)g->writes, (unsigned long long)g->hash);
+	}
 }
 
-void lcd_setarea2(int *spih, uint16_t sx, uint16_t sy, uint16_t x, uint16_t y) {
-	
-	if (sx>479)	sx=0;
-	if (sy>319) sy=0;
-	if (x>479) x=479;
-	if (y>319) y=319;
-	
-	lcd_cmd(spih, 0x002b);
-	lcd_data(spih, sy>>8) ;
-	lcd_data(spih, 0x00ff&sy);
-	lcd_data(spih, y>>8);
-	lcd_data(spih, 0x00ff&y);
+/*
+	Name: gpio_open
+	Description: Open the panel on a bit-banged GPIO backend instead of spidev, see lcd_gpio.h
+*/
+int gpio_open(LCD_Display_t *d, const char *how) {
+	static GPIO_Bcm_t bcm;
+	static GPIO_Sunxi_t sunxi;
+	static GPIO_Chip_t chip;
+	static GPIO_Mock_t mock;
+	int r;
+
+	if (!strcmp(how, "bcm")) {
+		if ((r = gpio_bcm_open(&bcm, &gpio_pins_bcm, 0)) < 0) return r;
+		return lcd_open_transport(d, lcd_gpio_transport<GPIO_Bcm_t>(), &bcm);
+	}
+	if (!strcmp(how, "sunxi")) {
+		if ((r = gpio_sunxi_open(&sunxi, GPIO_SUNXI_PORT_C, &gpio_pins_sunxi, 0)) < 0) return r;
+		return lcd_open_transport(d, lcd_gpio_transport<GPIO_Sunxi_t>(), &sunxi);
+	}
+	if (!strcmp(how, "mock")) {
+		gpio_mock_init(&mock, LCD_SPI_MODE, NULL, 0);
+		return lcd_open_transport(d, lcd_gpio_transport<GPIO_Mock_t>(), &mock);
+	}
+	if ((r = gpio_chip_open(&chip, how, &gpio_pins_bcm, 0)) < 0) return r;
+	return lcd_open_transport(d, lcd_gpio_transport<GPIO_Chip_t>(), &chip);
+}
+
+/*
+	Name: widget_demo
+	Description: Telemetry style screen of labels, bars and numbers. Only the changed
+		parts are sent on every update, the totals are compared with full redraws.
+*/
+void widget_demo(LCD_Display_t *d) {
+	LCD_Screen_t *s = new LCD_Screen_t;
+	LCD_Widget_t title, panel, name[3], bar[3], num[3];
+	static const char *names[3] = { "Pressure", "Flow", "Temp" };
+	uint32_t windows = 0, pixels = 0;
+	const int updates = 50;
+	
+	if (lcd_screen_init(s, d, ILI9341_COLOR_BLACK) < 0) {
+		delete s;
+		return;
+	}
+	s->damage.cost = lcd_cost_calibrate(d, ILI9341_COLOR_BLACK);
+	printf("Widgets: cost model %.2f us per window, %.3f us per pixel\n", s->damage.cost.window, s->damage.cost.pixel);
+	lcd_label_init(&title, 10, 5, 20, &TM_Font_11x18, ILI9341_COLOR_WHITE, ILI9341_COLOR_BLUE2);
+	lcd_label_set(&title, "Telemetry");
+	lcd_widget_add(&s->root, &title);
+	lcd_panel_init(&panel, 5, 40, 470, 120, ILI9341_COLOR_GRAY);
+	lcd_widget_add(&s->root, &panel);
+	for (int i=0; i<3; i++) {
+		int y = 50 + i * 35;
+		lcd_label_init(&name[i], 15, y + 4, 9, &TM_Font_11x18, ILI9341_COLOR_WHITE, ILI9341_TRANSPARENT);
+		lcd_label_set(&name[i], names[i]);
+		lcd_widget_add(&panel, &name[i]);
+		lcd_bar_init(&bar[i], 120, y, 240, 26, 0, 1000, ILI9341_COLOR_GREEN, ILI9341_COLOR_BLACK);
+		lcd_widget_add(&panel, &bar[i]);
+		lcd_number_init(&num[i], 370, y + 4, 8, 1, &TM_Font_11x18, ILI9341_COLOR_YELLOW, ILI9341_COLOR_GRAY);
+		lcd_widget_add(&panel, &num[i]);
+	}
+	lcd_screen_update(s);
+	std::cout << "Widgets: first update " << s->windows << " windows, " << s->pixels << " pixels" << std::endl;
+	memset(&s->damage.stats, 0, sizeof(s->damage.stats));
+	
+	double t = now_ms();
+	for (int k=0; k<updates; k++) {
+		for (int i=0; i<3; i++) {
+			int32_t v = 500 + (int32_t)(400 * sin(k * 0.2 + i));
+			lcd_bar_set(&bar[i], v);
+			lcd_number_set(&num[i], v);
+		}
+		lcd_screen_update(s);
+		windows += s->windows;
+		pixels += s->pixels;
+	}
+	t = now_ms() - t;
+	printf("Widgets: %.1f windows, %u pixels, %.3f ms per update (full redraw %d pixels)\n",
+		(double)windows / updates, pixels / updates, t / updates, 470 * 120);
+	LCD_DamageStats_t *st = &s->damage.stats;
+	printf("Damage: %u rects, %u splits, %u merges, %u forced, %u dirty / %u sent pixels\n",
+		st->added, st->splits, st->merges, st->forced, st->dirty, st->pixels);
+	printf("Damage: estimated ms per update: plan %.3f, exact pieces %.3f, bounding box %.3f\n",
+		st->cost_plan / 1000 / st->plans, st->cost_split / 1000 / st->plans, st->cost_bbox / 1000 / st->plans);
+	lcd_screen_close(s);
+	delete s;
+}
 
-	lcd_cmd(spih, 0x002a);
-	lcd_data(spih, sx>>8) ;
-	lcd_data(spih, 0x00ff&sx) ;
-	lcd_data(spih, x>>8);
-	lcd_data(spih, 0x00ff&x);
-	
-	lcd_cmd(spih, 0x002c); //Memory Write
-}
-
-void lcd_fill(int *spih, uint16_t color565) {
-	lcd_setptr(spih);
-	for(int x=0; x<153601;x++) {
-		lcd_data(spih, color565);
-	}
-}
-
-void lcd_fill2(int *spih, uint16_t sx, uint16_t sy, uint16_t x, uint16_t y, uint16_t color565) {
-	uint16_t tmp=0;
-	int cnt;
-	if (sx>479) sx=0;
-	if (sy>319) sy=0;
-	if (x>479)  x=479;
-	if (y>319)  y=319;
-	
-	if (sx>x) {
-		tmp=sx;
-		sx=x;
-		x=tmp;
-	}
-	
-	if (sy>y) {
-		tmp=sy;
-		sy=y;
-		y=tmp;
-	}
-	
-	cnt = (y-sy+1) * (x-sx+1);
-	lcd_setarea2(spih, sx,sy,x,y);
-	for(int t=0;t<cnt;t++) {
-		lcd_data(spih, color565);
-	}	
-}
-	
-
-//void lcd_init(int *spih) {
-//	ILI9486L
-void lcd_init(void) {
-	int *spih = &spi;
-	lcd_reset(spih);
-	delayms(100);
-	lcd_cmd(spih, 0x0000);	//No Operation
-	delayms(1);
-
-	lcd_cmd(spih, 0x00B0);	//Interface Mode Control 
-	lcd_data(spih, 0x0000);
-	lcd_cmd(spih, 0x0011);	//Sleep OUT
-	delayms(50); //mdelay(50);
-
-	lcd_cmd(spih, 0x00B3);	//Frame Control
-	lcd_data(spih, 0x0002);
-	lcd_data(spih, 0x0000);
-	lcd_data(spih, 0x0000);
-	lcd_data(spih, 0x0000);
-
-	lcd_cmd(spih, 0x00C0);	//Power Control 1
-	lcd_data(spih, 0x0010);//13
-	lcd_data(spih, 0x003B);//480
-	lcd_data(spih, 0x0000);
-	lcd_data(spih, 0x0002);
-	lcd_data(spih, 0x0000);
-	lcd_data(spih, 0x0001);
-	lcd_data(spih, 0x0000);//NW
-	lcd_data(spih, 0x0043);
-
-	lcd_cmd(spih, 0x00C1);	//Power Control 2
-	lcd_data(spih, 0x0008);//w_data(0x0008);
-	lcd_data(spih, 0x0016);//w_data(0x0016);//CLOCK
-	lcd_data(spih, 0x0008);
-	lcd_data(spih, 0x0008);
-
-	lcd_cmd(spih, 0x00C4);//Power Control 5
-	lcd_data(spih, 0x0011);
-	lcd_data(spih, 0x0007);
-	lcd_data(spih, 0x0003);
-	lcd_data(spih, 0x0003);
-
-	lcd_cmd(spih, 0x00C6);//CABC Control 1 ????
-	lcd_data(spih, 0x0000);
-
-	lcd_cmd(spih, 0x00C8); //GAMMA
-	lcd_data(spih, 0x0003);
-	lcd_data(spih, 0x0003);
-	lcd_data(spih, 0x0013);
-	lcd_data(spih, 0x005C);
-	lcd_data(spih, 0x0003);
-	lcd_data(spih, 0x0007);
-	lcd_data(spih, 0x0014);
-	lcd_data(spih, 0x0008);
-	lcd_data(spih, 0x0000);
-	lcd_data(spih, 0x0021);
-	lcd_data(spih, 0x0008);
-	lcd_data(spih, 0x0014);
-	lcd_data(spih, 0x0007);
-	lcd_data(spih, 0x0053);
-	lcd_data(spih, 0x000C);
-	lcd_data(spih, 0x0013);
-	lcd_data(spih, 0x0003);
-	lcd_data(spih, 0x0003);
-	lcd_data(spih, 0x0021);
-	lcd_data(spih, 0x0000);
-
-	lcd_cmd(spih, 0x0035);	//Tearing Effect Line ON
-	lcd_data(spih, 0x0000);
-
-	lcd_cmd(spih, 0x0036);  //Memory Access Control
-	lcd_data(spih, 0x0028);
-
-	lcd_cmd(spih, 0x003A);	//Pixel Format Set
-	lcd_data(spih, 0x0055); //55 lgh
-
-	lcd_cmd(spih, 0x0044);//Set Tear Scanline
-	lcd_data(spih, 0x0000);
-	lcd_data(spih, 0x0001);
-
-	lcd_cmd(spih, 0x00B6);	//Display Function Control
-	lcd_data(spih, 0x0000);
-	lcd_data(spih, 0x0002); //220 GS SS SM ISC[3:0]
-	lcd_data(spih, 0x003B);
-
-	lcd_cmd(spih, 0x00D0);	//NV Memory Write
-	lcd_data(spih, 0x0007);
-	lcd_data(spih, 0x0007); //VCI1
-	lcd_data(spih, 0x001D); //VRH
-
-	lcd_cmd(spih, 0x00D1);	//NV Memory Protection Key
-	lcd_data(spih, 0x0000);
-	lcd_data(spih, 0x0003); //VCM
-	lcd_data(spih, 0x0000); //VDV
-
-	lcd_cmd(spih, 0x00D2);	//NV Memory Status Read
-	lcd_data(spih, 0x0003);
-	lcd_data(spih, 0x0014);
-	lcd_data(spih, 0x0004);
-
-
-
-	lcd_cmd(spih, 0xE0);  		//Positive Gamma Correction
-	lcd_data(spih, 0x1f);  
-	lcd_data(spih, 0x2C);  
-	lcd_data(spih, 0x2C);  
-	lcd_data(spih, 0x0B);  
-	lcd_data(spih, 0x0C);  
-	lcd_data(spih, 0x04);  
-	lcd_data(spih, 0x4C);  
-	lcd_data(spih, 0x64);  
-	lcd_data(spih, 0x36);  
-	lcd_data(spih, 0x03);  
-	lcd_data(spih, 0x0E);  
-	lcd_data(spih, 0x01);  
-	lcd_data(spih, 0x10);  
-	lcd_data(spih, 0x01);  
-	lcd_data(spih, 0x00);  
-
-	lcd_cmd(spih, 0XE1);  	//Negative Gamma Correction
-	lcd_data(spih, 0x1f);  
-	lcd_data(spih, 0x3f);  
-	lcd_data(spih, 0x3f);  
-	lcd_data(spih, 0x0f);  
-	lcd_data(spih, 0x1f);  
-	lcd_data(spih, 0x0f);  
-	lcd_data(spih, 0x7f);  
-	lcd_data(spih, 0x32);  
-	lcd_data(spih, 0x36);  
-	lcd_data(spih, 0x04);  
-	lcd_data(spih, 0x0B);  
-	lcd_data(spih, 0x00);  
-	lcd_data(spih, 0x19);  
-	lcd_data(spih, 0x14);  
-	lcd_data(spih, 0x0F);  
-
-	lcd_cmd(spih, 0xE2);	//Digital Gamma Control 1
-	lcd_data(spih, 0x0f);
-	lcd_data(spih, 0x0f);
-
-	lcd_data(spih, 0x0f);
-
-	lcd_cmd(spih, 0xE3);	//Digital Gamma Control 2
-	lcd_data(spih, 0x0f);
-	lcd_data(spih, 0x0f);
-
-	lcd_data(spih, 0x0f);
-
-	lcd_cmd(spih, 0x13);	//Normal Display Mode ON
-
-	lcd_cmd(spih, 0x0029);	//Display ON
-	delayms(20); //mdelay(20);
-
-	lcd_cmd(spih, 0x00B4);	//Display Inversion Control
-	lcd_data(spih, 0x0000);
-	delayms(20); //mdelay(20);
-	lcd_cmd(spih, 0x002C);	//Memory Write
-	lcd_cmd(spih, 0x002A); 	//Column Address Set
-	lcd_data(spih, 0x0000);
-	lcd_data(spih, 0x0000);
-
-	lcd_data(spih, 0x0001);
-	lcd_data(spih, 0x000dF);
-
-	lcd_cmd(spih, 0x002B);  //Page Address Set
-	lcd_data(spih, 0x0000);
-	lcd_data(spih, 0x0000);
-	lcd_data(spih, 0x0001);
-	lcd_data(spih, 0x003f); 
-
-	lcd_cmd(spih, 0x002c); //Memory Write
-}
-
-
-
-
-/**
- * @brief  Draws single pixel to LCD
- * @param  x: X position for pixel
- * @param  y: Y position for pixel
- * @param  color: Color of pixel
- * @retval None
- */
-
-void lcd_DrawPixel(uint16_t x, uint16_t y, uint32_t color) {
-	int *spih = &spi;
-	
-	// lcd_SetCursorPosition(x, y, x, y);
-	
-	// lcd_cmd(&spi, 0x002c);
-	// lcd_data(&spi,color >> 8);
-	// lcd_data(&spi,color & 0xFF);
-	lcd_setarea2(spih, x,y,x,y);
-	lcd_data(spih, color);
-}
-
-/**
- * @brief  Puts single character to LCD
- * @param  x: X position of top left corner
- * @param  y: Y position of top left corner
- * @param  c: Character to be displayed
- * @param  *font: Pointer to @ref TM_FontDef_t used font
- * @param  foreground: Color for char
- * @param  background: Color for char background
- * @retval None
- */
-
-void TM_ILI9341_Putc(uint16_t x, uint16_t y, char c, TM_FontDef_t *font, uint32_t foreground, uint32_t background) {
-	uint32_t i, b, j;
-	/* Set coordinates */
-	ILI9341_x = x;
-	ILI9341_y = y;
-	
-	if ((ILI9341_x + font->FontWidth) > ILI9341_Opts.width) {
-		/* If at the end of a line of display, go to new line and set x to 0 position */
-		ILI9341_y += font->FontHeight;
-		ILI9341_x = 0;
-	}
-	
-	/* Draw rectangle for background */
-	if(background != ILI9341_TRANSPARENT)
-		lcd_fill2(&spi,ILI9341_x, ILI9341_y, ILI9341_x + font->FontWidth, ILI9341_y + font->FontHeight, background);
-	
-	/* Draw font data */
-	for (i = 0; i < font->FontHeight; i++) {
-		b = font->data[(c - 32) * font->FontHeight + i];
-		for (j = 0; j < font->FontWidth; j++) {
-			if ((b << j) & 0x8000) {
-				lcd_DrawPixel(ILI9341_x + j, (ILI9341_y + i), foreground);
+/*
+	Name: touch_demo
+	Description: Sample the touch controller while full-screen redraws keep the bus busy, paint a dot
+		at every touch and print how well the sampling kept its rate.
+*/
+void touch_demo(LCD_Display_t *d, const char *dev) {
+	LCD_Touch_t *t = new LCD_Touch_t;
+	LCD_TouchEvent_t e;
+	LCD_Latency_t *lat = new LCD_Latency_t;
+	SPI_Bus_t bus;
+	struct timespec now;
+	uint32_t age_max = 0, id = 0;
+	int frames = 20;
+
+	spi_bus_init(&bus, LCD_TOUCH_SLICE_US);
+	d->bus = &bus;
+	if (lcd_touch_open(t, dev, d->opts.width, d->opts.height, &bus) < 0 || lcd_touch_start(t, 0) < 0) {
+		fprintf(stderr, "Unable to start touch %s : %s\n", dev, strerror(errno));
+		lcd_touch_close(t);
+		d->bus = NULL;
+		spi_bus_destroy(&bus);
+		delete lat;
+		delete t;
+		return;
+	}
+	lcd_latency_init(lat);
+	d->lat = lat;
+
+	double ms = now_ms();
+	for (int k=0; k<frames; k++) {
+		/* full-screen redraw in bands, touches are drawn between them */
+		for (int y=0; y<d->opts.height; y+=40) {
+			lcd_fill2(d, 0, y, d->opts.width - 1, y + 39, k & 1 ? ILI9341_COLOR_BLUE2 : ILI9341_COLOR_BLACK);
+			while (lcd_touch_read(t, &e)) {
+				clock_gettime(CLOCK_MONOTONIC, &now);
+				uint32_t age = (uint32_t)(((uint64_t)now.tv_sec * 1000000000u + now.tv_nsec - e.t_ns) / 1000);
+				if (age > age_max) age_max = age;
+				if (e.type == LCD_TOUCH_UP) continue;
+				lcd_latency_input(lat, ++id, e.t_ns);
+				lcd_latency_apply(lat, id);
+				lcd_fill2(d, e.x - 2, e.y - 2, e.x + 2, e.y + 2, ILI9341_COLOR_WHITE);
+				lcd_flush(d);
 			}
 		}
+		lcd_flush(d);
 	}
-	
-	/* Set new pointer */
-	ILI9341_x += font->FontWidth;
-}
-
-/**
- * @brief  Puts string to LCD
- * @param  x: X position of top left corner of first character in string
- * @param  y: Y position of top left corner of first character in string
- * @param  *str: Pointer to first character
- * @param  *font: Pointer to @ref TM_FontDef_t used font
- * @param  foreground: Color for string
- * @param  background: Color for string background
- * @retval None
- */
-
-void TM_ILI9341_Puts(uint16_t x, uint16_t y, char *str, TM_FontDef_t *font, uint32_t foreground, uint32_t background) {
-	uint16_t startX = x;
-	
-	/* Set X and Y coordinates */
-	ILI9341_x = x;
-	ILI9341_y = y;
-	
-	while (*str) {
-		/* New line */
-		if (*str == '\n') {
-			ILI9341_y += font->FontHeight + 1;
-			/* if after \n is also \r, than go to the left of the screen */
-			if (*(str + 1) == '\r') {
-				ILI9341_x = 0;
-				str++;
-			} else {
-				ILI9341_x = startX;
+	ms = now_ms() - ms;
+	lcd_touch_stop(t);
+
+	printf("Touch: %u samples in %.0f ms (%.0f/s, want %d), %u overruns, read max %u us, gap max %u us\n",
+		t->samples.load(), ms, t->samples.load() * 1000.0 / ms, t->rate, t->overruns.load(),
+		t->read_max_us.load(), t->gap_max_us.load());
+	printf("Touch: %u events, %u dropped, oldest when read %u us; bus: %u messages, %u waited, max wait %u us\n",
+		t->events.load(), t->dropped.load(), age_max, bus.messages, bus.contended, bus.wait_max_us);
+	latency_print("Touch", lat);
+	d->lat = NULL;
+	lcd_latency_destroy(lat);
+	delete lat;
+	lcd_touch_close(t);
+	d->bus = NULL;
+	spi_bus_destroy(&bus);
+	delete t;
+}
+
+/*
+	Name: server_client
+	Description: Server demo client process i: 0 - main UI writing its pixels directly, 1 - status
+		bar on top of it, 2 - alarm popup blinking above both that exits without closing.
+*/
+void server_client(int i) {
+	LCD_Client_t c;
+	char text[LCD_QUEUE_TEXT_LEN];
+	static const int16_t box[3][5] = { { 0, 0, 480, 320, 0 }, { 0, 0, 480, 24, 1 }, { 120, 110, 240, 100, 2 } };
+	int r = lcd_client_open(&c, LCD_SERVER_NAME, box[i][0], box[i][1], box[i][2], box[i][3], box[i][4]);
+
+	if (r < 0) {
+		fprintf(stderr, "Client %d: no display server (%d)\n", i, r);
+		return;
+	}
+	for (int f=0; f<40; f++) {
+		if (i == 0) {
+			/* animate a band of the surface in place, the server only gets told where */
+			for (int y=24; y<320; y++) {
+				uint16_t *p = c.surface.px + y*c.surface.stride;
+				for (int x=0; x<480; x++) p[x] = (uint16_t)(((x + f*8) & 0xFF) >> 3 | (y & 0xFC) << 3);
 			}
-			str++;
-			continue;
-		} else if (*str == '\r') {
-			str++;
-			continue;
+			lcd_client_damage(&c, 0, 24, 479, 319);
+			snprintf(text, sizeof(text), "main ui frame %d", f);
+			lcd_client_text(&c, 10, 290, text, &TM_Font_11x18, ILI9341_COLOR_WHITE, ILI9341_COLOR_BLACK);
+		} else if (i == 1) {
+			lcd_client_fill(&c, 0, 0, 479, 23, ILI9341_COLOR_BLUE2);
+			snprintf(text, sizeof(text), "status agent  up %d.%02d s  load %d%%", f / 20, f % 20 * 5, 40 + f % 7);
+			lcd_client_text(&c, 4, 3, text, &TM_Font_11x18, ILI9341_COLOR_WHITE, ILI9341_TRANSPARENT);
+		} else {
+			lcd_client_fill(&c, 0, 0, 239, 99, f & 1 ? ILI9341_COLOR_RED : ILI9341_COLOR_ORANGE);
+			lcd_client_text(&c, 20, 40, "ALARM", &TM_Font_16x26, ILI9341_COLOR_WHITE, ILI9341_TRANSPARENT);
+			lcd_client_move(&c, 120, 110, 2, (f & 4) == 0);
 		}
-		
-		/* Put character to LCD */
-		TM_ILI9341_Putc(ILI9341_x, ILI9341_y, *str++, font, foreground, background);
+		delayms(25);
 	}
+	if (i != 2) lcd_client_close(&c); // the alarm dies with its slot still claimed
 }
 
+/*
+	Name: server_demo
+	Description: This process keeps the panel and serves it to three forked client processes
+		until they exited, then prints what the server did.
+*/
+void server_demo(LCD_Display_t *d) {
+	LCD_Server_t s;
+	pid_t pid[3];
+	int left = 0;
+	double t;
 
+	int r = lcd_server_open(&s, d, LCD_SERVER_NAME, ILI9341_COLOR_BLACK);
+	if (r < 0) {
+		fprintf(stderr, "Display server: unable to create %s (%d,%d) : %s\n", LCD_SERVER_NAME, r, errno, strerror(errno));
+		return;
+	}
+	fflush(stdout);
+	for (int i=0; i<3; i++) {
+		pid[i] = fork();
+		if (pid[i] == 0) {
+			server_client(i);
+			_exit(0);
+		}
+		if (pid[i] > 0) left++;
+	}
 
-int main(int argc, char **argv)
-{
-	//std::string dev = LCD_SPI_DEVICE;
-	//int spi;
+	t = now_ms();
+	while (left > 0) {
+		if (lcd_server_poll(&s) == 0) delayus(2000);
+		for (int i=0; i<3; i++) {
+			if (pid[i] > 0 && waitpid(pid[i], NULL, WNOHANG) == pid[i]) {
+				pid[i] = 0;
+				left--;
+			}
+		}
+	}
+	lcd_server_poll(&s); // reap the alarm, show what is left
+	t = now_ms() - t;
+	printf("Display server: %u commands, %u windows, %.1f screens sent in %.0f ms, %u clients reaped, %u rejected\n",
+		s.commands, s.windows, s.pixels / (double)ILI9341_PIXEL, t, s.reaped, s.rejected);
+	lcd_server_close(&s);
+}
+
+/*
+	Name: tune_run
+	Description: Autotune the transport, print the measurements and store the best setting.
+*/
+void tune_run(LCD_Display_t *d, const char *dev, uint32_t max_speed) {
+	LCD_Tune_t *t = new LCD_Tune_t;
+	int r = lcd_tune_save(d, dev, max_speed, t);
+
+	printf("Tune %s: MB/s per chunk (bytes)\n   MHz  ioctl us  byte ns", dev);
+	for (int c=0; c<LCD_TUNE_CHUNKS; c++) printf(" %7d", lcd_tune_chunk(d, lcd_tune_chunks[c]));
+	printf("\n");
+	for (int s=0; s<LCD_TUNE_SPEEDS; s++) {
+		if (!t->speed[s]) continue;
+		printf("%6.1f %9.2f %8.2f", t->speed[s] / 1e6, t->ioctl_us[s], t->byte_ns[s]);
+		for (int c=0; c<LCD_TUNE_CHUNKS; c++) printf(" %7.2f", t->mbps[s][c]);
+		printf("\n");
+	}
+	if (r < 0) {
+		fprintf(stderr, "Tune %s: failed (%d), %s not written\n", dev, r, spi_tune_path());
+	} else {
+		printf("Tune %s: %u Hz, %d byte chunks saved to %s\n", dev, t->best.speed, t->best.chunk, spi_tune_path());
+	}
+	delete t;
+}
+
+/*
+	Name: panel_run
+	Description: Open, init and draw the test screen on one panel. Runs in its own thread per panel.
+*/
+void *panel_run(void *arg) {
+	panel_t *p = (panel_t *)arg;
+	LCD_Display_t *d = &p->lcd;
 	int r;
-	/* Set default settings */
-	ILI9341_x = ILI9341_y = 0;
-	ILI9341_Opts.width = ILI9341_WIDTH;
-	ILI9341_Opts.height = ILI9341_HEIGHT;
-	ILI9341_Opts.orientation = TM_ILI9341_Portrait;
 	
-	r = spi_open(&spi, LCD_SPI_DEVICE, LCD_SPI_MODE, LCD_SPI_BITS_PER_WORD, LCD_SPI_SPEED);
-	if (r < 0) {
-		fprintf(stderr, "Unable to open SPI bus 0.0 , error (%d,%d) : %s", r, errno, strerror(errno));
-		return 1;
+	if (p->gpio) {
+		r = gpio_open(d, p->gpio);
+		if (r < 0) {
+			fprintf(stderr, "Unable to open GPIO %s , error (%d,%d) : %s\n", p->gpio, r, errno, strerror(errno));
+			p->result = 1;
+			return NULL;
+		}
+		std::cout << "GPIO " << p->gpio << " open, bit-banged." << std::endl;
+	} else if ((r = lcd_open(d, p->dev, LCD_SPI_SPEED, p->wide)) < 0) {
+		fprintf(stderr, "Unable to open SPI %s , error (%d,%d) : %s\n", p->dev, r, errno, strerror(errno));
+		p->result = 1;
+		return NULL;
 	} else {
-		std::cout << "SPI 0.0 open." << std::endl;
+		std::cout << "SPI " << p->dev << " open, " << ((int)d->bits) << " bits per word." << std::endl;
 	}
 	
-	lcd_init();
+	if (p->replay) {
+		LCD_ReplayStats_t st;
+		r = lcd_replay(d, p->replay, p->fast, &st);
+		if (r < 0) {
+			fprintf(stderr, "Unable to replay %s (%d,%d) : %s\n", p->replay, r, errno, strerror(errno));
+		} else {
+			printf("Replay %s: %llu records, %.1f MB, recorded %.1f ms, replayed in %.1f ms (%.2f MB/s)%s",
+				p->replay, (unsigned long long)st.records, st.bytes / 1e6, st.recorded_us / 1e3, st.wall_us / 1e3,
+				st.wall_us ? st.bytes / (double)st.wall_us : 0.0, st.error ? ", send errors" : "");
+			if (st.resplit) printf(", %llu records split differently than recorded", (unsigned long long)st.resplit);
+			printf("\n");
+		}
+		p->result = r < 0 || st.error;
+		gpio_mock_print(d);
+		lcd_close(d);
+		return NULL;
+	}
+
+	LCD_Record_t rec;
+	if (p->record) {
+		if (lcd_record_open(&rec, p->record, d->bits, d->speed, d->cs_word) < 0) {
+			fprintf(stderr, "Unable to create %s (%d) : %s\n", p->record, errno, strerror(errno));
+		} else {
+			d->rec = &rec;
+		}
+	}
+
+	lcd_init(d);
+	if (p->orientation != TM_ILI9341_Landscape) TM_ILI9341_Rotate(d, p->orientation);
+	if (p->tune) tune_run(d, p->dev, p->tune);
+	if (p->shadow && lcd_shadow_init(d, p->shadow) < 0) {
+		fprintf(stderr, "No memory for the shadow buffer, drawing directly.\n");
+	}
 
 	std::cout << "Fill black." << std::endl;
-	lcd_fill(&spi, 0x0000);
-	lcd_fill2(&spi, 200, 130, 280, 190, ILI9341_COLOR_MAGENTA);
-	//TM_ILI9341_Putc(10,10,'F',&TM_Font_11x18,ILI9341_COLOR_BLACK,ILI9341_COLOR_WHITE);
+	lcd_fill(d, 0x0000);
+	lcd_fill2(d, 200, 130, 280, 190, ILI9341_COLOR_MAGENTA);
+	//TM_ILI9341_Putc(d, 10,10,'F',&TM_Font_11x18,ILI9341_COLOR_BLACK,ILI9341_COLOR_WHITE);
 	
 	
 	// std::cout << "Fill black." << std::endl;
-	// lcd_fill(&spi, 0x0000);
+	// lcd_fill(d, 0x0000);
 	// delayms(500);
 	
 	// std::cout << "Fill whilte." << std::endl;
-	// lcd_fill(&spi, 0xffff);
+	// lcd_fill(d, 0xffff);
 	
 	// //fprintf(stdout,"Fill red. ");
 	// std::cout << "Fill red." << std::endl;
 	// //td_b = get_ticks();
-	// lcd_fill(&spi, 0xF800);
+	// lcd_fill(d, 0xF800);
 	// //td_e = get_ticks();
 	// //td = (uint64_t)(td_e - td_b);
 	// //fprintf(stdout,"Time: %9.3f" "ms\n",(float)((uint64_t)td/1000.0f));
@@ -793,7 +1389,7 @@ int main(int argc, char **argv)
 	//fprintf(stdout,"Fill green. ");
 	//std::cout << "Fill green." << std::endl;
 	//td_b = get_ticks();
-	//lcd_fill(&spi, 0x07E0);
+	//lcd_fill(d, 0x07E0);
 	//td_e = get_ticks();
 	//td = (uint64_t)(td_e - td_b);
 	//fprintf(stdout,"Time: %9.3f" "ms\n",(float)((uint64_t)td/1000.0f));
@@ -802,7 +1398,7 @@ int main(int argc, char **argv)
 	// //fprintf(stdout,"Fill blue. ");
 	// std::cout << "Fill blue." << std::endl;
 	// //td_b = get_ticks();
-	// lcd_fill(&spi, 0x001F);
+	// lcd_fill(d, 0x001F);
 	// //td_e = get_ticks();
 	// //td = (uint64_t)(td_e - td_b);
 	// //fprintf(stdout,"Time: %9.3f" "ms\n",(float)((uint64_t)td/1000.0f));
@@ -811,31 +1407,147 @@ int main(int argc, char **argv)
 	
 	// // std::cout << "Color test..." << std::endl;
 	// // for(uint16_t color=0;color <= 0xffff; color++) {
-		// // lcd_fill2(&spi, 200, 130, 280, 190, color);
+		// // lcd_fill2(d, 200, 130, 280, 190, color);
 	// // }
 	// std::cout << "Fill black." << std::endl;
-	// lcd_fill(&spi, 0x0000);
+	// lcd_fill(d, 0x0000);
 	
 	// for(uint16_t color=0;color <= 0xffff; color++) {
-		// lcd_fill2(&spi, 200, 130, 280, 190, color);
+		// lcd_fill2(d, 200, 130, 280, 190, color);
 		// std::cout << "color:" <<color<< std::endl;
 		// //delayms(100);
 	// }
 	
-    TM_ILI9341_Puts(30, 30, (char *)"KeDei 3.5 inch 480x320 TFT lcd from ali", &TM_Font_11x18, ILI9341_COLOR_BLUE, ILI9341_COLOR_GREEN);
+    TM_ILI9341_Puts(d, 30, 30, (char *)"KeDei 3.5 inch 480x320 TFT lcd from ali", &TM_Font_11x18, ILI9341_COLOR_BLUE, ILI9341_COLOR_GREEN);
 
-    TM_ILI9341_Puts(30, 50, (char *)"(~14USD) 3,5 TFT LCD display with touch", &TM_Font_11x18, ILI9341_COLOR_BLACK, ILI9341_COLOR_RED);
+    TM_ILI9341_Puts(d, 30, 50, (char *)"(~14USD) 3,5 TFT LCD display with touch", &TM_Font_11x18, ILI9341_COLOR_BLACK, ILI9341_COLOR_RED);
 
-    TM_ILI9341_Puts(0, 70, (char *)"The ILI9486L supports parallel CPU 8-/9-/16-/18-bit data bus interface and 3-/4-line serial peripheral interfaces (SPI)", &TM_Font_11x18, ILI9341_COLOR_YELLOW, ILI9341_TRANSPARENT);
+    TM_ILI9341_Puts(d, 0, 70, (char *)"The ILI9486L supports parallel CPU 8-/9-/16-/18-bit data bus interface and 3-/4-line serial peripheral interfaces (SPI)", &TM_Font_11x18, ILI9341_COLOR_YELLOW, ILI9341_TRANSPARENT);
 
-	TM_ILI9341_Puts(10, 130, (char *)"by saper_2", &TM_Font_16x26, ILI9341_COLOR_BROWN, ILI9341_COLOR_WHITE);
+	TM_ILI9341_Puts(d, 10, 130, (char *)"by saper_2", &TM_Font_16x26, ILI9341_COLOR_BROWN, ILI9341_COLOR_WHITE);
+	
 	
 	
 	
+	/* gauge from span primitives */
+	lcd_FillRoundRect(d, 330, 170, 470, 300, 12, ILI9341_COLOR_GRAY);
+	lcd_DrawRoundRect(d, 330, 170, 470, 300, 12, ILI9341_COLOR_WHITE);
+	lcd_DrawCircle(d, 400, 240, 50, ILI9341_COLOR_WHITE);
+	lcd_DrawLine(d, 400, 240, 435, 205, ILI9341_COLOR_RED);
+	lcd_FillCircle(d, 400, 240, 5, ILI9341_COLOR_BLACK);
 	
-    TM_ILI9341_Puts(455, 308, (char *)"mk9", &TM_Font_7x10, ILI9341_COLOR_BLACK, ILI9341_COLOR_ORANGE);
+    TM_ILI9341_Puts(d, 455, 308, (char *)"mk9", &TM_Font_7x10, ILI9341_COLOR_BLACK, ILI9341_COLOR_ORANGE);
+	lcd_flush(d);
 	
-	r = spi_close(&spi);
-	std::cout << "SPI 0.0 closed. (" << ((int)r) << ")" << std::endl;
-	return 0;
-}
\ No newline at end of file
+	if (p->run & RUN_QUEUE) queue_demo(d);
+	if (p->run & RUN_BENCH) bench_shapes();
+	if (p->run & RUN_BENCH) bench_polygon(d);
+	if (p->run & RUN_BENCH) bench_frame(d);
+	if (p->run & RUN_BENCH) bench_encode(d);
+	if (p->run & RUN_BENCH) bench_shadow();
+	if (p->run & RUN_BENCH) bench_fonts(d);
+	if (p->run & RUN_BENCH) bench_trace();
+	if (p->run & RUN_BENCH) bench_stats();
+	if (p->run & RUN_BENCH) bench_runs();
+	if (p->run & RUN_BENCH) bench_strip();
+	if (p->run & RUN_BENCH) bench_bitbang();
+	if (p->run & RUN_BENCH) bench_lanes();
+	if (p->run & RUN_WIDGETS) widget_demo(d);
+	if (p->run & RUN_SERVER) server_demo(d);
+	if (p->pace > 0) pace_demo(d, p->pace);
+	if (p->touch) touch_demo(d, p->touch);
+	
+	gpio_mock_print(d);
+	if (d->rec) {
+		d->rec = NULL;
+		r = lcd_record_close(&rec);
+		printf("Captured %s: %llu records, %.1f MB sent, %.2f MB written%s\n", p->record, (unsigned long long)rec.records,
+			rec.bytes / 1e6, rec.written / 1e6, r < 0 ? ", WRITE FAILED" : "");
+	}
+	r = lcd_close(d);
+	std::cout << "SPI " << p->dev << " closed. (" << ((int)r) << ")" << std::endl;
+	p->result = 0;
+	return NULL;
+}
+
+
+int main(int argc, char **argv)
+{
+	panel_t panel[LCD_MAX_PANELS];
+	pthread_t th[LCD_MAX_PANELS];
+	bool started[LCD_MAX_PANELS];
+	int n = 0;
+	int res = 0;
+	uint8_t wide = 0; // -w16 / -w32 : try wider SPI words, falls back to 8 bits
+	unsigned run = 0;
+	int orientation = TM_ILI9341_Landscape;
+	uint32_t tune = 0;
+	LCD_ShadowMode_t shadow = LCD_SHADOW_NONE;
+	const char *touch = NULL;
+	const char *gpio = NULL;
+	const char *record = NULL;
+	const char *replay = NULL;
+	bool fast = false;
+	double pace = 0;
+	const char *trace = NULL;
+	bool stats = false;
+	
+	memset(panel, 0, sizeof(panel));
+	for (int i=1; i<argc; i++) {
+		if (!strcmp(argv[i], "-w16")) wide = 16;
+		else if (!strcmp(argv[i], "-w32")) wide = 32;
+		else if (!strcmp(argv[i], "-q")) run |= RUN_QUEUE;
+		else if (!strcmp(argv[i], "-b")) run |= RUN_BENCH;
+		else if (!strcmp(argv[i], "-W")) run |= RUN_WIDGETS;
+		else if (!strcmp(argv[i], "-m")) run |= RUN_SERVER;
+		else if (!strcmp(argv[i], "-s") && i+1 < argc) { // -s 565 / wire / i8 / i4 / rle : draw into a shadow buffer, see lcd_flush
+			i++;
+			shadow = !strcmp(argv[i], "wire") ? LCD_SHADOW_WIRE : !strcmp(argv[i], "i8") ? LCD_SHADOW_I8 :
+				!strcmp(argv[i], "i4") ? LCD_SHADOW_I4 : !strcmp(argv[i], "rle") ? LCD_SHADOW_RLE : LCD_SHADOW_RGB565;
+		}
+		else if (!strcmp(argv[i], "-T") && i+1 < argc) tune = atoi(argv[++i]) * 1000000u; // -T MHz : highest clock to try
+		else if (!strcmp(argv[i], "-t") && i+1 < argc) touch = argv[++i]; // -t /dev/spidevX.Y : touch controller
+		else if (!strcmp(argv[i], "-g") && i+1 < argc) gpio = argv[++i]; // -g bcm|sunxi|mock|/dev/gpiochipN : bit-bang
+		else if (!strcmp(argv[i], "-c") && i+1 < argc) record = argv[++i]; // -c file : capture the wire stream
+		else if ((!strcmp(argv[i], "-r") || !strcmp(argv[i], "-rf")) && i+1 < argc) { // -r file : replay it, -rf as fast as possible
+			fast = argv[i][2] == 'f';
+			replay = argv[++i];
+		}
+		else if (!strcmp(argv[i], "-p") && i+1 < argc) pace = atof(argv[++i]); // -p fps : frame pacing demo
+		else if (!strcmp(argv[i], "-x") && i+1 < argc) trace = argv[++i]; // -x file.json : Chrome trace of the run
+		else if (!strcmp(argv[i], "-S")) stats = true; // -S : call latency table at the end
+		else if (!strcmp(argv[i], "-o") && i+1 < argc) orientation = atoi(argv[++i]) & 3; // -o 0..3, see TM_ILI9341_Orientation
+		else if (!strcmp(argv[i], "-d") && i+1 < argc && n < LCD_MAX_PANELS) panel[n++].dev = argv[++i]; // -d /dev/spidevX.Y, one per panel
+	}
+	if (n == 0) panel[n++].dev = LCD_SPI_DEVICE;
+	panel[0].touch = touch;
+	panel[0].gpio = gpio;
+	panel[0].record = record;
+	panel[0].replay = replay;
+	panel[0].fast = fast;
+	if (trace) lcd_trace_start();
+	
+	/* every panel is driven by its own thread, so two panels refresh as fast as one */
+	for (int i=0; i<n; i++) {
+		panel[i].wide = wide;
+		panel[i].run = run;
+		panel[i].tune = tune;
+		panel[i].shadow = shadow;
+		panel[i].pace = pace;
+		panel[i].orientation = (TM_ILI9341_Orientation)orientation;
+		started[i] = pthread_create(&th[i], NULL, panel_run, &panel[i]) == 0;
+		if (!started[i]) panel[i].result = 1;
+	}
+	for (int i=0; i<n; i++) {
+		if (started[i]) pthread_join(th[i], NULL);
+		res |= panel[i].result;
+	}
+	if (trace) {
+		lcd_trace_stop();
+		int e = lcd_trace_dump(trace);
+		if (e < 0) fprintf(stderr, "Trace %s: %s\n", trace, strerror(errno));
+		else printf("Trace %s: %d events, %u lost\n", trace, e, lcd_tracer.rings.lost.load());
+	}
+	if (stats) lcd_stats_print(stdout);
+	return res;
+}
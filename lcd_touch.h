@@ -0,0 +1,344 @@
+// ************ RESISTIVE TOUCH **************
+// XPT2046 (ADS7846 compatible) touch controller of the KeDei board, on its
+// own spidev node next to the panel (after the CS swap from the README).
+// A thread samples it at a fixed rate and turns the samples into down /
+// move / up events in a lock-free ring. Panel and touch share one SPI
+// controller, so both join an SPI_Bus_t: messages go out in request order
+// and panel bulk messages are cut to the bus slice, a touch sample waits
+// for at most one slice even in the middle of a full-screen flush.
+// -------------------------------------------
+
+#ifndef LCD_TOUCH_H
+#define LCD_TOUCH_H
+
+#include <atomic>
+#include <sched.h>
+
+#include "lcd_spi.h"
+
+#define LCD_TOUCH_DEVICE    "/dev/spidev0.1"
+#define LCD_TOUCH_SPEED     2000000   // the XPT2046 takes up to 2.5 MHz
+#define LCD_TOUCH_RATE      200       // samples per second
+#define LCD_TOUCH_SLICE_US  1000      // panel message bound for SPI_Bus_t, us of wire time
+#define LCD_TOUCH_QUEUE     64        // events, must be a power of two
+#define LCD_TOUCH_PRESSURE  400       // z1 + 4095 - z2 above this is a touch
+#define LCD_TOUCH_RELEASE   2         // samples without pressure before the pen counts as lifted
+#define LCD_TOUCH_STEP      2         // pixels the pen has to move for a move event
+
+/* control byte: start, channel, 12 bit, differential; power down between conversions, pen irq on */
+#define XPT2046_X    0xD0
+#define XPT2046_Y    0x90
+#define XPT2046_Z1   0xB0
+#define XPT2046_Z2   0xC0
+#define XPT2046_ADC_ON 0x01 // keep the ADC powered until the last conversion of a sample
+
+typedef enum {
+	LCD_TOUCH_DOWN,
+	LCD_TOUCH_MOVE,
+	LCD_TOUCH_UP
+} LCD_TouchType_t;
+
+/**
+ * @brief  One touch event in screen coordinates
+ */
+typedef struct {
+	uint8_t type;         /*!< LCD_TouchType_t */
+	int16_t x, y;         /*!< position, for UP the last one seen */
+	uint16_t pressure;    /*!< z1 + 4095 - z2 */
+	uint64_t t_ns;        /*!< CLOCK_MONOTONIC when the sample came off the bus */
+} LCD_TouchEvent_t;
+
+/**
+ * @brief  Raw to screen mapping: x = ax * rx + bx * ry + cx, y = ay * rx + by * ry + cy
+ */
+typedef struct {
+	float ax, bx, cx;
+	float ay, by, cy;
+} LCD_TouchCal_t;
+
+typedef struct {
+	int spi;                        /*!< spidev handle, 0 when closed */
+	uint32_t speed;                 /*!< SPI clock in Hz */
+	SPI_Bus_t *bus;                 /*!< bus shared with the panel, NULL - not shared */
+	uint16_t width, height;         /*!< screen size events are clipped to */
+	LCD_TouchCal_t cal;
+	int rate;                       /*!< samples per second while running */
+	pthread_t thread;
+	bool running;
+	std::atomic<int> stop;
+	/* state of the sampling thread */
+	bool down;
+	int lifted;                     /*!< samples without pressure since the last one with */
+	int16_t x, y;                   /*!< last reported position */
+	/* event ring, written by the sampling thread only */
+	LCD_TouchEvent_t ev[LCD_TOUCH_QUEUE];
+	std::atomic<uint32_t> head;
+	std::atomic<uint32_t> tail;
+	/* statistics */
+	std::atomic<uint32_t> samples;
+	std::atomic<uint32_t> events;
+	std::atomic<uint32_t> dropped;   /*!< events lost because the ring was full */
+	std::atomic<uint32_t> overruns;  /*!< periods missed */
+	std::atomic<uint32_t> read_max_us; /*!< longest sample read incl. the wait for the bus */
+	std::atomic<uint32_t> gap_max_us;  /*!< longest time between two samples */
+} LCD_Touch_t;
+
+/**
+ * @brief  Map the full raw range onto width x height, good enough until lcd_touch_calibrate
+ */
+void lcd_touch_cal_default(LCD_Touch_t *t) {
+	memset(&t->cal, 0, sizeof(t->cal));
+	t->cal.ax = (float)t->width / 4096;
+	t->cal.by = (float)t->height / 4096;
+}
+
+/*
+	Name: lcd_touch_calibrate
+	Description: Solve the raw to screen mapping from three touches at known screen points,
+		e.g. near three corners. Takes care of swapped or mirrored axes and rotation.
+	Parameters:
+		1. t : pointer LCD_Touch_t - touch controller
+		2. raw : int[3][2] - raw x, y of the three touches (LCD_TouchEvent_t with an identity cal)
+		3. scr : int[3][2] - screen x, y of the three targets
+	Returns:
+		0 - on success, -1 - the three points are on one line
+*/
+int lcd_touch_calibrate(LCD_Touch_t *t, const int raw[3][2], const int scr[3][2]) {
+	double x0 = raw[0][0], y0 = raw[0][1], x1 = raw[1][0], y1 = raw[1][1], x2 = raw[2][0], y2 = raw[2][1];
+	double det = (x0 - x2) * (y1 - y2) - (x1 - x2) * (y0 - y2);
+	if (det > -1 && det < 1) return -1;
+
+	for (int k=0; k<2; k++) {
+		double s0 = scr[0][k], s1 = scr[1][k], s2 = scr[2][k];
+		double a = ((s0 - s2) * (y1 - y2) - (s1 - s2) * (y0 - y2)) / det;
+		double b = ((x0 - x2) * (s1 - s2) - (x1 - x2) * (s0 - s2)) / det;
+		double c = s2 - a * x2 - b * y2;
+		if (k == 0) { t->cal.ax = (float)a; t->cal.bx = (float)b; t->cal.cx = (float)c; }
+		else        { t->cal.ay = (float)a; t->cal.by = (float)b; t->cal.cy = (float)c; }
+	}
+	return 0;
+}
+
+/*
+	Name: lcd_touch_open
+	Description: Open the touch controller and join the bus it shares with the panel.
+	Parameters:
+		1. t : pointer LCD_Touch_t - touch controller to set up
+		2. spidev : string - spi device, e.g. LCD_TOUCH_DEVICE
+		3. width, height : uint16_t - screen size, see LCD_Display_t opts
+		4. bus : pointer SPI_Bus_t - bus the panel sends on (its LCD_Display_t bus), NULL if not
+			shared; must outlive t
+	Returns:
+		0 - on success, negative - spi_open error
+*/
+int lcd_touch_open(LCD_Touch_t *t, std::string spidev, uint16_t width, uint16_t height, SPI_Bus_t *bus) {
+	int r;
+
+	t->spi = 0;
+	t->bus = bus;
+	t->running = false;
+	t->width = width;
+	t->height = height;
+	t->rate = LCD_TOUCH_RATE;
+	t->down = false;
+	t->lifted = 0;
+	t->x = t->y = 0;
+	t->stop.store(0);
+	t->head.store(0);
+	t->tail.store(0);
+	t->samples.store(0);
+	t->events.store(0);
+	t->dropped.store(0);
+	t->overruns.store(0);
+	t->read_max_us.store(0);
+	t->gap_max_us.store(0);
+	lcd_touch_cal_default(t);
+
+	r = spi_open(&t->spi, spidev, SPI_MODE_0, 8, LCD_TOUCH_SPEED);
+	if (r < 0) return r;
+	t->speed = spi_get_speed(&t->spi);
+	return 0;
+}
+
+/*
+	Name: lcd_touch_sample
+	Description: Read pressure and position in one message: z1, z2 and three x / y pairs,
+		each control byte followed by the two bytes that clock out its 12 bit result.
+		Position is the median of the three readings per axis.
+	Parameters:
+		1. t : pointer LCD_Touch_t - opened touch controller
+		2. rx, ry : pointer int - raw position, 0..4095
+	Returns:
+		pressure (z1 + 4095 - z2, 0 when not touched), negative - transfer failed
+*/
+int lcd_touch_sample(LCD_Touch_t *t, int *rx, int *ry) {
+	static const uint8_t cmd[8] = {
+		XPT2046_Z1 | XPT2046_ADC_ON, XPT2046_Z2 | XPT2046_ADC_ON,
+		XPT2046_X | XPT2046_ADC_ON, XPT2046_Y | XPT2046_ADC_ON,
+		XPT2046_X | XPT2046_ADC_ON, XPT2046_Y | XPT2046_ADC_ON,
+		XPT2046_X | XPT2046_ADC_ON, XPT2046_Y  // powers down, pen irq back on
+	};
+	uint8_t tx[24], rxb[24];
+	int v[8];
+	struct spi_ioc_transfer xfer;
+
+	memset(tx, 0, sizeof(tx));
+	for (int i=0; i<8; i++) tx[i*3] = cmd[i];
+	memset(&xfer, 0, sizeof(xfer));
+	xfer.tx_buf = (uint64_t)(uintptr_t)tx;
+	xfer.rx_buf = (uint64_t)(uintptr_t)rxb;
+	xfer.len = sizeof(tx);
+	xfer.speed_hz = t->speed;
+	xfer.bits_per_word = 8;
+	if (spi_message(&t->spi, t->bus, 1, &xfer) < 0) return -1;
+
+	for (int i=0; i<8; i++) v[i] = ((rxb[i*3+1] << 8) | rxb[i*3+2]) >> 3 & 0xFFF;
+	int z = v[0] + 4095 - v[1];
+	if (v[0] == 0 || z < LCD_TOUCH_PRESSURE) return 0;
+
+	for (int a=0; a<2; a++) {
+		int p = v[2+a], q = v[4+a], r = v[6+a], m;
+		if (p > q) { m = p; p = q; q = m; }
+		m = r < p ? p : (r > q ? q : r);
+		*(a ? ry : rx) = m;
+	}
+	return z;
+}
+
+/* append an event, dropped when the reader fell LCD_TOUCH_QUEUE behind */
+void lcd_touch_emit(LCD_Touch_t *t, uint8_t type, int pressure, uint64_t t_ns) {
+	uint32_t h = t->head.load(std::memory_order_relaxed);
+	if (h - t->tail.load(std::memory_order_acquire) >= LCD_TOUCH_QUEUE) {
+		t->dropped.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	LCD_TouchEvent_t *e = &t->ev[h & (LCD_TOUCH_QUEUE-1)];
+	e->type = type;
+	e->x = t->x;
+	e->y = t->y;
+	e->pressure = (uint16_t)pressure;
+	e->t_ns = t_ns;
+	t->head.store(h+1, std::memory_order_release);
+	t->events.fetch_add(1, std::memory_order_relaxed);
+}
+
+/* one sampling period: read the controller and emit what changed */
+void lcd_touch_step(LCD_Touch_t *t) {
+	struct timespec t0, t1;
+	int rx = 0, ry = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	int z = lcd_touch_sample(t, &rx, &ry);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	uint64_t ns = (uint64_t)t1.tv_sec * 1000000000u + t1.tv_nsec;
+	uint32_t us = (uint32_t)((t1.tv_sec - t0.tv_sec) * 1000000 + (t1.tv_nsec - t0.tv_nsec) / 1000);
+	if (us > t->read_max_us.load(std::memory_order_relaxed)) t->read_max_us.store(us, std::memory_order_relaxed);
+	t->samples.fetch_add(1, std::memory_order_relaxed);
+	if (z < 0) return;
+
+	if (z == 0) {
+		if (t->down && ++t->lifted >= LCD_TOUCH_RELEASE) {
+			t->down = false;
+			lcd_touch_emit(t, LCD_TOUCH_UP, 0, ns);
+		}
+		return;
+	}
+	t->lifted = 0;
+
+	const LCD_TouchCal_t *c = &t->cal;
+	int x = (int)(c->ax * rx + c->bx * ry + c->cx);
+	int y = (int)(c->ay * rx + c->by * ry + c->cy);
+	x = x < 0 ? 0 : (x >= t->width ? t->width - 1 : x);
+	y = y < 0 ? 0 : (y >= t->height ? t->height - 1 : y);
+
+	if (!t->down) {
+		t->down = true;
+		t->x = x;
+		t->y = y;
+		lcd_touch_emit(t, LCD_TOUCH_DOWN, z, ns);
+	} else if (abs(x - t->x) >= LCD_TOUCH_STEP || abs(y - t->y) >= LCD_TOUCH_STEP) {
+		t->x = x;
+		t->y = y;
+		lcd_touch_emit(t, LCD_TOUCH_MOVE, z, ns);
+	}
+}
+
+/*
+	Name: lcd_touch_run
+	Description: Sampling thread. Wakes every 1 / rate seconds on an absolute timer, so a slow
+		read does not shift the following periods; periods already over are skipped and counted.
+*/
+void *lcd_touch_run(void *arg) {
+	LCD_Touch_t *t = (LCD_Touch_t *)arg;
+	struct sched_param sp;
+	struct timespec next, now, last;
+	long period = 1000000000L / (t->rate > 0 ? t->rate : LCD_TOUCH_RATE);
+	bool first = true;
+
+	/* ahead of the drawing threads when the system allows it, harmless when not */
+	sp.sched_priority = sched_get_priority_min(SCHED_FIFO);
+	pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp);
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	while (!t->stop.load(std::memory_order_acquire)) {
+		lcd_touch_step(t);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (!first) {
+			uint32_t gap = (uint32_t)((now.tv_sec - last.tv_sec) * 1000000 + (now.tv_nsec - last.tv_nsec) / 1000);
+			if (gap > t->gap_max_us.load(std::memory_order_relaxed)) t->gap_max_us.store(gap, std::memory_order_relaxed);
+		}
+		first = false;
+		last = now;
+
+		next.tv_nsec += period;
+		if (next.tv_nsec >= 1000000000L) { next.tv_sec++; next.tv_nsec -= 1000000000L; }
+		if (next.tv_sec < now.tv_sec || (next.tv_sec == now.tv_sec && next.tv_nsec < now.tv_nsec)) {
+			t->overruns.fetch_add(1, std::memory_order_relaxed);
+			next = now;
+			continue;
+		}
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+	}
+	return NULL;
+}
+
+/**
+ * @brief  Start sampling rate times per second (0 - LCD_TOUCH_RATE)
+ * @retval 0 on success, -1 thread could not be created
+ */
+int lcd_touch_start(LCD_Touch_t *t, int rate) {
+	if (t->running) return 0;
+	if (rate > 0) t->rate = rate;
+	t->stop.store(0, std::memory_order_release);
+	if (pthread_create(&t->thread, NULL, lcd_touch_run, t) != 0) return -1;
+	t->running = true;
+	return 0;
+}
+
+void lcd_touch_stop(LCD_Touch_t *t) {
+	if (!t->running) return;
+	t->stop.store(1, std::memory_order_release);
+	pthread_join(t->thread, NULL);
+	t->running = false;
+}
+
+/*
+	Name: lcd_touch_read
+	Description: Take the oldest event. Only one thread may read.
+	Returns:
+		1 - *e filled, 0 - no event waiting
+*/
+int lcd_touch_read(LCD_Touch_t *t, LCD_TouchEvent_t *e) {
+	uint32_t tl = t->tail.load(std::memory_order_relaxed);
+	if (tl == t->head.load(std::memory_order_acquire)) return 0;
+	*e = t->ev[tl & (LCD_TOUCH_QUEUE-1)];
+	t->tail.store(tl+1, std::memory_order_release);
+	return 1;
+}
+
+int lcd_touch_close(LCD_Touch_t *t) {
+	lcd_touch_stop(t);
+	return spi_close(&t->spi);
+}
+
+#endif
@@ -0,0 +1,185 @@
+// ************ CALL TRACER **************
+// Begin and end events of the public draw calls (lcd_fill2, lcd_setarea2,
+// TM_ILI9341_Puts, TM_ILI9341_Putc, lcd_flush) and of every SPI message
+// ioctl, written by each thread into its own ring without locks and dumped
+// as Chrome trace-event JSON (chrome://tracing, ui.perfetto.dev) to see
+// where a slow screen update spent its time. Off by default: a disabled
+// tracer costs one relaxed load per call. Build with LCD_TRACE 0 to compile
+// the hooks out entirely.
+// ---------------------------------------
+
+#ifndef LCD_TRACE_H
+#define LCD_TRACE_H
+
+#include <atomic>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "lcd_slots.h"
+
+#ifndef LCD_TRACE
+#define LCD_TRACE 1                 // 0 - no hooks compiled in
+#endif
+#define LCD_TRACE_EVENTS  16384     // per thread ring, a power of two; the oldest events are overwritten
+#define LCD_TRACE_THREADS 16        // threads traced, later ones are counted in lost
+
+typedef enum {
+	LCD_TR_FILL2,     /*!< lcd_fill2, arg pixels */
+	LCD_TR_SETAREA,   /*!< lcd_setarea2, arg pixels in the window */
+	LCD_TR_PUTS,      /*!< TM_ILI9341_Puts, arg characters */
+	LCD_TR_PUTC,      /*!< TM_ILI9341_Putc, arg the character */
+	LCD_TR_FLUSH,     /*!< lcd_flush, arg windows */
+	LCD_TR_IOCTL,     /*!< one SPI_IOC_MESSAGE, arg bytes */
+	LCD_TR_OPS
+} LCD_TraceOp_t;
+
+static const char *lcd_trace_name[LCD_TR_OPS] = {
+	"lcd_fill2", "lcd_setarea2", "TM_ILI9341_Puts", "TM_ILI9341_Putc", "lcd_flush", "spi_ioctl"
+};
+
+typedef struct {
+	uint64_t t_ns;    /*!< CLOCK_MONOTONIC */
+	uint32_t arg;
+	uint8_t op;       /*!< LCD_TraceOp_t */
+	char ph;          /*!< 'B' begin, 'E' end */
+} LCD_TraceEv_t;
+
+/**
+ * @brief  Events of one thread, only that thread writes
+ */
+typedef struct {
+	LCD_TraceEv_t ev[LCD_TRACE_EVENTS];
+	std::atomic<uint64_t> head;   /*!< events written so far, the newest is head - 1 */
+	int tid;
+} LCD_TraceRing_t;
+
+typedef struct {
+	std::atomic<int> on;
+	LCD_Slots<LCD_TraceRing_t, LCD_TRACE_THREADS> rings;   /*!< lost: events of threads without a ring */
+	uint64_t start_ns;                          /*!< time 0 of the dump */
+} LCD_Tracer_t;
+
+static LCD_Tracer_t lcd_tracer;
+
+static inline uint64_t lcd_trace_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static void lcd_trace_ring_init(LCD_TraceRing_t *r) {
+	r->tid = (int)syscall(SYS_gettid);
+}
+
+/* append one event; the slot is written before head moves past it */
+void lcd_trace_event(uint8_t op, char ph, uint32_t arg) {
+	LCD_TraceRing_t *r = lcd_slot(&lcd_tracer.rings, lcd_trace_ring_init);   // claimed on the first event
+	if (!r) return;
+	uint64_t h = r->head.load(std::memory_order_relaxed);
+	LCD_TraceEv_t *e = &r->ev[h & (LCD_TRACE_EVENTS - 1)];
+	e->t_ns = lcd_trace_now();
+	e->arg = arg;
+	e->op = op;
+	e->ph = ph;
+	r->head.store(h + 1, std::memory_order_release);
+}
+
+static inline bool lcd_trace_on(void) {
+	return lcd_tracer.on.load(std::memory_order_relaxed) != 0;
+}
+
+/**
+ * @brief  Begin event now, end event when the scope is left (every return path)
+ */
+struct LCD_TraceScope {
+	uint8_t op;
+	bool on;
+	LCD_TraceScope(uint8_t o, uint32_t arg) : op(o), on(lcd_trace_on()) {
+		if (on) lcd_trace_event(op, 'B', arg);
+	}
+	~LCD_TraceScope() {
+		if (on) lcd_trace_event(op, 'E', 0);
+	}
+};
+
+#if LCD_TRACE
+#define LCD_TRACE_SCOPE(op, arg) LCD_TraceScope lcd_trace_scope_((op), (arg))
+#else
+#define LCD_TRACE_SCOPE(op, arg) do {} while (0)
+#endif
+
+/**
+ * @brief  Start recording, the dump counts time from here
+ */
+void lcd_trace_start(void) {
+	lcd_tracer.start_ns = lcd_trace_now();
+	lcd_tracer.on.store(1);
+}
+
+/**
+ * @brief  Stop recording, what was recorded stays for lcd_trace_dump
+ */
+void lcd_trace_stop(void) {
+	lcd_tracer.on.store(0);
+}
+
+/*
+	Name: lcd_trace_dump
+	Description: Write the events held in all rings as Chrome trace-event JSON, one track per
+		thread. Safe while threads keep tracing: slots overwritten during the copy are left
+		out, and an end whose begin was already overwritten is dropped.
+	Returns:
+		events written, -1 - fopen failed (errno)
+*/
+int lcd_trace_dump(const char *path) {
+	FILE *f = fopen(path, "w");
+	LCD_TraceEv_t *tmp = (LCD_TraceEv_t *)malloc(sizeof(LCD_TraceEv_t) * LCD_TRACE_EVENTS);
+	int pid = (int)getpid(), n = 0;
+	int rings = lcd_slots_used(&lcd_tracer.rings);
+
+	if (!f || !tmp) {
+		if (f) fclose(f);
+		free(tmp);
+		return -1;
+	}
+	fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+	for (int i=0; i<rings; i++) {
+		LCD_TraceRing_t *r = lcd_slot_at(&lcd_tracer.rings, i);
+		if (!r) continue;
+		uint64_t end = r->head.load(std::memory_order_acquire);
+		uint64_t first = end > LCD_TRACE_EVENTS ? end - LCD_TRACE_EVENTS : 0;
+		for (uint64_t k=first; k<end; k++) tmp[k - first] = r->ev[k & (LCD_TRACE_EVENTS - 1)];
+		/* the writer may have lapped the oldest slots meanwhile */
+		uint64_t now = r->head.load(std::memory_order_acquire);
+		uint64_t safe = now > LCD_TRACE_EVENTS ? now - LCD_TRACE_EVENTS : 0;
+		int depth = 0;
+
+		fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"lcd %d\"}}",
+			n ? ",\n" : "", pid, r->tid, r->tid);
+		n++;
+		for (uint64_t k=first > safe ? first : safe; k<end; k++) {
+			const LCD_TraceEv_t *e = &tmp[k - first];
+			if (e->op >= LCD_TR_OPS) continue;
+			if (e->ph == 'E' && depth == 0) continue; // its begin is gone
+			depth += e->ph == 'B' ? 1 : -1;
+			double ts = e->t_ns >= lcd_tracer.start_ns ? (e->t_ns - lcd_tracer.start_ns) / 1000.0 : 0;
+			if (e->ph == 'B') {
+				fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"B\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d,\"args\":{\"n\":%u}}",
+					lcd_trace_name[e->op], ts, pid, r->tid, e->arg);
+			} else {
+				fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"E\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d}", lcd_trace_name[e->op], ts, pid, r->tid);
+			}
+			n++;
+		}
+	}
+	fprintf(f, "\n]}\n");
+	free(tmp);
+	if (fclose(f) != 0) return -1;
+	return n;
+}
+
+#endif
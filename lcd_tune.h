@@ -0,0 +1,157 @@
+// ************ TRANSPORT AUTOTUNER **************
+// Measures pixel throughput over a grid of SPI clocks and bulk message sizes
+// on the running board, fits the cost of one ioctl and of one byte per clock,
+// and stores the fastest setting in the tune file that spi_open / lcd_open
+// read on later runs. SPI controllers and kernels differ enough between
+// boards that no single hardcoded setting is best everywhere.
+// lcd_cost_calibrate measures the window / pixel cost model of lcd_damage.h.
+// -----------------------------------------------
+
+#ifndef LCD_TUNE_H
+#define LCD_TUNE_H
+
+#include "lcd_display.h"
+#include "lcd_damage.h"
+
+#define LCD_TUNE_SPEEDS 8
+#define LCD_TUNE_CHUNKS 6
+#define LCD_TUNE_BYTES  65536  // wire bytes sent per measurement, 8192 pixels
+
+static const uint32_t lcd_tune_speeds[LCD_TUNE_SPEEDS] = {
+	8000000, 16000000, 20000000, 25000000, 32000000, 40000000, 50000000, 64000000
+};
+static const int lcd_tune_chunks[LCD_TUNE_CHUNKS] = { 8, 32, 128, 512, 2048, 0 }; // 0 - largest allowed
+
+/**
+ * @brief  Measurements of one lcd_tune run
+ */
+typedef struct {
+	uint32_t speed[LCD_TUNE_SPEEDS];      /*!< clock the driver reported for each candidate, 0 - skipped */
+	float ioctl_us[LCD_TUNE_SPEEDS];      /*!< fitted time of one ioctl */
+	float byte_ns[LCD_TUNE_SPEEDS];       /*!< fitted time of one wire byte */
+	float mbps[LCD_TUNE_SPEEDS][LCD_TUNE_CHUNKS]; /*!< measured wire MB/s per clock and chunk */
+	SPI_Tune_t best;                      /*!< fastest point */
+} LCD_Tune_t;
+
+/* bytes per message that chunk stands for on this display */
+int lcd_tune_chunk(const LCD_Display_t *d, int chunk) {
+	int max = spi_message_max(d->cs_word) & ~7;
+	return chunk <= 0 || chunk > max ? max : chunk;
+}
+
+/* seconds spent sending LCD_TUNE_BYTES of black pixels in chunk byte messages */
+double lcd_tune_measure(LCD_Display_t *d, int chunk) {
+	struct timespec t0, t1;
+	int n = LCD_TUNE_BYTES / 8;
+
+	d->chunk = lcd_tune_chunk(d, chunk);
+	lcd_setptr(d);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	lcd_pixels_fill(d, ILI9341_COLOR_BLACK, n);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	return (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+}
+
+/*
+	Name: lcd_tune
+	Description: Try every candidate clock up to max_speed that the driver accepts and every bulk
+		message size, timing a stream of black pixels for each. Per clock, time = ioctls * a + bytes * b
+		is fitted over the message sizes to separate syscall overhead from wire time.
+		The display is left running with the fastest setting; the screen content is lost.
+	Parameters:
+		1. d : pointer LCD_Display_t - open and initialised display
+		2. max_speed : uint32_t - highest clock in Hz the wiring is known to carry, the panel
+			is write only so a garbled picture at a higher clock cannot be detected here
+		3. t : pointer LCD_Tune_t - measurements and the chosen setting
+	Returns:
+		0 - on success, -1 - no candidate clock was accepted
+*/
+int lcd_tune(LCD_Display_t *d, uint32_t max_speed, LCD_Tune_t *t) {
+	double best = 0;
+
+	memset(t, 0, sizeof(*t));
+	for (int s=0; s<LCD_TUNE_SPEEDS; s++) {
+		if (lcd_tune_speeds[s] > max_speed) break;
+		uint32_t got = spi_set_speed(&d->spi, lcd_tune_speeds[s]);
+		if (got == 0) continue;
+		bool seen = false;
+		for (int k=0; k<s; k++) seen |= t->speed[k] == got;
+		if (seen) continue; // rounded to a clock already measured
+		t->speed[s] = got;
+		d->speed = got;
+
+		/* least squares of seconds over ioctl count, the byte count is the same for every point */
+		double sx = 0, sy = 0, sxx = 0, sxy = 0;
+		for (int c=0; c<LCD_TUNE_CHUNKS; c++) {
+			double sec = lcd_tune_measure(d, lcd_tune_chunks[c]);
+			double msgs = (double)LCD_TUNE_BYTES / lcd_tune_chunk(d, lcd_tune_chunks[c]);
+			double rate = LCD_TUNE_BYTES / sec;
+			t->mbps[s][c] = (float)(rate / 1e6);
+			sx += msgs; sy += sec; sxx += msgs * msgs; sxy += msgs * sec;
+			if (rate > best) {
+				best = rate;
+				t->best.speed = got;
+				t->best.chunk = lcd_tune_chunk(d, lcd_tune_chunks[c]);
+			}
+		}
+		double a = (LCD_TUNE_CHUNKS * sxy - sx * sy) / (LCD_TUNE_CHUNKS * sxx - sx * sx);
+		double b = (sy - a * sx) / LCD_TUNE_CHUNKS;
+		t->ioctl_us[s] = (float)(a * 1e6);
+		t->byte_ns[s] = (float)(b / LCD_TUNE_BYTES * 1e9);
+	}
+	if (t->best.speed == 0) return -1;
+
+	d->speed = spi_set_speed(&d->spi, t->best.speed);
+	d->chunk = t->best.chunk;
+	return 0;
+}
+
+/*
+	Name: lcd_cost_calibrate
+	Description: Measure the cost model on the panel. Many one pixel windows give window + pixel,
+		a few full width strips give window + 9600 * pixel, the two are solved for window and pixel.
+		Draws into the top 20 lines with color, the caller redraws them afterwards.
+	Parameters:
+		1. d : pointer LCD_Display_t - open and initialised display
+		2. color : uint16_t - color used for the test writes
+	Returns:
+		costs in microseconds
+*/
+LCD_Cost_t lcd_cost_calibrate(LCD_Display_t *d, uint16_t color) {
+	const int small = 256, strips = 4, strip_h = 20;
+	const int strip_px = d->opts.width * strip_h;
+	struct timespec t0, t1, t2;
+	LCD_Cost_t c;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (int i=0; i<small; i++) {
+		lcd_fill2(d, i % d->opts.width, 0, i % d->opts.width, 0, color);
+		lcd_flush(d);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	for (int i=0; i<strips; i++) {
+		lcd_fill2(d, 0, 0, d->opts.width - 1, strip_h - 1, color);
+		lcd_flush(d);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t2);
+
+	double a = ((t1.tv_sec - t0.tv_sec) * 1e6 + (t1.tv_nsec - t0.tv_nsec) / 1e3) / small;
+	double b = ((t2.tv_sec - t1.tv_sec) * 1e6 + (t2.tv_nsec - t1.tv_nsec) / 1e3) / strips;
+	c.pixel = (float)((b - a) / (strip_px - 1));
+	if (c.pixel <= 0) c.pixel = (float)(b / strip_px);
+	c.window = (float)(a - c.pixel);
+	if (c.window < 0) c.window = 0;
+	return c;
+}
+
+/**
+ * @brief  Run lcd_tune and store the result for spidev, see spi_tune_save
+ * @retval 0 on success, negative on error
+ */
+int lcd_tune_save(LCD_Display_t *d, std::string spidev, uint32_t max_speed, LCD_Tune_t *t) {
+	if (lcd_tune(d, max_speed, t) < 0) return -1;
+	if (spi_tune_save(spidev, &t->best) < 0) return -2;
+	return 0;
+}
+
+#endif
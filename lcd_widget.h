@@ -0,0 +1,384 @@
+// ************ RETAINED WIDGETS **************
+// A tree of labels, bars, numbers, icons and panels kept in memory. Setting
+// a property only damages the pixels it changes (the changed character cells
+// of a label, the moved part of a bar), and lcd_screen_update renders each
+// damaged rectangle off-screen and sends it as a single window.
+// --------------------------------------------
+
+#ifndef LCD_WIDGET_H
+#define LCD_WIDGET_H
+
+#include "lcd_display.h"
+#include "lcd_damage.h"
+#include "lcd_draw.h"
+
+#define LCD_WIDGET_TEXT 40   // longest label / number text, incl. '\0'
+
+typedef enum {
+	LCD_WIDGET_PANEL,   // plain background, container
+	LCD_WIDGET_LABEL,   // text, left aligned
+	LCD_WIDGET_BAR,     // horizontal bar filled from the left between min and max
+	LCD_WIDGET_NUMBER,  // fixed point number, right aligned
+	LCD_WIDGET_ICON     // RGB565 pixels, one per pixel of the box
+} LCD_WidgetType_t;
+
+typedef struct LCD_Screen_s LCD_Screen_t;
+typedef struct LCD_Widget_s LCD_Widget_t;
+
+struct LCD_Widget_s {
+	uint8_t type;              /*!< LCD_WidgetType_t */
+	bool visible;
+	LCD_Rect_t box;            /*!< bounds in screen coordinates */
+	uint32_t fg;               /*!< text / bar color */
+	uint32_t bg;               /*!< background or ILI9341_TRANSPARENT */
+	TM_FontDef_t *font;
+	char text[LCD_WIDGET_TEXT];
+	int32_t value, min, max;
+	uint8_t decimals;          /*!< number: digits after the point */
+	const uint16_t *icon;
+	LCD_Screen_t *screen;      /*!< set by lcd_widget_add */
+	LCD_Widget_t *parent, *child, *next;
+};
+
+struct LCD_Screen_s {
+	LCD_Display_t *d;
+	LCD_Widget_t root;         /*!< full screen panel, everything else hangs below it */
+	LCD_Damage_t damage;
+	uint16_t *tmp;             /*!< render buffer, a screen */
+	uint32_t windows;          /*!< windows sent by the last update */
+	uint32_t pixels;           /*!< pixels sent by the last update */
+};
+
+/*
+	Name: lcd_widget_damage
+	Description: Mark part of a widget (screen coordinates) for redraw, clipped to the widget and the panel.
+		Widgets not added to a screen yet are ignored.
+*/
+void lcd_widget_damage(LCD_Widget_t *w, LCD_Rect_t r) {
+	LCD_Rect_t c, s;
+	if (!w->screen) return;
+	if (!lcd_rect_clip(&w->box, &r, &c)) return;
+	s.x0 = 0;
+	s.y0 = 0;
+	s.x1 = w->screen->d->opts.width - 1;
+	s.y1 = w->screen->d->opts.height - 1;
+	if (!lcd_rect_clip(&c, &s, &c)) return;
+	lcd_damage_add(&w->screen->damage, c);
+}
+
+void lcd_widget_init(LCD_Widget_t *w, LCD_WidgetType_t type, int x, int y, int width, int height, uint32_t fg, uint32_t bg) {
+	memset(w, 0, sizeof(*w));
+	w->type = type;
+	w->visible = true;
+	w->box.x0 = x;
+	w->box.y0 = y;
+	w->box.x1 = x + width - 1;
+	w->box.y1 = y + height - 1;
+	w->fg = fg;
+	w->bg = bg;
+}
+
+/*
+	Name: lcd_screen_init
+	Description: Empty screen of color bg on d, all of it damaged. Holds a render buffer of one
+		screen until lcd_screen_close.
+	Returns:
+		0 - on success, -11 - out of memory
+*/
+int lcd_screen_init(LCD_Screen_t *s, LCD_Display_t *d, uint16_t bg) {
+	memset(s, 0, sizeof(*s));
+	s->tmp = (uint16_t *)malloc((size_t)d->opts.width * d->opts.height * sizeof(uint16_t));
+	if (!s->tmp) return -11;
+	s->d = d;
+	lcd_damage_init(&s->damage, NULL);
+	lcd_widget_init(&s->root, LCD_WIDGET_PANEL, 0, 0, d->opts.width, d->opts.height, bg, bg);
+	s->root.screen = s;
+	lcd_widget_damage(&s->root, s->root.box);
+	return 0;
+}
+
+/**
+ * @brief  Release the render buffer, the widgets stay with the caller
+ */
+void lcd_screen_close(LCD_Screen_t *s) {
+	free(s->tmp);
+	s->tmp = NULL;
+}
+
+/**
+ * @brief  Append w as the topmost child of parent and damage its area
+ */
+void lcd_widget_add(LCD_Widget_t *parent, LCD_Widget_t *w) {
+	LCD_Widget_t **p = &parent->child;
+	while (*p) p = &(*p)->next;
+	*p = w;
+	w->next = NULL;
+	w->parent = parent;
+	w->screen = parent->screen;
+	lcd_widget_damage(w, w->box);
+}
+
+void lcd_panel_init(LCD_Widget_t *w, int x, int y, int width, int height, uint16_t bg) {
+	lcd_widget_init(w, LCD_WIDGET_PANEL, x, y, width, height, bg, bg);
+}
+
+/**
+ * @brief  Label sized for chars characters of font
+ */
+void lcd_label_init(LCD_Widget_t *w, int x, int y, int chars, TM_FontDef_t *font, uint32_t fg, uint32_t bg) {
+	lcd_widget_init(w, LCD_WIDGET_LABEL, x, y, chars * font->FontWidth, font->FontHeight, fg, bg);
+	w->font = font;
+}
+
+void lcd_number_init(LCD_Widget_t *w, int x, int y, int chars, uint8_t decimals, TM_FontDef_t *font, uint32_t fg, uint32_t bg) {
+	lcd_widget_init(w, LCD_WIDGET_NUMBER, x, y, chars * font->FontWidth, font->FontHeight, fg, bg);
+	w->font = font;
+	w->decimals = decimals;
+	w->value = 0x7fffffff; // first lcd_number_set always prints
+}
+
+void lcd_bar_init(LCD_Widget_t *w, int x, int y, int width, int height, int32_t min, int32_t max, uint16_t fg, uint16_t bg) {
+	lcd_widget_init(w, LCD_WIDGET_BAR, x, y, width, height, fg, bg);
+	w->min = min;
+	w->max = max > min ? max : min + 1;
+	w->value = min;
+}
+
+void lcd_icon_init(LCD_Widget_t *w, int x, int y, int width, int height, const uint16_t *pixels) {
+	lcd_widget_init(w, LCD_WIDGET_ICON, x, y, width, height, 0, 0);
+	w->icon = pixels;
+}
+
+/*
+	Name: lcd_text_damage
+	Description: Replace the text of a label / number, damaging only the character cells that differ.
+		With a proportional font everything after the first difference may move, so the
+		damage runs from there to the end of the longer text.
+*/
+void lcd_text_damage(LCD_Widget_t *w, const char *text) {
+	int fw = w->font->FontWidth;
+	int run = -1, i = 0;
+
+	if (w->font->metrics) {
+		TM_FONTS_SIZE_t a, b;
+		int x = 0;
+		while (w->text[i] && w->text[i] == text[i]) {
+			if (i) x += TM_FONTS_Kern(w->font, text[i-1], text[i]);
+			x += TM_FONTS_Advance(w->font, text[i]);
+			i++;
+		}
+		if (w->text[i] != text[i]) {
+			if (i) { // the pair before the change is kerned anew
+				int ka = w->text[i] ? TM_FONTS_Kern(w->font, text[i-1], w->text[i]) : 0;
+				int kb = text[i] ? TM_FONTS_Kern(w->font, text[i-1], text[i]) : 0;
+				x += ka < kb ? ka : kb;
+			}
+			TM_FONTS_GetStringSize(w->text, &a, w->font);
+			TM_FONTS_GetStringSize((char *)text, &b, w->font);
+			int end = a.Length > b.Length ? a.Length : b.Length;
+			LCD_Rect_t r = { (int16_t)(w->box.x0 + x), w->box.y0, (int16_t)(w->box.x0 + end - 1), w->box.y1 };
+			lcd_widget_damage(w, r);
+		}
+		strncpy(w->text, text, LCD_WIDGET_TEXT - 1);
+		w->text[LCD_WIDGET_TEXT - 1] = 0;
+		return;
+	}
+
+	for (;; i++) {
+		char a = w->text[i], b = text[i];
+		bool differ = a != b;
+		if (differ && run < 0) run = i;
+		if (!differ && run >= 0) {
+			LCD_Rect_t r = { (int16_t)(w->box.x0 + run*fw), w->box.y0, (int16_t)(w->box.x0 + i*fw - 1), w->box.y1 };
+			lcd_widget_damage(w, r);
+			run = -1;
+		}
+		if (a == 0 && b == 0) break;
+		if (a == 0 || b == 0) {
+			/* one string ended, the rest of the longer one changes */
+			int n = i + (int)strlen(a ? w->text + i : text + i);
+			if (run < 0) run = i;
+			LCD_Rect_t r = { (int16_t)(w->box.x0 + run*fw), w->box.y0, (int16_t)(w->box.x0 + n*fw - 1), w->box.y1 };
+			lcd_widget_damage(w, r);
+			break;
+		}
+	}
+	strncpy(w->text, text, LCD_WIDGET_TEXT - 1);
+	w->text[LCD_WIDGET_TEXT - 1] = 0;
+}
+
+void lcd_label_set(LCD_Widget_t *w, const char *text) {
+	lcd_text_damage(w, text);
+}
+
+/**
+ * @brief  Set a number widget, printed right aligned with w->decimals (up to 9) digits after the point
+ */
+void lcd_number_set(LCD_Widget_t *w, int32_t value) {
+	char buf[64]; // "-%ld.%0*ld" of any long
+	char field[LCD_WIDGET_TEXT];
+	int decimals = w->decimals > 9 ? 9 : w->decimals; // 10^9 is the largest power in an int32_t
+	int32_t p = 1;
+	TM_FONTS_SIZE_t size;
+
+	if (value == w->value) return;
+	w->value = value;
+
+	for (int i=0; i<decimals; i++) p *= 10;
+	if (decimals) {
+		snprintf(buf, sizeof(buf), "%s%ld.%0*ld", value < 0 ? "-" : "", labs(value / p), decimals, labs(value % p));
+	} else {
+		snprintf(buf, sizeof(buf), "%ld", (long)value);
+	}
+
+	/* spaces in front up to the box width, measured in pixels for proportional fonts */
+	TM_FONTS_GetStringSize(buf, &size, w->font);
+	int pad = (w->box.x1 - w->box.x0 + 1 - size.Length) / TM_FONTS_Advance(w->font, ' ');
+	int len = (int)strlen(buf);
+	if (len > LCD_WIDGET_TEXT - 1) len = LCD_WIDGET_TEXT - 1;
+	if (pad > LCD_WIDGET_TEXT - 1 - len) pad = LCD_WIDGET_TEXT - 1 - len;
+	if (pad < 0) pad = 0;
+	memset(field, ' ', pad);
+	memcpy(field + pad, buf, len);
+	field[pad + len] = 0;
+	lcd_text_damage(w, field);
+}
+
+/* screen column where the bar fill ends (exclusive) for value v */
+int lcd_bar_edge(const LCD_Widget_t *w, int32_t v) {
+	int width = w->box.x1 - w->box.x0 + 1;
+	if (v < w->min) v = w->min;
+	if (v > w->max) v = w->max;
+	return w->box.x0 + (int)((int64_t)(v - w->min) * width / (w->max - w->min));
+}
+
+/**
+ * @brief  Move a bar, damaging only the columns between the old and the new fill edge
+ */
+void lcd_bar_set(LCD_Widget_t *w, int32_t value) {
+	int a = lcd_bar_edge(w, w->value);
+	int b = lcd_bar_edge(w, value);
+	w->value = value;
+	if (a == b) return;
+	LCD_Rect_t r = { (int16_t)(a < b ? a : b), w->box.y0, (int16_t)((a < b ? b : a) - 1), w->box.y1 };
+	lcd_widget_damage(w, r);
+}
+
+void lcd_icon_set(LCD_Widget_t *w, const uint16_t *pixels) {
+	if (pixels == w->icon) return;
+	w->icon = pixels;
+	lcd_widget_damage(w, w->box);
+}
+
+void lcd_widget_color(LCD_Widget_t *w, uint32_t fg, uint32_t bg) {
+	if (fg == w->fg && bg == w->bg) return;
+	w->fg = fg;
+	w->bg = bg;
+	lcd_widget_damage(w, w->box);
+}
+
+void lcd_widget_show(LCD_Widget_t *w, bool visible) {
+	if (visible == w->visible) return;
+	w->visible = visible;
+	/* damage through the parent, the area now shows what is below */
+	if (w->parent) {
+		LCD_Rect_t r = w->box;
+		lcd_widget_damage(w->parent, r);
+	} else {
+		lcd_widget_damage(w, w->box);
+	}
+}
+
+/* ------------------------------------------------------------------------------ */
+
+/*
+	Name: lcd_widget_render
+	Description: Paint w and its children into buf, which holds the screen rectangle area.
+		Only pixels inside clip are touched; children are clipped to their parent.
+*/
+void lcd_widget_render(const LCD_Widget_t *w, LCD_Buffer_t *buf, const LCD_Rect_t *area, const LCD_Rect_t *clip) {
+	LCD_Rect_t c;
+
+	if (!w->visible || !lcd_rect_clip(&w->box, clip, &c)) return;
+
+	/* background */
+	if (w->type != LCD_WIDGET_ICON && w->bg != ILI9341_TRANSPARENT) {
+		for (int y=c.y0; y<=c.y1; y++) {
+			uint16_t *p = buf->px + (y - area->y0) * buf->stride - area->x0;
+			for (int x=c.x0; x<=c.x1; x++) p[x] = w->bg;
+		}
+	}
+
+	switch (w->type) {
+	case LCD_WIDGET_BAR: {
+		int e = lcd_bar_edge(w, w->value);
+		for (int y=c.y0; y<=c.y1; y++) {
+			uint16_t *p = buf->px + (y - area->y0) * buf->stride - area->x0;
+			for (int x=c.x0; x<=c.x1 && x<e; x++) p[x] = w->fg;
+		}
+		break;
+	}
+	case LCD_WIDGET_LABEL:
+	case LCD_WIDGET_NUMBER: {
+		/* the glyphs into the clipped part of the box, spaced as TM_ILI9341_Puts does */
+		LCD_Buffer_t sub = { c.x1 - c.x0 + 1, c.y1 - c.y0 + 1, buf->stride,
+			buf->px + (c.y0 - area->y0) * buf->stride + (c.x0 - area->x0) };
+		char text[LCD_WIDGET_TEXT];
+		LCD_Rect_t r;
+		memcpy(text, w->text, sizeof(text));
+		text[LCD_WIDGET_TEXT - 1] = 0;
+		for (char *t = text; *t; t++) if (*t > 0 && *t < 32) *t = ' '; // one line, control characters blank
+		lcd_surface_text(&sub, w->box.x0 - c.x0, w->box.y0 - c.y0, text, w->font, w->fg, ILI9341_TRANSPARENT, &r);
+		break;
+	}
+	case LCD_WIDGET_ICON:
+		if (w->icon) {
+			int iw = w->box.x1 - w->box.x0 + 1;
+			for (int y=c.y0; y<=c.y1; y++) {
+				uint16_t *p = buf->px + (y - area->y0) * buf->stride - area->x0;
+				const uint16_t *s = w->icon + (y - w->box.y0) * iw - w->box.x0;
+				for (int x=c.x0; x<=c.x1; x++) p[x] = s[x];
+			}
+		}
+		break;
+	default:
+		break;
+	}
+
+	for (const LCD_Widget_t *ch = w->child; ch; ch = ch->next) {
+		lcd_widget_render(ch, buf, area, &c);
+	}
+}
+
+/*
+	Name: lcd_screen_update
+	Description: Coalesce the damage, then redraw every rectangle of the plan: render the widgets
+		covering it off-screen and send it as one window. Nothing happens when nothing changed.
+		Set s->damage.cost (e.g. from lcd_cost_calibrate, lcd_tune.h) to plan with measured costs.
+	Returns:
+		number of windows sent
+*/
+int lcd_screen_update(LCD_Screen_t *s) {
+	LCD_Buffer_t buf;
+
+	s->windows = 0;
+	s->pixels = 0;
+	lcd_damage_coalesce(&s->damage);
+	if (s->damage.n == 0) return 0;
+
+	buf.px = s->tmp; // damage is clipped to the panel, any rectangle fits
+	for (int i=0; i<s->damage.n; i++) {
+		const LCD_Rect_t *r = &s->damage.r[i];
+		buf.w = buf.stride = r->x1 - r->x0 + 1;
+		buf.h = r->y1 - r->y0 + 1;
+		lcd_widget_render(&s->root, &buf, r, r);
+		lcd_blit_buffer(s->d, r->x0, r->y0, &buf);
+		s->windows++;
+		s->pixels += buf.w * buf.h;
+	}
+	lcd_damage_clear(&s->damage);
+	lcd_flush(s->d); // with a shadow buffer the windows above only reached the shadow
+	return s->windows;
+}
+
+#endif
@@ -57,6 +57,10 @@
  * \par Changelog
  *
 @verbatim
+ Version 1.3
+  - String size counts lines and the widest of them
+  - Optional proportional metrics (per character advance, kerning pairs)
+  
  Version 1.2
   - May 24, 2015
   - Added support for string length and height
@@ -83,6 +87,25 @@
  * @{
  */
 
+/**
+ * @brief  Kerning pair, see @ref TM_FontMetrics_t
+ */
+typedef struct {
+	char left;            /*!< Character drawn first */
+	char right;           /*!< Character following it */
+	int8_t adjust;        /*!< Pixels added to the advance of left, mostly negative */
+} TM_FontKern_t;
+
+/**
+ * @brief  Proportional spacing of characters 32..126
+ */
+typedef struct {
+	uint8_t advance[95];       /*!< Pixels from the character to the next one */
+	uint8_t left[95];          /*!< Empty bitmap columns skipped at the left */
+	const TM_FontKern_t *kern; /*!< Pairs sorted by left, then right; NULL - none */
+	uint16_t kerns;            /*!< Number of pairs */
+} TM_FontMetrics_t;
+
 /**
  * @brief  Font structure used on my LCD libraries
  */
@@ -90,6 +113,7 @@ typedef struct {
 	uint8_t FontWidth;    /*!< Font width in pixels */
 	uint8_t FontHeight;   /*!< Font height in pixels */
 	const uint16_t *data; /*!< Pointer to data font data array */
+	const TM_FontMetrics_t *metrics; /*!< Proportional spacing, NULL - every character FontWidth wide */
 } TM_FontDef_t;
 
 /** 
@@ -136,7 +160,41 @@ extern TM_FontDef_t TM_Font_16x26;
  */
 
 /**
- * @brief  Calculates string length and height in units of pixels depending on string and font used
+ * @brief  Horizontal step after character c
+ * @param  *Font: Pointer to @ref TM_FontDef_t font used
+ * @param  c: Character
+ * @retval FontWidth, or the proportional advance when the font has metrics
+ */
+static inline int TM_FONTS_Advance(const TM_FontDef_t* Font, char c) {
+	if (!Font->metrics || c < 32 || c > 126) return Font->FontWidth;
+	return Font->metrics->advance[c - 32];
+}
+
+/**
+ * @brief  Kerning between two characters, binary search in the sorted pairs
+ * @retval Pixels to add to the advance of a when b follows, 0 when the pair is not listed
+ */
+static inline int TM_FONTS_Kern(const TM_FontDef_t* Font, char a, char b) {
+	const TM_FontMetrics_t *m = Font->metrics;
+	int lo = 0, hi;
+
+	if (!m || !m->kerns) return 0;
+	hi = m->kerns - 1;
+	while (lo <= hi) {
+		int mid = (lo + hi) >> 1;
+		const TM_FontKern_t *k = &m->kern[mid];
+		int cmp = k->left != a ? (uint8_t)k->left - (uint8_t)a : (uint8_t)k->right - (uint8_t)b;
+		if (cmp == 0) return k->adjust;
+		if (cmp < 0) lo = mid + 1;
+		else hi = mid - 1;
+	}
+	return 0;
+}
+
+/**
+ * @brief  Calculates string length and height in units of pixels depending on string and font used.
+ *         Length is the widest line, height covers every line as TM_ILI9341_Puts steps them
+ *         (FontHeight + 1 apart); '\r' takes no space.
  * @param  *str: String to be checked for length and height
  * @param  *SizeStruct: Pointer to empty @ref TM_FONTS_SIZE_t structure where informations will be saved
  * @param  *Font: Pointer to @ref TM_FontDef_t font used for calculations
@@ -460,25 +518,45 @@ const uint16_t TM_Font16x26 [] = {
 TM_FontDef_t TM_Font_7x10 = {
 	7,
 	10,
-	TM_Font7x10
+	TM_Font7x10,
+	NULL
 };
 
 TM_FontDef_t TM_Font_11x18 = {
 	11,
 	18,
-	TM_Font11x18
+	TM_Font11x18,
+	NULL
 };
 
 TM_FontDef_t TM_Font_16x26 = {
 	16,
 	26,
-	TM_Font16x26
+	TM_Font16x26,
+	NULL
 };
 
 char* TM_FONTS_GetStringSize(char* str, TM_FONTS_SIZE_t* SizeStruct, TM_FontDef_t* Font) {
+	int lines = 1, width = 0, widest = 0;
+	char prev = 0;
+	
+	for (const char *p = str; *p; p++) {
+		if (*p == '\n') {
+			lines++;
+			width = 0;
+			prev = 0;
+			continue;
+		}
+		if (*p == '\r') continue;
+		if (prev) width += TM_FONTS_Kern(Font, prev, *p);
+		width += TM_FONTS_Advance(Font, *p);
+		if (width > widest) widest = width;
+		prev = *p;
+	}
+	
 	/* Fill settings */
-	SizeStruct->Height = Font->FontHeight;
-	SizeStruct->Length = Font->FontWidth * strlen(str);
+	SizeStruct->Height = lines * (Font->FontHeight + 1) - 1;
+	SizeStruct->Length = widest;
 	
 	/* Return pointer */
 	return str;